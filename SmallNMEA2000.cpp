@@ -1,8 +1,14 @@
 #include <Arduino.h>
+#ifndef SNMEA2000_HOST
 #include <SPI.h>
 #include <mcp_can.h>
+#endif
 #include "SmallNMEA2000.h"
+#include "SmallNMEA2000IsoTP.h"
 
+#ifdef SNMEA2000_HOST
+thread_local const unsigned long * SNMEA2000::threadRxTimestamp = NULL;
+#endif
 
 unsigned long getPgnId(unsigned long ID) {
     // CAN ID is 29 bits long
@@ -28,6 +34,40 @@ unsigned long getPgnId(unsigned long ID) {
         return (((unsigned long)canIdDP) << 16) | (((unsigned long)canIdPF) << 8) | (unsigned long)canIdPS;
     }        
 };
+uint8_t assembleFastPacket(SNMEA2000FastPacketState *state, byte *payload, uint8_t size, const byte *frame, uint8_t len) {
+    if ( len < 2 || len > 8 ) {
+        return 0;
+    }
+    uint8_t frameNumber = frame[0] & 0x1f;
+    uint8_t sequence = (frame[0] >> 5) & 0x07;
+    uint16_t received;
+    if ( frameNumber == 0 ) {
+        state->length = frame[1];
+        state->sequence = sequence;
+        state->nextFrame = 1;
+        for (uint8_t i = 2; i < len && i-2 < size; i++) {
+            payload[i-2] = frame[i];
+        }
+        received = len-2;
+    } else if ( state->nextFrame == frameNumber && state->sequence == sequence ) {
+        uint16_t position = 6 + (frameNumber-1)*7;
+        for (uint8_t i = 1; i < len && position < size; i++) {
+            payload[position++] = frame[i];
+        }
+        state->nextFrame++;
+        received = (6 + (frameNumber-1)*7) + (len-1);
+    } else {
+        // missed a frame, or a different sequence, wait for the next start.
+        state->nextFrame = 0;
+        return 0;
+    }
+    if ( received >= state->length && state->length > 0 ) {
+        state->nextFrame = 0;
+        return state->length;
+    }
+    return 0;
+}
+
 MessageHeader::MessageHeader(unsigned long ID, unsigned long PGN) {
     pgn = PGN;
     id = ID;
@@ -85,8 +125,9 @@ void MessageHeader::print(Print *console, byte *buf, int len) {
 
 
 
-bool SNMEA2000::open(byte clockSet) {
-    if ( canIsOpen ) {
+#ifndef SNMEA2000_HOST
+bool SNMEA2000MCP2515::open() {
+    if ( isOpen ) {
         return true;
     }
     uint8_t res =  CAN.begin(CAN_250KBPS, clockSet);
@@ -94,76 +135,508 @@ bool SNMEA2000::open(byte clockSet) {
         // in most cases setting filters on the chip  with NMEA2000 doesnt work
         // where the range of PGNs is enough to set all bits.
         // also the filters are persistant.
-        if ( CAN.init_Mask(0,1,0x0)  != MCP2515_OK ) {
+        res = CAN.init_Mask(0,1,0x0);
+        if ( res == MCP2515_OK ) {
+            res = CAN.init_Mask(1,1,0x0);
+        }
+        if ( res == MCP2515_OK ) {
+            openError = 0;
+            isOpen = true;
+            return true;
+        }
+    }
+    openError = res;
+    return false;
+}
+
+static volatile unsigned long interruptTimestamp = 0;
+static volatile bool interruptTimestampSet = false;
+
+static void mcp2515Interrupt() {
+    interruptTimestamp = micros();
+    interruptTimestampSet = true;
+}
+
+void SNMEA2000MCP2515::enableRxTimestamps(uint8_t _intPin) {
+    intPin = _intPin;
+    pinMode(intPin, INPUT);
+    attachInterrupt(digitalPinToInterrupt(intPin), mcp2515Interrupt, FALLING);
+}
+
+bool SNMEA2000MCP2515::receiveFrame(unsigned long *id, uint8_t *len, byte *buf) {
+    if ( !isOpen || CAN_MSGAVAIL != CAN.checkReceive() ) {
+        return false;
+    }
+    rxTimestamp = micros();
+    if ( intPin != 0xff ) {
+        noInterrupts();
+        if ( interruptTimestampSet ) {
+            rxTimestamp = interruptTimestamp;
+        }
+        interrupts();
+    }
+    CAN.readMsgBuf(len, buf);    // read data,  len: data length, buf: data buf
+    *id = CAN.getCanId();
+    if ( intPin != 0xff ) {
+        noInterrupts();
+        if ( digitalRead(intPin) == HIGH ) {
+            // both buffers read, the next frame will interrupt.
+            interruptTimestampSet = false;
+        }
+        interrupts();
+    }
+    return true;
+}
+
+bool SNMEA2000MCP2515::sendFrame(unsigned long id, uint8_t len, const byte *buf) {
+    if ( controllerState == SNMEA2000_CONTROLLER_BUS_OFF ) {
+        return false;
+    }
+    return CAN.sendMsgBuf(id, 1, len, (byte *)buf) == CAN_OK;
+}
+
+// MCP2515 SPI read instruction and error registers.
+#define MCP2515_SPI_READ 0x03
+#define MCP2515_REG_TEC 0x1C
+#define MCP2515_REG_REC 0x1D
+#define MCP2515_REG_EFLG 0x2D
+#define MCP2515_EFLG_RXEP 0x08
+#define MCP2515_EFLG_TXEP 0x10
+#define MCP2515_EFLG_TXBO 0x20
+
+uint8_t SNMEA2000MCP2515::readRegister(uint8_t address) {
+    SPI.beginTransaction(SPISettings(10000000, MSBFIRST, SPI_MODE0));
+    digitalWrite(csPin, LOW);
+    SPI.transfer(MCP2515_SPI_READ);
+    SPI.transfer(address);
+    uint8_t value = SPI.transfer(0);
+    digitalWrite(csPin, HIGH);
+    SPI.endTransaction();
+    return value;
+}
+
+void SNMEA2000MCP2515::setControllerState(uint8_t state) {
+    unsigned long now = millis();
+    stateTime[controllerState] += now - stateChanged;
+    stateChanged = now;
+    if ( state == SNMEA2000_CONTROLLER_ERROR_PASSIVE ) {
+        errorPassiveCount++;
+    } else if ( state == SNMEA2000_CONTROLLER_BUS_OFF ) {
+        busOffCount++;
+    }
+    controllerState = state;
+}
+
+bool SNMEA2000MCP2515::checkErrors() {
+    unsigned long now = millis();
+    // checked before isOpen, which is false after a reset that failed.
+    if ( controllerState == SNMEA2000_CONTROLLER_BUS_OFF ) {
+        if ( now - stateChanged < busOffRecoveryDelay ) {
             return false;
         }
-        if ( CAN.init_Mask(1,1,0x0)  != MCP2515_OK ) {
+        // the MCP2515 recovers by itself after 128x11 recessive bits, however the frames 
+        // left in the tx buffers would be sent late, so reset the controller.
+        isOpen = false;
+        if ( !open() ) {
+            // try again after another delay.
+            stateTime[SNMEA2000_CONTROLLER_BUS_OFF] += now - stateChanged;
+            stateChanged = now;
             return false;
         }
+        noInterrupts();
+        interruptTimestampSet = false;
+        interrupts();
+        txErrorCount = 0;
+        rxErrorCount = 0;
+        recoveries++;
+        lastErrorCheck = now;
+        setControllerState(SNMEA2000_CONTROLLER_ERROR_ACTIVE);
+        return true;
+    }
+    if ( !isOpen || now - lastErrorCheck < SNMEA2000_ERROR_POLL_PERIOD ) {
+        return false;
+    }
+    lastErrorCheck = now;
+    uint8_t eflg = readRegister(MCP2515_REG_EFLG);
+    txErrorCount = readRegister(MCP2515_REG_TEC);
+    rxErrorCount = readRegister(MCP2515_REG_REC);
+    uint8_t state = SNMEA2000_CONTROLLER_ERROR_ACTIVE;
+    if ( (eflg & MCP2515_EFLG_TXBO) != 0 ) {
+        state = SNMEA2000_CONTROLLER_BUS_OFF;
+    } else if ( (eflg & (MCP2515_EFLG_TXEP|MCP2515_EFLG_RXEP)) != 0 ) {
+        state = SNMEA2000_CONTROLLER_ERROR_PASSIVE;
+    }
+    if ( state != controllerState ) {
+        setControllerState(state);
+    }
+    return false;
+}
+
+unsigned long SNMEA2000MCP2515::getStateTime(uint8_t state) {
+    if ( state > SNMEA2000_CONTROLLER_BUS_OFF ) {
+        return 0;
+    }
+    if ( state == controllerState ) {
+        return stateTime[state] + (millis() - stateChanged);
+    }
+    return stateTime[state];
+}
+
+void SNMEA2000MCP2515::dumpErrorStatus(Print *console) {
+    console->print(F("MCP2515 state="));
+    console->print(controllerState);
+    console->print(F(" tec="));
+    console->print(txErrorCount);
+    console->print(F(" rec="));
+    console->print(rxErrorCount);
+    console->print(F(" error passive="));
+    console->print(errorPassiveCount);
+    console->print(F(" bus off="));
+    console->print(busOffCount);
+    console->print(F(" recoveries="));
+    console->print(recoveries);
+    console->print(F(" ms active="));
+    console->print(getStateTime(SNMEA2000_CONTROLLER_ERROR_ACTIVE));
+    console->print(F(" passive="));
+    console->print(getStateTime(SNMEA2000_CONTROLLER_ERROR_PASSIVE));
+    console->print(F(" bus off="));
+    console->println(getStateTime(SNMEA2000_CONTROLLER_BUS_OFF));
+}
+#endif
+
 
+
+bool SNMEA2000::open() {
+    if ( canIsOpen ) {
+        return true;
+    }
+    if ( transport->open() ) {
         canIsOpen = true;
         delay(200);
         claimAddress();
         return true;
     } else {
         console->print(F("CAN Fail code:"));
-        console->println(res);
+        console->println(transport->getOpenError());
     }
     return false;
 }
 
+#ifndef SNMEA2000_HOST
+bool SNMEA2000::open(byte clockSet) {
+    if ( ownedTransport != NULL ) {
+        ownedTransport->setClockSet(clockSet);
+    }
+    return open();
+}
+#endif
+
+void SNMEA2000::addDevice(SNMEA2000 *device) {
+    SNMEA2000 *last = this;
+    while (last->nextDevice != NULL) {
+        last = last->nextDevice;
+    }
+    last->nextDevice = device;
+    device->firstDevice = this;
+    device->transport = transport;
+}
 
+bool SNMEA2000::isLocalAddress(unsigned char address) {
+    for (SNMEA2000 *device = firstDevice; device != NULL; device = device->nextDevice) {
+        if ( device != this && device->deviceAddress == address ) {
+            return true;
+        }
+    }
+    return false;
+}
 
 
 void SNMEA2000::processMessages() {
-    if ( ! canIsOpen ) {
+    processFrames(SNMEA2000_MAX_FRAMES_PER_CALL, 0);
+}
+
+void SNMEA2000::processMessages(uint16_t budget) {
+    if ( budget == 0 ) {
+        // no time limit, so limit the frames.
+        processFrames(SNMEA2000_MAX_FRAMES_PER_CALL, 0);
+    } else {
+        processFrames(0, budget);
+    }
+}
+
+void SNMEA2000::processFrames(uint8_t maxFrames, uint16_t budget) {
+    if ( ! canIsOpen || firstDevice != this ) {
         return;
     }
-    unsigned char len = 0;
-    int frames = 0;
+    unsigned long start = micros();
+    uint8_t len = 0;
+    uint16_t frames = 0;
     unsigned char buf[8];
-    hasClaimedAddress();
-    while(frames < 20 && CAN_MSGAVAIL == CAN.checkReceive()){
+    unsigned long canId;
+    if ( transport->checkErrors() ) {
+        // controller reset after bus off, other nodes may have taken our addresses.
+        for (SNMEA2000 *device = this; device != NULL; device = device->nextDevice) {
+            device->claimAddress();
+        }
+    }
+    for (SNMEA2000 *device = this; device != NULL; device = device->nextDevice) {
+        device->processHousekeeping();
+        for (SNMEA2000Listener *l = device->listeners; l != NULL; l = l->nextListener) {
+            l->process();
+        }
+    }
+    updateBusLoad();
+    bool drained = false;
+    deferring = (budget > 0);
+    for (;;) {
+        if ( maxFrames > 0 && frames >= maxFrames ) {
+            break;
+        }
+        if ( budget > 0 && frames > 0 && (micros() - start) >= budget ) {
+            break;
+        }
+        if ( !transport->receiveFrame(&canId, &len, buf) ) {
+            drained = true;
+            break;
+        }
         frames++;
-        CAN.readMsgBuf(&len, buf);    // read data,  len: data length, buf: data buf
-        unsigned long canId = CAN.getCanId();
+        rxTimestamp = transport->getRxTimestamp();
+        countBusFrame(len);
         unsigned long pgn = getPgnId(canId);
-        uint8_t i = 0;
-        for (; i < rxListLen; i++) {
-            if (rxPGNList[i] == pgn) {
-                break;
-            }
+        bool accepted = false;
+        for (SNMEA2000 *device = this; device != NULL; device = device->nextDevice) {
+            accepted |= device->handleFrame(canId, pgn, buf, len);
+        }
+        if ( frameMonitor != NULL ) {
+            frameMonitor(canId, buf, len, accepted);
         }
-        if (i == rxListLen) {
-            messagesDropped++;
+    }
+    deferring = false;
+    // without a budget only overdue responses are sent, left by earlier processMessages(budget) calls.
+    for (SNMEA2000 *device = this; device != NULL; device = device->nextDevice) {
+        device->sendDeferredResponses(start, budget, drained);
+    }
+    if ( budget > 0 && !drained ) {
+        budgetBacklogs++;
+    }
+    unsigned long elapsed = micros() - start;
+    if ( budget > 0 && elapsed > budget ) {
+        budgetOverruns++;
+    }
+    if ( elapsed > maxProcessMicros ) {
+        maxProcessMicros = (elapsed > 0xffff)?0xffff:elapsed;
+    }
+}
+
+/**
+ * Multi frame responses wait until the rx backlog has been read, so that a burst of 
+ * requests does not cost the frames behind it. One response answers repeated requests
+ * from the same requester, a request from another requester is answered at once.
+ */
+bool SNMEA2000::deferResponse(uint8_t response, MessageHeader *requestMessageHeader) {
+    if ( !firstDevice->deferring ) {
+        return false;
+    }
+    uint8_t i = (response == SNMEA2000_DEFER_PGN_LISTS)?0:(response == SNMEA2000_DEFER_PRODUCT_INFO)?1:2;
+    if ( (deferredResponses & response) != 0 ) {
+        return deferredSource[i] == requestMessageHeader->source 
+            && deferredDestination[i] == requestMessageHeader->destination;
+    }
+    if ( deferredResponses == 0 ) {
+        deferredAt = millis();
+    }
+    deferredResponses |= response;
+    deferredSource[i] = requestMessageHeader->source;
+    deferredDestination[i] = requestMessageHeader->destination;
+    return true;
+}
+
+void SNMEA2000::sendDeferredResponses(unsigned long start, uint16_t budget, bool drained) {
+    if ( deferredResponses == 0 ) {
+        return;
+    }
+    bool overdue = (millis() - deferredAt) >= SNMEA2000_MAX_RESPONSE_DELAY;
+    for (uint8_t i = 0; i < 3; i++) {
+        uint8_t response = 1<<i;
+        if ( (deferredResponses & response) == 0 ) {
             continue;
         }
-        messagesRecieved++;
-        MessageHeader messageHeader(canId, pgn);
-        if ( diagnostics ) {
-            console->print(F("can:"));
-            switch(pgn) {
-                case 59392L: console->print(F("<a")); break;
-                case 59904L: console->print(F("<r")); break;
-                case 60928L: console->print(F("<c")); break;
-                default: console->print(F("<o")); break;
-            }
-            messageHeader.print(console, buf, len);
+        if ( !overdue && !(drained && (micros() - start) < budget) ) {
+            return;
         }
-        switch (pgn) {
-          case 59904L: /*ISO Request*/
-            handleISORequest(&messageHeader, buf, len);
+        deferredResponses &= ~response;
+        deferredResponsesSent++;
+        MessageHeader requestMessageHeader(59904L, 6, deferredSource[i], deferredDestination[i]);
+        switch(response) {
+          case SNMEA2000_DEFER_PGN_LISTS:
+            sendPGNLists(&requestMessageHeader);
             break;
-          case 60928L: /*ISO Address Claim*/
-            handleISOAddressClaim(&messageHeader, buf, len);
+          case SNMEA2000_DEFER_PRODUCT_INFO:
+            sendProductInformation(&requestMessageHeader);
             break;
-
           default:
-            if ( messageHandler != NULL) {
-                messageHandler(&messageHeader, buf, len);
+            sendConfigurationInformation(&requestMessageHeader);
+            break;
+        }
+    }
+}
+
+bool SNMEA2000::handleFrame(unsigned long canId, unsigned long pgn, byte * buf, uint8_t len) {
+    if ( !canIsOpen ) {
+        return false;
+    }
+    if ( len < 1 || len > 8 ) {
+        // no NMEA2000 PGN is 0 bytes, and more than 8 is a transport fault.
+        rxLengthErrors++;
+        return false;
+    }
+    MessageHeader messageHeader(canId, pgn);
+    // addressed to another device.
+    if (messageHeader.destination != broadcastAddress && messageHeader.destination != deviceAddress ) {
+        messagesDropped++;
+        return false;
+    }
+    if ( !isRxPGN(pgn) ) {
+        messagesDropped++;
+        return false;
+    }
+    messagesRecieved++;
+    if ( diagnostics ) {
+        console->print(F("can:"));
+        switch(pgn) {
+            case 59392L: console->print(F("<a")); break;
+            case 59904L: console->print(F("<r")); break;
+            case 60928L: console->print(F("<c")); break;
+            default: console->print(F("<o")); break;
+        }
+        messageHeader.print(console, buf, len);
+    }
+    dispatchMessage(&messageHeader, buf, len);
+    return true;
+}
+
+bool SNMEA2000::isRxPGN(unsigned long pgn) {
+    for (uint8_t i = 0; i < rxListLen; i++) {
+        if (rxPGNList[i] == pgn) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SNMEA2000::isTxPGN(unsigned long pgn) {
+    for (uint8_t i = 0; i < txListLen; i++) {
+        if (txPGNList[i] == pgn) {
+            return true;
+        }
+    }
+    return findIsoResponse(pgn) != NULL;
+}
+
+const SNMEA2000IsoResponse * SNMEA2000::findIsoResponse(unsigned long pgn) {
+    for (uint8_t i = 0; i < isoResponsesLen; i++) {
+        if ( pgm_read_dword(&isoResponses[i].pgn) == pgn ) {
+            return &isoResponses[i];
+        }
+    }
+    return NULL;
+}
+
+void SNMEA2000::dispatchMessage(MessageHeader *messageHeader, byte * buf, int len) {
+    for (SNMEA2000Listener *l = listeners; l != NULL; l = l->nextListener) {
+        l->onMessage(messageHeader, buf, len);
+    }
+    switch (messageHeader->pgn) {
+      case 59904L: /*ISO Request*/
+        handleISORequest(messageHeader, buf, len);
+        break;
+      case 60928L: /*ISO Address Claim*/
+        handleISOAddressClaim(messageHeader, buf, len);
+        break;
+
+      default:
+        if ( messageHandler != NULL) {
+            messageHandler(messageHeader, buf, len);
+        }
+    }
+}
+
+/**
+ * Bits a 29 bit extended data frame occupies on the bus including the interframe space.
+ * 67 bits of framing, 8 per data byte and stuff bits estimated at 1 in 8 of the
+ * 54+8*len stuffable bits (worst case is 1 in 4, random data is closer to 1 in 10).
+ */
+void SNMEA2000::countBusFrame(uint8_t len) {
+    if ( len > 8 ) {
+        len = 8;
+    }
+    uint8_t dataBits = len*8;
+    // the first device on the transport estimates the load for all.
+    firstDevice->busBits += 67 + dataBits + ((54 + dataBits) >> 3);
+}
+
+void SNMEA2000::updateBusLoad() {
+    unsigned long now = millis();
+    unsigned long elapsed = now - busLoadWindowStart;
+    if ( elapsed >= 1000 ) {
+        // 250 bits per ms at 250Kb/s, smoothed over the last 2 windows.
+        uint32_t load = (busBits*2)/(elapsed*5);
+        if ( load > 100 ) {
+            load = 100;
+        }
+        busLoad = (busLoad + load + 1) >> 1;
+        busBits = 0;
+        busLoadWindowStart = now;
+    }
+}
+
+uint8_t SNMEA2000::getThrottleStretch(const SNMEA2000ThrottleCurve *curve) {
+    uint8_t stretch = 1;
+    uint8_t load = getBusLoad();
+    if ( curve != NULL ) {
+        for (uint8_t i = 0; i < 3; i++) {
+            if ( load < curve->loadThreshold[i] ) {
+                break;
             }
+            stretch = curve->periodStretch[i];
         }
     }
+    return stretch;
+}
+
+SNMEA2000TxSchedule * SNMEA2000::getTxSchedule(unsigned long pgn) {
+    for (uint8_t i = 0; i < txScheduleLen; i++) {
+        if ( txSchedule[i].pgn == pgn ) {
+            return &txSchedule[i];
+        }
+    }
+    return NULL;
+}
+
+bool SNMEA2000::isTxDue(uint8_t i) {
+    if ( i >= txScheduleLen ) {
+        return false;
+    }
+    SNMEA2000TxSchedule *schedule = &txSchedule[i];
+    unsigned long now = millis();
+    unsigned long period = (unsigned long)schedule->period * getThrottleStretch(schedule->throttle);
+    if ( transport->getControllerState() != SNMEA2000_CONTROLLER_ERROR_ACTIVE ) {
+        // back off while error passive, until the error counters recover.
+        period *= SNMEA2000_ERROR_PASSIVE_STRETCH;
+    }
+    if ( now-schedule->lastSent >= period ) {
+        schedule->lastSent = now;
+        return true;
+    }
+    return false;
+}
+
+bool SNMEA2000::isSampleDue(uint8_t i) {
+    if ( !isTxDue(i) ) {
+        return false;
+    }
+    txSchedule[i].sid = advanceSid(txSchedule[i].sid);
+    return true;
 }
 
 //void SNMEA2000::print_uint64_t(uint64_t num) {
@@ -186,6 +659,11 @@ void SNMEA2000::processMessages() {
 
 void SNMEA2000::handleISOAddressClaim(MessageHeader *messageHeader, byte * buffer, int len) {
     if ( messageHeader->source == 254 ) return; // annother node cannot claim an address, ignore this.
+    if ( len != 8 ) {
+        // a short claim would compare our name with stale buffer bytes.
+        rxLengthErrors++;
+        return;
+    }
     tUnionDeviceInformation * remoteDeviceInfo = (tUnionDeviceInformation *)(&buffer[0]);
     if ( messageHeader->source == deviceAddress ) {
         // annother device is claiming this address 
@@ -212,7 +690,14 @@ void SNMEA2000::handleISOAddressClaim(MessageHeader *messageHeader, byte * buffe
             // but our name is > callers so we must increment address and claim
             // 
             //console->println(F("can: Claim from remote has higher precidence"));
-            deviceAddress++;
+            // skipping addresses used by other devices on the same transport, which wont 
+            // see each others claims.
+            do {
+                deviceAddress++;
+                if ( deviceAddress > 251 ) {
+                    deviceAddress = 0;
+                }
+            } while ( isLocalAddress(deviceAddress) );
         } else {
             //console->println(F("can: Claim from remote has lower precidence"));
         }
@@ -223,6 +708,8 @@ void SNMEA2000::handleISOAddressClaim(MessageHeader *messageHeader, byte * buffe
 void SNMEA2000::claimAddress() {
     sendIsoAddressClaim();
     addressClaimStarted = millis();
+    // announce the address with a heartbeat once claimed.
+    heartbeatDue = true;
     //console->print(F("Send Address claim for:"));
     //console->print(deviceAddress);
     //console->print(F(" at "));
@@ -245,6 +732,7 @@ bool SNMEA2000::hasClaimedAddress() {
 
 void SNMEA2000::handleISORequest(MessageHeader *messageHeader, byte * buffer, int len) {
     if ( len < 3 || len > 8) {
+        rxLengthErrors++;
         return; // ISO requests are expected to be between 3 and 8 bytes.
     }
     if (messageHeader->destination != 0xff && messageHeader->destination != deviceAddress ) {
@@ -259,19 +747,44 @@ void SNMEA2000::handleISORequest(MessageHeader *messageHeader, byte * buffer, in
         sendIsoAddressClaim();
         break;
       case 126464L:
-        sendPGNLists(messageHeader);
+        if ( !deferResponse(SNMEA2000_DEFER_PGN_LISTS, messageHeader) ) {
+            sendPGNLists(messageHeader);
+        }
         break;
       case 126996L: /* Product information */
-        sendProductInformation(messageHeader);
+        if ( !deferResponse(SNMEA2000_DEFER_PRODUCT_INFO, messageHeader) ) {
+            sendProductInformation(messageHeader);
+        }
         break;
       case 126998L: /* Configuration information */
-        sendConfigurationInformation(messageHeader);
+        if ( !deferResponse(SNMEA2000_DEFER_CONFIG_INFO, messageHeader) ) {
+            sendConfigurationInformation(messageHeader);
+        }
+        break;
+      case 126993L: /* Heartbeat */
+        if ( isTxPGN(126993L) ) {
+            sendHeartbeat();
+        } else {
+            sendIsoAcknowlegement(messageHeader, 1, 0xff, requestedPGN);
+        }
         break;
       default:
+        {
+            const SNMEA2000IsoResponse * response = findIsoResponse(requestedPGN);
+            if ( response != NULL ) {
+                sendIsoResponse(response, messageHeader);
+                return;
+            }
+        }
+        for (SNMEA2000Listener *l = listeners; l != NULL; l = l->nextListener) {
+            if ( l->onRequest(requestedPGN, messageHeader) ) {
+                return;
+            }
+        }
         if ( isoRequestHandler == NULL || !isoRequestHandler(requestedPGN, messageHeader, buffer, len) ) {
             //console->print(F("Not Known"));
             //console->println(requestedPGN);
-            sendIsoAcknowlegement(messageHeader, 1, 0xff);
+            sendIsoAcknowlegement(messageHeader, 1, 0xff, requestedPGN);
         }
     }
 
@@ -283,26 +796,180 @@ void SNMEA2000::handleISORequest(MessageHeader *messageHeader, byte * buffer, in
 // the PDN lists are 
 void SNMEA2000::sendPGNLists(MessageHeader *requestMessageHeader) {
     MessageHeader messageHeader(126464L, 6, deviceAddress, requestMessageHeader->source);
+    // lists too long for a fast packet are sent with the transport protocol,
+    // broadcast if the request was.
+    uint8_t tpDestination = (requestMessageHeader->destination == broadcastAddress)?broadcastAddress:requestMessageHeader->source;
     // 126464L structure is a fast packet sequence with the
     // total length is 1+npgns*3
-    sendPGNList(&messageHeader, 0, txPGNList, rxListLen);
-    sendPGNList(&messageHeader, 1, rxPGNList, txListLen);
+    sendPGNList(&messageHeader, 0, getTxListLength(), tpDestination);
+    sendPGNList(&messageHeader, 1, rxListLen, tpDestination);
+}
+
+/**
+ * The tx list followed by the iso response PGNs not already in it.
+ */
+uint8_t SNMEA2000::getTxListLength() {
+    uint8_t len = txListLen;
+    for (uint8_t i = 0; i < isoResponsesLen; i++) {
+        unsigned long pgn = pgm_read_dword(&isoResponses[i].pgn);
+        bool listed = false;
+        for (uint8_t j = 0; j < txListLen && !listed; j++) {
+            listed = txPGNList[j] == pgn;
+        }
+        if ( !listed ) {
+            len++;
+        }
+    }
+    return len;
+}
+
+unsigned long SNMEA2000::getTxListPGN(uint8_t i) {
+    if ( i < txListLen ) {
+        return txPGNList[i];
+    }
+    i -= txListLen;
+    for (uint8_t r = 0; r < isoResponsesLen; r++) {
+        unsigned long pgn = pgm_read_dword(&isoResponses[r].pgn);
+        bool listed = false;
+        for (uint8_t j = 0; j < txListLen && !listed; j++) {
+            listed = txPGNList[j] == pgn;
+        }
+        if ( !listed && i-- == 0 ) {
+            return pgn;
+        }
+    }
+    return 0;
+}
+
+byte SNMEA2000::readProgmemPayload(const void * context, uint16_t offset) {
+    return pgm_read_byte(((const byte *)context) + offset);
+}
+
+void SNMEA2000::sendIsoResponse(const SNMEA2000IsoResponse * response, MessageHeader *requestMessageHeader) {
+    const byte * payload = (const byte *)pgm_read_ptr(&response->payload);
+    SNMEA2000PayloadReader reader = readProgmemPayload;
+    const void * context = payload;
+    if ( payload == NULL ) {
+        reader = (SNMEA2000PayloadReader)pgm_read_ptr(&response->reader);
+        context = pgm_read_ptr(&response->context);
+    }
+    uint16_t length = pgm_read_word(&response->length);
+    MessageHeader messageHeader(pgm_read_dword(&response->pgn), pgm_read_byte(&response->priority), 
+        deviceAddress, requestMessageHeader->source);
+    if ( length > 223 ) {
+        uint8_t tpDestination = (requestMessageHeader->destination == broadcastAddress)?broadcastAddress:requestMessageHeader->source;
+        if ( isoTP == NULL || 
+            !isoTP->send(messageHeader.pgn, messageHeader.priority, tpDestination, length, reader, context) ) {
+            packetErrors++;
+            console->println(F("Error: ISO response too long"));
+        }
+        return;
+    }
+    if ( pgm_read_byte(&response->fastPacket) ) {
+        SNMEA2000PacketWriter writer(this, &messageHeader, length);
+        for (uint16_t i = 0; i < length; i++) {
+            writer.outputByte(reader(context, i));
+        }
+        writer.finishFastPacket();
+    } else if ( length > 8 ) {
+        packetErrors++;
+        console->println(F("Error: ISO response too long for a single frame"));
+    } else {
+        SNMEA2000PacketWriter writer(this, &messageHeader);
+        for (uint16_t i = 0; i < length; i++) {
+            writer.outputByte(reader(context, i));
+        }
+        writer.finishPacket();
+    }
 }
 
 
 
-void SNMEA2000::sendPGNList(MessageHeader *messageHeader, int listType, const unsigned long *pgnList, uint8_t len ) {
-    startFastPacket(messageHeader, 1+len*3);
-    outputByte(listType); // RX PGN List
+void SNMEA2000::sendPGNList(MessageHeader *messageHeader, int listType, uint8_t len, uint8_t tpDestination) {
+    uint16_t length = 1+len*3;
+    if ( length > 223 ) {
+        if ( isoTP == NULL || 
+            !isoTP->send(messageHeader->pgn, messageHeader->priority, tpDestination, length, 
+                (listType == 0)?readTxPGNList:readRxPGNList, this) ) {
+            packetErrors++;
+            console->println(F("Error: PGN list too long"));
+        }
+        return;
+    }
+    SNMEA2000PacketWriter writer(this, messageHeader, length);
+    writer.outputByte(listType); // RX PGN List
     for(int i = 0; i < len; i++) {
-        output3ByteInt(pgnList[i]);
+        writer.output3ByteInt((listType == 0)?getTxListPGN(i):rxPGNList[i]);
+    }
+    writer.finishFastPacket();
+}
+
+byte SNMEA2000::readTxPGNList(const void * context, uint16_t offset) {
+    if ( offset == 0 ) {
+        return 0;
+    }
+    offset--;
+    return (((SNMEA2000 *)context)->getTxListPGN(offset/3) >> (8*(offset%3))) & 0xff;
+}
+
+byte SNMEA2000::readRxPGNList(const void * context, uint16_t offset) {
+    if ( offset == 0 ) {
+        return 1;
     }
-    finishFastPacket();
+    offset--;
+    return (((const SNMEA2000 *)context)->rxPGNList[offset/3] >> (8*(offset%3))) & 0xff;
 }
 
 
 
 
+void SNMEA2000::setDeviceInstances(uint8_t deviceInstance, uint8_t systemInstance) {
+    devInfo->setDeviceInstanceNumber(deviceInstance);
+    devInfo->setSystemInstanceNumber(systemInstance);
+    if ( canIsOpen && hasClaimedAddress() ) {
+        sendIsoAddressClaim();
+    }
+}
+
+/**
+ * Periodic messages owned by the library, called for each device by processMessages. 
+ * Nothing is sent until the address has been claimed.
+ */
+void SNMEA2000::processHousekeeping() {
+    if ( !canIsOpen || !hasClaimedAddress() || heartbeatPeriod == 0 ) {
+        return;
+    }
+    if ( heartbeatDue || (millis() - lastHeartbeat) >= heartbeatPeriod ) {
+        if ( isTxPGN(126993L) ) {
+            unsigned long start = micros();
+            sendHeartbeat();
+            housekeepingMicros += micros() - start;
+        } else {
+            heartbeatDue = false;
+            lastHeartbeat = millis();
+        }
+    }
+}
+
+void SNMEA2000::sendHeartbeat() {
+    MessageHeader messageHeader(126993L, 7, deviceAddress, broadcastAddress);
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.output2ByteUInt(heartbeatPeriod/10); // 0.01s
+    writer.outputByte(heartbeatSequence);
+    // controller 1 state, controller 2 not available, equipment operational
+    writer.outputByte((transport->getControllerState() & 0x03) | 0x0c | 0xc0);
+    writer.outputByte(0xff);
+    writer.outputByte(0xff);
+    writer.outputByte(0xff);
+    writer.outputByte(0xff);
+    writer.finishPacket();
+    // 253 to 255 are reserved
+    heartbeatSequence = (heartbeatSequence >= 252)?0:heartbeatSequence+1;
+    heartbeatsSent++;
+    heartbeatDue = false;
+    lastHeartbeat = millis();
+}
+
 void SNMEA2000::sendIsoAddressClaim() {
   MessageHeader messageHeader(60928L, 6, deviceAddress, 0xff);
   // CAN and AVR are little endian, so this is ok.
@@ -315,16 +982,16 @@ void SNMEA2000::sendProductInformation(MessageHeader *requestMessageHeader) {
     MessageHeader messageHeader(126996L, 6, deviceAddress, requestMessageHeader->source);
 
     // this is a fast packet, has to be constructed from the struc on the fly.
-    startFastPacket(&messageHeader, 4+32*4+2);
-    output2ByteUInt(pgm_read_word(&productInfo->nk2version));
-    output2ByteUInt(pgm_read_word(&productInfo->productCode));
-    outputFixedString(pgm_read_ptr(&productInfo->modelID), 32, 0xff);
-    outputFixedString(pgm_read_ptr(&productInfo->softwareVersion), 32, 0xff);
-    outputFixedString(pgm_read_ptr(&productInfo->modelVersion), 32, 0xff);
-    outputFixedString(pgm_read_ptr(&productInfo->serialNumber), 32, 0xff);
-    outputByte(pgm_read_byte(&productInfo->certificationLevel));
-    outputByte(pgm_read_byte(&productInfo->loadEquivalency));
-    finishFastPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader, 4+32*4+2);
+    writer.output2ByteUInt(pgm_read_word(&productInfo->nk2version));
+    writer.output2ByteUInt(pgm_read_word(&productInfo->productCode));
+    writer.outputFixedString(pgm_read_ptr(&productInfo->modelID), 32, 0xff);
+    writer.outputFixedString(pgm_read_ptr(&productInfo->softwareVersion), 32, 0xff);
+    writer.outputFixedString(pgm_read_ptr(&productInfo->modelVersion), 32, 0xff);
+    writer.outputFixedString(pgm_read_ptr(&productInfo->serialNumber), 32, 0xff);
+    writer.outputByte(pgm_read_byte(&productInfo->certificationLevel));
+    writer.outputByte(pgm_read_byte(&productInfo->loadEquivalency));
+    writer.finishFastPacket();
 }
 
 
@@ -338,14 +1005,14 @@ void SNMEA2000::sendConfigurationInformation(MessageHeader *requestMessageHeader
     int manufacturerInfoLen = strnlen(manufacturerInfo,70);
     int installDesc1Len = strnlen(installDesc1,70);
     int installDesc2Len = strnlen(installDesc2,70);
-    startFastPacket(&messageHeader, manufacturerInfoLen+installDesc1Len+installDesc2Len+6 );
-    outputVarString(manufacturerInfo, manufacturerInfoLen);
-    outputVarString(installDesc1, installDesc1Len);
-    outputVarString(installDesc2, installDesc2Len);
-    finishFastPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader, manufacturerInfoLen+installDesc1Len+installDesc2Len+6 );
+    writer.outputVarString(manufacturerInfo, manufacturerInfoLen);
+    writer.outputVarString(installDesc1, installDesc1Len);
+    writer.outputVarString(installDesc2, installDesc2Len);
+    writer.finishFastPacket();
 }
 
-void SNMEA2000::outputVarString(const char * str,  uint8_t strLen) {
+void SNMEA2000PacketWriter::outputVarString(const char * str,  uint8_t strLen) {
     outputByte(strLen+2);
     outputByte(0x01);
     for(int i = 0; i < strLen; i++) {
@@ -353,7 +1020,7 @@ void SNMEA2000::outputVarString(const char * str,  uint8_t strLen) {
     }
 }
 
-void SNMEA2000::outputFixedString(const char * str, int maxLen, byte padding) {
+void SNMEA2000PacketWriter::outputFixedString(const char * str, int maxLen, byte padding) {
     int ib = 0;
     while( ib < maxLen ) {
         byte bs = str[ib++];
@@ -366,25 +1033,25 @@ void SNMEA2000::outputFixedString(const char * str, int maxLen, byte padding) {
     }
 }
 
-void SNMEA2000::output2ByteUInt(uint16_t i) {
+void SNMEA2000PacketWriter::output2ByteUInt(uint16_t i) {
     outputByte(i&0xff);
     outputByte((i>>8)&0xff);
 }
-void SNMEA2000::output2ByteInt(uint16_t i) {
+void SNMEA2000PacketWriter::output2ByteInt(uint16_t i) {
     outputByte(i&0xff);
     outputByte((i>>8)&0xff);
 }
-void SNMEA2000::output3ByteInt(int32_t i) {
+void SNMEA2000PacketWriter::output3ByteInt(int32_t i) {
     outputByte(i&0xff);
     outputByte((i>>8)&0xff);
     outputByte((i>>16)&0xff);
 }
-void SNMEA2000::output3ByteUInt(uint32_t i) {
+void SNMEA2000PacketWriter::output3ByteUInt(uint32_t i) {
     outputByte(i&0xff);
     outputByte((i>>8)&0xff);
     outputByte((i>>16)&0xff);
 }
-void SNMEA2000::output2ByteDouble(double value, double precision) {
+void SNMEA2000PacketWriter::output2ByteDouble(double value, double precision) {
     if (value == SNMEA2000::n2kDoubleNA ) {
         // udefined is 32767 = 0x7FFF
         outputByte(0xff);
@@ -397,7 +1064,7 @@ void SNMEA2000::output2ByteDouble(double value, double precision) {
         outputByte((i>>8)&0xff);
     }
 }
-void SNMEA2000::output2ByteUDouble(double value, double precision) {
+void SNMEA2000PacketWriter::output2ByteUDouble(double value, double precision) {
     // indef is 65535U = 0xFFFF
     if (value == SNMEA2000::n2kDoubleNA) {
         outputByte(0xff);
@@ -412,7 +1079,7 @@ void SNMEA2000::output2ByteUDouble(double value, double precision) {
 
 }
 
-void SNMEA2000::output3ByteDouble(double value, double precision) {
+void SNMEA2000PacketWriter::output3ByteDouble(double value, double precision) {
     if (value == SNMEA2000::n2kDoubleNA ) {
         // undef is 2147483647 = 7FFFFF
         outputByte(0xff);
@@ -427,7 +1094,7 @@ void SNMEA2000::output3ByteDouble(double value, double precision) {
         outputByte((i>>16)&0xff);
     }
 }
-void SNMEA2000::output3ByteUDouble(double value, double precision) {
+void SNMEA2000PacketWriter::output3ByteUDouble(double value, double precision) {
     if (value == SNMEA2000::n2kDoubleNA ) {
         // undef is 2147483647 = FFFFFF
         outputByte(0xff);
@@ -443,7 +1110,7 @@ void SNMEA2000::output3ByteUDouble(double value, double precision) {
     }
 }
 
-void SNMEA2000::output4ByteDouble(double value, double precision) {
+void SNMEA2000PacketWriter::output4ByteDouble(double value, double precision) {
     if (value == SNMEA2000::n2kDoubleNA ) {
         // undef is 2147483647 = 7FFFFFFF
         outputByte(0xff);
@@ -466,7 +1133,7 @@ void SNMEA2000::output4ByteDouble(double value, double precision) {
 
 
 
-void SNMEA2000::output4ByteUDouble(double value, double precision) {
+void SNMEA2000PacketWriter::output4ByteUDouble(double value, double precision) {
     if (value == SNMEA2000::n2kDoubleNA ) {
         // undef is 4294967295U = FFFFFFFF
         outputByte(0xff);
@@ -491,118 +1158,151 @@ void SNMEA2000::output4ByteUDouble(double value, double precision) {
 
 
 
-void SNMEA2000::startPacket(MessageHeader *messageHeader) {
-    packetMessageHeader = messageHeader;
+void SNMEA2000PacketWriter::startPacket(MessageHeader *messageHeader) {
+    this->messageHeader = messageHeader;
     ob = 0;
     fastPacket = false;
 } 
-void SNMEA2000::finishPacket() {
+void SNMEA2000PacketWriter::finishPacket() {
     if ( !fastPacket ) {
         if ( ob > 0) {
-            sendMessage(packetMessageHeader, buffer, ob);
+            device->sendMessage(messageHeader, buffer, ob);
         }
     } else {
-        packetErrors++;
-        console->println(F("Error: Not a Single Packet"));
+        device->packetErrors++;
+        device->console->println(F("Error: Not a Single Packet"));
     }
 }
 
 
-void SNMEA2000::startFastPacket(MessageHeader *messageHeader, int length) {
-    packetMessageHeader = messageHeader;
+void SNMEA2000PacketWriter::startFastPacket(MessageHeader *messageHeader, int length) {
+    this->messageHeader = messageHeader;
     fastPacket = true;
-    fastPacketSequence++;
-    if (fastPacketSequence > 7 ) {
-        fastPacketSequence = 0;
-    }
+    sequence = device->nextFastPacketSequence(messageHeader->pgn);
     frame = 0;
     ob = 0;
-    buffer[ob++] =  (fastPacketSequence << 5) | frame++;
+    buffer[ob++] =  (sequence << 5) | frame++;
     buffer[ob++] = length;
     fastPacketLength = length;
-    fastPacketSent = 0;
 } 
 
-void SNMEA2000::checkFastPacket() {
+void SNMEA2000PacketWriter::checkFastPacket() {
     if ( fastPacket ) {
-        if ( fastPacketLength > 223 ) {
-            console->print(F("Error: fastpacket too long:"));
-            console->println(fastPacketLength);
-        }
-        if ( fastPacketSent != fastPacketLength ) {
-            console->print(F("Error: FastPacket length wrong wanted:"));
-            console->print(fastPacketLength);
-            console->print(F(" got:"));
-            console->println(fastPacketSent);
+        if ( fastPacketLength != 0 ) {
+            device->console->print(F("Error: FastPacket length wrong, bytes remaining:"));
+            device->console->println(fastPacketLength);
         } 
     } else {
-        console->println(F("not fast packet"));
+        device->console->println(F("not fast packet"));
     }
 }
 
 
-void SNMEA2000::finishFastPacket() {
+void SNMEA2000PacketWriter::finishFastPacket() {
     if (fastPacket ) {
         if (ob > 1) {
             // send remaining frame
-            sendMessage(packetMessageHeader, buffer, ob);
+            device->sendMessage(messageHeader, buffer, ob);
         }
     } else {
-        packetErrors++;
-        console->println(F("Error: Not a FastPacket"));
+        device->packetErrors++;
+        device->console->println(F("Error: Not a FastPacket"));
     }
 }
 
-void SNMEA2000::outputByte(byte opb) {
+void SNMEA2000PacketWriter::outputByte(byte opb) {
     if ( ob < 8 ) {
         buffer[ob++] = opb;
         fastPacketLength--;
         if( fastPacket && ob == 8) {
-            sendMessage(packetMessageHeader, &buffer[0], 8);
+            device->sendMessage(messageHeader, &buffer[0], 8);
             ob = 0;
-            buffer[ob++] = (fastPacketSequence << 5) | frame++;
+            buffer[ob++] = (sequence << 5) | frame++;
         }
     } else {
-        frameErrors++;
-        console->println(F("Error: Frame > 8 bytes"));
+        device->frameErrors++;
+        device->console->println(F("Error: Frame > 8 bytes"));
     }
 }
 
-/*
-void SNMEA2000::sendFastPacket(MessageHeader *messageHeader, byte *message, int len, bool progmem) {
-    startFastPacket(messageHeader, len);
-    int ib = 0;
-    while(ib < len) {
-        if ( progmem ) {
-            outputByte(pgm_read_byte(&message[ib++]));
-        } else {
-            outputByte(message[ib++]);
+uint8_t SNMEA2000::nextFastPacketSequence(unsigned long pgn) {
+    uint8_t counter = (pgn ^ (pgn >> 8) ^ (pgn >> 16)) & (SNMEA2000_FAST_PACKET_SEQUENCES-1);
+#if defined(SNMEA2000_HOST) && defined(SNMEA2000_THREADS)
+    return (fastPacketSequences[counter].fetch_add(1) + 1) & 0x07;
+#else
+    uint8_t shift = (counter & 1)?4:0;
+    uint8_t *b = &fastPacketSequences[counter >> 1];
+    uint8_t sequence = ((*b >> shift) + 1) & 0x07;
+    *b = (*b & ~(0x0f << shift)) | (sequence << shift);
+    return sequence;
+#endif
+}
+
+void SNMEA2000::sendFastPacket(MessageHeader *messageHeader, const byte *payload, uint8_t length) {
+    if ( length > 223 ) {
+        packetErrors++;
+        console->print(F("Error: fastpacket too long:"));
+        console->println(length);
+        return;
+    }
+    uint8_t sequence = nextFastPacketSequence(messageHeader->pgn);
+    byte frameBuffer[8];
+    uint8_t frameNumber = 0;
+    uint8_t sent = 0;
+    uint8_t n = 2;
+    frameBuffer[0] = (sequence << 5) | frameNumber++;
+    frameBuffer[1] = length;
+    while ( sent < length ) {
+        frameBuffer[n++] = payload[sent++];
+        if ( n == 8 ) {
+            sendMessage(messageHeader, frameBuffer, 8);
+            frameBuffer[0] = (sequence << 5) | frameNumber++;
+            n = 1;
         }
     }
-    finishFastPacket();
+    if ( n > 1 ) {
+        sendMessage(messageHeader, frameBuffer, n);
+    }
 }
-*/
 
-void SNMEA2000::sendIsoAcknowlegement(MessageHeader *requestMessageHeader, unsigned char control, unsigned char groupFunction) {
+void SNMEA2000::sendIsoAcknowlegement(MessageHeader *requestMessageHeader, unsigned char control, unsigned char groupFunction, unsigned long pgn) {
     MessageHeader messageHeader(59392L, 6, deviceAddress, requestMessageHeader->source);
-    startPacket(&messageHeader);
-    outputByte(control);
-    outputByte(groupFunction);
-    outputByte(0xff);
-    outputByte(0xff);
-    outputByte(0xff);
-    output3ByteInt(requestMessageHeader->pgn);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(control);
+    writer.outputByte(groupFunction);
+    writer.outputByte(0xff);
+    writer.outputByte(0xff);
+    writer.outputByte(0xff);
+    writer.output3ByteInt(pgn); // the PGN requested
+    writer.finishPacket();
+}
+
+void SNMEA2000::sendFrame(unsigned long canId, const byte *frame, uint8_t len) {
+    if ( ! canIsOpen ) {
+        return;
+    }
+    countBusFrame(len);
+    if ( !transport->sendFrame(canId, len, frame) ) {
+        txFailures++;
+        // expected while error passive or bus off.
+        if ( transport->getControllerState() == SNMEA2000_CONTROLLER_ERROR_ACTIVE ) {
+            console->println(F("can: err"));
+        }
+    }
+    messagesSent++;
 }
 
 void SNMEA2000::sendMessage(MessageHeader *messageHeader, byte * message, int length) {
     if ( ! canIsOpen ) {
         return;
     }
-    uint8_t res = CAN.sendMsgBuf(messageHeader->id, 1, length, message);
-    if ( res != CAN_OK ) {
-        console->print(F("can: err"));
-        console->println(res);
+    countBusFrame(length);
+    if ( !transport->sendFrame(messageHeader->id, length, message) ) {
+        txFailures++;
+        // expected while error passive or bus off.
+        if ( transport->getControllerState() == SNMEA2000_CONTROLLER_ERROR_ACTIVE ) {
+            console->println(F("can: err"));
+        }
     }
     //if ( diagnostics ) {
     //    console->print(F("can: out>"));
@@ -620,14 +1320,14 @@ void EngineMonitor::sendRapidEngineDataMessage(
     double engineBoostPressure, 
     byte engineTiltTrim) {
     MessageHeader messageHeader(127488L, 2, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(engineInstance);
-    output2ByteUDouble(engineSpeed,0.25);
-    output2ByteUDouble(engineBoostPressure,100);
-    outputByte(engineTiltTrim);
-    outputByte(0xff);
-    outputByte(0xff);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(engineInstance);
+    writer.output2ByteUDouble(engineSpeed,0.25);
+    writer.output2ByteUDouble(engineBoostPressure,100);
+    writer.outputByte(engineTiltTrim);
+    writer.outputByte(0xff);
+    writer.outputByte(0xff);
+    writer.finishPacket();
 }
 
 void EngineMonitor::sendEngineDynamicParamMessage(
@@ -647,22 +1347,22 @@ void EngineMonitor::sendEngineDynamicParamMessage(
     
 ) {
     MessageHeader messageHeader(127489L, 2, getAddress(), SNMEA2000::broadcastAddress);
-    startFastPacket(&messageHeader, 26);
-    outputByte(engineInstance);
-    output2ByteUDouble(engineOilPressure,100);
-    output2ByteUDouble(engineOilTemperature,0.1);
-    output2ByteUDouble(engineCoolantTemperature,0.01);
-    output2ByteDouble(alternatorVoltage,0.01);
-    output2ByteDouble(fuelRate,0.1);
-    output4ByteUDouble(engineHours,1);
-    output2ByteUDouble(engineCoolantPressure,100);
-    output2ByteUDouble(engineFuelPressure,1000);
-    outputByte(0xff); // reserved
-    output2ByteUInt(status1);
-    output2ByteUInt(status2);
-    outputByte(engineLoad);
-    outputByte(engineTorque);
-    finishFastPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader, 26);
+    writer.outputByte(engineInstance);
+    writer.output2ByteUDouble(engineOilPressure,100);
+    writer.output2ByteUDouble(engineOilTemperature,0.1);
+    writer.output2ByteUDouble(engineCoolantTemperature,0.01);
+    writer.output2ByteDouble(alternatorVoltage,0.01);
+    writer.output2ByteDouble(fuelRate,0.1);
+    writer.output4ByteUDouble(engineHours,1);
+    writer.output2ByteUDouble(engineCoolantPressure,100);
+    writer.output2ByteUDouble(engineFuelPressure,1000);
+    writer.outputByte(0xff); // reserved
+    writer.output2ByteUInt(status1);
+    writer.output2ByteUInt(status2);
+    writer.outputByte(engineLoad);
+    writer.outputByte(engineTorque);
+    writer.finishFastPacket();
 
 }
 void EngineMonitor::sendDCBatterStatusMessage(
@@ -673,13 +1373,29 @@ void EngineMonitor::sendDCBatterStatusMessage(
     double batteryCurrent
     ) {
     MessageHeader messageHeader(127508L, 6, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(batteryInstance);  
-    output2ByteDouble(batteryVoltage,0.01);
-    output2ByteDouble(batteryCurrent,0.1);
-    output2ByteUDouble(batteryTemperature,0.01);
-    outputByte(sid);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(batteryInstance);  
+    writer.output2ByteDouble(batteryVoltage,0.01);
+    writer.output2ByteDouble(batteryCurrent,0.1);
+    writer.output2ByteUDouble(batteryTemperature,0.01);
+    writer.outputByte(sid);
+    writer.finishPacket();
+}
+void EngineMonitor::sendDCBatterStatusMessageFixed(
+    byte batteryInstance, 
+    byte sid,
+    int16_t batteryVoltage,
+    uint16_t batteryTemperature,
+    int16_t batteryCurrent
+    ) {
+    MessageHeader messageHeader(127508L, 6, getAddress(), SNMEA2000::broadcastAddress);
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(batteryInstance);  
+    writer.output2ByteInt(batteryVoltage);
+    writer.output2ByteInt(batteryCurrent);
+    writer.output2ByteUInt(batteryTemperature);
+    writer.outputByte(sid);
+    writer.finishPacket();
 }
 void EngineMonitor::sendFluidLevelMessage(
     byte type,
@@ -687,13 +1403,13 @@ void EngineMonitor::sendFluidLevelMessage(
     double level, 
     double capacity) {
     MessageHeader messageHeader(127505L, 6, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
+    SNMEA2000PacketWriter writer(this, &messageHeader);
     byte b = ((type<<4)&0xff)|(instance&0xff);
-    outputByte(b);
-    output2ByteDouble(level,0.004);
-    output4ByteUDouble(capacity,0.1);
-    outputByte(0xff);
-    finishPacket();
+    writer.outputByte(b);
+    writer.output2ByteDouble(level,0.004);
+    writer.output4ByteUDouble(capacity,0.1);
+    writer.outputByte(0xff);
+    writer.finishPacket();
 }
 void EngineMonitor::sendTemperatureMessage(
     byte sid, 
@@ -702,14 +1418,30 @@ void EngineMonitor::sendTemperatureMessage(
     double actual,
     double requested) {
     MessageHeader messageHeader(130312L, 5, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(sid);
-    outputByte(instance);
-    outputByte(source);
-    output2ByteUDouble(actual,0.01);
-    output2ByteUDouble(requested,0.01);
-    outputByte(0xff);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(instance);
+    writer.outputByte(source);
+    writer.output2ByteUDouble(actual,0.01);
+    writer.output2ByteUDouble(requested,0.01);
+    writer.outputByte(0xff);
+    writer.finishPacket();
+}
+void EngineMonitor::sendTemperatureMessageFixed(
+    byte sid, 
+    byte instance,
+    byte source,
+    uint16_t actual,
+    uint16_t requested) {
+    MessageHeader messageHeader(130312L, 5, getAddress(), SNMEA2000::broadcastAddress);
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(instance);
+    writer.outputByte(source);
+    writer.output2ByteUInt(actual);
+    writer.output2ByteUInt(requested);
+    writer.outputByte(0xff);
+    writer.finishPacket();
 }
 
 
@@ -721,13 +1453,13 @@ void PressureMonitor::sendOutsideEnvironmentParameters(
         double atmospheicPressure
         ) {
     MessageHeader messageHeader(130310L, 5, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(sid);
-    output2ByteUDouble(waterTemperature,0.01);
-    output2ByteUDouble(outsideAirTemperature,0.01);
-    output2ByteUDouble(atmospheicPressure,100);
-    outputByte(0xff);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.output2ByteUDouble(waterTemperature,0.01);
+    writer.output2ByteUDouble(outsideAirTemperature,0.01);
+    writer.output2ByteUDouble(atmospheicPressure,100);
+    writer.outputByte(0xff);
+    writer.finishPacket();
 }
 
 void PressureMonitor::sendEnvironmentParameters(
@@ -739,47 +1471,73 @@ void PressureMonitor::sendEnvironmentParameters(
         double humidity // humidity
         ) {
     MessageHeader messageHeader(130311L, 5, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(sid);
-    outputByte(((humiditySource) & 0x03)<<6 | (tempSource & 0x3f));
-    output2ByteUDouble(temperature,0.01);
-    output2ByteDouble(humidity,0.004);
-    output2ByteUDouble(atmosphericPressure,100);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(((humiditySource) & 0x03)<<6 | (tempSource & 0x3f));
+    writer.output2ByteUDouble(temperature,0.01);
+    writer.output2ByteDouble(humidity,0.004);
+    writer.output2ByteUDouble(atmosphericPressure,100);
+    writer.finishPacket();
 }
 
 
 void PressureMonitor::sendHumidity(byte sid, byte humiditySource, byte humidityInstance, double humidity) {
     MessageHeader messageHeader(130313L, 5, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(sid);
-    outputByte(humidityInstance);
-    outputByte(humiditySource);
-    output2ByteDouble(humidity,0.004);
-    output2ByteDouble(SNMEA2000::n2kDoubleNA,0.004);
-    outputByte(0xff);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(humidityInstance);
+    writer.outputByte(humiditySource);
+    writer.output2ByteDouble(humidity,0.004);
+    writer.output2ByteDouble(SNMEA2000::n2kDoubleNA,0.004);
+    writer.outputByte(0xff);
+    writer.finishPacket();
 }
 
 void PressureMonitor::sendPressure(byte sid, byte pressureSource, byte pressureInstance, double pressure ) {
     MessageHeader messageHeader(130314L, 5, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(sid);
-    outputByte(pressureInstance);
-    outputByte(pressureSource);
-    output4ByteDouble(pressure,0.1);
-    outputByte(0xff);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(pressureInstance);
+    writer.outputByte(pressureSource);
+    writer.output4ByteDouble(pressure,0.1);
+    writer.outputByte(0xff);
+    writer.finishPacket();
 }
 
 void PressureMonitor::sendTemperature(byte sid, byte temperatureSource,  byte temperatureInstance, double tremperature ) {
     MessageHeader messageHeader(130316L, 5, getAddress(), SNMEA2000::broadcastAddress);
-    startPacket(&messageHeader);
-    outputByte(sid);
-    outputByte(temperatureInstance);
-    outputByte(temperatureSource);
-    output3ByteUDouble(tremperature,0.001);
-    output2ByteUDouble(SNMEA2000::n2kDoubleNA,0.1);
-    finishPacket();
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(temperatureInstance);
+    writer.outputByte(temperatureSource);
+    writer.output3ByteUDouble(tremperature,0.001);
+    writer.output2ByteUDouble(SNMEA2000::n2kDoubleNA,0.1);
+    writer.finishPacket();
+}
+void PressureMonitor::sendEnvironmentSample(byte sid, const SNMEA2000EnvironmentSample *sample) {
+    if ( isTxPGN(130311L) ) {
+        sendEnvironmentParameters(sid, sample->atmosphericPressure, sample->temperatureSource, 
+            sample->temperature, sample->humiditySource, sample->humidity);
+    }
+    if ( sample->humidity != SNMEA2000::n2kDoubleNA && isTxPGN(130313L) ) {
+        sendHumidity(sid, sample->humiditySource, sample->instance, sample->humidity);
+    }
+    if ( sample->atmosphericPressure != SNMEA2000::n2kDoubleNA && isTxPGN(130314L) ) {
+        sendPressure(sid, sample->pressureSource, sample->instance, sample->atmosphericPressure);
+    }
+    if ( sample->temperature != SNMEA2000::n2kDoubleNA && isTxPGN(130316L) ) {
+        sendTemperature(sid, sample->temperatureSource, sample->instance, sample->temperature);
+    }
+}
+
+void PressureMonitor::sendTemperatureFixed(byte sid, byte temperatureSource,  byte temperatureInstance, uint32_t temperature ) {
+    MessageHeader messageHeader(130316L, 5, getAddress(), SNMEA2000::broadcastAddress);
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(sid);
+    writer.outputByte(temperatureInstance);
+    writer.outputByte(temperatureSource);
+    writer.output3ByteUInt(temperature);
+    writer.output2ByteUInt(SNMEA2000::n2kUInt16NA);
+    writer.finishPacket();
 }
 
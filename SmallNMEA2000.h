@@ -10,7 +10,21 @@
 #endif
 
 #include <Arduino.h>
+#ifndef SNMEA2000_HOST
 #include <mcp_can.h>
+#endif
+
+#if defined(SNMEA2000_HOST) && defined(SNMEA2000_THREADS)
+#include <atomic>
+// host builds where several threads send through one device, see host/ThreadedTransport.h
+typedef std::atomic<uint16_t> SNMEA2000Counter;
+typedef std::atomic<uint32_t> SNMEA2000BitCounter;
+typedef std::atomic<uint8_t> SNMEA2000SequenceCounter;
+#else
+typedef uint16_t SNMEA2000Counter;
+typedef uint32_t SNMEA2000BitCounter;
+typedef uint8_t SNMEA2000SequenceCounter;
+#endif
 
 
 #define CToKelvin(x) (x+273.15)
@@ -59,11 +73,31 @@ byte configurationInformation[] PROGMEM = {
  *  They are RX and TX by the SNMEA2000 class but we need to get them into 
  *  a contiguous memory space in program memory.
  */ 
-#define SNMEA200_DEFAULT_TX_PGN 126464L,60928L,126996L,126998L,59392L
-#define SNMEA200_DEFAULT_TX_PGN_LEN 5
+#define SNMEA200_DEFAULT_TX_PGN 126464L,60928L,126996L,126998L,59392L,126993L
+#define SNMEA200_DEFAULT_TX_PGN_LEN 6
 #define SNMEA200_DEFAULT_RX_PGN 59392L,59904L,60928L
 #define SNMEA200_DEFAULT_RX_PGN_LEN 3
 
+// 126993 heartbeat period, ms
+#define SNMEA2000_HEARTBEAT_PERIOD 60000
+#define SNMEA2000_CONTROLLER_ERROR_ACTIVE 0
+#define SNMEA2000_CONTROLLER_ERROR_PASSIVE 1
+#define SNMEA2000_CONTROLLER_BUS_OFF 2
+// controller error flags poll period, ms
+#define SNMEA2000_ERROR_POLL_PERIOD 100
+// wait after bus off before resetting the controller and re-claiming, ms
+#define SNMEA2000_BUS_OFF_RECOVERY_DELAY 1000
+// tx schedule period stretch while the controller is error passive
+#define SNMEA2000_ERROR_PASSIVE_STRETCH 4
+// frames read by each processMessages() call without a budget
+#define SNMEA2000_MAX_FRAMES_PER_CALL 20
+// longest a response deferred by processMessages(budget) waits for the rx backlog to clear, ms
+#define SNMEA2000_MAX_RESPONSE_DELAY 250
+// responses to ISO requests deferred by processMessages(budget)
+#define SNMEA2000_DEFER_PGN_LISTS 0x01
+#define SNMEA2000_DEFER_PRODUCT_INFO 0x02
+#define SNMEA2000_DEFER_CONFIG_INFO 0x04
+
 // from NMEA2000 library, makes it much easier creating the name.
 
 
@@ -127,6 +161,15 @@ class SNMEA2000DeviceInfo {
         void setDeviceInstanceNumber(uint8_t deviceInstance) {
             deviceInformation.deviceInstance = deviceInstance;
         };
+        void setSystemInstanceNumber(uint8_t systemInstance) {
+            deviceInformation.industryGroupAndSystemInstance = (deviceInformation.industryGroupAndSystemInstance & 0xf0) | (systemInstance & 0x0f);
+        };
+        uint8_t getDeviceInstanceNumber() {
+            return deviceInformation.deviceInstance;
+        };
+        uint8_t getSystemInstanceNumber() {
+            return deviceInformation.industryGroupAndSystemInstance & 0x0f;
+        };
         uint64_t getName() {
             return deviceInformation.name;
         };
@@ -153,12 +196,59 @@ typedef struct SNMEA2000ProductInfo {
     byte loadEquivalency;
 } SNMEA2000ProductInfo;
 
+/**
+ * Throttling curve for a periodically transmitted PGN.
+ * When the estimated bus load reaches loadThreshold[i] percent the transmit
+ * period is multiplied by periodStretch[i]. Thresholds must be ascending, set
+ * unused entries to 0xff so they never match.
+ * eg { {50, 70, 85}, {2, 4, 10} }
+ */
+typedef struct SNMEA2000ThrottleCurve {
+    uint8_t loadThreshold[3]; // % bus load
+    uint8_t periodStretch[3]; // multiplier applied to the period
+} SNMEA2000ThrottleCurve;
+
+/**
+ * Transmit schedule entry, one per periodically sent PGN.
+ * Must be in RAM as lastSent is updated by isTxDue, and period may be changed 
+ * at runtime, eg by a SNMEA2000GroupFunction.
+ */
+typedef struct SNMEA2000TxSchedule {
+    unsigned long pgn;
+    uint16_t period; // ms, max 65s
+    const SNMEA2000ThrottleCurve * throttle; // NULL to never throttle
+    unsigned long lastSent;
+    uint16_t defaultPeriod; // ms, set from period by setTxSchedule if 0
+    uint8_t sid; // SID of the last sampling pass, advanced by isSampleDue
+} SNMEA2000TxSchedule;
+
 typedef struct SNMEA2000ConfigInfo {
     const char * manufacturerInfo; // max 71 var string
     const char * installDesc1; // max 71 var string
     const char * installDesc2; // max 71 var string
 } SNMEA2000ConfigInfo;
 
+/**
+ * @brief PGN from a 29 bit CAN id.
+ */
+unsigned long getPgnId(unsigned long ID);
+
+/**
+ * Progress of one fast packet being reassembled.
+ */
+typedef struct SNMEA2000FastPacketState {
+    uint8_t nextFrame; // next frame expected, 0 if waiting for a first frame
+    uint8_t sequence;
+    uint8_t length; // payload length from the first frame
+} SNMEA2000FastPacketState;
+
+/**
+ * @brief add a fast packet frame to payload, keeping at most size bytes. Returns the payload length 
+ * from the first frame once the last frame has been added, otherwise 0. A frame out of order or from 
+ * another sequence abandons the packet until the next first frame.
+ */
+uint8_t assembleFastPacket(SNMEA2000FastPacketState *state, byte *payload, uint8_t size, const byte *frame, uint8_t len);
+
 class MessageHeader {
     public:
         MessageHeader(unsigned long ID, unsigned long PGN);
@@ -171,9 +261,230 @@ class MessageHeader {
         unsigned char destination;
 };
 
+class SNMEA2000;
 
+/**
+ * Recieves every message accepted by the rx filter, before the message is handled. 
+ * Listeners are chained with SNMEA2000::addListener so that optional services eg the
+ * SNMEA2000RxCache are only linked when used.
+ */
+class SNMEA2000Listener {
+    public:
+        /**
+         * @brief len is 1 to 8 for frames, frames outside that are dropped and counted in getRxLengthErrors(). 
+         * When a SNMEA2000IsoTP is registered, messages it reassembles are passed whole, so len can be up 
+         * to 1785, listeners expecting frames must check len <= 8. Fields beyond len must not be read, 
+         * a misbehaving device can send short frames.
+         */
+        virtual void onMessage(MessageHeader *messageHeader, byte * buffer, int len) = 0;
+        /**
+         * @brief called on every processMessages before frames are read, for listeners with timers.
+         */
+        virtual void process() {};
+        /**
+         * @brief answer an ISO request for a PGN the device does not answer itself, true if answered.
+         * Unanswered requests go to the iso request handler.
+         */
+        virtual bool onRequest(unsigned long requestedPGN, MessageHeader *messageHeader) { return false; };
+        SNMEA2000Listener * nextListener = NULL;
+        SNMEA2000 * device = NULL; // set by addListener, eg for device->getRxTimestamp()
+};
+
+/**
+ * Reads byte offset of a payload sent in more than one message or frame, allowing 
+ * payloads to be generated or read from PROGMEM on demand.
+ */
+typedef byte (*SNMEA2000PayloadReader)(const void * context, uint16_t offset);
+
+/**
+ * Reply to ISO requests for pgn with constant or generated data, held in a PROGMEM table given to
+ * SNMEA2000::setIsoResponses, eg
+ *
+ *  const byte batteryConfig[] PROGMEM = { 0x01, 0xc5, ... };
+ *  const SNMEA2000IsoResponse isoResponses[] PROGMEM = {
+ *      { 127513L, 6, true, sizeof(batteryConfig), batteryConfig, NULL, NULL },
+ *      { 65280L, 6, false, 8, NULL, readEquipmentIdentity, &equipment }
+ *  };
+ *
+ * Fast packet PGNs are sent as fast packets whatever their length, payloads over 223 bytes with the
+ * SNMEA2000IsoTP if set. Single frame PGNs must be at most 8 bytes.
+ */
+typedef struct SNMEA2000IsoResponse {
+    unsigned long pgn;
+    uint8_t priority;
+    bool fastPacket; // the PGN is a fast packet PGN
+    uint16_t length;
+    const byte * payload; // PROGMEM, streamed from flash, or NULL to use reader
+    SNMEA2000PayloadReader reader; // called for each byte with context when payload is NULL
+    const void * context;
+} SNMEA2000IsoResponse;
+
+class SNMEA2000IsoTP;
+
+/**
+ * CAN transport used by one or more SNMEA2000 devices, all frames are 29 bit extended.
+ */
+class SNMEA2000Transport {
+    public:
+        /**
+         * @brief open the transport, must be safe to call when already open.
+         */
+        virtual bool open() = 0;
+        /**
+         * @brief read the next recieved frame, false if none are available.
+         */
+        virtual bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) = 0;
+        virtual bool sendFrame(unsigned long id, uint8_t len, const byte *buf) = 0;
+        /**
+         * @brief micros() when the frame last returned by receiveFrame was captured, by default when it was read.
+         */
+        virtual unsigned long getRxTimestamp() { return micros(); };
+        /**
+         * @brief CAN controller state reported in the 126993 heartbeat, SNMEA2000_CONTROLLER_ERROR_ACTIVE, 
+         * _ERROR_PASSIVE or _BUS_OFF.
+         */
+        virtual uint8_t getControllerState() { return SNMEA2000_CONTROLLER_ERROR_ACTIVE; };
+        /**
+         * @brief check the controller error state, called by processMessages. Returns true when the 
+         * controller has been reset after bus off and the devices must re-claim their addresses.
+         */
+        virtual bool checkErrors() { return false; };
+        /**
+         * @brief result code of the last open() that failed, 0 if none.
+         */
+        virtual uint8_t getOpenError() { return 0; };
+};
+
+#ifndef SNMEA2000_HOST
+/**
+ * MCP2515 transport at 250Kb/s, filtering is done in code by each device.
+ */
+class SNMEA2000MCP2515 : public SNMEA2000Transport {
+    public:
+        SNMEA2000MCP2515(const uint8_t csPin, byte clockSet = MCP_8MHz) :
+            CAN{csPin},
+            clockSet{clockSet},
+            csPin{csPin} {
+        };
+        bool open() override;
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override;
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override;
+        uint8_t getOpenError() override { return openError; };
+        /**
+         * @brief MCP2515 clock used by the next open(), eg MCP_16MHz.
+         */
+        void setClockSet(byte clockSet) { this->clockSet = clockSet; };
+        /**
+         * @brief timestamp frames in an interrupt on the falling edge of the MCP2515 INT pin, which 
+         * must be an external interrupt pin, rather than when processMessages reads them. Frames 
+         * read while INT stays low, ie both rx buffers full, get the time of the first. Only one 
+         * SNMEA2000MCP2515 can use interrupt timestamps.
+         */
+        void enableRxTimestamps(uint8_t intPin);
+        unsigned long getRxTimestamp() override { return rxTimestamp; };
+        uint8_t getControllerState() override { return controllerState; };
+        /**
+         * @brief reads EFLG, TEC and REC every SNMEA2000_ERROR_POLL_PERIOD ms, 3 single byte SPI reads. 
+         * Frames are not sent while bus off, after the recovery delay the controller is reset.
+         */
+        bool checkErrors() override;
+        /**
+         * @brief ms to stay bus off before resetting the controller, default SNMEA2000_BUS_OFF_RECOVERY_DELAY.
+         */
+        void setBusOffRecoveryDelay(uint16_t delay) { busOffRecoveryDelay = delay; };
+        uint8_t getTxErrorCount() { return txErrorCount; };
+        uint8_t getRxErrorCount() { return rxErrorCount; };
+        uint16_t getErrorPassiveCount() { return errorPassiveCount; };
+        uint16_t getBusOffCount() { return busOffCount; };
+        uint16_t getRecoveries() { return recoveries; };
+        /**
+         * @brief total ms spent in a SNMEA2000_CONTROLLER_ state.
+         */
+        unsigned long getStateTime(uint8_t state);
+        void dumpErrorStatus(Print *console);
+    private:
+        uint8_t readRegister(uint8_t address);
+        void setControllerState(uint8_t state);
+        MCP_CAN CAN;
+        byte clockSet;
+        uint8_t csPin;
+        bool isOpen = false;
+        uint8_t openError = 0;
+        uint8_t controllerState = SNMEA2000_CONTROLLER_ERROR_ACTIVE;
+        uint8_t txErrorCount = 0;
+        uint8_t rxErrorCount = 0;
+        uint16_t errorPassiveCount = 0;
+        uint16_t busOffCount = 0;
+        uint16_t recoveries = 0;
+        uint16_t busOffRecoveryDelay = SNMEA2000_BUS_OFF_RECOVERY_DELAY;
+        unsigned long lastErrorCheck = 0;
+        unsigned long stateChanged = 0;
+        unsigned long stateTime[3] = {0,0,0};
+        uint8_t intPin = 0xff;
+        unsigned long rxTimestamp = 0;
+};
+#endif
+
+
+
+// fast packet sequence counters per device, PGNs are hashed onto them, a power of 2.
+#define SNMEA2000_FAST_PACKET_SEQUENCES 8
+
+/**
+ * Builds one single frame or fast packet message in its own 8 byte frame, sending each frame
+ * through the device as it fills. Writers are declared on the stack where a message is sent, so 
+ * a handler can reply while another message is half built, eg
+ *
+ *  MessageHeader messageHeader(127508L, 6, getAddress(), SNMEA2000::broadcastAddress);
+ *  SNMEA2000PacketWriter writer(this, &messageHeader);
+ *  writer.outputByte(instance);
+ *  writer.finishPacket();
+ *
+ * Fast packets take the payload length, and a sequence number from the device per PGN.
+ */
+class SNMEA2000PacketWriter {
+    public:
+        SNMEA2000PacketWriter(SNMEA2000 *device) : device{device} {};
+        SNMEA2000PacketWriter(SNMEA2000 *device, MessageHeader *messageHeader) : device{device} {
+            startPacket(messageHeader);
+        };
+        SNMEA2000PacketWriter(SNMEA2000 *device, MessageHeader *messageHeader, int length) : device{device} {
+            startFastPacket(messageHeader, length);
+        };
+        void startPacket(MessageHeader *messageHeader);
+        void finishPacket();
+        void startFastPacket(MessageHeader *messageHeader, int length);
+        void finishFastPacket();
+        /**
+         * @brief print an error if the bytes output differ from the fast packet length.
+         */
+        void checkFastPacket();
+        void outputByte(byte opb);
+        void output3ByteUInt(uint32_t i);
+        void output3ByteInt(int32_t i);
+        void output2ByteUInt(uint16_t i);
+        void outputFixedString(const char * str, int maxLen, byte padding);
+        void outputVarString(const char * str,  uint8_t strLen);
+        void output2ByteInt(uint16_t i);
+        void output2ByteDouble(double v, double p);
+        void output2ByteUDouble(double v, double p);
+        void output3ByteDouble(double v, double p);
+        void output3ByteUDouble(double v, double p);
+        void output4ByteDouble(double v, double p);
+        void output4ByteUDouble(double v, double p);
+    private:
+        SNMEA2000 *device;
+        MessageHeader *messageHeader = NULL;
+        byte buffer[8];
+        uint8_t ob = 0;
+        uint8_t frame = 0;
+        uint8_t sequence = 0;
+        bool fastPacket = false;
+        int16_t fastPacketLength = 0; // bytes remaining
+};
 
 class SNMEA2000 {
+    friend class SNMEA2000PacketWriter;
     public:
         SNMEA2000(byte addr,
         SNMEA2000DeviceInfo * devInfo, 
@@ -183,6 +494,33 @@ class SNMEA2000 {
         const uint8_t txLen,
         const unsigned long *rx,
         const uint8_t rxLen,
+        SNMEA2000Transport * transport,
+        Print * console = &Serial
+        ): 
+        deviceAddress{addr},
+        devInfo{devInfo},
+        productInfo{pinfo},
+        configInfo{cinfo},
+        txPGNList{tx},
+        rxPGNList{rx},
+        txListLen{txLen},
+        rxListLen{rxLen},
+        transport{transport},
+        console{console}
+        {
+        };
+#ifndef SNMEA2000_HOST
+        /**
+         * @brief as before transports, the device owns a SNMEA2000MCP2515 on csPin.
+         */
+        SNMEA2000(byte addr,
+        SNMEA2000DeviceInfo * devInfo, 
+        const SNMEA2000ProductInfo * pinfo, 
+        const SNMEA2000ConfigInfo * cinfo,
+        const unsigned long *tx,
+        const uint8_t txLen,
+        const unsigned long *rx,
+        const uint8_t rxLen,
         const uint8_t csPin,
         Print * console = &Serial
         ): 
@@ -194,13 +532,79 @@ class SNMEA2000 {
         rxPGNList{rx},
         txListLen{txLen},
         rxListLen{rxLen},
-        CAN{csPin},
+        transport{new SNMEA2000MCP2515(csPin)},
         console{console}
         {
+            ownedTransport = (SNMEA2000MCP2515 *)transport;
         };
+#endif
 
-        bool open(byte clockSet = MCP_8MHz);
+        /**
+         * @brief open the transport and claim an address. Each device sharing a transport 
+         * must be opened.
+         */
+        bool open();
+#ifndef SNMEA2000_HOST
+        /**
+         * @brief open with the MCP2515 clock, eg MCP_16MHz, for devices constructed with a csPin.
+         */
+        bool open(byte clockSet) __attribute__((deprecated("set the clock in the SNMEA2000MCP2515 constructor")));
+#endif
+        /**
+         * @brief read and handle recieved frames, only the first device on a transport reads frames,
+         * each frame is passed to all devices added with addDevice in one pass.
+         */
         void processMessages();
+        /**
+         * @brief read and handle recieved frames until budget us have been used, rather than 
+         * SNMEA2000_MAX_FRAMES_PER_CALL frames. Multi frame responses to ISO requests, PGN lists, 
+         * product and configuration information, are deferred until the rx backlog has been read, 
+         * then sent while budget remains, or after SNMEA2000_MAX_RESPONSE_DELAY ms regardless. At 
+         * least one frame is read on each call, so a call can overrun the budget by one handler. 
+         * A budget of 0 is the same as processMessages().
+         */
+        void processMessages(uint16_t budget);
+        /**
+         * @brief processMessages(budget) calls that took longer than the budget.
+         */
+        uint16_t getBudgetOverruns() { return budgetOverruns; };
+        /**
+         * @brief processMessages(budget) calls that ran out of budget with frames still to read.
+         */
+        uint16_t getBudgetBacklogs() { return budgetBacklogs; };
+        /**
+         * @brief longest processMessages call in us, since the last call to this.
+         */
+        uint16_t getMaxProcessMicros() { 
+            uint16_t m = maxProcessMicros;
+            maxProcessMicros = 0;
+            return m;
+        };
+        /**
+         * @brief add another logical device sharing this devices transport, with its own address,
+         * name, product information and PGN lists.
+         */
+        void addDevice(SNMEA2000 *device);
+        /**
+         * @brief 126993 heartbeat period in ms, 0 to stop the heartbeat, default 60s. The heartbeat
+         * is only sent when 126993 is in the tx list.
+         */
+        void setHeartbeatPeriod(uint16_t period) {
+            heartbeatPeriod = period;
+        };
+        /**
+         * @brief send a 126993 heartbeat now, normally sent by processMessages.
+         */
+        void sendHeartbeat();
+        uint16_t getHeartbeatsSent() { return heartbeatsSent; };
+        /**
+         * @brief recieved frames dropped as too short or too long for their PGN.
+         */
+        uint16_t getRxLengthErrors() { return rxLengthErrors; };
+        /**
+         * @brief total us spent sending housekeeping messages from processMessages.
+         */
+        unsigned long getHousekeepingMicros() { return housekeepingMicros; };
         void dumpStatus() {
             console->print(F("NMEA2000 Status open="));
             console->print(canIsOpen);
@@ -213,68 +617,254 @@ class SNMEA2000 {
             console->print(F(" packet errors="));
             console->print(packetErrors);
             console->print(F(" frame errors="));
-            console->println(frameErrors);
+            console->print(frameErrors);
+            console->print(F(" rx length errors="));
+            console->print(rxLengthErrors);
+            console->print(F(" busload="));
+            console->print(getBusLoad());
+            console->print(F("% heartbeats="));
+            console->print(heartbeatsSent);
+            console->print(F(" housekeeping us="));
+            console->print(housekeepingMicros);
+            console->print(F(" controller="));
+            console->print(transport->getControllerState());
+            console->print(F(" tx failures="));
+            console->print(txFailures);
+            console->print(F(" budget overruns="));
+            console->print(budgetOverruns);
+            console->print(F(" backlogs="));
+            console->print(budgetBacklogs);
+            console->print(F(" deferred="));
+            console->println(deferredResponsesSent);
+            for (uint8_t i = 0; i < txScheduleLen; i++) {
+                console->print(F("  tx pgn="));
+                console->print(txSchedule[i].pgn);
+                console->print(F(" period="));
+                console->print(txSchedule[i].period);
+                console->print(F(" throttle=x"));
+                console->println(getThrottleStretch(txSchedule[i].throttle));
+            }
         };
+        /**
+         * @brief Set the schedule used by isTxDue, the array must remain in RAM for 
+         * the life of this instance.
+         */
+        void setTxSchedule(SNMEA2000TxSchedule *schedule, uint8_t len) {
+            txSchedule = schedule;
+            txScheduleLen = len;
+            for (uint8_t i = 0; i < len; i++) {
+                if ( schedule[i].defaultPeriod == 0 ) {
+                    schedule[i].defaultPeriod = schedule[i].period;
+                }
+            }
+        };
+        /**
+         * @brief the schedule entry for pgn, NULL if it is not scheduled.
+         */
+        SNMEA2000TxSchedule * getTxSchedule(unsigned long pgn);
+        /**
+         * @brief true when schedule entry i is due to be sent, period stretched by its throttle curve
+         * at the current bus load. Marks the entry as sent when true.
+         */
+        bool isTxDue(uint8_t i);
+        /**
+         * @brief isTxDue for an entry sending the related PGNs of one sampling pass. When true the 
+         * entry SID is advanced, send every PGN of the pass with getSampleSid(i) so receivers can 
+         * tie the readings together.
+         */
+        bool isSampleDue(uint8_t i);
+        /**
+         * @brief SID of the last sampling pass of schedule entry i, 0 to 252.
+         */
+        byte getSampleSid(uint8_t i) { return (i < txScheduleLen)?txSchedule[i].sid:0xff; };
+        /**
+         * @brief SID for a sampling pass outside the tx schedule, 0 to 252, counted per device.
+         */
+        byte nextSid() {
+            sampleSid = advanceSid(sampleSid);
+            return sampleSid;
+        };
+        static byte advanceSid(byte sid) {
+            // 253 to 255 are reserved
+            return (sid >= 252)?0:sid+1;
+        };
+        /**
+         * @brief period multiplier for the curve at the current bus load, 1 when not throttled.
+         */
+        uint8_t getThrottleStretch(const SNMEA2000ThrottleCurve *curve);
+        /**
+         * @brief estimated bus load in %, updated every second from all frames seen and sent.
+         */
+        uint8_t getBusLoad() { return firstDevice->busLoad; };
         void setDiagnostics(bool enabled) {
             diagnostics = enabled;
         };
         void sendMessage(MessageHeader *messageHeader, byte *message, int len);
-        //void sendFastPacket(MessageHeader *messageHeader, byte *message, int len, bool progmem=false);    
+        /**
+         * @brief send one frame with a CAN id built by the caller, eg canIdBase(pgn, priority) | getAddress(), 
+         * without a MessageHeader. For single frame PGNs sent at high rates.
+         */
+        void sendFrame(unsigned long canId, const byte *frame, uint8_t len);
+        /**
+         * @brief the CAN id of a broadcast PDU2 PGN without the source address, a constant for constant arguments.
+         */
+        static constexpr unsigned long canIdBase(unsigned long pgn, uint8_t priority) {
+            return ((unsigned long)(priority & 0x7) << 26) | (pgn << 8);
+        };
+        /**
+         * @brief send a complete payload of up to 223 bytes as a fast packet, the same frames as 
+         * startFastPacket, outputByte and finishFastPacket without the per byte calls.
+         */
+        void sendFastPacket(MessageHeader *messageHeader, const byte *payload, uint8_t length);
         void setSerialNumber(uint32_t serialNumber) { 
             devInfo->setSerialNumber(serialNumber); 
         };
+        /**
+         * @brief change the device and system instance in the NAME, announcing the new NAME
+         * with an address claim if the address has been claimed.
+         */
+        void setDeviceInstances(uint8_t deviceInstance, uint8_t systemInstance);
+        uint8_t getDeviceInstance() { return devInfo->getDeviceInstanceNumber(); };
+        uint8_t getSystemInstance() { return devInfo->getSystemInstanceNumber(); };
         void setDeviceAddress(unsigned char _deviceAddress) { 
             deviceAddress = _deviceAddress; 
             console->print("Device Address set to ");
             console->println(deviceAddress);
         };
         unsigned char getAddress() { return deviceAddress; };
-        void startPacket(MessageHeader *messageHeader);
-        void finishPacket();
-        void startFastPacket(MessageHeader *messageHeader, int length);
-        void finishFastPacket();
-        void checkFastPacket();
-        void outputByte(byte opb);
-        void output3ByteUInt(uint32_t i);
-        void output3ByteInt(int32_t i);
-        void output2ByteUInt(uint16_t i);
-        void outputFixedString(const char * str, int maxLen, byte padding);
-        void outputVarString(const char * str,  uint8_t strLen);
-
-        void output2ByteInt(uint16_t i);
-        void output2ByteDouble(double v, double p);
-        void output2ByteUDouble(double v, double p);
-        void output3ByteDouble(double v, double p);
-        void output3ByteUDouble(double v, double p);
-        void output4ByteDouble(double v, double p);
-        void output4ByteUDouble(double v, double p);
+        /**
+         * @brief true once 250ms have passed since the last address claim without a conflict.
+         */
+        bool hasClaimedAddress();
+        /**
+         * @brief build a message in the devices own SNMEA2000PacketWriter, which is not re-entrant, a 
+         * handler replying while a message is being built must use a writer on the stack.
+         */
+        void startPacket(MessageHeader *messageHeader) { packetWriter.startPacket(messageHeader); };
+        void finishPacket() { packetWriter.finishPacket(); };
+        void startFastPacket(MessageHeader *messageHeader, int length) { packetWriter.startFastPacket(messageHeader, length); };
+        void finishFastPacket() { packetWriter.finishFastPacket(); };
+        void checkFastPacket() { packetWriter.checkFastPacket(); };
+        void outputByte(byte opb) { packetWriter.outputByte(opb); };
+        void output3ByteUInt(uint32_t i) { packetWriter.output3ByteUInt(i); };
+        void output3ByteInt(int32_t i) { packetWriter.output3ByteInt(i); };
+        void output2ByteUInt(uint16_t i) { packetWriter.output2ByteUInt(i); };
+        void outputFixedString(const char * str, int maxLen, byte padding) { packetWriter.outputFixedString(str, maxLen, padding); };
+        void outputVarString(const char * str,  uint8_t strLen) { packetWriter.outputVarString(str, strLen); };
+
+        void output2ByteInt(uint16_t i) { packetWriter.output2ByteInt(i); };
+        void output2ByteDouble(double v, double p) { packetWriter.output2ByteDouble(v, p); };
+        void output2ByteUDouble(double v, double p) { packetWriter.output2ByteUDouble(v, p); };
+        void output3ByteDouble(double v, double p) { packetWriter.output3ByteDouble(v, p); };
+        void output3ByteUDouble(double v, double p) { packetWriter.output3ByteUDouble(v, p); };
+        void output4ByteDouble(double v, double p) { packetWriter.output4ByteDouble(v, p); };
+        void output4ByteUDouble(double v, double p) { packetWriter.output4ByteUDouble(v, p); };
+        /**
+         * @brief the next fast packet sequence number for pgn, 0 to 7. Each PGN counts through the 
+         * sequence numbers, PGNs that hash to the same counter share it.
+         */
+        uint8_t nextFastPacketSequence(unsigned long pgn);
 
         void setIsoRequestHandler(bool (*_isoRequestHandler)(unsigned long requestedPGN, MessageHeader *messageHeader, byte * buffer, int len)) {
             isoRequestHandler = _isoRequestHandler;
         };
+        /**
+         * @brief handler for messages not handled by the library, len is 1 to 8, or up to 1785 for transport
+         * protocol messages, as for SNMEA2000Listener::onMessage.
+         */
         void setMessageHandler(void (*_messageHandler)(MessageHeader *messageHeader, byte * buffer, int len)) {
             messageHandler = _messageHandler;
         };
+        /**
+         * @brief called with every frame read by processMessages after it has been handled, 
+         * accepted is true if any device on the transport passed it on. Set on the first device.
+         */
+        void setFrameMonitor(void (*_frameMonitor)(unsigned long canId, byte * buffer, uint8_t len, bool accepted)) {
+            frameMonitor = _frameMonitor;
+        };
+        /**
+         * @brief PROGMEM table of responses to ISO requests, checked before listeners and the iso request
+         * handler. The PGNs are added to the 126464 tx list and isTxPGN.
+         */
+        void setIsoResponses(const SNMEA2000IsoResponse * responses, uint8_t len) {
+            isoResponses = responses;
+            isoResponsesLen = len;
+        };
+        /**
+         * @brief transport protocol used for PGN lists longer than a fast packet.
+         */
+        void setIsoTP(SNMEA2000IsoTP * _isoTP) {
+            isoTP = _isoTP;
+        };
+        /**
+         * @brief pass a complete message to the listeners and handlers, as if it had been recieved.
+         */
+        void dispatchMessage(MessageHeader *messageHeader, byte * buf, int len);
+        bool isRxPGN(unsigned long pgn);
+        bool isTxPGN(unsigned long pgn);
+        void addListener(SNMEA2000Listener * listener) {
+            listener->nextListener = listeners;
+            listener->device = this;
+            listeners = listener;
+        };
+        /**
+         * @brief micros() when the frame being handled was captured by the transport, valid in
+         * listeners, handlers and the frame monitor.
+         */
+        unsigned long getRxTimestamp() {
+#ifdef SNMEA2000_HOST
+            if ( threadRxTimestamp != NULL ) {
+                return *threadRxTimestamp;
+            }
+#endif
+            return firstDevice->rxTimestamp;
+        };
+#ifdef SNMEA2000_HOST
+        /**
+         * @brief for threads handling frames outside processMessages, eg SNMEA2000RxEngine workers,
+         * getRxTimestamp() on this thread returns *timestamp, NULL to use the device again.
+         */
+        static void setThreadRxTimestamp(const unsigned long *timestamp) { threadRxTimestamp = timestamp; };
+#endif
         
         static const byte broadcastAddress=0xff;
+        static const byte anySource=0xff;
         static const int16_t undefined2ByteDouble=0x7ffe;
 
         static constexpr double n2kDoubleNA=-1000000000.0;
         static const uint8_t n2kInt8NA=127;
+        static const int16_t n2kInt16NA=0x7fff;
+        static const uint16_t n2kUInt16NA=0xffff;
+        static const uint32_t n2kUInt24NA=0xffffff;
+        static const int32_t n2kInt32NA=0x7fffffff;
 
 
     private:
+        bool handleFrame(unsigned long canId, unsigned long pgn, byte * buf, uint8_t len);
+        bool isLocalAddress(unsigned char address);
         void handleISOAddressClaim(MessageHeader *messageHeader, byte * buffer, int len);
         void claimAddress();
-        bool hasClaimedAddress();
         void handleISORequest(MessageHeader *messageHeader, byte * buffer, int len);
         void sendPGNLists(MessageHeader *requestMessageHeader);
-        void sendPGNList(MessageHeader *messageHeader, int listType, const unsigned long *pgnList, uint8_t len);
+        void sendPGNList(MessageHeader *messageHeader, int listType, uint8_t len, uint8_t tpDestination);
+        uint8_t getTxListLength();
+        unsigned long getTxListPGN(uint8_t i);
+        const SNMEA2000IsoResponse * findIsoResponse(unsigned long pgn);
+        void sendIsoResponse(const SNMEA2000IsoResponse * response, MessageHeader *requestMessageHeader);
+        static byte readProgmemPayload(const void * context, uint16_t offset);
+        static byte readTxPGNList(const void * context, uint16_t offset);
+        static byte readRxPGNList(const void * context, uint16_t offset);
         void sendIsoAddressClaim();
         void sendProductInformation(MessageHeader *requestMessageHeader);
         void sendConfigurationInformation(MessageHeader *requestMessageHeader);
-        void sendIsoAcknowlegement(MessageHeader *requestMessageHeader, byte control, byte groupFunction);
+        void sendIsoAcknowlegement(MessageHeader *requestMessageHeader, byte control, byte groupFunction, unsigned long pgn);
         int getPgmSize(const char *str, int maxLen);
+        void processHousekeeping();
+        void processFrames(uint8_t maxFrames, uint16_t budget);
+        bool deferResponse(uint8_t response, MessageHeader *requestMessageHeader);
+        void sendDeferredResponses(unsigned long start, uint16_t budget, bool drained);
+        void countBusFrame(uint8_t len);
+        void updateBusLoad();
         //void print_uint64_t(uint64_t num);
 
         //void print(tUnionDeviceInformation * devInfo) {
@@ -303,26 +893,64 @@ class SNMEA2000 {
         const unsigned long *rxPGNList;
         const uint8_t txListLen;
         const uint8_t rxListLen;
-        MCP_CAN CAN;
+        SNMEA2000Transport * transport;
+#ifndef SNMEA2000_HOST
+        SNMEA2000MCP2515 * ownedTransport = NULL;
+#endif
+        SNMEA2000 * firstDevice = this;
+        SNMEA2000 * nextDevice = NULL;
         bool (*isoRequestHandler)(unsigned long requestedPGN, MessageHeader *messageHeader, byte * buffer, int len) = NULL;
         void (*messageHandler)(MessageHeader *messageHeader, byte * buffer, int len) = NULL;
+        void (*frameMonitor)(unsigned long canId, byte * buffer, uint8_t len, bool accepted) = NULL;
+        SNMEA2000Listener * listeners = NULL;
+        SNMEA2000IsoTP * isoTP = NULL;
+        const SNMEA2000IsoResponse * isoResponses = NULL;
+        uint8_t isoResponsesLen = 0;
         unsigned long addressClaimStarted=0;
-        //output buffer and frames
-        MessageHeader *packetMessageHeader = NULL;
-        bool fastPacket = false;
+        unsigned long rxTimestamp = 0;
+#ifdef SNMEA2000_HOST
+        static thread_local const unsigned long * threadRxTimestamp;
+#endif
+        SNMEA2000PacketWriter packetWriter{this};
         bool diagnostics = false;
         bool canIsOpen = false;
-        uint8_t fastPacketSequence = 0;
-        int16_t fastPacketSent = 0;
-        int16_t fastPacketLength = 0;
-        byte buffer[8] = {0,0,0,0,0,0,0,0};
-        uint8_t frame = 0;
-        uint8_t ob = 0;
+#if defined(SNMEA2000_HOST) && defined(SNMEA2000_THREADS)
+        SNMEA2000SequenceCounter fastPacketSequences[SNMEA2000_FAST_PACKET_SEQUENCES] = {};
+#else
+        // 4 bits per counter.
+        SNMEA2000SequenceCounter fastPacketSequences[SNMEA2000_FAST_PACKET_SEQUENCES/2] = {0};
+#endif
         uint16_t messagesRecieved = 0;
         uint16_t messagesDropped = 0;
-        uint16_t messagesSent = 0;
-        uint16_t packetErrors = 0;
-        uint16_t frameErrors = 0;
+        // updated by senders
+        SNMEA2000Counter messagesSent{0};
+        SNMEA2000Counter packetErrors{0};
+        SNMEA2000Counter frameErrors{0};
+        SNMEA2000Counter txFailures{0};
+        uint16_t rxLengthErrors = 0;
+        SNMEA2000TxSchedule * txSchedule = NULL;
+        uint8_t txScheduleLen = 0;
+        uint8_t busLoad = 0;
+        SNMEA2000BitCounter busBits{0};
+        unsigned long busLoadWindowStart = 0;
+        uint16_t heartbeatPeriod = SNMEA2000_HEARTBEAT_PERIOD;
+        unsigned long lastHeartbeat = 0;
+        unsigned long housekeepingMicros = 0;
+        uint16_t heartbeatsSent = 0;
+        uint8_t heartbeatSequence = 0;
+        uint8_t sampleSid = 0;
+        bool heartbeatDue = false;
+        // set on the first device while processMessages(budget) is reading frames.
+        bool deferring = false;
+        uint8_t deferredResponses = 0;
+        // requester source and destination for each deferred response
+        uint8_t deferredSource[3];
+        uint8_t deferredDestination[3];
+        unsigned long deferredAt = 0;
+        uint16_t deferredResponsesSent = 0;
+        uint16_t budgetOverruns = 0;
+        uint16_t budgetBacklogs = 0;
+        uint16_t maxProcessMicros = 0;
 
     protected:
         Print * console;
@@ -331,8 +959,32 @@ class SNMEA2000 {
 
 };
 
+/**
+ * Environment readings taken in one sampling pass, SNMEA2000::n2kDoubleNA if not measured.
+ */
+typedef struct SNMEA2000EnvironmentSample {
+    double atmosphericPressure; // Pa
+    double temperature; // K
+    double humidity; // %
+    byte instance; // for 130313, 130314 and 130316
+    byte temperatureSource;
+    byte humiditySource;
+    byte pressureSource;
+} SNMEA2000EnvironmentSample;
+
 class PressureMonitor : public SNMEA2000 {
     public:
+      PressureMonitor(byte addr,
+        SNMEA2000DeviceInfo * devInfo, 
+        const SNMEA2000ProductInfo * pinfo, 
+        const SNMEA2000ConfigInfo * cinfo,
+        const unsigned long *tx,
+        const uint8_t txLen,
+        const unsigned long *rx,
+        const uint8_t rxLen,
+        SNMEA2000Transport * transport
+        ): SNMEA2000{addr, devInfo, pinfo, cinfo, tx, txLen, rx, rxLen, transport} {};
+#ifndef SNMEA2000_HOST
       PressureMonitor(byte addr,
         SNMEA2000DeviceInfo * devInfo, 
         const SNMEA2000ProductInfo * pinfo, 
@@ -343,6 +995,7 @@ class PressureMonitor : public SNMEA2000 {
         const uint8_t rxLen,
         const uint8_t csPin
         ): SNMEA2000{addr, devInfo, pinfo, cinfo, tx, txLen, rx, rxLen, csPin} {};
+#endif
 
     /**
      * @brief PGN 130310 
@@ -408,12 +1061,34 @@ class PressureMonitor : public SNMEA2000 {
      * @param temperature in K
      */
     void sendTemperature(byte sid, byte temperatureSource,  byte temperatureInstance, double temperature );
+    /**
+     * @brief PGN 130316L from a fixed point value, eg from a SNMEA2000Calibration.
+     * @param temperature in 0.001K, SNMEA2000::n2kUInt24NA if not available
+     */
+    void sendTemperatureFixed(byte sid, byte temperatureSource,  byte temperatureInstance, uint32_t temperature );
+
+    /**
+     * @brief send the readings of one sampling pass back to back with the same sid, as 130311 and 
+     * each of 130313, 130314 and 130316 that is in the tx list and has a reading.
+     */
+    void sendEnvironmentSample(byte sid, const SNMEA2000EnvironmentSample *sample);
 
 };
 
 
 class EngineMonitor : public SNMEA2000 {
     public:
+      EngineMonitor(byte addr,
+        SNMEA2000DeviceInfo * devInfo, 
+        const SNMEA2000ProductInfo * pinfo, 
+        const SNMEA2000ConfigInfo * cinfo,
+        const unsigned long *tx,
+        const uint8_t txLen,
+        const unsigned long *rx,
+        const uint8_t rxLen,
+        SNMEA2000Transport * transport
+        ): SNMEA2000{addr, devInfo, pinfo, cinfo, tx, txLen, rx, rxLen, transport} {};
+#ifndef SNMEA2000_HOST
       EngineMonitor(byte addr,
         SNMEA2000DeviceInfo * devInfo, 
         const SNMEA2000ProductInfo * pinfo, 
@@ -424,6 +1099,7 @@ class EngineMonitor : public SNMEA2000 {
         const uint8_t rxLen,
         const uint8_t csPin
         ): SNMEA2000{addr, devInfo, pinfo, cinfo, tx, txLen, rx, rxLen, csPin} {};
+#endif
     /**
      * RapidEngine Data - PGN 127488, standard packet
      * enginInstance starting a 0
@@ -483,6 +1159,20 @@ class EngineMonitor : public SNMEA2000 {
             double batteryTemperature = SNMEA2000::n2kDoubleNA, // K
             double batteryCurrent = SNMEA2000::n2kDoubleNA // A
         );
+    /**
+     * DC Battery Status PGN 127508 from fixed point values in N2K units, eg from a SNMEA2000Calibration,
+     * without floating point.
+     * batteryVoltage in 0.01V, SNMEA2000::n2kInt16NA if not available
+     * batteryTemperature in 0.01K, SNMEA2000::n2kUInt16NA if not available
+     * batteryCurrent in 0.1A, SNMEA2000::n2kInt16NA if not available
+     */
+    void sendDCBatterStatusMessageFixed(
+            byte batteryInstance, 
+            byte sid,
+            int16_t batteryVoltage, // 0.01V
+            uint16_t batteryTemperature, // 0.01K
+            int16_t batteryCurrent // 0.1A
+        );
     /**
      * Fluid Level PGN 127505
      * type fuel=0, 
@@ -534,6 +1224,16 @@ class EngineMonitor : public SNMEA2000 {
         double actual = SNMEA2000::n2kDoubleNA, // K
         double requested = SNMEA2000::n2kDoubleNA // K
         );
+    /*
+     * Temperature PGN 130312 from fixed point values in 0.01K, SNMEA2000::n2kUInt16NA if not available.
+     */
+    void sendTemperatureMessageFixed(
+        byte sid, 
+        byte instance,
+        byte source,
+        uint16_t actual, // 0.01K
+        uint16_t requested = SNMEA2000::n2kUInt16NA // 0.01K
+        );
 };
 
 
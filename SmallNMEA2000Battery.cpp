@@ -0,0 +1,173 @@
+#include "SmallNMEA2000Battery.h"
+
+#define DC_DETAILED_STATUS_PGN 127506L
+#define BATTERY_STATUS_PGN 127508L
+#define BATTERY_CONFIGURATION_PGN 127513L
+
+// uAs in 1 Ah
+#define MICROAMP_SECONDS_PER_AH 3600000000LL
+
+BatteryMonitor::BatteryMonitor(byte addr,
+        SNMEA2000DeviceInfo * devInfo,
+        const SNMEA2000ProductInfo * pinfo,
+        const SNMEA2000ConfigInfo * cinfo,
+        const unsigned long *tx,
+        const uint8_t txLen,
+        const unsigned long *rx,
+        const uint8_t rxLen,
+        SNMEA2000Transport * transport,
+        const SNMEA2000BatteryConfig * config,
+        uint16_t sampleRate,
+        uint32_t microampsPerCount,
+        int16_t zeroOffset
+        ) : SNMEA2000{addr, devInfo, pinfo, cinfo, tx, txLen, rx, rxLen, transport},
+        config{config},
+        microampsPerCount{(microampsPerCount == 0)?1:microampsPerCount},
+        sampleRate{(sampleRate == 0)?(uint16_t)1:sampleRate},
+        zeroOffset{zeroOffset} {
+    uint16_t capacity = pgm_read_word(&config->capacity);
+    ratedCapacity = ((int64_t)capacity*MICROAMP_SECONDS_PER_AH/this->microampsPerCount)*this->sampleRate;
+    usableCapacity = ratedCapacity;
+    int8_t efficiency = (int8_t)pgm_read_byte(&config->chargeEfficiency);
+    chargeEfficiency = (efficiency <= 0 || efficiency > 100)?100:efficiency;
+    addListener(this);
+}
+
+void BatteryMonitor::update() {
+    noInterrupts();
+    int32_t chargeCounts = pendingCharge;
+    int32_t dischargeCounts = pendingDischarge;
+    uint16_t n = pendingSamples;
+    pendingCharge = 0;
+    pendingDischarge = 0;
+    pendingSamples = 0;
+    interrupts();
+    if ( n == 0 ) {
+        return;
+    }
+    samples += n;
+    charge += dischargeCounts + ((int64_t)chargeCounts*chargeEfficiency)/100;
+    if ( charge > 0 ) {
+        charge = 0;
+    }
+    current = (int32_t)(((int64_t)(chargeCounts + dischargeCounts)*microampsPerCount)/n);
+    if ( current < 0 ) {
+        averageDischarge = (averageDischarge == 0)?-current:(averageDischarge*3 - current)/4;
+    } else {
+        averageDischarge = 0;
+    }
+}
+
+void BatteryMonitor::setFull() {
+    charge = 0;
+}
+
+void BatteryMonitor::setEmpty() {
+    // only learn from a discharge of at least half the rated capacity.
+    if ( -charge > ratedCapacity/2 ) {
+        usableCapacity = -charge;
+    }
+    charge = -usableCapacity;
+}
+
+void BatteryMonitor::setStateOfCharge(uint8_t percent) {
+    if ( percent > 100 ) {
+        percent = 100;
+    }
+    charge = -(usableCapacity*(100-percent))/100;
+}
+
+uint8_t BatteryMonitor::getStateOfCharge() {
+    if ( usableCapacity <= 0 ) {
+        return 0;
+    }
+    int64_t soc = ((usableCapacity + charge)*100 + usableCapacity/2)/usableCapacity;
+    return (soc < 0)?0:(uint8_t)soc;
+}
+
+uint8_t BatteryMonitor::getStateOfHealth() {
+    if ( ratedCapacity <= 0 || usableCapacity >= ratedCapacity ) {
+        return 100;
+    }
+    return (uint8_t)((usableCapacity*100)/ratedCapacity);
+}
+
+uint32_t BatteryMonitor::getTimeRemaining() {
+    if ( averageDischarge <= 0 ) {
+        return 0xffffffff;
+    }
+    int64_t seconds = getRemainingCharge()/averageDischarge;
+    return (seconds > 0xfffffffe)?0xfffffffe:(uint32_t)seconds;
+}
+
+bool BatteryMonitor::onRequest(unsigned long requestedPGN, MessageHeader *messageHeader) {
+    if ( requestedPGN == BATTERY_CONFIGURATION_PGN ) {
+        sendBatteryConfiguration();
+        return true;
+    }
+    return false;
+}
+
+void BatteryMonitor::sendDCDetailedStatus(byte sid) {
+    MessageHeader messageHeader(DC_DETAILED_STATUS_PGN, 6, getAddress(), SNMEA2000::broadcastAddress);
+    uint32_t timeRemaining = getTimeRemaining();
+    uint16_t minutes = (timeRemaining == 0xffffffff)?0xffff:((timeRemaining/60 > 0xfffd)?0xfffd:(uint16_t)(timeRemaining/60));
+    int64_t remaining = getRemainingCharge()/MICROAMP_SECONDS_PER_AH;
+    byte payload[11];
+    payload[0] = sid;
+    payload[1] = pgm_read_byte(&config->batteryInstance);
+    payload[2] = 0; // battery
+    payload[3] = getStateOfCharge();
+    payload[4] = getStateOfHealth();
+    payload[5] = minutes & 0xff;
+    payload[6] = (minutes >> 8) & 0xff;
+    payload[7] = 0xff; // ripple voltage not available
+    payload[8] = 0xff;
+    payload[9] = remaining & 0xff; // Ah
+    payload[10] = (remaining >> 8) & 0xff;
+    sendFastPacket(&messageHeader, payload, 11);
+}
+
+void BatteryMonitor::sendBatteryStatus(byte sid) {
+    MessageHeader messageHeader(BATTERY_STATUS_PGN, 6, getAddress(), SNMEA2000::broadcastAddress);
+    // 0.1A, rounded
+    int32_t current01 = (current < 0)?(current - 50000)/100000:(current + 50000)/100000;
+    SNMEA2000PacketWriter writer(this, &messageHeader);
+    writer.outputByte(pgm_read_byte(&config->batteryInstance));
+    writer.output2ByteInt(voltage);
+    writer.output2ByteInt((current01 > 0x7ffd || current01 < -0x7fff)?0x7ffe:(int16_t)current01);
+    writer.output2ByteUInt(temperature);
+    writer.outputByte(sid);
+    writer.finishPacket();
+}
+
+void BatteryMonitor::sendBatteryConfiguration() {
+    MessageHeader messageHeader(BATTERY_CONFIGURATION_PGN, 6, getAddress(), SNMEA2000::broadcastAddress);
+    // a fast packet PGN, even though the payload fits in one frame.
+    SNMEA2000PacketWriter writer(this, &messageHeader, 8);
+    writer.outputByte(pgm_read_byte(&config->batteryInstance));
+    writer.outputByte((pgm_read_byte(&config->batteryType) & 0x0f)
+        | ((pgm_read_byte(&config->supportsEqualization) & 0x03) << 4) | 0xc0);
+    writer.outputByte((pgm_read_byte(&config->nominalVoltage) & 0x0f)
+        | ((pgm_read_byte(&config->chemistry) & 0x0f) << 4));
+    writer.output2ByteUInt(pgm_read_word(&config->capacity));
+    writer.outputByte(pgm_read_byte(&config->temperatureCoefficient));
+    writer.outputByte(pgm_read_byte(&config->peukertExponent));
+    writer.outputByte(pgm_read_byte(&config->chargeEfficiency));
+    writer.finishFastPacket();
+}
+
+void BatteryMonitor::dumpBatteryStatus() {
+    console->print(F("Battery soc="));
+    console->print(getStateOfCharge());
+    console->print(F("% soh="));
+    console->print(getStateOfHealth());
+    console->print(F("% current mA="));
+    console->print(current/1000);
+    console->print(F(" remaining Ah="));
+    console->print((long)(getRemainingCharge()/MICROAMP_SECONDS_PER_AH));
+    console->print(F(" time remaining s="));
+    console->print(getTimeRemaining());
+    console->print(F(" samples="));
+    console->println(samples);
+}
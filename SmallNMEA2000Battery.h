@@ -0,0 +1,130 @@
+#ifndef SmallNMEA2000Battery_H
+#define SmallNMEA2000Battery_H
+
+#include "SmallNMEA2000.h"
+
+/**
+ * Battery configuration sent in PGN 127513, define in PROGMEM.
+ */
+typedef struct SNMEA2000BatteryConfig {
+    uint8_t batteryInstance;
+    uint8_t batteryType; // 0 flooded, 1 gel, 2 AGM
+    uint8_t supportsEqualization; // 0 no, 1 yes
+    uint8_t nominalVoltage; // 0 6V, 1 12V, 2 24V, 3 32V, 4 36V, 5 42V, 6 48V
+    uint8_t chemistry; // 0 lead acid, 1 LiIon, 2 NiCad, 3 ZnO, 4 NiMH
+    uint16_t capacity; // Ah
+    int8_t temperatureCoefficient; // %
+    uint8_t peukertExponent; // 0.002 above 1, eg 1.25 is 125
+    int8_t chargeEfficiency; // %, applied to charge current, 100 if not known
+} SNMEA2000BatteryConfig;
+
+/**
+ * Battery shunt monitor, sending 127506 DC Detailed Status and 127508 Battery Status, and
+ * answering ISO requests for 127513 Battery Configuration from a PROGMEM SNMEA2000BatteryConfig.
+ *
+ * Shunt ADC samples are passed to sample() at a fixed rate, eg from the ADC interrupt at 1kHz.
+ * sample() only subtracts the zero offset and adds to a 32 bit total, as the ATtiny 0, 1 and 2
+ * series have no hardware multiply. update(), called from the loop at least every 30s, folds
+ * the totals into a 64 bit charge counter in ADC count samples, applying the charge efficiency,
+ * and calibrates the average current. Calibration to uA is only done in update() and
+ * the getters, in integer arithmetic, so no floating point is linked.
+ *
+ * The counter starts full. State of charge is relative to the capacity in the config until
+ * setEmpty() is called at the discharge cut off, which measures the usable capacity and so the
+ * state of health. setFull() resets the counter when a charger reports the battery full.
+ * Peukert and temperature compensation are reported in 127513 but not applied.
+ */
+class BatteryMonitor : public SNMEA2000, public SNMEA2000Listener {
+    public:
+      BatteryMonitor(byte addr,
+        SNMEA2000DeviceInfo * devInfo,
+        const SNMEA2000ProductInfo * pinfo,
+        const SNMEA2000ConfigInfo * cinfo,
+        const unsigned long *tx,
+        const uint8_t txLen,
+        const unsigned long *rx,
+        const uint8_t rxLen,
+        SNMEA2000Transport * transport,
+        const SNMEA2000BatteryConfig * config,
+        uint16_t sampleRate, // Hz
+        uint32_t microampsPerCount, // shunt calibration, charging is positive
+        int16_t zeroOffset = 0 // ADC count at 0A
+        );
+    void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override {};
+    bool onRequest(unsigned long requestedPGN, MessageHeader *messageHeader) override;
+    /**
+     * @brief add a shunt ADC sample, safe to call from an interrupt.
+     */
+    void sample(int16_t current) {
+        int16_t c = current - zeroOffset;
+        if ( c < 0 ) {
+            pendingDischarge += c;
+        } else {
+            pendingCharge += c;
+        }
+        pendingSamples++;
+    };
+    /**
+     * @brief fold the samples into the charge counter, at least every 30s at 1kHz so the 32 bit totals
+     * dont overflow.
+     */
+    void update();
+    void setFull();
+    void setEmpty();
+    void setStateOfCharge(uint8_t percent);
+    /**
+     * @brief voltage in 0.01V and temperature in 0.01K for 127508, eg from a SNMEA2000Calibration.
+     */
+    void setVoltage(int16_t voltage) { this->voltage = voltage; };
+    void setTemperature(uint16_t temperature) { this->temperature = temperature; };
+    uint8_t getStateOfCharge();
+    uint8_t getStateOfHealth();
+    /**
+     * @brief s at the average discharge current, 0xffffffff when not discharging.
+     */
+    uint32_t getTimeRemaining();
+    /**
+     * @brief average current in uA between the last 2 updates, charging positive.
+     */
+    int32_t getCurrent() { return current; };
+    /**
+     * @brief remaining charge in uAs.
+     */
+    int64_t getRemainingCharge() { return toMicroampSeconds(usableCapacity + charge); };
+    unsigned long getSamples() { return samples; };
+    /**
+     * @brief PGN 127506, fast packet.
+     */
+    void sendDCDetailedStatus(byte sid);
+    /**
+     * @brief PGN 127508.
+     */
+    void sendBatteryStatus(byte sid);
+    /**
+     * @brief PGN 127513, from the PROGMEM config, a fast packet.
+     */
+    void sendBatteryConfiguration();
+    void dumpBatteryStatus();
+    private:
+      int64_t toMicroampSeconds(int64_t countSamples) {
+          return (countSamples / sampleRate) * microampsPerCount + ((countSamples % sampleRate) * microampsPerCount) / sampleRate;
+      };
+      const SNMEA2000BatteryConfig * config;
+      int64_t charge = 0; // count samples relative to full, <= 0
+      int64_t ratedCapacity; // count samples
+      int64_t usableCapacity; // count samples
+      uint32_t microampsPerCount;
+      volatile int32_t pendingCharge = 0;
+      volatile int32_t pendingDischarge = 0;
+      volatile uint16_t pendingSamples = 0;
+      unsigned long samples = 0;
+      int32_t current = 0; // uA
+      int32_t averageDischarge = 0; // uA, smoothed over updates
+      int16_t voltage = SNMEA2000::n2kInt16NA;
+      uint16_t temperature = SNMEA2000::n2kUInt16NA;
+      uint16_t sampleRate;
+      int16_t zeroOffset;
+      uint8_t chargeEfficiency;
+};
+
+#endif
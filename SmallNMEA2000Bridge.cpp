@@ -0,0 +1,146 @@
+#include "SmallNMEA2000Bridge.h"
+
+
+bool SNMEA2000Bridge::open() {
+    if ( !portA->open() ) {
+        console->println(F("Bridge: port A failed"));
+        return false;
+    }
+    if ( !portB->open() ) {
+        console->println(F("Bridge: port B failed"));
+        return false;
+    }
+    return true;
+}
+
+void SNMEA2000Bridge::process() {
+    forward(portA, portB, aToB, aToBLen, aToBFastPackets, &aToBCounters);
+    forward(portB, portA, bToA, bToALen, bToAFastPackets, &bToACounters);
+}
+
+void SNMEA2000Bridge::forward(SNMEA2000Transport * from,
+        SNMEA2000Transport * to,
+        SNMEA2000BridgeRule * rules,
+        uint8_t nRules,
+        SNMEA2000BridgeFastPacket * fastPackets,
+        SNMEA2000BridgeCounters * counters) {
+    unsigned long canId;
+    uint8_t len;
+    byte buf[8];
+    int frames = 0;
+    while ( frames < 20 && from->receiveFrame(&canId, &len, buf) ) {
+        frames++;
+        unsigned long pgn = getPgnId(canId);
+        uint8_t source = canId & 0xff;
+        SNMEA2000BridgeRule * rule = NULL;
+        for (uint8_t i = 0; i < nRules; i++) {
+            if ( rules[i].pgn == pgn && 
+                (rules[i].source == SNMEA2000::anySource || rules[i].source == source) ) {
+                rule = &rules[i];
+                break;
+            }
+        }
+        if ( rule == NULL ) {
+            counters->dropped++;
+            continue;
+        }
+        unsigned long now = millis();
+        if ( rule->fastPacket ) {
+            if ( !forwardFastPacket(now, pgn, source, buf, len, rule, fastPackets, counters) ) {
+                continue;
+            }
+        } else if ( rule->minInterval > 0 ) {
+            if ( rule->lastForwarded != 0 && now - rule->lastForwarded < rule->minInterval ) {
+                counters->decimated++;
+                continue;
+            }
+            rule->lastForwarded = now;
+        }
+        if ( to->sendFrame(canId, len, buf) ) {
+            counters->forwarded++;
+        } else {
+            counters->errors++;
+        }
+    }
+}
+
+/**
+ * The decision to forward is made on the first frame, following frames with the same 
+ * PGN, source and sequence are forwarded until the packet is complete.
+ */
+bool SNMEA2000Bridge::forwardFastPacket(unsigned long now,
+        unsigned long pgn,
+        uint8_t source,
+        byte * buf,
+        uint8_t len,
+        SNMEA2000BridgeRule * rule,
+        SNMEA2000BridgeFastPacket * fastPackets,
+        SNMEA2000BridgeCounters * counters) {
+    if ( len < 1 ) {
+        counters->dropped++;
+        return false;
+    }
+    uint8_t frame = buf[0] & 0x1f;
+    uint8_t sequence = (buf[0] >> 5) & 0x07;
+    if ( frame != 0 ) {
+        for (uint8_t i = 0; i < SNMEA2000_BRIDGE_FAST_PACKETS; i++) {
+            SNMEA2000BridgeFastPacket * fp = &fastPackets[i];
+            if ( fp->framesRemaining > 0 && fp->pgn == pgn && fp->source == source && fp->sequence == sequence ) {
+                fp->framesRemaining--;
+                return true;
+            }
+        }
+        // part of a decimated packet, or the first frame was missed.
+        counters->decimated++;
+        return false;
+    }
+    if ( len < 2 ) {
+        counters->dropped++;
+        return false;
+    }
+    if ( rule->minInterval > 0 && rule->lastForwarded != 0 && now - rule->lastForwarded < rule->minInterval ) {
+        counters->decimated++;
+        return false;
+    }
+    // the first frame carries 6 bytes, following frames 7, ceil((length-6)/7) == length/7
+    uint8_t following = buf[1]/7;
+    if ( following > 0 ) {
+        // free slot, or one abandoned for longer than the fast packet timeout.
+        SNMEA2000BridgeFastPacket * slot = NULL;
+        for (uint8_t i = 0; i < SNMEA2000_BRIDGE_FAST_PACKETS; i++) {
+            SNMEA2000BridgeFastPacket * fp = &fastPackets[i];
+            if ( fp->framesRemaining == 0 || now - fp->started > 750 ) {
+                slot = fp;
+                break;
+            }
+        }
+        if ( slot == NULL ) {
+            counters->dropped++;
+            return false;
+        }
+        slot->pgn = pgn;
+        slot->source = source;
+        slot->sequence = sequence;
+        slot->started = now;
+        slot->framesRemaining = following;
+    }
+    rule->lastForwarded = now;
+    return true;
+}
+
+void SNMEA2000Bridge::dumpCounters(const char * direction, SNMEA2000BridgeCounters * counters) {
+    console->print(direction);
+    console->print(F(" forwarded="));
+    console->print(counters->forwarded);
+    console->print(F(" decimated="));
+    console->print(counters->decimated);
+    console->print(F(" dropped="));
+    console->print(counters->dropped);
+    console->print(F(" errors="));
+    console->println(counters->errors);
+}
+
+void SNMEA2000Bridge::dumpStatus() {
+    dumpCounters("Bridge A>B", &aToBCounters);
+    dumpCounters("Bridge B>A", &bToACounters);
+}
@@ -0,0 +1,107 @@
+#ifndef SmallNMEA2000Bridge_H
+#define SmallNMEA2000Bridge_H
+
+#include "SmallNMEA2000.h"
+
+/**
+ * Allow list entry for one direction of a SNMEA2000Bridge. Must be in RAM.
+ * Only the first 4 fields need to be set, eg
+ *
+ * SNMEA2000BridgeRule engineToNav[] = {
+ *    { 127488L, SNMEA2000::anySource, 0, false },     // every rapid engine message
+ *    { 129025L, SNMEA2000::anySource, 1000, false },  // position at 1Hz
+ *    { 129029L, 35, 5000, true }                      // GNSS position from 35, fast packet, every 5s
+ * };
+ */
+typedef struct SNMEA2000BridgeRule {
+    unsigned long pgn;
+    uint8_t source; // source address or SNMEA2000::anySource
+    uint16_t minInterval; // ms between forwarded messages, 0 to forward every message
+    bool fastPacket; // forwarded as whole fast packets
+    unsigned long lastForwarded; // maintained by the bridge
+} SNMEA2000BridgeRule;
+
+/**
+ * A fast packet being forwarded, all frames after the first follow the decision made
+ * on the first frame.
+ */
+typedef struct SNMEA2000BridgeFastPacket {
+    unsigned long pgn;
+    unsigned long started;
+    uint8_t source;
+    uint8_t sequence;
+    uint8_t framesRemaining; // 0 when free
+} SNMEA2000BridgeFastPacket;
+
+typedef struct SNMEA2000BridgeCounters {
+    unsigned long forwarded; // frames
+    unsigned long decimated; // frames held back by minInterval
+    unsigned long dropped; // frames not in the allow list, or with no fast packet slot
+    unsigned long errors; // frames that could not be sent
+} SNMEA2000BridgeCounters;
+
+#define SNMEA2000_BRIDGE_FAST_PACKETS 4
+
+/**
+ * Forwards allowed PGNs between 2 CAN transports, eg 2 MCP2515s or 2 SocketCAN 
+ * interfaces. The bridge has no address of its own and does not reassemble 
+ * fast packets, all frames of a fast packet are forwarded or none are. 
+ * Up to SNMEA2000_BRIDGE_FAST_PACKETS fast packets can be in flight in each direction.
+ * Call process() from the main loop.
+ */
+class SNMEA2000Bridge {
+    public:
+        SNMEA2000Bridge(SNMEA2000Transport * portA,
+            SNMEA2000Transport * portB,
+            SNMEA2000BridgeRule * aToB,
+            uint8_t aToBLen,
+            SNMEA2000BridgeRule * bToA,
+            uint8_t bToALen,
+            Print * console = &Serial) :
+            portA{portA},
+            portB{portB},
+            aToB{aToB},
+            bToA{bToA},
+            aToBLen{aToBLen},
+            bToALen{bToALen},
+            console{console} {
+        };
+        bool open();
+        /**
+         * @brief forward up to 20 frames in each direction.
+         */
+        void process();
+        void dumpStatus();
+        SNMEA2000BridgeCounters * getAToBCounters() { return &aToBCounters; };
+        SNMEA2000BridgeCounters * getBToACounters() { return &bToACounters; };
+
+    private:
+        void forward(SNMEA2000Transport * from,
+            SNMEA2000Transport * to,
+            SNMEA2000BridgeRule * rules,
+            uint8_t nRules,
+            SNMEA2000BridgeFastPacket * fastPackets,
+            SNMEA2000BridgeCounters * counters);
+        bool forwardFastPacket(unsigned long now,
+            unsigned long pgn,
+            uint8_t source,
+            byte * buf,
+            uint8_t len,
+            SNMEA2000BridgeRule * rule,
+            SNMEA2000BridgeFastPacket * fastPackets,
+            SNMEA2000BridgeCounters * counters);
+        void dumpCounters(const char * direction, SNMEA2000BridgeCounters * counters);
+        SNMEA2000Transport * portA;
+        SNMEA2000Transport * portB;
+        SNMEA2000BridgeRule * aToB;
+        SNMEA2000BridgeRule * bToA;
+        uint8_t aToBLen;
+        uint8_t bToALen;
+        SNMEA2000BridgeFastPacket aToBFastPackets[SNMEA2000_BRIDGE_FAST_PACKETS] = {};
+        SNMEA2000BridgeFastPacket bToAFastPackets[SNMEA2000_BRIDGE_FAST_PACKETS] = {};
+        SNMEA2000BridgeCounters aToBCounters = {};
+        SNMEA2000BridgeCounters bToACounters = {};
+        Print * console;
+};
+
+#endif
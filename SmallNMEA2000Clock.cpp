@@ -0,0 +1,130 @@
+#include "SmallNMEA2000Clock.h"
+
+#define SYSTEM_TIME_PGN 126992L
+#define TIME_SOURCE_LOCAL_CRYSTAL 5
+
+void SNMEA2000Clock::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( messageHeader->pgn != SYSTEM_TIME_PGN || len < 8 ) {
+        return;
+    }
+    if ( (buffer[1] & 0x0f) == TIME_SOURCE_LOCAL_CRYSTAL ) {
+        return;
+    }
+    uint16_t days = ((uint16_t)buffer[3] << 8) | buffer[2];
+    uint32_t time = ((uint32_t)buffer[7] << 24) | ((uint32_t)buffer[6] << 16) | ((uint32_t)buffer[5] << 8) | buffer[4];
+    if ( days >= 0xfffe || time >= 0xfffffffe ) {
+        return;
+    }
+    int64_t busTime = (int64_t)days*86400000000LL + (int64_t)time*100;
+    update((device != NULL)?device->getRxTimestamp():micros(), busTime, messageHeader->source);
+}
+
+void SNMEA2000Clock::update(unsigned long localMicros, int64_t busTime, uint8_t address) {
+    if ( source != SNMEA2000::anySource && address != source ) {
+        return;
+    }
+    if ( synchronised && address != lockedSource ) {
+        return;
+    }
+    lastUpdate = millis();
+    updates++;
+    if ( !synchronised ) {
+        // first update or after a timeout, the drift is kept.
+        referenceBusTime = busTime;
+        referenceLocal = localMicros;
+        lockedSource = address;
+        lastError = 0;
+        synchronised = true;
+        return;
+    }
+    int64_t dt = (long)(localMicros - referenceLocal);
+    int64_t predicted = referenceBusTime + dt + ((dt*drift) >> 32);
+    int64_t error = busTime - predicted;
+    lastError = (long)error;
+    if ( error > SNMEA2000_CLOCK_STEP || error < -SNMEA2000_CLOCK_STEP || dt <= 0 ) {
+        referenceBusTime = busTime;
+        referenceLocal = localMicros;
+        steps++;
+        return;
+    }
+    // drift += error/dt/64 scaled by 2^32
+    drift += (error * 67108864LL) / dt;
+    const int64_t maxDrift = ((int64_t)SNMEA2000_CLOCK_MAX_DRIFT << 32) / 1000000;
+    if ( drift > maxDrift ) {
+        drift = maxDrift;
+    } else if ( drift < -maxDrift ) {
+        drift = -maxDrift;
+    }
+    referenceBusTime = predicted + error/4;
+    referenceLocal = localMicros;
+}
+
+void SNMEA2000Clock::process() {
+    if ( synchronised && (millis() - lastUpdate) > SNMEA2000_CLOCK_TIMEOUT ) {
+        synchronised = false;
+        lockedSource = SNMEA2000::anySource;
+    }
+}
+
+int64_t SNMEA2000Clock::toBusTime(unsigned long localMicros) {
+    if ( updates == 0 ) {
+        return 0;
+    }
+    int64_t dt = (long)(localMicros - referenceLocal);
+    return referenceBusTime + dt + ((dt*drift) >> 32);
+}
+
+void SNMEA2000Clock::dumpStatus(Print * console) {
+    console->print(F("Clock synchronised="));
+    console->print(synchronised);
+    console->print(F(" source="));
+    console->print(lockedSource);
+    console->print(F(" updates="));
+    console->print(updates);
+    console->print(F(" steps="));
+    console->print(steps);
+    console->print(F(" error us="));
+    console->print(lastError);
+    console->print(F(" drift ppb="));
+    console->println(getDrift());
+}
+
+void SNMEA2000LatencyHistogram::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( device != NULL ) {
+        record(micros() - device->getRxTimestamp());
+    }
+}
+
+void SNMEA2000LatencyHistogram::record(unsigned long latency) {
+    uint8_t bucket = 0;
+    while ( bucket < SNMEA2000_LATENCY_BUCKETS-1 && latency >= getBucketLimit(bucket) ) {
+        bucket++;
+    }
+    counts[bucket]++;
+    if ( latency > max ) {
+        max = latency;
+    }
+}
+
+void SNMEA2000LatencyHistogram::reset() {
+    for (uint8_t i = 0; i < SNMEA2000_LATENCY_BUCKETS; i++) {
+        counts[i] = 0;
+    }
+    max = 0;
+}
+
+void SNMEA2000LatencyHistogram::dumpStatus(Print * console) {
+    console->print(F("Latency us"));
+    for (uint8_t i = 0; i < SNMEA2000_LATENCY_BUCKETS; i++) {
+        console->print(F(" <"));
+        if ( i < SNMEA2000_LATENCY_BUCKETS-1 ) {
+            console->print(getBucketLimit(i));
+        } else {
+            console->print(F("inf"));
+        }
+        console->print(F(":"));
+        console->print(counts[i]);
+    }
+    console->print(F(" max="));
+    console->println(max);
+}
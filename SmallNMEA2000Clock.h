@@ -0,0 +1,109 @@
+#ifndef SmallNMEA2000Clock_H
+#define SmallNMEA2000Clock_H
+
+#include "SmallNMEA2000.h"
+
+// ms without a 126992 before the clock is no longer synchronised
+#define SNMEA2000_CLOCK_TIMEOUT 10000
+// errors larger than this, in us, step the clock rather than slewing it
+#define SNMEA2000_CLOCK_STEP 100000
+// largest drift the loop will correct, ppm
+#define SNMEA2000_CLOCK_MAX_DRIFT 500
+
+#define SNMEA2000_LATENCY_BUCKETS 12
+
+/**
+ * Bus time from PGN 126992 System Time, eg from a GNSS.
+ *
+ * Each 126992 is paired with the capture timestamp of its frame, see
+ * SNMEA2000Transport::getRxTimestamp(), and steers a model of bus time as an offset and
+ * drift of the local micros() clock. The offset is corrected by 1/4 of the error at each
+ * update and the drift by 1/64 of the error rate, so with a 1Hz source the clock settles
+ * within a minute and a late 126992 moves it by 1/4 of the lateness. Errors over
+ * SNMEA2000_CLOCK_STEP step the clock. The clock locks to the first source address it
+ * hears, ignoring others, until SNMEA2000_CLOCK_TIMEOUT ms pass without an update.
+ * 126992 with time source 5, local crystal, is ignored.
+ *
+ * Register with addListener(), 126992 must be in the rx list. Bus time is in us since
+ * 1970-01-01 UTC, and can stamp received values with toBusTime(cache.capturedAt(slot)) or
+ * outgoing messages with toN2kDate(now()) and toN2kTime(now()). The model is int64 and
+ * shift arithmetic so that toBusTime() is cheap on an 8 bit CPU.
+ */
+class SNMEA2000Clock : public SNMEA2000Listener {
+    public:
+        SNMEA2000Clock(uint8_t source = SNMEA2000::anySource) :
+            source{source} {
+        };
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        void process() override;
+        /**
+         * @brief update the model with a bus time in us since 1970 observed at localMicros, eg
+         * from another time source. 126992 calls this.
+         */
+        void update(unsigned long localMicros, int64_t busTime, uint8_t address);
+        bool isSynchronised() { return synchronised; };
+        bool hasTime() { return updates > 0; };
+        /**
+         * @brief bus time in us since 1970 at localMicros, within 35 minutes of the last update,
+         * 0 if there has never been an update.
+         */
+        int64_t toBusTime(unsigned long localMicros);
+        int64_t now() { return toBusTime(micros()); };
+        /**
+         * @brief days since 1970, as in 126992 and 129029.
+         */
+        static uint16_t toN2kDate(int64_t busTime) { return (uint16_t)(busTime / 86400000000LL); };
+        /**
+         * @brief 0.0001s since midnight, as in 126992 and 129029.
+         */
+        static uint32_t toN2kTime(int64_t busTime) { return (uint32_t)((busTime % 86400000000LL) / 100); };
+        /**
+         * @brief local clock drift in ppb, positive if the local clock is slow.
+         */
+        long getDrift() { return (long)((drift*1000000000LL) >> 32); };
+        /**
+         * @brief the last difference between 126992 and the model in us.
+         */
+        long getLastError() { return lastError; };
+        unsigned long getUpdates() { return updates; };
+        unsigned long getSteps() { return steps; };
+        uint8_t getTimeSource() { return lockedSource; };
+        void dumpStatus(Print * console);
+    private:
+        int64_t referenceBusTime = 0;
+        int64_t drift = 0; // fraction of local time to add, scaled by 2^32
+        unsigned long referenceLocal = 0;
+        unsigned long lastUpdate = 0; // millis()
+        unsigned long updates = 0;
+        unsigned long steps = 0;
+        long lastError = 0;
+        uint8_t source;
+        uint8_t lockedSource = SNMEA2000::anySource;
+        bool synchronised = false;
+};
+
+/**
+ * Histogram of the time from a frame being captured by the transport to a listener,
+ * in power of 2 buckets from < 64us to >= 65ms. Listeners are called in the reverse of
+ * the order they were added, add the histogram last to measure latency to the first
+ * listener, or call record() from a message handler with device.getRxTimestamp().
+ */
+class SNMEA2000LatencyHistogram : public SNMEA2000Listener {
+    public:
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        void record(unsigned long latency);
+        /**
+         * @brief frames in bucket, with latency below getBucketLimit(bucket) and at or above
+         * the limit of the previous bucket, the last bucket has no limit.
+         */
+        unsigned long getCount(uint8_t bucket) { return (bucket < SNMEA2000_LATENCY_BUCKETS)?counts[bucket]:0; };
+        static unsigned long getBucketLimit(uint8_t bucket) { return 64UL << bucket; };
+        unsigned long getMax() { return max; };
+        void reset();
+        void dumpStatus(Print * console);
+    private:
+        unsigned long counts[SNMEA2000_LATENCY_BUCKETS] = {};
+        unsigned long max = 0;
+};
+
+#endif
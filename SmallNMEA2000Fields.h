@@ -0,0 +1,164 @@
+#ifndef SmallNMEA2000Fields_H
+#define SmallNMEA2000Fields_H
+
+#include "SmallNMEA2000.h"
+
+#define SNMEA2000_FIELD_SIGNED 0x01
+
+/**
+ * A field in a payload, bit offsets count from bit 0 of byte 0 and fields are little endian.
+ * value = raw*resolution + offset. Tables are generated into PROGMEM by generator/n2kgen.py.
+ */
+typedef struct SNMEA2000FieldDef {
+    uint16_t bitOffset;
+    uint8_t bitLength; // max 32
+    uint8_t flags;
+    float resolution;
+    float offset;
+} SNMEA2000FieldDef;
+
+typedef struct SNMEA2000PGNDef {
+    unsigned long pgn;
+    uint8_t length;
+    uint8_t fastPacket;
+    uint8_t nFields;
+    const SNMEA2000FieldDef * fields;
+} SNMEA2000PGNDef;
+
+/**
+ * Payload encoding used by generated PGN encoders. Scaled values clamp to the largest valid raw
+ * value when out of range, SNMEA2000::n2kDoubleNA encodes as not available, all bits 1 or the
+ * largest positive value when signed. Everything is inline so that only what a build uses is linked.
+ */
+class SNMEA2000Fields {
+    public:
+        static uint32_t maxRaw(uint8_t bitLength, bool isSigned) {
+            if ( isSigned ) {
+                return (bitLength >= 32)?0x7fffffffUL:((1UL << (bitLength-1)) - 1);
+            }
+            return (bitLength >= 32)?0xffffffffUL:((1UL << bitLength) - 1);
+        };
+        /**
+         * @brief raw unsigned value, scale is 1/resolution so that the divide is done at compile time.
+         */
+        static uint32_t encodeUnsigned(double value, double scale, double offset, uint8_t bitLength) {
+            uint32_t na = maxRaw(bitLength, false);
+            if ( value == SNMEA2000::n2kDoubleNA ) {
+                return na;
+            }
+            double vd = round((value - offset)*scale);
+            return (vd >= 0 && vd < (double)(na - 1))?(uint32_t)vd:(na - 1);
+        };
+        static uint32_t encodeSigned(double value, double scale, double offset, uint8_t bitLength) {
+            int32_t na = (int32_t)maxRaw(bitLength, true);
+            if ( value == SNMEA2000::n2kDoubleNA ) {
+                return (uint32_t)na;
+            }
+            double vd = round((value - offset)*scale);
+            int32_t i = (vd >= -(double)na - 1 && vd < (double)(na - 1))?(int32_t)vd:(na - 1);
+            return (uint32_t)i;
+        };
+        static void put1(byte *p, uint32_t v) {
+            p[0] = v;
+        };
+        static void put2(byte *p, uint32_t v) {
+            p[0] = v;
+            p[1] = v >> 8;
+        };
+        static void put3(byte *p, uint32_t v) {
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+        };
+        static void put4(byte *p, uint32_t v) {
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+            p[3] = v >> 24;
+        };
+        /**
+         * @brief fixed length string padded with 0xff.
+         */
+        static void putString(byte *p, const char *s, uint8_t length) {
+            uint8_t i = 0;
+            for (; i < length && s != NULL && s[i] != '\0'; i++) {
+                p[i] = s[i];
+            }
+            for (; i < length; i++) {
+                p[i] = 0xff;
+            }
+        };
+        static void setBits(byte *payload, uint16_t bitOffset, uint8_t bitLength, uint32_t value) {
+            while ( bitLength > 0 ) {
+                uint8_t shift = bitOffset & 0x07;
+                uint8_t n = 8 - shift;
+                if ( n > bitLength ) {
+                    n = bitLength;
+                }
+                byte mask = ((1 << n) - 1) << shift;
+                byte *p = &payload[bitOffset >> 3];
+                *p = (*p & ~mask) | ((value << shift) & mask);
+                value >>= n;
+                bitOffset += n;
+                bitLength -= n;
+            }
+        };
+        static uint32_t getBits(const byte *payload, uint16_t bitOffset, uint8_t bitLength) {
+            uint32_t value = 0;
+            uint8_t got = 0;
+            while ( got < bitLength ) {
+                uint8_t shift = bitOffset & 0x07;
+                uint8_t n = 8 - shift;
+                if ( n > bitLength - got ) {
+                    n = bitLength - got;
+                }
+                uint32_t bits = (payload[bitOffset >> 3] >> shift) & ((1 << n) - 1);
+                value |= bits << got;
+                got += n;
+                bitOffset += n;
+            }
+            return value;
+        };
+        /**
+         * @brief encode a field from a PROGMEM table.
+         */
+        static void encode(const SNMEA2000FieldDef *def, byte *payload, double value) {
+            uint16_t bitOffset = pgm_read_word(&def->bitOffset);
+            uint8_t bitLength = pgm_read_byte(&def->bitLength);
+            bool isSigned = (pgm_read_byte(&def->flags) & SNMEA2000_FIELD_SIGNED) != 0;
+            float resolution;
+            float offset;
+            memcpy_P(&resolution, &def->resolution, sizeof(float));
+            memcpy_P(&offset, &def->offset, sizeof(float));
+            uint32_t raw = isSigned?encodeSigned(value, 1.0/resolution, offset, bitLength)
+                :encodeUnsigned(value, 1.0/resolution, offset, bitLength);
+            setBits(payload, bitOffset, bitLength, raw);
+        };
+        /**
+         * @brief decode a field from a PROGMEM table, SNMEA2000::n2kDoubleNA if not available or
+         * beyond length.
+         */
+        static double decode(const SNMEA2000FieldDef *def, const byte *payload, uint8_t length) {
+            uint16_t bitOffset = pgm_read_word(&def->bitOffset);
+            uint8_t bitLength = pgm_read_byte(&def->bitLength);
+            bool isSigned = (pgm_read_byte(&def->flags) & SNMEA2000_FIELD_SIGNED) != 0;
+            if ( bitOffset + bitLength > length*8 ) {
+                return SNMEA2000::n2kDoubleNA;
+            }
+            float resolution;
+            float offset;
+            memcpy_P(&resolution, &def->resolution, sizeof(float));
+            memcpy_P(&offset, &def->offset, sizeof(float));
+            uint32_t raw = getBits(payload, bitOffset, bitLength);
+            uint32_t na = maxRaw(bitLength, isSigned);
+            if ( bitLength > 1 && raw >= na - 1 && (!isSigned || raw <= na) ) {
+                return SNMEA2000::n2kDoubleNA;
+            }
+            if ( isSigned && bitLength < 32 && (raw & (1UL << (bitLength-1))) != 0 ) {
+                return ((int32_t)(raw | ~((1UL << bitLength) - 1)))*(double)resolution + offset;
+            }
+            return (isSigned?(double)(int32_t)raw:(double)raw)*resolution + offset;
+        };
+};
+
+#endif
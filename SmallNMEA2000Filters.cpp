@@ -0,0 +1,67 @@
+#include "SmallNMEA2000Filters.h"
+
+void SNMEA2000MovingAverage::add(int16_t sample) {
+    if ( count < size ) {
+        count++;
+    } else {
+        sum -= window[next];
+    }
+    window[next] = sample;
+    sum += sample;
+    next++;
+    if ( next == size ) {
+        next = 0;
+    }
+}
+
+int16_t SNMEA2000MovingAverage::get() {
+    if ( count == 0 ) {
+        return 0;
+    }
+    int32_t half = count >> 1;
+    return (int16_t)((sum < 0)?(sum - half)/count:(sum + half)/count);
+}
+
+void SNMEA2000LowPass::add(int16_t sample) {
+    int32_t x = (int32_t)sample << SNMEA2000_LOWPASS_FRACTION_BITS;
+    if ( !started ) {
+        state = x;
+        started = true;
+    } else {
+        state += (x - state + ((1L << shift) >> 1)) >> shift;
+    }
+}
+
+int16_t SNMEA2000MedianFilter::add(int16_t sample) {
+    window[next] = sample;
+    next++;
+    if ( next == size ) {
+        next = 0;
+    }
+    if ( count < size ) {
+        count++;
+    }
+    if ( count == 3 ) {
+        // the common despiking case without a copy.
+        int16_t a = window[0], b = window[1], c = window[2];
+        if ( a > b ) {
+            int16_t t = a; a = b; b = t;
+        }
+        if ( b > c ) {
+            b = c;
+        }
+        return (a > b)?a:b;
+    }
+    // insertion sort a copy, at most SNMEA2000_MEDIAN_MAX samples.
+    int16_t sorted[SNMEA2000_MEDIAN_MAX];
+    for (uint8_t i = 0; i < count; i++) {
+        int16_t v = window[i];
+        uint8_t j = i;
+        while ( j > 0 && sorted[j-1] > v ) {
+            sorted[j] = sorted[j-1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    return sorted[count >> 1];
+}
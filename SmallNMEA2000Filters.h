@@ -0,0 +1,121 @@
+#ifndef SmallNMEA2000Filters_H
+#define SmallNMEA2000Filters_H
+
+#include "SmallNMEA2000.h"
+
+/**
+ * Integer sensor conditioning, so that ADC readings can be filtered, calibrated and sent in
+ * N2K units without floating point, eg
+ *
+ *   // 10mV per count, 0.01V N2K units
+ *   const SNMEA2000Calibration voltageCalibration(1.0, 0.0);
+ *   // 10mV/C sensor with a 500mV offset, 4.88mV per count, 0.01K N2K units
+ *   const SNMEA2000Calibration temperatureCalibration(48.8, CToKelvin(-50.0)*100);
+ *
+ *   voltageAverage.add(analogRead(A0));
+ *   engineMonitor.sendDCBatterStatusMessageFixed(0, sid,
+ *       voltageCalibration.apply(voltageAverage.get()), ...);
+ *
+ * Calibration constants are converted to Q format when the constructor runs, at compile time
+ * for const globals, so the conversion including CToKelvin is not done on the device.
+ */
+
+/**
+ * x in Q format with bits fraction bits, rounded.
+ */
+#define SNMEA2000_Q(x, bits) ((int32_t)((x)*(1L<<(bits)) + (((x) < 0)?-0.5:0.5)))
+
+#define SNMEA2000_MEDIAN_MAX 9
+#define SNMEA2000_LOWPASS_FRACTION_BITS 8
+
+/**
+ * Linear calibration, output = raw*gain + offset, rounded to the nearest output unit. Gain and
+ * offset are in output units, eg 0.01V per ADC count. raw*gain*2^fractionBits must fit in 31 bits,
+ * with the default 12 bits gains up to 16 for 15 bit raw values.
+ */
+class SNMEA2000Calibration {
+    public:
+        constexpr SNMEA2000Calibration(double gain, double offset, uint8_t fractionBits = 12) :
+            gain{SNMEA2000_Q(gain, fractionBits)},
+            offset{SNMEA2000_Q(offset, fractionBits) + ((int32_t)1 << (fractionBits-1))},
+            fractionBits{fractionBits} {
+        };
+        int32_t apply(int32_t raw) const { return (raw*gain + offset) >> fractionBits; };
+    private:
+        const int32_t gain;
+        const int32_t offset;
+        const uint8_t fractionBits;
+};
+
+/**
+ * Moving average over the last size samples, held in window which must remain in RAM.
+ * The sum keeps the extra resolution of the average, calibrate with gain/size to use it.
+ */
+class SNMEA2000MovingAverage {
+    public:
+        SNMEA2000MovingAverage(int16_t *window, uint8_t size) :
+            window{window},
+            size{size} {
+        };
+        /**
+         * @brief add a sample, without the division get() needs.
+         */
+        void add(int16_t sample);
+        /**
+         * @brief the rounded average of the samples added, 0 before the first.
+         */
+        int16_t get();
+        int32_t getSum() { return sum; };
+        uint8_t getCount() { return count; };
+        void reset() { sum = 0; count = 0; next = 0; };
+    private:
+        int16_t *window;
+        int32_t sum = 0;
+        uint8_t size;
+        uint8_t count = 0;
+        uint8_t next = 0;
+};
+
+/**
+ * First order low pass, y += (x - y)/2^shift, with SNMEA2000_LOWPASS_FRACTION_BITS kept between
+ * samples so small steps are not lost. The time constant is about 2^shift samples. The first
+ * sample sets the output.
+ */
+class SNMEA2000LowPass {
+    public:
+        SNMEA2000LowPass(uint8_t shift) :
+            shift{shift} {
+        };
+        void add(int16_t sample);
+        int16_t get() { return (int16_t)((state + (1L << SNMEA2000_LOWPASS_FRACTION_BITS >> 1)) >> SNMEA2000_LOWPASS_FRACTION_BITS); };
+        /**
+         * @brief the output with SNMEA2000_LOWPASS_FRACTION_BITS, calibrate with gain/256 to use them.
+         */
+        int32_t getState() { return state; };
+        void reset() { started = false; };
+    private:
+        int32_t state = 0;
+        uint8_t shift;
+        bool started = false;
+};
+
+/**
+ * Median of the last size samples, size at most SNMEA2000_MEDIAN_MAX, held in window which must
+ * remain in RAM. Removes single sample spikes with a size of 3, or up to (size-1)/2 in a window.
+ */
+class SNMEA2000MedianFilter {
+    public:
+        SNMEA2000MedianFilter(int16_t *window, uint8_t size) :
+            window{window},
+            size{(size > SNMEA2000_MEDIAN_MAX)?(uint8_t)SNMEA2000_MEDIAN_MAX:size} {
+        };
+        int16_t add(int16_t sample);
+        void reset() { count = 0; next = 0; };
+    private:
+        int16_t *window;
+        uint8_t size;
+        uint8_t count = 0;
+        uint8_t next = 0;
+};
+
+#endif
@@ -0,0 +1,330 @@
+#include "SmallNMEA2000Gateway.h"
+
+// ring record flags, a record is [flags][body length][body].
+#define RECORD_PENDING 0x01 // fast packet still being assembled
+#define RECORD_DROPPED 0x02 // abandoned, skipped when written
+#define RECORD_WRAP 0x04 // the rest of the ring is unused, the next record is at 0
+
+#define ACTISENSE_DLE 0x10
+#define ACTISENSE_STX 0x02
+#define ACTISENSE_ETX 0x03
+#define ACTISENSE_N2K_RECEIVED 0x93
+// command, length, priority, pgn, destination, source, timestamp, data length, checksum
+#define ACTISENSE_OVERHEAD 14
+#define ACTISENSE_DATA 13
+
+static const char hexDigits[] PROGMEM = "0123456789ABCDEF";
+
+bool SNMEA2000Gateway::begin() {
+    head = 0;
+    tail = 0;
+    used = 0;
+    written = 0;
+    for (uint8_t i = 0; i < SNMEA2000_GATEWAY_FAST_PACKETS; i++) {
+        fastPackets[i].active = false;
+    }
+    lastSecond = millis();
+    lastBytes = counters.bytes;
+    // records are never split, so the ring must hold the largest record in the format.
+    if ( format == SNMEA2000_GATEWAY_ACTISENSE ) {
+        return ringSize >= 2+ACTISENSE_OVERHEAD+223;
+    }
+    return ringSize >= 2+25+3*8;
+}
+
+bool SNMEA2000Gateway::isFastPacket(unsigned long pgn) {
+    for (uint8_t i = 0; i < fastPacketPGNsLen; i++) {
+        if ( fastPacketPGNs[i] == pgn ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SNMEA2000Gateway::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( len < 1 || len > 8 ) {
+        return;
+    }
+    if ( format == SNMEA2000_GATEWAY_YDRAW ) {
+        encodeYDRaw(messageHeader, buffer, len);
+    } else if ( isFastPacket(messageHeader->pgn) ) {
+        fastPacketFrame(messageHeader, buffer, len);
+    } else {
+        byte * body = reserve(ACTISENSE_OVERHEAD+len, 0);
+        if ( body == NULL ) {
+            counters.overflows++;
+            return;
+        }
+        memcpy(actisenseHeader(body, messageHeader, len), buffer, len);
+        finishRecord(body - 2 - ring);
+        counters.messages++;
+    }
+}
+
+void SNMEA2000Gateway::fastPacketFrame(MessageHeader *messageHeader, byte * buffer, uint8_t len) {
+    SNMEA2000GatewayFastPacket *fastPacket = NULL;
+    SNMEA2000GatewayFastPacket *unused = NULL;
+    for (uint8_t i = 0; i < SNMEA2000_GATEWAY_FAST_PACKETS; i++) {
+        if ( !fastPackets[i].active ) {
+            unused = &fastPackets[i];
+        } else if ( fastPackets[i].canId == messageHeader->id ) {
+            fastPacket = &fastPackets[i];
+        }
+    }
+    if ( (buffer[0] & 0x1f) == 0 ) {
+        if ( fastPacket != NULL ) {
+            // the previous packet from this source never completed.
+            dropRecord(fastPacket->record);
+            counters.fastPacketErrors++;
+        } else if ( unused != NULL ) {
+            fastPacket = unused;
+        } else {
+            counters.fastPacketErrors++;
+            return;
+        }
+        fastPacket->active = false;
+        if ( len < 2 || buffer[1] > 223 ) {
+            counters.fastPacketErrors++;
+            return;
+        }
+        byte * body = reserve(ACTISENSE_OVERHEAD+buffer[1], RECORD_PENDING);
+        if ( body == NULL ) {
+            counters.overflows++;
+            return;
+        }
+        actisenseHeader(body, messageHeader, buffer[1]);
+        fastPacket->canId = messageHeader->id;
+        fastPacket->started = millis();
+        fastPacket->record = body - 2 - ring;
+        fastPacket->state.nextFrame = 0;
+        fastPacket->active = true;
+    } else if ( fastPacket == NULL ) {
+        // the first frame was missed or dropped, already counted.
+        return;
+    }
+    byte * body = &ring[fastPacket->record+2];
+    if ( assembleFastPacket(&fastPacket->state, &body[ACTISENSE_DATA], body[ACTISENSE_DATA-1], buffer, len) > 0 ) {
+        finishRecord(fastPacket->record);
+        fastPacket->active = false;
+        counters.messages++;
+    } else if ( fastPacket->state.nextFrame == 0 ) {
+        dropRecord(fastPacket->record);
+        fastPacket->active = false;
+        counters.fastPacketErrors++;
+    }
+}
+
+uint16_t SNMEA2000Gateway::contiguousFree() {
+    if ( used == 0 ) {
+        head = 0;
+        tail = 0;
+        return ringSize;
+    }
+    if ( head == tail ) {
+        return 0;
+    }
+    if ( head < tail ) {
+        return tail - head;
+    }
+    return ringSize - head;
+}
+
+byte * SNMEA2000Gateway::reserve(uint8_t bodyLength, byte flags) {
+    uint16_t required = bodyLength + 2;
+    uint16_t available = contiguousFree();
+    if ( available < required ) {
+        // records are never split, wrap if the start of the ring has room.
+        if ( head <= tail || tail < required ) {
+            return NULL;
+        }
+        ring[head] = RECORD_WRAP;
+        used += ringSize - head;
+        head = 0;
+    }
+    byte * record = &ring[head];
+    record[0] = flags;
+    record[1] = bodyLength;
+    head += required;
+    if ( head == ringSize ) {
+        head = 0;
+    }
+    used += required;
+    if ( used > counters.peakUsed ) {
+        counters.peakUsed = used;
+    }
+    return &record[2];
+}
+
+byte * SNMEA2000Gateway::actisenseHeader(byte * body, MessageHeader *messageHeader, uint8_t length) {
+    unsigned long now = millis();
+    body[0] = ACTISENSE_N2K_RECEIVED;
+    body[1] = ACTISENSE_DATA - 2 + length;
+    body[2] = messageHeader->priority;
+    body[3] = messageHeader->pgn & 0xff;
+    body[4] = (messageHeader->pgn >> 8) & 0xff;
+    body[5] = (messageHeader->pgn >> 16) & 0xff;
+    body[6] = messageHeader->destination;
+    body[7] = messageHeader->source;
+    body[8] = now & 0xff;
+    body[9] = (now >> 8) & 0xff;
+    body[10] = (now >> 16) & 0xff;
+    body[11] = (now >> 24) & 0xff;
+    body[12] = length;
+    return &body[ACTISENSE_DATA];
+}
+
+void SNMEA2000Gateway::finishRecord(uint16_t record) {
+    uint8_t bodyLength = ring[record+1];
+    byte * body = &ring[record+2];
+    if ( format == SNMEA2000_GATEWAY_ACTISENSE ) {
+        byte sum = 0;
+        for (uint8_t i = 0; i < bodyLength-1; i++) {
+            sum += body[i];
+        }
+        body[bodyLength-1] = (byte)(256 - sum);
+    }
+    ring[record] = 0;
+}
+
+void SNMEA2000Gateway::dropRecord(uint16_t record) {
+    ring[record] = RECORD_DROPPED;
+}
+
+void SNMEA2000Gateway::encodeYDRaw(MessageHeader *messageHeader, byte * buffer, uint8_t len) {
+    // hh:mm:ss.ddd R 09F80105 01 02 03\r\n
+    byte * line = reserve(25+3*len, 0);
+    if ( line == NULL ) {
+        counters.overflows++;
+        return;
+    }
+    unsigned long now = millis();
+    unsigned long seconds = (now / 1000) % 86400;
+    uint16_t ms = now % 1000;
+    uint8_t fields[3] = { (uint8_t)(seconds / 3600), (uint8_t)((seconds / 60) % 60), (uint8_t)(seconds % 60) };
+    byte * p = line;
+    for (uint8_t i = 0; i < 3; i++) {
+        *p++ = '0' + fields[i] / 10;
+        *p++ = '0' + fields[i] % 10;
+        *p++ = (i < 2)?':':'.';
+    }
+    *p++ = '0' + ms / 100;
+    *p++ = '0' + (ms / 10) % 10;
+    *p++ = '0' + ms % 10;
+    *p++ = ' ';
+    *p++ = 'R';
+    *p++ = ' ';
+    for (int8_t shift = 28; shift >= 0; shift -= 4) {
+        *p++ = pgm_read_byte(&hexDigits[(messageHeader->id >> shift) & 0x0f]);
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        *p++ = ' ';
+        *p++ = pgm_read_byte(&hexDigits[buffer[i] >> 4]);
+        *p++ = pgm_read_byte(&hexDigits[buffer[i] & 0x0f]);
+    }
+    *p++ = '\r';
+    *p++ = '\n';
+    counters.messages++;
+}
+
+void SNMEA2000Gateway::process() {
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < SNMEA2000_GATEWAY_FAST_PACKETS; i++) {
+        if ( fastPackets[i].active && (now - fastPackets[i].started) > SNMEA2000_GATEWAY_FAST_PACKET_TIMEOUT ) {
+            dropRecord(fastPackets[i].record);
+            fastPackets[i].active = false;
+            counters.fastPacketErrors++;
+        }
+    }
+    writeRecords();
+    if ( now - lastSecond >= 1000 ) {
+        bytesPerSecond = ((counters.bytes - lastBytes)*1000)/(now - lastSecond);
+        lastBytes = counters.bytes;
+        lastSecond = now;
+    }
+}
+
+void SNMEA2000Gateway::writeRecords() {
+    static const byte start[2] = { ACTISENSE_DLE, ACTISENSE_STX };
+    static const byte end[2] = { ACTISENSE_DLE, ACTISENSE_ETX };
+    static const byte escapedDLE[2] = { ACTISENSE_DLE, ACTISENSE_DLE };
+    int available = output->availableForWrite();
+    while ( used > 0 && available > 0 ) {
+        byte flags = ring[tail];
+        if ( (flags & RECORD_WRAP) != 0 ) {
+            used -= ringSize - tail;
+            tail = 0;
+            continue;
+        }
+        if ( (flags & RECORD_PENDING) != 0 ) {
+            break;
+        }
+        uint8_t bodyLength = ring[tail+1];
+        byte * body = &ring[tail+2];
+        if ( (flags & RECORD_DROPPED) == 0 ) {
+            // written counts output bytes for YDRAW, for Actisense the position in DLE STX body DLE ETX.
+            uint16_t recordEnd = bodyLength;
+            if ( format == SNMEA2000_GATEWAY_ACTISENSE ) {
+                recordEnd += 4;
+            }
+            while ( written < recordEnd && available > 0 ) {
+                uint8_t n;
+                if ( format == SNMEA2000_GATEWAY_YDRAW ) {
+                    n = ((int)(bodyLength - written) < available)?(bodyLength - written):available;
+                    output->write(&body[written], n);
+                    written += n;
+                } else if ( written < 2 ) {
+                    n = output->write(&start[written], 1);
+                    written++;
+                } else if ( written >= bodyLength+2 ) {
+                    n = output->write(&end[written-bodyLength-2], 1);
+                    written++;
+                } else if ( body[written-2] == ACTISENSE_DLE ) {
+                    if ( available < 2 ) {
+                        break;
+                    }
+                    n = output->write(escapedDLE, 2);
+                    written++;
+                } else {
+                    // the longest run without a DLE.
+                    uint8_t i = written-2;
+                    n = 0;
+                    while ( i+n < bodyLength && n < available && body[i+n] != ACTISENSE_DLE ) {
+                        n++;
+                    }
+                    output->write(&body[i], n);
+                    written += n;
+                }
+                available -= n;
+                counters.bytes += n;
+            }
+            if ( written < recordEnd ) {
+                return;
+            }
+        }
+        written = 0;
+        used -= bodyLength + 2;
+        tail += bodyLength + 2;
+        if ( tail == ringSize ) {
+            tail = 0;
+        }
+    }
+}
+
+void SNMEA2000Gateway::dumpStatus(Print * console) {
+    console->print(F("Gateway messages="));
+    console->print(counters.messages);
+    console->print(F(" bytes="));
+    console->print(counters.bytes);
+    console->print(F(" bytes/s="));
+    console->print(bytesPerSecond);
+    console->print(F(" overflows="));
+    console->print(counters.overflows);
+    console->print(F(" fastPacketErrors="));
+    console->print(counters.fastPacketErrors);
+    console->print(F(" ring used="));
+    console->print(used);
+    console->print(F(" peak="));
+    console->print(counters.peakUsed);
+    console->print(F("/"));
+    console->println(ringSize);
+}
@@ -0,0 +1,114 @@
+#ifndef SmallNMEA2000Gateway_H
+#define SmallNMEA2000Gateway_H
+
+#include "SmallNMEA2000.h"
+
+#define SNMEA2000_GATEWAY_ACTISENSE 0
+#define SNMEA2000_GATEWAY_YDRAW 1
+#define SNMEA2000_GATEWAY_FAST_PACKETS 4
+// N2K fast packet timeout
+#define SNMEA2000_GATEWAY_FAST_PACKET_TIMEOUT 750
+
+/**
+ * A fast packet being assembled directly into its record in the ring.
+ */
+typedef struct SNMEA2000GatewayFastPacket {
+    unsigned long canId;
+    unsigned long started;
+    uint16_t record; // ring offset of the record
+    SNMEA2000FastPacketState state;
+    bool active;
+} SNMEA2000GatewayFastPacket;
+
+typedef struct SNMEA2000GatewayCounters {
+    unsigned long messages; // messages queued for output
+    unsigned long bytes; // bytes written to the output
+    unsigned long overflows; // messages dropped because the ring was full
+    unsigned long fastPacketErrors; // fast packets abandoned, missed frames, timeouts or no free slot
+    uint16_t peakUsed; // most ring bytes in use
+} SNMEA2000GatewayCounters;
+
+/**
+ * Streams the messages a device accepts to a serial port, eg USB to a laptop running OpenCPN
+ * or SignalK, in one of 2 formats
+ *
+ *   SNMEA2000_GATEWAY_ACTISENSE  Actisense NGT-1 binary, N2K message received (0x93), fast
+ *                                packets are reassembled into one message
+ *   SNMEA2000_GATEWAY_YDRAW      Yacht Devices RAW text, one line per frame
+ *                                  17:33:21.107 R 19F51323 01 2F 30 70 00 2F 30 70
+ *
+ * Messages are encoded straight from the frame buffer into a ring of records in RAM supplied
+ * by the application, fast packets are assembled in place in their record, and process()
+ * writes whole records from the ring to the output as fast as output->availableForWrite()
+ * allows, so the main loop never blocks on the serial port. The output must implement
+ * availableForWrite(), as HardwareSerial does. When the ring is full new messages are dropped
+ * and counted, so overflows and the bytes/s in dumpStatus() show whether the baud rate keeps
+ * up with the bus, 115200 baud is 11520 bytes/s at most.
+ *
+ * Register with addListener(), only PGNs in the rx list are forwarded. Fast packet PGNs must be
+ * listed, in RAM, for Actisense output. Messages are written in the order their first frame
+ * arrived, so a fast packet being assembled holds back the messages behind it, for at most
+ * SNMEA2000_GATEWAY_FAST_PACKET_TIMEOUT ms. Console output, eg diagnostics, must not share the
+ * serial port.
+ */
+class SNMEA2000Gateway : public SNMEA2000Listener {
+    public:
+        SNMEA2000Gateway(Print * output,
+            uint8_t format,
+            byte * ring,
+            uint16_t ringSize,
+            const unsigned long * fastPacketPGNs = NULL,
+            uint8_t fastPacketPGNsLen = 0) :
+            output{output},
+            ring{ring},
+            fastPacketPGNs{fastPacketPGNs},
+            ringSize{ringSize},
+            format{format},
+            fastPacketPGNsLen{fastPacketPGNsLen} {
+        };
+        /**
+         * @brief false if the ring cannot hold the largest record, 239 bytes for Actisense, a 223 byte
+         * fast packet, or 51 bytes for YDRAW. Any size can be used, more than the minimum holds
+         * the messages that arrive while the port is busy.
+         */
+        bool begin();
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        /**
+         * @brief write queued messages to the output, called on every processMessages.
+         */
+        void process() override;
+        SNMEA2000GatewayCounters * getCounters() { return &counters; };
+        uint16_t getRingUsed() { return used; };
+        /**
+         * @brief bytes written to the output over the last second.
+         */
+        unsigned long getBytesPerSecond() { return bytesPerSecond; };
+        void dumpStatus(Print * console);
+    private:
+        bool isFastPacket(unsigned long pgn);
+        void fastPacketFrame(MessageHeader *messageHeader, byte * buffer, uint8_t len);
+        byte * reserve(uint8_t bodyLength, byte flags);
+        byte * actisenseHeader(byte * body, MessageHeader *messageHeader, uint8_t length);
+        void finishRecord(uint16_t record);
+        void dropRecord(uint16_t record);
+        void encodeYDRaw(MessageHeader *messageHeader, byte * buffer, uint8_t len);
+        uint16_t contiguousFree();
+        void writeRecords();
+        Print * output;
+        byte * ring;
+        const unsigned long * fastPacketPGNs;
+        uint16_t ringSize;
+        uint16_t head = 0; // next record is written here
+        uint16_t tail = 0; // oldest record
+        uint16_t used = 0;
+        uint16_t written = 0; // bytes of the record at tail already written
+        uint8_t format;
+        uint8_t fastPacketPGNsLen;
+        SNMEA2000GatewayFastPacket fastPackets[SNMEA2000_GATEWAY_FAST_PACKETS] = {};
+        SNMEA2000GatewayCounters counters = {};
+        unsigned long bytesPerSecond = 0;
+        unsigned long lastSecond = 0;
+        unsigned long lastBytes = 0;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "SmallNMEA2000GroupFunction.h"
+
+#define ISO_ADDRESS_CLAIM_PGN 60928L
+
+#define INTERVAL_NO_CHANGE 0xffffffffUL
+#define INTERVAL_RESTORE_DEFAULT 0xfffffffeUL
+#define OFFSET_NO_CHANGE 0xffff
+#define PRIORITY_NO_CHANGE 8
+
+
+static uint32_t getUInt32(const byte * p) {
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+void SNMEA2000GroupFunction::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( messageHeader->pgn != GROUP_FUNCTION_PGN || device == NULL || len < 2 || len > 8 ) {
+        return;
+    }
+    if ( messageHeader->destination != device->getAddress()
+        && messageHeader->destination != SNMEA2000::broadcastAddress ) {
+        return;
+    }
+    if ( (buffer[0] & 0x1f) == 0 ) {
+        assemblingSource = messageHeader->source;
+    } else if ( messageHeader->source != assemblingSource ) {
+        return;
+    }
+    uint8_t length = assembleFastPacket(&fastPacket, payload, SNMEA2000_GROUP_FUNCTION_SIZE, buffer, len);
+    if ( length > 0 ) {
+        if ( length > SNMEA2000_GROUP_FUNCTION_SIZE ) {
+            // parameters past the buffer are reported as invalid.
+            length = SNMEA2000_GROUP_FUNCTION_SIZE;
+        }
+        handle(messageHeader, payload, length);
+    }
+}
+
+void SNMEA2000GroupFunction::handle(MessageHeader *messageHeader, const byte * payload, uint8_t length) {
+    if ( length < 4 ) {
+        errors++;
+        return;
+    }
+    unsigned long pgn = ((unsigned long)payload[3] << 16) | ((unsigned long)payload[2] << 8) | payload[1];
+    uint8_t pgnError = GROUP_FUNCTION_PGN_OK;
+    uint8_t txError = GROUP_FUNCTION_TX_OK;
+    uint8_t paramErrors[SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS];
+    uint8_t nParams = 0;
+    switch(payload[0]) {
+        case GROUP_FUNCTION_REQUEST:
+            if ( length < 11 ) {
+                errors++;
+                return;
+            }
+            requests++;
+            nParams = payload[10];
+            pgnError = handleRequest(payload, length, &txError, paramErrors);
+            break;
+        case GROUP_FUNCTION_COMMAND:
+            if ( length < 6 ) {
+                errors++;
+                return;
+            }
+            commands++;
+            nParams = payload[5];
+            pgnError = handleCommand(payload, length, &txError, paramErrors);
+            break;
+        case GROUP_FUNCTION_ACKNOWLEDGE:
+            return;
+        default:
+            // Read Fields, Write Fields and their replies.
+            pgnError = GROUP_FUNCTION_PGN_FUNCTION_NOT_SUPPORTED;
+            break;
+    }
+    if ( pgnError != GROUP_FUNCTION_PGN_OK || txError != GROUP_FUNCTION_TX_OK ) {
+        errors++;
+    }
+    if ( messageHeader->destination == device->getAddress() ) {
+        sendAcknowledgement(messageHeader, pgn, pgnError, txError, nParams, paramErrors);
+    }
+}
+
+uint8_t SNMEA2000GroupFunction::handleRequest(const byte * payload, uint8_t length, uint8_t *txError, uint8_t *paramErrors) {
+    unsigned long pgn = ((unsigned long)payload[3] << 16) | ((unsigned long)payload[2] << 8) | payload[1];
+    uint32_t interval = getUInt32(&payload[4]);
+    uint16_t offset = ((uint16_t)payload[9] << 8) | payload[8];
+    uint8_t nParams = payload[10];
+    for (uint8_t i = 0; i < nParams && i < SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS; i++) {
+        paramErrors[i] = GROUP_FUNCTION_PARAMETER_NOT_SUPPORTED;
+    }
+    if ( !device->isTxPGN(pgn) ) {
+        return GROUP_FUNCTION_PGN_NOT_SUPPORTED;
+    }
+    if ( nParams > 0 ) {
+        return GROUP_FUNCTION_PGN_OK;
+    }
+    SNMEA2000TxSchedule * schedule = device->getTxSchedule(pgn);
+    if ( schedule == NULL ) {
+        if ( interval != INTERVAL_NO_CHANGE || offset != OFFSET_NO_CHANGE ) {
+            *txError = GROUP_FUNCTION_TX_NOT_SUPPORTED;
+        }
+        return GROUP_FUNCTION_PGN_REQUEST_NOT_SUPPORTED;
+    }
+    if ( interval == INTERVAL_NO_CHANGE && offset == OFFSET_NO_CHANGE ) {
+        // send at the next isTxDue.
+        schedule->lastSent = millis() - schedule->period;
+        return GROUP_FUNCTION_PGN_OK;
+    }
+    uint16_t period = schedule->period;
+    if ( interval == INTERVAL_RESTORE_DEFAULT ) {
+        period = schedule->defaultPeriod;
+    } else if ( interval != INTERVAL_NO_CHANGE ) {
+        if ( interval < SNMEA2000_GROUP_FUNCTION_MIN_INTERVAL ) {
+            *txError = GROUP_FUNCTION_TX_INTERVAL_TOO_LOW;
+            return GROUP_FUNCTION_PGN_OK;
+        } else if ( interval > 0xffff ) {
+            *txError = GROUP_FUNCTION_TX_NOT_SUPPORTED;
+            return GROUP_FUNCTION_PGN_OK;
+        }
+        period = interval;
+    }
+    if ( offset != OFFSET_NO_CHANGE && (uint32_t)offset*10 > period ) {
+        *txError = GROUP_FUNCTION_TX_NOT_SUPPORTED;
+        return GROUP_FUNCTION_PGN_OK;
+    }
+    schedule->period = period;
+    if ( offset != OFFSET_NO_CHANGE ) {
+        // next sent offset*10 ms from now.
+        schedule->lastSent = millis() - period + (unsigned long)offset*10;
+    }
+    changed(pgn);
+    return GROUP_FUNCTION_PGN_OK;
+}
+
+uint8_t SNMEA2000GroupFunction::handleCommand(const byte * payload, uint8_t length, uint8_t *txError, uint8_t *paramErrors) {
+    unsigned long pgn = ((unsigned long)payload[3] << 16) | ((unsigned long)payload[2] << 8) | payload[1];
+    uint8_t priority = payload[4] & 0x0f;
+    uint8_t nParams = payload[5];
+    for (uint8_t i = 0; i < nParams && i < SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS; i++) {
+        paramErrors[i] = GROUP_FUNCTION_PARAMETER_INVALID;
+    }
+    bool isAddressClaim = (pgn == ISO_ADDRESS_CLAIM_PGN);
+    if ( !isAddressClaim && (commandHandler == NULL || !device->isTxPGN(pgn)) ) {
+        return GROUP_FUNCTION_PGN_NOT_SUPPORTED;
+    }
+    if ( priority < PRIORITY_NO_CHANGE ) {
+        *txError = GROUP_FUNCTION_TX_NOT_SUPPORTED;
+    }
+    uint8_t deviceInstance = device->getDeviceInstance();
+    uint8_t systemInstance = device->getSystemInstance();
+    bool hasChanged = false;
+    uint8_t pos = 6;
+    for (uint8_t i = 0; i < nParams && pos < length; i++) {
+        uint8_t field = payload[pos++];
+        if ( pos >= length ) {
+            break;
+        }
+        uint8_t error = GROUP_FUNCTION_PARAMETER_OK;
+        uint8_t size = length - pos;
+        if ( isAddressClaim ) {
+            byte value = payload[pos];
+            size = 1;
+            if ( field == 3 ) {
+                deviceInstance = (deviceInstance & 0xf8) | (value & 0x07);
+            } else if ( field == 4 ) {
+                deviceInstance = (deviceInstance & 0x07) | ((value & 0x1f) << 3);
+            } else if ( field == 8 ) {
+                systemInstance = value & 0x0f;
+            } else {
+                error = GROUP_FUNCTION_PARAMETER_INVALID;
+            }
+        } else {
+            error = commandHandler(pgn, field, &payload[pos], &size);
+        }
+        if ( i < SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS ) {
+            paramErrors[i] = error;
+        }
+        if ( error == GROUP_FUNCTION_PARAMETER_INVALID ) {
+            // the size of an unknown field is unknown, the remaining parameters cant be read.
+            break;
+        }
+        if ( error == GROUP_FUNCTION_PARAMETER_OK ) {
+            hasChanged = true;
+        }
+        pos += size;
+    }
+    if ( hasChanged ) {
+        if ( isAddressClaim ) {
+            device->setDeviceInstances(deviceInstance, systemInstance);
+        }
+        changed(pgn);
+    }
+    return GROUP_FUNCTION_PGN_OK;
+}
+
+void SNMEA2000GroupFunction::sendAcknowledgement(MessageHeader *messageHeader, unsigned long pgn, uint8_t pgnError,
+        uint8_t txError, uint8_t nParams, uint8_t *paramErrors) {
+    if ( nParams > SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS ) {
+        nParams = SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS;
+    }
+    byte ack[6+SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS/2];
+    ack[0] = GROUP_FUNCTION_ACKNOWLEDGE;
+    ack[1] = pgn & 0xff;
+    ack[2] = (pgn >> 8) & 0xff;
+    ack[3] = (pgn >> 16) & 0xff;
+    ack[4] = (pgnError & 0x0f) | ((txError & 0x0f) << 4);
+    ack[5] = nParams;
+    uint8_t length = 6;
+    for (uint8_t i = 0; i < nParams; i += 2) {
+        uint8_t high = (i+1 < nParams)?paramErrors[i+1]:0x0f;
+        ack[length++] = (paramErrors[i] & 0x0f) | (high << 4);
+    }
+    MessageHeader ackHeader(GROUP_FUNCTION_PGN, 3, device->getAddress(), messageHeader->source);
+    // 126208 is always a fast packet, even when it fits in one frame.
+    device->sendFastPacket(&ackHeader, ack, length);
+}
+
+void SNMEA2000GroupFunction::dumpStatus(Print * console) {
+    console->print(F("Group functions requests="));
+    console->print(requests);
+    console->print(F(" commands="));
+    console->print(commands);
+    console->print(F(" errors="));
+    console->println(errors);
+}
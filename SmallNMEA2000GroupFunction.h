@@ -0,0 +1,104 @@
+#ifndef SmallNMEA2000GroupFunction_H
+#define SmallNMEA2000GroupFunction_H
+
+#include "SmallNMEA2000.h"
+
+#define GROUP_FUNCTION_PGN 126208L
+
+// largest 126208 accepted, enough for a command with a few parameters.
+#define SNMEA2000_GROUP_FUNCTION_SIZE 32
+// most parameters reported in an acknowledgement.
+#define SNMEA2000_GROUP_FUNCTION_MAX_PARAMETERS 8
+// shortest transmission interval a request may set, ms.
+#define SNMEA2000_GROUP_FUNCTION_MIN_INTERVAL 50
+
+#define GROUP_FUNCTION_REQUEST 0
+#define GROUP_FUNCTION_COMMAND 1
+#define GROUP_FUNCTION_ACKNOWLEDGE 2
+
+// 126208 PGN error codes
+#define GROUP_FUNCTION_PGN_OK 0
+#define GROUP_FUNCTION_PGN_NOT_SUPPORTED 1
+#define GROUP_FUNCTION_PGN_NOT_AVAILABLE 2
+#define GROUP_FUNCTION_PGN_ACCESS_DENIED 3
+#define GROUP_FUNCTION_PGN_REQUEST_NOT_SUPPORTED 4
+#define GROUP_FUNCTION_PGN_FUNCTION_NOT_SUPPORTED 6
+
+// 126208 transmission interval and priority error codes
+#define GROUP_FUNCTION_TX_OK 0
+#define GROUP_FUNCTION_TX_NOT_SUPPORTED 1
+#define GROUP_FUNCTION_TX_INTERVAL_TOO_LOW 2
+
+// 126208 parameter error codes, also returned by a SNMEA2000GroupFunctionHandler
+#define GROUP_FUNCTION_PARAMETER_OK 0
+#define GROUP_FUNCTION_PARAMETER_INVALID 1
+#define GROUP_FUNCTION_PARAMETER_TEMPORARILY_UNAVAILABLE 2
+#define GROUP_FUNCTION_PARAMETER_OUT_OF_RANGE 3
+#define GROUP_FUNCTION_PARAMETER_ACCESS_DENIED 4
+#define GROUP_FUNCTION_PARAMETER_NOT_SUPPORTED 5
+
+/**
+ * Sets field of pgn from value, for commanded fields other than the device and system instance.
+ * valueLength is the number of bytes remaining in the message, set it to the size of the field.
+ * Return a GROUP_FUNCTION_PARAMETER_ error code, with GROUP_FUNCTION_PARAMETER_INVALID for an
+ * unknown field.
+ */
+typedef uint8_t (*SNMEA2000GroupFunctionHandler)(unsigned long pgn, uint8_t field, const byte *value, uint8_t *valueLength);
+
+/**
+ * PGN 126208 Group Function, Request, Command and Acknowledge.
+ *
+ * A Request for a scheduled PGN, see SNMEA2000::setTxSchedule, changes its period, 0xFFFFFFFE
+ * restores the period in the schedule when setTxSchedule was called, and the offset delays the
+ * next transmission. A Request without an interval sends the PGN at the next isTxDue.
+ * A Command to 60928 sets the device instance lower (field 3), upper (field 4) and the system
+ * instance (field 8), re-claiming the address with the new NAME. Commands to other PGNs are passed to
+ * the SNMEA2000GroupFunctionHandler, eg to set a battery instance.
+ * Messages addressed to this device are acknowledged, broadcasts are applied without an
+ * acknowledgement. Nothing is stored, use the change callback to save periods and instances,
+ * eg in EEPROM, and restore them before open().
+ *
+ * Register with addListener(), 126208 must be in the rx and tx lists. Field selection pairs
+ * in Requests and Read/Write Fields are not supported.
+ */
+class SNMEA2000GroupFunction : public SNMEA2000Listener {
+    public:
+        SNMEA2000GroupFunction(SNMEA2000GroupFunctionHandler commandHandler = NULL) :
+            commandHandler{commandHandler} {
+        };
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        /**
+         * @brief handle a complete 126208 payload.
+         */
+        void handle(MessageHeader *messageHeader, const byte * payload, uint8_t length);
+        /**
+         * @brief called with the pgn after a period or field has been changed, 60928 for instances.
+         */
+        void setChangeHandler(void (*changeHandler)(unsigned long pgn)) {
+            this->changeHandler = changeHandler;
+        };
+        unsigned long getRequests() { return requests; };
+        unsigned long getCommands() { return commands; };
+        unsigned long getErrors() { return errors; };
+        void dumpStatus(Print * console);
+    private:
+        uint8_t handleRequest(const byte * payload, uint8_t length, uint8_t *txError, uint8_t *paramErrors);
+        uint8_t handleCommand(const byte * payload, uint8_t length, uint8_t *txError, uint8_t *paramErrors);
+        void sendAcknowledgement(MessageHeader *messageHeader, unsigned long pgn, uint8_t pgnError,
+            uint8_t txError, uint8_t nParams, uint8_t *paramErrors);
+        void changed(unsigned long pgn) {
+            if ( changeHandler != NULL ) {
+                changeHandler(pgn);
+            }
+        };
+        SNMEA2000GroupFunctionHandler commandHandler;
+        void (*changeHandler)(unsigned long pgn) = NULL;
+        SNMEA2000FastPacketState fastPacket = {};
+        uint8_t assemblingSource = SNMEA2000::anySource;
+        byte payload[SNMEA2000_GROUP_FUNCTION_SIZE];
+        unsigned long requests = 0;
+        unsigned long commands = 0;
+        unsigned long errors = 0;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "SmallNMEA2000IsoTP.h"
+
+// TP.CM control bytes
+#define TP_CM_RTS 16
+#define TP_CM_CTS 17
+#define TP_CM_EOM_ACK 19
+#define TP_CM_BAM 32
+#define TP_CM_ABORT 255
+
+// abort reasons
+#define TP_ABORT_BUSY 1
+#define TP_ABORT_RESOURCES 2
+#define TP_ABORT_TIMEOUT 3
+
+#define TX_START 0
+#define TX_BAM 1
+#define TX_WAIT_CTS 2
+#define TX_SENDING 3
+#define TX_WAIT_EOM 4
+
+#define RX_IDLE 0
+#define RX_BAM 1
+#define RX_CMDT 2
+
+// packets requested in each CTS
+#define RX_WINDOW 16
+
+
+bool SNMEA2000IsoTP::send(unsigned long pgn, byte priority, uint8_t destination,
+        uint16_t length, SNMEA2000PayloadReader reader, const void * context) {
+    if ( length > maxLength || txQueueLen >= SNMEA2000_ISOTP_TX_QUEUE ) {
+        counters.busy++;
+        return false;
+    }
+    SNMEA2000IsoTPSession * session = &txQueue[txQueueLen++];
+    session->pgn = pgn;
+    session->priority = priority;
+    session->destination = destination;
+    session->length = length;
+    session->reader = reader;
+    session->context = context;
+    session->packets = (length+6)/7;
+    session->nextPacket = 1;
+    session->lastPacket = 0;
+    session->state = TX_START;
+    session->lastActivity = millis();
+    return true;
+}
+
+void SNMEA2000IsoTP::process() {
+    unsigned long now = millis();
+    if ( rxState != RX_IDLE &&
+        now - rxLastActivity > ((rxState == RX_CMDT)?SNMEA2000_ISOTP_T2:SNMEA2000_ISOTP_T1) ) {
+        counters.timeouts++;
+        if ( rxState == RX_CMDT ) {
+            abortRecieve(TP_ABORT_TIMEOUT);
+        }
+        rxState = RX_IDLE;
+    }
+    if ( txQueueLen == 0 ) {
+        return;
+    }
+    SNMEA2000IsoTPSession * session = &txQueue[0];
+    switch(session->state) {
+    case TX_START:
+        if ( session->destination == SNMEA2000::broadcastAddress ) {
+            sendConnectionManagement(session->destination, TP_CM_BAM,
+                session->length&0xff, (session->length>>8)&0xff, session->packets, 0xff, session->pgn);
+            session->state = TX_BAM;
+        } else {
+            sendConnectionManagement(session->destination, TP_CM_RTS,
+                session->length&0xff, (session->length>>8)&0xff, session->packets, 0xff, session->pgn);
+            session->state = TX_WAIT_CTS;
+        }
+        session->lastActivity = now;
+        break;
+    case TX_BAM:
+        if ( now - session->lastActivity >= SNMEA2000_ISOTP_BAM_INTERVAL ) {
+            session->lastPacket = session->packets;
+            sendDataPackets(session, 1);
+            session->lastActivity = now;
+            if ( session->nextPacket > session->packets ) {
+                finishSend(true);
+            }
+        }
+        break;
+    case TX_SENDING:
+        sendDataPackets(session, SNMEA2000_ISOTP_FRAMES_PER_CALL);
+        session->lastActivity = now;
+        if ( session->nextPacket > session->lastPacket ) {
+            session->state = (session->nextPacket > session->packets)?TX_WAIT_EOM:TX_WAIT_CTS;
+        }
+        break;
+    case TX_WAIT_CTS:
+    case TX_WAIT_EOM:
+        if ( now - session->lastActivity > SNMEA2000_ISOTP_T3 ) {
+            counters.timeouts++;
+            sendConnectionManagement(session->destination, TP_CM_ABORT,
+                TP_ABORT_TIMEOUT, 0xff, 0xff, 0xff, session->pgn);
+            finishSend(false);
+        }
+        break;
+    }
+}
+
+void SNMEA2000IsoTP::sendDataPackets(SNMEA2000IsoTPSession * session, uint8_t max) {
+    MessageHeader messageHeader(tpDtPGN, 7, device->getAddress(), session->destination);
+    byte frame[8];
+    for (uint8_t i = 0; i < max && session->nextPacket <= session->lastPacket; i++) {
+        frame[0] = session->nextPacket;
+        uint16_t offset = (session->nextPacket-1)*7;
+        for (uint8_t b = 1; b < 8; b++, offset++) {
+            frame[b] = (offset < session->length)?session->reader(session->context, offset):0xff;
+        }
+        device->sendMessage(&messageHeader, frame, 8);
+        session->nextPacket++;
+    }
+}
+
+void SNMEA2000IsoTP::finishSend(bool ok) {
+    if ( ok ) {
+        counters.messagesSent++;
+        counters.bytesSent += txQueue[0].length;
+    }
+    for (uint8_t i = 1; i < txQueueLen; i++) {
+        txQueue[i-1] = txQueue[i];
+    }
+    txQueueLen--;
+}
+
+void SNMEA2000IsoTP::sendConnectionManagement(uint8_t destination, byte control,
+        byte b1, byte b2, byte b3, byte b4, unsigned long pgn) {
+    MessageHeader messageHeader(tpCmPGN, 7, device->getAddress(), destination);
+    byte frame[8] = { control, b1, b2, b3, b4,
+        (byte)(pgn&0xff), (byte)((pgn>>8)&0xff), (byte)((pgn>>16)&0xff) };
+    device->sendMessage(&messageHeader, frame, 8);
+}
+
+void SNMEA2000IsoTP::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( len != 8 ) {
+        return;
+    }
+    if ( messageHeader->pgn == tpCmPGN ) {
+        handleConnectionManagement(messageHeader, buffer);
+    } else if ( messageHeader->pgn == tpDtPGN ) {
+        handleData(messageHeader, buffer);
+    }
+}
+
+void SNMEA2000IsoTP::handleConnectionManagement(MessageHeader *messageHeader, byte * buffer) {
+    unsigned long pgn = (((unsigned long)buffer[7])<<16)|(((unsigned long)buffer[6])<<8)|buffer[5];
+    SNMEA2000IsoTPSession * session = (txQueueLen > 0)?&txQueue[0]:NULL;
+    bool forSession = session != NULL && session->state != TX_START && session->state != TX_BAM &&
+        session->destination == messageHeader->source && session->pgn == pgn;
+    switch(buffer[0]) {
+    case TP_CM_RTS:
+        if ( messageHeader->destination != SNMEA2000::broadcastAddress ) {
+            startRecieve(messageHeader, buffer, false);
+        }
+        break;
+    case TP_CM_BAM:
+        if ( messageHeader->destination == SNMEA2000::broadcastAddress ) {
+            startRecieve(messageHeader, buffer, true);
+        }
+        break;
+    case TP_CM_CTS:
+        if ( forSession ) {
+            session->lastActivity = millis();
+            if ( buffer[1] == 0 ) {
+                // hold the connection open.
+                session->state = TX_WAIT_CTS;
+            } else if ( buffer[2] == 0 || buffer[2] > session->packets ) {
+                sendConnectionManagement(session->destination, TP_CM_ABORT,
+                    TP_ABORT_RESOURCES, 0xff, 0xff, 0xff, session->pgn);
+                counters.aborts++;
+                finishSend(false);
+            } else {
+                session->nextPacket = buffer[2];
+                uint16_t lastPacket = buffer[2] + buffer[1] - 1;
+                session->lastPacket = (lastPacket > session->packets)?session->packets:lastPacket;
+                session->state = TX_SENDING;
+            }
+        }
+        break;
+    case TP_CM_EOM_ACK:
+        if ( forSession ) {
+            finishSend(true);
+        }
+        break;
+    case TP_CM_ABORT:
+        if ( forSession ) {
+            counters.aborts++;
+            finishSend(false);
+        } else if ( rxState != RX_IDLE && rxSource == messageHeader->source && rxPGN == pgn ) {
+            counters.aborts++;
+            rxState = RX_IDLE;
+        }
+        break;
+    }
+}
+
+void SNMEA2000IsoTP::startRecieve(MessageHeader *messageHeader, byte * buffer, bool broadcast) {
+    unsigned long pgn = (((unsigned long)buffer[7])<<16)|(((unsigned long)buffer[6])<<8)|buffer[5];
+    uint16_t length = (((uint16_t)buffer[2])<<8)|buffer[1];
+    if ( rxState != RX_IDLE ) {
+        counters.busy++;
+        if ( !broadcast ) {
+            sendConnectionManagement(messageHeader->source, TP_CM_ABORT, TP_ABORT_BUSY, 0xff, 0xff, 0xff, pgn);
+        }
+        return;
+    }
+    if ( length > rxBufferSize || length > maxLength || buffer[3] != (length+6)/7 || !device->isRxPGN(pgn) ) {
+        if ( !broadcast ) {
+            sendConnectionManagement(messageHeader->source, TP_CM_ABORT, TP_ABORT_RESOURCES, 0xff, 0xff, 0xff, pgn);
+        }
+        return;
+    }
+    rxPGN = pgn;
+    rxLength = length;
+    rxPackets = buffer[3];
+    rxSource = messageHeader->source;
+    rxNextPacket = 1;
+    // the most packets per CTS, 0 would stall the transfer with CTS holds, so treat it as no limit.
+    rxMaxWindow = (broadcast || buffer[4] == 0)?0xff:buffer[4];
+    rxState = broadcast?RX_BAM:RX_CMDT;
+    rxLastActivity = millis();
+    if ( !broadcast ) {
+        sendCTS();
+    } else {
+        rxLastPacket = rxPackets;
+    }
+}
+
+void SNMEA2000IsoTP::sendCTS() {
+    uint8_t window = rxPackets - rxNextPacket + 1;
+    if ( window > RX_WINDOW ) {
+        window = RX_WINDOW;
+    }
+    if ( window > rxMaxWindow ) {
+        window = rxMaxWindow;
+    }
+    rxLastPacket = rxNextPacket + window - 1;
+    sendConnectionManagement(rxSource, TP_CM_CTS, window, rxNextPacket, 0xff, 0xff, rxPGN);
+}
+
+void SNMEA2000IsoTP::abortRecieve(byte reason) {
+    sendConnectionManagement(rxSource, TP_CM_ABORT, reason, 0xff, 0xff, 0xff, rxPGN);
+    rxState = RX_IDLE;
+}
+
+void SNMEA2000IsoTP::handleData(MessageHeader *messageHeader, byte * buffer) {
+    if ( rxState == RX_IDLE || messageHeader->source != rxSource ) {
+        return;
+    }
+    if ( (rxState == RX_BAM) != (messageHeader->destination == SNMEA2000::broadcastAddress) ) {
+        return;
+    }
+    rxLastActivity = millis();
+    if ( buffer[0] != rxNextPacket ) {
+        if ( rxState == RX_CMDT ) {
+            // ask for the missing packets again.
+            sendCTS();
+        } else {
+            rxState = RX_IDLE;
+        }
+        return;
+    }
+    uint16_t offset = (rxNextPacket-1)*7;
+    for (uint8_t b = 1; b < 8 && offset < rxLength; b++, offset++) {
+        rxBuffer[offset] = buffer[b];
+    }
+    rxNextPacket++;
+    if ( rxNextPacket > rxPackets ) {
+        if ( rxState == RX_CMDT ) {
+            sendConnectionManagement(rxSource, TP_CM_EOM_ACK,
+                rxLength&0xff, (rxLength>>8)&0xff, rxPackets, 0xff, rxPGN);
+        }
+        rxState = RX_IDLE;
+        counters.messagesRecieved++;
+        counters.bytesRecieved += rxLength;
+        MessageHeader recieved(rxPGN, 6, rxSource, messageHeader->destination);
+        device->dispatchMessage(&recieved, rxBuffer, rxLength);
+    } else if ( rxState == RX_CMDT && rxNextPacket > rxLastPacket ) {
+        sendCTS();
+    }
+}
+
+void SNMEA2000IsoTP::dumpStatus(Print * console) {
+    console->print(F("IsoTP sent="));
+    console->print(counters.messagesSent);
+    console->print(F(" ("));
+    console->print(counters.bytesSent);
+    console->print(F(" bytes) recieved="));
+    console->print(counters.messagesRecieved);
+    console->print(F(" ("));
+    console->print(counters.bytesRecieved);
+    console->print(F(" bytes) aborts="));
+    console->print(counters.aborts);
+    console->print(F(" timeouts="));
+    console->print(counters.timeouts);
+    console->print(F(" busy="));
+    console->println(counters.busy);
+}
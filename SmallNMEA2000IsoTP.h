@@ -0,0 +1,109 @@
+#ifndef SmallNMEA2000IsoTP_H
+#define SmallNMEA2000IsoTP_H
+
+#include "SmallNMEA2000.h"
+
+#define SNMEA2000_ISOTP_TX_QUEUE 2
+// TP.DT frames sent per processMessages call for connection mode transfers.
+#define SNMEA2000_ISOTP_FRAMES_PER_CALL 4
+// ISO 11783-3 timing, ms.
+#define SNMEA2000_ISOTP_BAM_INTERVAL 50
+#define SNMEA2000_ISOTP_T1 750
+#define SNMEA2000_ISOTP_T2 1250
+#define SNMEA2000_ISOTP_T3 1250
+
+/**
+ * A message being sent, the payload is read on demand with reader(context, offset)
+ * so that it does not need to be held in RAM and can be re-read when packets are
+ * retransmitted.
+ */
+typedef struct SNMEA2000IsoTPSession {
+    unsigned long pgn;
+    unsigned long lastActivity;
+    SNMEA2000PayloadReader reader;
+    const void * context;
+    uint16_t length;
+    uint8_t destination; // broadcastAddress for BAM
+    uint8_t priority;
+    uint8_t state;
+    uint8_t packets;
+    uint8_t nextPacket; // 1 based
+    uint8_t lastPacket; // of the current CTS window
+} SNMEA2000IsoTPSession;
+
+typedef struct SNMEA2000IsoTPCounters {
+    unsigned long bytesSent;
+    unsigned long messagesSent;
+    unsigned long bytesRecieved;
+    unsigned long messagesRecieved;
+    uint16_t aborts;
+    uint16_t timeouts;
+    uint16_t busy;
+} SNMEA2000IsoTPCounters;
+
+/**
+ * ISO 11783-3 transport protocol for payloads of 9 to 1785 bytes. Broadcasts use BAM,
+ * messages to an address use RTS/CTS connection mode with flow control.
+ * Transfers are non blocking, driven from processMessages.
+ * Up to SNMEA2000_ISOTP_TX_QUEUE messages can be queued for sending, one message
+ * is recieved at a time into the buffer supplied, messages that dont fit are rejected.
+ * Recieved messages are passed to the device message handler and listeners as if
+ * they had been recieved in one frame.
+ * 60416 TP.CM and 60160 TP.DT must be in the devices rx and tx lists. eg
+ *
+ * byte tpBuffer[256];
+ * SNMEA2000IsoTP isoTP(&device, &tpBuffer[0], sizeof(tpBuffer));
+ * ...
+ *   device.addListener(&isoTP);
+ *   device.setIsoTP(&isoTP);
+ */
+class SNMEA2000IsoTP : public SNMEA2000Listener {
+    public:
+        SNMEA2000IsoTP(SNMEA2000 * device, byte * rxBuffer = NULL, uint16_t rxBufferSize = 0) :
+            device{device},
+            rxBuffer{rxBuffer},
+            rxBufferSize{rxBufferSize} {
+        };
+        /**
+         * @brief queue a message, false if the queue is full or the length is > 1785.
+         */
+        virtual bool send(unsigned long pgn, byte priority, uint8_t destination,
+            uint16_t length, SNMEA2000PayloadReader reader, const void * context);
+        bool isBusy() { return txQueueLen > 0; };
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        void process() override;
+        SNMEA2000IsoTPCounters * getCounters() { return &counters; };
+        void dumpStatus(Print * console);
+
+        static const unsigned long tpCmPGN = 60416L;
+        static const unsigned long tpDtPGN = 60160L;
+        static const uint16_t maxLength = 1785;
+    private:
+        void handleConnectionManagement(MessageHeader *messageHeader, byte * buffer);
+        void handleData(MessageHeader *messageHeader, byte * buffer);
+        void startRecieve(MessageHeader *messageHeader, byte * buffer, bool broadcast);
+        void sendDataPackets(SNMEA2000IsoTPSession * session, uint8_t max);
+        void sendConnectionManagement(uint8_t destination, byte control, byte b1, byte b2, byte b3, byte b4, unsigned long pgn);
+        void sendCTS();
+        void abortRecieve(byte reason);
+        void finishSend(bool ok);
+        SNMEA2000 * device;
+        byte * rxBuffer;
+        uint16_t rxBufferSize;
+        SNMEA2000IsoTPSession txQueue[SNMEA2000_ISOTP_TX_QUEUE];
+        uint8_t txQueueLen = 0;
+        // recieve session
+        unsigned long rxPGN = 0;
+        unsigned long rxLastActivity = 0;
+        uint16_t rxLength = 0;
+        uint8_t rxSource = 0;
+        uint8_t rxState = 0;
+        uint8_t rxPackets = 0;
+        uint8_t rxNextPacket = 0;
+        uint8_t rxLastPacket = 0;
+        uint8_t rxMaxWindow = 0;
+        SNMEA2000IsoTPCounters counters = {};
+};
+
+
+#endif
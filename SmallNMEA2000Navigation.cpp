@@ -0,0 +1,84 @@
+#include "SmallNMEA2000Navigation.h"
+
+static const unsigned long vesselHeadingId = SNMEA2000::canIdBase(127250L, 2);
+static const unsigned long rateOfTurnId = SNMEA2000::canIdBase(127251L, 2);
+static const unsigned long attitudeId = SNMEA2000::canIdBase(127257L, 3);
+static const unsigned long positionRapidId = SNMEA2000::canIdBase(129025L, 2);
+static const unsigned long cogSogRapidId = SNMEA2000::canIdBase(129026L, 2);
+
+// 0.0001 rad/s to 3.125e-8 rad/s
+#define RATE_OF_TURN_SCALE 3200
+#define RATE_OF_TURN_LIMIT (0x7ffffffd/RATE_OF_TURN_SCALE)
+
+void NavigationSensor::sendHeading(byte sid, uint16_t heading, int16_t deviation, int16_t variation, uint8_t reference) {
+    byte frame[8];
+    frame[0] = sid;
+    frame[1] = heading;
+    frame[2] = heading >> 8;
+    frame[3] = deviation;
+    frame[4] = deviation >> 8;
+    frame[5] = variation;
+    frame[6] = variation >> 8;
+    frame[7] = (reference & 0x03) | 0xfc;
+    sendFrame(vesselHeadingId | getAddress(), frame, 8);
+}
+
+void NavigationSensor::sendRateOfTurn(byte sid, int32_t rate) {
+    if ( rate != SNMEA2000::n2kInt32NA ) {
+        if ( rate > RATE_OF_TURN_LIMIT ) {
+            rate = RATE_OF_TURN_LIMIT;
+        } else if ( rate < -RATE_OF_TURN_LIMIT ) {
+            rate = -RATE_OF_TURN_LIMIT;
+        }
+        rate *= RATE_OF_TURN_SCALE;
+    }
+    byte frame[8];
+    frame[0] = sid;
+    frame[1] = rate;
+    frame[2] = rate >> 8;
+    frame[3] = rate >> 16;
+    frame[4] = rate >> 24;
+    frame[5] = 0xff;
+    frame[6] = 0xff;
+    frame[7] = 0xff;
+    sendFrame(rateOfTurnId | getAddress(), frame, 8);
+}
+
+void NavigationSensor::sendAttitude(byte sid, int16_t yaw, int16_t pitch, int16_t roll) {
+    byte frame[8];
+    frame[0] = sid;
+    frame[1] = yaw;
+    frame[2] = yaw >> 8;
+    frame[3] = pitch;
+    frame[4] = pitch >> 8;
+    frame[5] = roll;
+    frame[6] = roll >> 8;
+    frame[7] = 0xff;
+    sendFrame(attitudeId | getAddress(), frame, 8);
+}
+
+void NavigationSensor::sendPosition(int32_t latitude, int32_t longitude) {
+    byte frame[8];
+    frame[0] = latitude;
+    frame[1] = latitude >> 8;
+    frame[2] = latitude >> 16;
+    frame[3] = latitude >> 24;
+    frame[4] = longitude;
+    frame[5] = longitude >> 8;
+    frame[6] = longitude >> 16;
+    frame[7] = longitude >> 24;
+    sendFrame(positionRapidId | getAddress(), frame, 8);
+}
+
+void NavigationSensor::sendCOGSOG(byte sid, uint8_t reference, uint16_t cog, uint16_t sog) {
+    byte frame[8];
+    frame[0] = sid;
+    frame[1] = (reference & 0x03) | 0xfc;
+    frame[2] = cog;
+    frame[3] = cog >> 8;
+    frame[4] = sog;
+    frame[5] = sog >> 8;
+    frame[6] = 0xff;
+    frame[7] = 0xff;
+    sendFrame(cogSogRapidId | getAddress(), frame, 8);
+}
@@ -0,0 +1,71 @@
+#ifndef SmallNMEA2000Navigation_H
+#define SmallNMEA2000Navigation_H
+
+#include "SmallNMEA2000.h"
+
+#define N2K_HEADING_TRUE 0
+#define N2K_HEADING_MAGNETIC 1
+
+/**
+ * Heading, attitude and position sensor sending single frame PGNs at 10-20Hz.
+ *
+ * Angles are in the N2K unit, radians x 10^4, rates in radians/s x 10^4, positions in 1e-7
+ * degrees and speeds in 0.01 m/s, use SNMEA2000::n2kUInt16NA, n2kInt16NA and n2kInt32NA for
+ * not available. Each message is 8 bytes stored directly into a frame and sent with
+ * SNMEA2000::sendFrame using a CAN id that is a constant apart from the address, without the
+ * MessageHeader and the startPacket/outputByte state, so there is no floating point and no per
+ * byte call. Add the PGNs sent to the tx list. The MCP2515 has 3 tx buffers, so stagger the
+ * PGNs over the period rather than sending them all in one loop, see host/n2knavbench.cpp.
+ */
+class NavigationSensor : public SNMEA2000 {
+    public:
+      NavigationSensor(byte addr,
+        SNMEA2000DeviceInfo * devInfo, 
+        const SNMEA2000ProductInfo * pinfo, 
+        const SNMEA2000ConfigInfo * cinfo,
+        const unsigned long *tx,
+        const uint8_t txLen,
+        const unsigned long *rx,
+        const uint8_t rxLen,
+        SNMEA2000Transport * transport,
+        Print * console = &Serial
+        ): SNMEA2000{addr, devInfo, pinfo, cinfo, tx, txLen, rx, rxLen, transport, console} {};
+    /**
+     * @brief PGN 127250 Vessel Heading
+     * @param heading 0.0001 rad
+     * @param deviation 0.0001 rad
+     * @param variation 0.0001 rad
+     * @param reference N2K_HEADING_TRUE or N2K_HEADING_MAGNETIC
+     */
+    void sendHeading(byte sid, uint16_t heading, 
+        int16_t deviation = SNMEA2000::n2kInt16NA, 
+        int16_t variation = SNMEA2000::n2kInt16NA, 
+        uint8_t reference = N2K_HEADING_MAGNETIC);
+    /**
+     * @brief PGN 127251 Rate of Turn
+     * @param rate 0.0001 rad/s, positive to starboard
+     */
+    void sendRateOfTurn(byte sid, int32_t rate);
+    /**
+     * @brief PGN 127257 Attitude
+     * @param yaw 0.0001 rad
+     * @param pitch 0.0001 rad, bow up positive
+     * @param roll 0.0001 rad, starboard down positive
+     */
+    void sendAttitude(byte sid, int16_t yaw, int16_t pitch, int16_t roll);
+    /**
+     * @brief PGN 129025 Position, Rapid Update
+     * @param latitude 1e-7 degrees, north positive
+     * @param longitude 1e-7 degrees, east positive
+     */
+    void sendPosition(int32_t latitude, int32_t longitude);
+    /**
+     * @brief PGN 129026 COG & SOG, Rapid Update
+     * @param reference N2K_HEADING_TRUE or N2K_HEADING_MAGNETIC
+     * @param cog 0.0001 rad
+     * @param sog 0.01 m/s
+     */
+    void sendCOGSOG(byte sid, uint8_t reference, uint16_t cog, uint16_t sog);
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "SmallNMEA2000Request.h"
+
+#define ISO_REQUEST_PGN 59904L
+#define ISO_ACKNOWLEDGEMENT_PGN 59392L
+
+bool SNMEA2000RequestClient::add(unsigned long pgn, uint8_t destination, byte * payload, uint8_t size,
+        SNMEA2000RequestCallback callback, void * context) {
+    if ( device == NULL || callback == NULL || !device->hasClaimedAddress() ) {
+        return false;
+    }
+    SNMEA2000PendingRequest * slot = NULL;
+    SNMEA2000PendingRequest * sent = NULL;
+    for (uint8_t i = 0; i < SNMEA2000_REQUEST_SLOTS; i++) {
+        if ( !pending[i].inUse ) {
+            if ( slot == NULL ) {
+                slot = &pending[i];
+            }
+        } else if ( pending[i].pgn == pgn && pending[i].destination == destination ) {
+            sent = &pending[i];
+        }
+    }
+    if ( slot == NULL ) {
+        counters.full++;
+        return false;
+    }
+    slot->pgn = pgn;
+    slot->callback = callback;
+    slot->context = context;
+    slot->payload = payload;
+    slot->size = size;
+    slot->destination = destination;
+    slot->assemblySource = SNMEA2000::anySource;
+    slot->fastPacket.nextFrame = 0;
+    slot->inUse = true;
+    if ( sent != NULL ) {
+        // already requested, wait for the same reply.
+        slot->lastActivity = sent->lastActivity;
+        counters.deduplicated++;
+        return true;
+    }
+    slot->lastActivity = millis();
+    MessageHeader messageHeader(ISO_REQUEST_PGN, 6, device->getAddress(), destination);
+    SNMEA2000PacketWriter writer(device, &messageHeader);
+    writer.output3ByteUInt(pgn);
+    writer.finishPacket();
+    counters.sent++;
+    return true;
+}
+
+void SNMEA2000RequestClient::cancel(SNMEA2000RequestCallback callback, void * context) {
+    for (uint8_t i = 0; i < SNMEA2000_REQUEST_SLOTS; i++) {
+        if ( pending[i].inUse && pending[i].callback == callback && pending[i].context == context ) {
+            pending[i].inUse = false;
+        }
+    }
+}
+
+uint8_t SNMEA2000RequestClient::getPending() {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < SNMEA2000_REQUEST_SLOTS; i++) {
+        if ( pending[i].inUse ) {
+            n++;
+        }
+    }
+    return n;
+}
+
+void SNMEA2000RequestClient::reply(SNMEA2000PendingRequest *slot, uint8_t status,
+        MessageHeader *messageHeader, const byte * payload, uint16_t length) {
+    SNMEA2000RequestCallback callback = slot->callback;
+    void * context = slot->context;
+    if ( status == SNMEA2000_REQUEST_REPLY && slot->destination == SNMEA2000::broadcastAddress ) {
+        // more replies may follow until the timeout.
+        slot->lastActivity = millis();
+    } else {
+        slot->inUse = false;
+    }
+    callback(context, status, messageHeader, payload, length);
+}
+
+void SNMEA2000RequestClient::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( messageHeader->pgn == ISO_ACKNOWLEDGEMENT_PGN ) {
+        if ( len == 8 ) {
+            handleAcknowledgement(messageHeader, buffer);
+        }
+        return;
+    }
+    for (uint8_t i = 0; i < SNMEA2000_REQUEST_SLOTS; i++) {
+        SNMEA2000PendingRequest * slot = &pending[i];
+        if ( !slot->inUse || slot->pgn != messageHeader->pgn ||
+            (slot->destination != SNMEA2000::broadcastAddress && slot->destination != messageHeader->source) ) {
+            continue;
+        }
+        if ( slot->payload == NULL || len > 8 ) {
+            // a single frame, or a whole message reassembled by a SNMEA2000IsoTP.
+            counters.replies++;
+            reply(slot, SNMEA2000_REQUEST_REPLY, messageHeader, buffer, len);
+            continue;
+        }
+        if ( slot->assemblySource == SNMEA2000::anySource ) {
+            if ( (buffer[0] & 0x1f) != 0 ) {
+                continue; // wait for a first frame.
+            }
+            slot->assemblySource = messageHeader->source;
+        } else if ( slot->assemblySource != messageHeader->source ) {
+            continue;
+        }
+        slot->lastActivity = millis();
+        uint8_t length = assembleFastPacket(&slot->fastPacket, slot->payload, slot->size, buffer, len);
+        if ( length > 0 ) {
+            slot->assemblySource = SNMEA2000::anySource;
+            counters.replies++;
+            reply(slot, SNMEA2000_REQUEST_REPLY, messageHeader, slot->payload, (length > slot->size)?slot->size:length);
+        } else if ( slot->fastPacket.nextFrame == 0 ) {
+            // lost a frame, wait for the next first frame from any source.
+            slot->assemblySource = SNMEA2000::anySource;
+        }
+    }
+}
+
+void SNMEA2000RequestClient::handleAcknowledgement(MessageHeader *messageHeader, byte * buffer) {
+    unsigned long pgn = (((unsigned long)buffer[7])<<16)|(((unsigned long)buffer[6])<<8)|buffer[5];
+    for (uint8_t i = 0; i < SNMEA2000_REQUEST_SLOTS; i++) {
+        SNMEA2000PendingRequest * slot = &pending[i];
+        if ( slot->inUse && slot->pgn == pgn && slot->destination == messageHeader->source ) {
+            if ( buffer[0] == 0 ) {
+                counters.acks++;
+                reply(slot, SNMEA2000_REQUEST_ACK, messageHeader, buffer, 8);
+            } else {
+                counters.naks++;
+                reply(slot, SNMEA2000_REQUEST_NAK, messageHeader, buffer, 8);
+            }
+        }
+    }
+}
+
+void SNMEA2000RequestClient::process() {
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < SNMEA2000_REQUEST_SLOTS; i++) {
+        SNMEA2000PendingRequest * slot = &pending[i];
+        if ( slot->inUse && (now - slot->lastActivity) > timeout ) {
+            if ( slot->destination == SNMEA2000::broadcastAddress ) {
+                reply(slot, SNMEA2000_REQUEST_DONE, NULL, NULL, 0);
+            } else {
+                counters.timeouts++;
+                reply(slot, SNMEA2000_REQUEST_TIMEOUT, NULL, NULL, 0);
+            }
+        }
+    }
+}
+
+void SNMEA2000RequestClient::dumpStatus(Print * console) {
+    console->print(F("Requests sent="));
+    console->print(counters.sent);
+    console->print(F(" deduplicated="));
+    console->print(counters.deduplicated);
+    console->print(F(" replies="));
+    console->print(counters.replies);
+    console->print(F(" naks="));
+    console->print(counters.naks);
+    console->print(F(" acks="));
+    console->print(counters.acks);
+    console->print(F(" timeouts="));
+    console->print(counters.timeouts);
+    console->print(F(" full="));
+    console->print(counters.full);
+    console->print(F(" pending="));
+    console->println(getPending());
+}
@@ -0,0 +1,107 @@
+#ifndef SmallNMEA2000Request_H
+#define SmallNMEA2000Request_H
+
+#include "SmallNMEA2000.h"
+
+// pending requests, each about 24 bytes
+#ifndef SNMEA2000_REQUEST_SLOTS
+#define SNMEA2000_REQUEST_SLOTS 4
+#endif
+// ms without a reply frame before a request times out, ISO 11783 allows 1250ms to respond
+#define SNMEA2000_REQUEST_TIMEOUT_PERIOD 1250
+
+// status passed to a SNMEA2000RequestCallback
+#define SNMEA2000_REQUEST_REPLY 0
+// the destination sent a 59392 ISO Acknowledgement, payload[0] is the control byte, 1 NAK, 2 access denied, 3 cannot respond
+#define SNMEA2000_REQUEST_NAK 1
+// an addressed request had no reply within the timeout
+#define SNMEA2000_REQUEST_TIMEOUT 2
+// the reply window of a broadcast request has closed
+#define SNMEA2000_REQUEST_DONE 3
+// the destination sent a 59392 ISO Acknowledgement with control byte 0, a positive acknowledgement
+#define SNMEA2000_REQUEST_ACK 4
+
+/**
+ * @brief called with each reply to a request, messageHeader and payload are NULL for _TIMEOUT and _DONE.
+ * length can be up to 1785 for replies sent with transport protocol and reassembled by a SNMEA2000IsoTP.
+ * The request has been removed before the callback, except for replies to broadcasts, so the callback can
+ * make another request.
+ */
+typedef void (*SNMEA2000RequestCallback)(void * context, uint8_t status, MessageHeader *messageHeader, const byte * payload, uint16_t length);
+
+typedef struct SNMEA2000PendingRequest {
+    unsigned long pgn;
+    unsigned long lastActivity; // millis() when sent or the last reply frame arrived
+    SNMEA2000RequestCallback callback;
+    void * context;
+    byte * payload; // fast packet reassembly, NULL for single frame replies
+    uint8_t size;
+    uint8_t destination;
+    uint8_t assemblySource; // source of the fast packet being reassembled, or anySource
+    bool inUse;
+    SNMEA2000FastPacketState fastPacket;
+} SNMEA2000PendingRequest;
+
+typedef struct SNMEA2000RequestCounters {
+    uint16_t sent;
+    uint16_t deduplicated;
+    uint16_t replies;
+    uint16_t naks;
+    uint16_t acks;
+    uint16_t timeouts;
+    uint16_t full;
+} SNMEA2000RequestCounters;
+
+/**
+ * Sends 59904 ISO Requests and matches the replies, eg a remote 126996 Product Information,
+ * a one off 127513 or an address claim sweep with request(60928L, SNMEA2000::broadcastAddress, ...).
+ *
+ * Requests are held in a fixed table of SNMEA2000_REQUEST_SLOTS. A reply is a message with the
+ * requested PGN from the destination, reassembled into a caller supplied buffer for fast packets,
+ * or a 59392 ISO Acknowledgement for the PGN. An addressed request completes with the first reply or
+ * after SNMEA2000_REQUEST_TIMEOUT_PERIOD ms without one; a broadcast passes every reply to the callback and
+ * completes with _DONE once the replies stop for the timeout. Broadcast fast packet replies are
+ * reassembled one source at a time, frames from other sources while one is in progress are dropped.
+ * Replies longer than 8 bytes are whole messages from a SNMEA2000IsoTP and are passed to the callback
+ * as they are, not through the fast packet buffer.
+ * A request for a PGN and destination already pending is not sent again, it waits for the same reply.
+ *
+ * Register with addListener(). 59904 must be in the tx list and each requested PGN in the rx list.
+ */
+class SNMEA2000RequestClient : public SNMEA2000Listener {
+    public:
+        /**
+         * @brief request a single frame PGN, false if the table is full or the address not claimed.
+         */
+        bool request(unsigned long pgn, uint8_t destination, SNMEA2000RequestCallback callback, void * context = NULL) {
+            return add(pgn, destination, NULL, 0, callback, context);
+        };
+        /**
+         * @brief request a fast packet PGN, reassembling at most size bytes into payload, which must
+         * remain valid until the callback.
+         */
+        bool requestFastPacket(unsigned long pgn, uint8_t destination, byte * payload, uint8_t size,
+                SNMEA2000RequestCallback callback, void * context = NULL) {
+            return (payload != NULL && size > 0) && add(pgn, destination, payload, size, callback, context);
+        };
+        /**
+         * @brief drop pending requests with this callback and context without calling it.
+         */
+        void cancel(SNMEA2000RequestCallback callback, void * context = NULL);
+        uint8_t getPending();
+        void setTimeout(uint16_t timeout) { this->timeout = timeout; };
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        void process() override;
+        SNMEA2000RequestCounters * getCounters() { return &counters; };
+        void dumpStatus(Print * console);
+    private:
+        bool add(unsigned long pgn, uint8_t destination, byte * payload, uint8_t size,
+            SNMEA2000RequestCallback callback, void * context);
+        void handleAcknowledgement(MessageHeader *messageHeader, byte * buffer);
+        void reply(SNMEA2000PendingRequest *pending, uint8_t status, MessageHeader *messageHeader, const byte * payload, uint16_t length);
+        SNMEA2000PendingRequest pending[SNMEA2000_REQUEST_SLOTS] = {};
+        SNMEA2000RequestCounters counters = {};
+        uint16_t timeout = SNMEA2000_REQUEST_TIMEOUT_PERIOD;
+};
+
+#endif
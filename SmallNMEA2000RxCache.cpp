@@ -0,0 +1,124 @@
+#include "SmallNMEA2000RxCache.h"
+
+
+uint16_t SNMEA2000RxCache::requiredArenaSize(const SNMEA2000CacheSlot * slots, uint8_t nSlots) {
+    uint16_t size = 0;
+    for (uint8_t i = 0; i < nSlots; i++) {
+        size += (slots[i].size > 8)?2*slots[i].size:slots[i].size;
+    }
+    return size;
+}
+
+bool SNMEA2000RxCache::begin() {
+    uint16_t offset = 0;
+    bool fits = true;
+    for (uint8_t i = 0; i < nSlots; i++) {
+        SNMEA2000CacheSlot *slot = &slots[i];
+        if ( slot->size > 223 ) {
+            slot->size = 223;
+        }
+        uint16_t required = (slot->size > 8)?2*slot->size:slot->size;
+        if ( offset+required > arenaSize ) {
+            slot->size = 0;
+            fits = false;
+        }
+        slot->offset = offset;
+        slot->length = 0;
+        slot->current = 0;
+        slot->fastPacket.nextFrame = 0;
+        slot->assemblySource = SNMEA2000::anySource;
+        slot->assemblyStarted = 0;
+        slot->receivedAt = 0;
+        slot->capturedAt = 0;
+        offset += (slot->size > 8)?2*slot->size:slot->size;
+    }
+    return fits;
+}
+
+void SNMEA2000RxCache::onMessage(MessageHeader *messageHeader, byte * buffer, int len) {
+    for (uint8_t i = 0; i < nSlots; i++) {
+        SNMEA2000CacheSlot *slot = &slots[i];
+        if ( slot->pgn != messageHeader->pgn || slot->size == 0 ) {
+            continue;
+        }
+        if ( slot->source != SNMEA2000::anySource && slot->source != messageHeader->source ) {
+            continue;
+        }
+        if ( slot->size > 8 ) {
+            updateFastPacket(slot, messageHeader, buffer, len);
+        } else {
+            updateSingleFrame(slot, buffer, len);
+        }
+    }
+}
+
+void SNMEA2000RxCache::updateSingleFrame(SNMEA2000CacheSlot *slot, byte * buffer, int len) {
+    if ( len <= 0 || len > 8 ) {
+        return;
+    }
+    if ( slot->instanceOffset != noInstance &&
+        (slot->instanceOffset >= len || buffer[slot->instanceOffset] != slot->instance) ) {
+        return;
+    }
+    uint8_t n = (len > slot->size)?slot->size:len;
+    memcpy(&arena[slot->offset], buffer, n);
+    slot->length = n;
+    slot->receivedAt = millis();
+    slot->capturedAt = (device != NULL)?device->getRxTimestamp():micros();
+}
+
+void SNMEA2000RxCache::updateFastPacket(SNMEA2000CacheSlot *slot, MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( len < 2 || len > 8 ) {
+        return;
+    }
+    bool firstFrame = (buffer[0] & 0x1f) == 0;
+    if ( slot->assemblySource != SNMEA2000::anySource && slot->assemblySource != messageHeader->source ) {
+        // another source sending the same PGN, unless the packet being reassembled has stalled.
+        if ( !firstFrame || (millis() - slot->assemblyStarted) < SNMEA2000_CACHE_FAST_PACKET_TIMEOUT ) {
+            return;
+        }
+    } else if ( slot->assemblySource == SNMEA2000::anySource && !firstFrame ) {
+        return; // wait for a first frame.
+    }
+    if ( firstFrame && slot->instanceOffset != noInstance && slot->instanceOffset < 6 &&
+        (2+slot->instanceOffset >= len || buffer[2+slot->instanceOffset] != slot->instance) ) {
+        if ( slot->assemblySource == messageHeader->source ) {
+            slot->assemblySource = SNMEA2000::anySource;
+        }
+        return;
+    }
+    if ( firstFrame ) {
+        slot->assemblySource = messageHeader->source;
+        slot->assemblyStarted = millis();
+    }
+    uint8_t length = assembleFastPacket(&slot->fastPacket, assemblyPayload(slot), slot->size, buffer, len);
+    if ( slot->fastPacket.nextFrame == 0 || length > 0 ) {
+        // lost a frame or complete, wait for the next first frame from any source.
+        slot->assemblySource = SNMEA2000::anySource;
+    }
+    if ( length > 0 ) {
+        // complete, swap the halves.
+        slot->current ^= 1;
+        slot->length = (length > slot->size)?slot->size:length;
+        slot->receivedAt = millis();
+        slot->capturedAt = (device != NULL)?device->getRxTimestamp():micros();
+    }
+}
+
+SNMEA2000FieldView SNMEA2000RxCache::get(uint8_t slot) {
+    if ( slot >= nSlots || slots[slot].size == 0 ) {
+        return SNMEA2000FieldView(arena, 0);
+    }
+    SNMEA2000CacheSlot *s = &slots[slot];
+    if ( s->size > 8 ) {
+        return SNMEA2000FieldView(currentPayload(s), s->length);
+    }
+    return SNMEA2000FieldView(&arena[s->offset], s->length);
+}
+
+unsigned long SNMEA2000RxCache::age(uint8_t slot) {
+    if ( slot >= nSlots || slots[slot].length == 0 ) {
+        return never;
+    }
+    return millis() - slots[slot].receivedAt;
+}
@@ -0,0 +1,336 @@
+#ifndef SmallNMEA2000RxCache_H
+#define SmallNMEA2000RxCache_H
+
+#include "SmallNMEA2000.h"
+#include "SmallNMEA2000Fields.h"
+
+// ms after which a fast packet from one source that has not completed can be replaced by another source.
+#define SNMEA2000_CACHE_FAST_PACKET_TIMEOUT 750
+
+/**
+ * A slot in the SNMEA2000RxCache holding the latest payload of a PGN, optionally
+ * restricted to one source address and/or an instance byte in the payload.
+ * Slots are declared in RAM by the application, only the first 5 fields
+ * need to be set, the rest are maintained by the cache, eg
+ *
+ * SNMEA2000CacheSlot cacheSlots[] = {
+ *    { 127508L, SNMEA2000::anySource, 0, 1, 8 }, // battery instance 1
+ *    { 127489L, SNMEA2000::anySource, 0, 0, 26 }, // engine 0, fast packet
+ *    { 130312L, 35, SNMEA2000RxCache::noInstance, 0, 8 } // any temperature from address 35
+ * };
+ *
+ * The PGNs must also be in the rx list, or they will be filtered before reaching the cache.
+ */
+typedef struct SNMEA2000CacheSlot {
+    unsigned long pgn;
+    uint8_t source; // source address or SNMEA2000::anySource
+    uint8_t instanceOffset; // payload offset of the instance byte, must be < 6 for fast packets, or SNMEA2000RxCache::noInstance
+    uint8_t instance; // instance byte to match, eg for 127505 (type<<4)|instance
+    uint8_t size; // max payload bytes kept, > 8 for fast packets, max 223
+
+    // maintained by the cache.
+    uint8_t length; // bytes in the latest payload, 0 if none.
+    uint8_t current; // half of the double buffer holding the latest fast packet
+    SNMEA2000FastPacketState fastPacket;
+    uint8_t assemblySource; // source of the fast packet being reassembled, or anySource
+    unsigned long assemblyStarted; // millis() of the first frame being reassembled
+    uint16_t offset; // into the arena
+    unsigned long receivedAt; // millis()
+    unsigned long capturedAt; // micros() the transport captured the last frame, see SNMEA2000Clock::toBusTime
+} SNMEA2000CacheSlot;
+
+
+/**
+ * Zero copy view of a payload, decoding fields on demand. Offsets are in bytes,
+ * multi byte fields are little endian. Fields beyond the payload length and
+ * fields containing the N2K not available or out of range codes decode as
+ * SNMEA2000::n2kDoubleNA. Views are only valid until the next call to processMessages.
+ */
+class SNMEA2000FieldView {
+    public:
+        SNMEA2000FieldView(const byte * data, uint8_t length) :
+            data{data},
+            length{length} {
+        };
+        bool isAvailable() { return length > 0; };
+        uint8_t getLength() { return length; };
+
+        uint8_t get1ByteUInt(uint8_t offset) {
+            return (offset < length)?data[offset]:0xff;
+        };
+        uint16_t get2ByteUInt(uint8_t offset) {
+            return has(offset, 2)?(((uint16_t)data[offset+1])<<8)|data[offset]:0xffff;
+        };
+        int16_t get2ByteInt(uint8_t offset) {
+            return has(offset, 2)?(int16_t)get2ByteUInt(offset):0x7fff;
+        };
+        uint32_t get3ByteUInt(uint8_t offset) {
+            return has(offset, 3)?(((uint32_t)data[offset+2])<<16)|(((uint32_t)data[offset+1])<<8)|data[offset]:0xffffff;
+        };
+        int32_t get3ByteInt(uint8_t offset) {
+            if ( !has(offset, 3) ) {
+                return 0x7fffff;
+            }
+            uint32_t v = get3ByteUInt(offset);
+            return (v & 0x800000)?(int32_t)(v | 0xff000000):(int32_t)v;
+        };
+        uint32_t get4ByteUInt(uint8_t offset) {
+            return has(offset, 4)?(((uint32_t)get2ByteUInt(offset+2))<<16)|get2ByteUInt(offset):0xffffffff;
+        };
+        int32_t get4ByteInt(uint8_t offset) {
+            return has(offset, 4)?(int32_t)get4ByteUInt(offset):0x7fffffff;
+        };
+
+        double get1ByteUDouble(uint8_t offset, double precision) {
+            uint8_t v = get1ByteUInt(offset);
+            return (v >= 0xfe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        double get2ByteDouble(uint8_t offset, double precision) {
+            int16_t v = get2ByteInt(offset);
+            return (v >= 0x7ffe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        double get2ByteUDouble(uint8_t offset, double precision) {
+            uint16_t v = get2ByteUInt(offset);
+            return (v >= 0xfffe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        double get3ByteDouble(uint8_t offset, double precision) {
+            int32_t v = get3ByteInt(offset);
+            return (v >= 0x7ffffe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        double get3ByteUDouble(uint8_t offset, double precision) {
+            uint32_t v = get3ByteUInt(offset);
+            return (v >= 0xfffffe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        double get4ByteDouble(uint8_t offset, double precision) {
+            int32_t v = get4ByteInt(offset);
+            return (v >= 0x7ffffffe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        double get4ByteUDouble(uint8_t offset, double precision) {
+            uint32_t v = get4ByteUInt(offset);
+            return (v >= 0xfffffffe)?SNMEA2000::n2kDoubleNA:v*precision;
+        };
+        /**
+         * @brief fields that are not whole bytes, all bits set if beyond the payload.
+         */
+        uint32_t getBits(uint16_t bitOffset, uint8_t bitLength) {
+            if ( bitOffset + bitLength > length*8 ) {
+                return SNMEA2000Fields::maxRaw(bitLength, false);
+            }
+            return SNMEA2000Fields::getBits(data, bitOffset, bitLength);
+        };
+        int32_t getSignedBits(uint16_t bitOffset, uint8_t bitLength) {
+            uint32_t v = getBits(bitOffset, bitLength);
+            if ( bitOffset + bitLength > length*8 ) {
+                return (int32_t)SNMEA2000Fields::maxRaw(bitLength, true);
+            }
+            if ( bitLength < 32 && (v & (1UL << (bitLength-1))) != 0 ) {
+                v |= ~((1UL << bitLength) - 1);
+            }
+            return (int32_t)v;
+        };
+        double getBitsUDouble(uint16_t bitOffset, uint8_t bitLength, double precision, double offset = 0) {
+            uint32_t v = getBits(bitOffset, bitLength);
+            return (v >= SNMEA2000Fields::maxRaw(bitLength, false) - 1)?SNMEA2000::n2kDoubleNA:v*precision + offset;
+        };
+        double getBitsDouble(uint16_t bitOffset, uint8_t bitLength, double precision, double offset = 0) {
+            int32_t v = getSignedBits(bitOffset, bitLength);
+            return (v >= (int32_t)SNMEA2000Fields::maxRaw(bitLength, true) - 1)?SNMEA2000::n2kDoubleNA:v*precision + offset;
+        };
+
+    protected:
+        bool has(uint8_t offset, uint8_t bytes) {
+            return (offset+bytes) <= length;
+        };
+        const byte * data;
+        uint8_t length;
+};
+
+/**
+ * Typed views of the PGNs this library sends, field offsets match the encoders in
+ * EngineMonitor and PressureMonitor. Units are the same as the encoders.
+ */
+
+// PGN 127488
+class RapidEngineDataView : public SNMEA2000FieldView {
+    public:
+        RapidEngineDataView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t engineInstance() { return get1ByteUInt(0); };
+        double engineSpeed() { return get2ByteUDouble(1, 0.25); }; // RPM
+        double engineBoostPressure() { return get2ByteUDouble(3, 100); }; // Pa
+        uint8_t engineTiltTrim() { return get1ByteUInt(5); }; // %
+};
+
+// PGN 127489
+class EngineDynamicParamView : public SNMEA2000FieldView {
+    public:
+        EngineDynamicParamView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t engineInstance() { return get1ByteUInt(0); };
+        double engineOilPressure() { return get2ByteUDouble(1, 100); }; // Pa
+        double engineOilTemperature() { return get2ByteUDouble(3, 0.1); }; // K
+        double engineCoolantTemperature() { return get2ByteUDouble(5, 0.01); }; // K
+        double alternatorVoltage() { return get2ByteDouble(7, 0.01); }; // V
+        double fuelRate() { return get2ByteDouble(9, 0.1); }; // l/h
+        double engineHours() { return get4ByteUDouble(11, 1); }; // s
+        double engineCoolantPressure() { return get2ByteUDouble(15, 100); }; // Pa
+        double engineFuelPressure() { return get2ByteUDouble(17, 1000); }; // Pa
+        uint16_t status1() { return get2ByteUInt(20); };
+        uint16_t status2() { return get2ByteUInt(22); };
+        uint8_t engineLoad() { return get1ByteUInt(24); }; // %
+        uint8_t engineTorque() { return get1ByteUInt(25); }; // %
+};
+
+// PGN 127505
+class FluidLevelView : public SNMEA2000FieldView {
+    public:
+        FluidLevelView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t type() { return get1ByteUInt(0)>>4; };
+        uint8_t instance() { return get1ByteUInt(0)&0x0f; };
+        double level() { return get2ByteDouble(1, 0.004); }; // %
+        double capacity() { return get4ByteUDouble(3, 0.1); }; // l
+};
+
+// PGN 127508
+class DCBatteryStatusView : public SNMEA2000FieldView {
+    public:
+        DCBatteryStatusView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t batteryInstance() { return get1ByteUInt(0); };
+        double batteryVoltage() { return get2ByteDouble(1, 0.01); }; // V
+        double batteryCurrent() { return get2ByteDouble(3, 0.1); }; // A
+        double batteryTemperature() { return get2ByteUDouble(5, 0.01); }; // K
+        uint8_t sid() { return get1ByteUInt(7); };
+};
+
+// PGN 130312
+class TemperatureView : public SNMEA2000FieldView {
+    public:
+        TemperatureView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t sid() { return get1ByteUInt(0); };
+        uint8_t instance() { return get1ByteUInt(1); };
+        uint8_t source() { return get1ByteUInt(2); };
+        double actual() { return get2ByteUDouble(3, 0.01); }; // K
+        double requested() { return get2ByteUDouble(5, 0.01); }; // K
+};
+
+// PGN 130316
+class ExtendedTemperatureView : public SNMEA2000FieldView {
+    public:
+        ExtendedTemperatureView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t sid() { return get1ByteUInt(0); };
+        uint8_t instance() { return get1ByteUInt(1); };
+        uint8_t source() { return get1ByteUInt(2); };
+        double temperature() { return get3ByteUDouble(3, 0.001); }; // K
+        double setTemperature() { return get2ByteUDouble(6, 0.1); }; // K
+};
+
+// PGN 130310
+class OutsideEnvironmentView : public SNMEA2000FieldView {
+    public:
+        OutsideEnvironmentView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t sid() { return get1ByteUInt(0); };
+        double waterTemperature() { return get2ByteUDouble(1, 0.01); }; // K
+        double outsideAirTemperature() { return get2ByteUDouble(3, 0.01); }; // K
+        double atmosphericPressure() { return get2ByteUDouble(5, 100); }; // Pa
+};
+
+// PGN 130311
+class EnvironmentParametersView : public SNMEA2000FieldView {
+    public:
+        EnvironmentParametersView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t sid() { return get1ByteUInt(0); };
+        uint8_t temperatureSource() { return get1ByteUInt(1)&0x3f; };
+        uint8_t humiditySource() { return (get1ByteUInt(1)>>6)&0x03; };
+        double temperature() { return get2ByteUDouble(2, 0.01); }; // K
+        double humidity() { return get2ByteDouble(4, 0.004); }; // %
+        double atmosphericPressure() { return get2ByteUDouble(6, 100); }; // Pa
+};
+
+// PGN 130313
+class HumidityView : public SNMEA2000FieldView {
+    public:
+        HumidityView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t sid() { return get1ByteUInt(0); };
+        uint8_t instance() { return get1ByteUInt(1); };
+        uint8_t source() { return get1ByteUInt(2); };
+        double humidity() { return get2ByteDouble(3, 0.004); }; // %
+        double setHumidity() { return get2ByteDouble(5, 0.004); }; // %
+};
+
+// PGN 130314
+class PressureView : public SNMEA2000FieldView {
+    public:
+        PressureView(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};
+        uint8_t sid() { return get1ByteUInt(0); };
+        uint8_t instance() { return get1ByteUInt(1); };
+        uint8_t source() { return get1ByteUInt(2); };
+        double pressure() { return get4ByteDouble(3, 0.1); }; // Pa
+};
+
+
+/**
+ * Keeps the latest payload of each slot in a single arena so that application loops
+ * can read current values by slot index without decoding every message.
+ * Fast packets are reassembled in place and double buffered, so fast packet slots use
+ * 2*size bytes of the arena and single frame slots use size bytes. A fast packet slot for any source
+ * reassembles one source at a time, frames from other sources are ignored until the packet completes,
+ * a frame is lost, or SNMEA2000_CACHE_FAST_PACKET_TIMEOUT ms pass without it completing.
+ *
+ * SNMEA2000RxCache rxCache(&cacheSlots[0], 3, &cacheArena[0], sizeof(cacheArena));
+ * ...
+ *   rxCache.begin();
+ *   n2k.addListener(&rxCache);
+ * ...
+ *   DCBatteryStatusView battery(rxCache.get(0));
+ *   if ( rxCache.age(0) < 5000 ) {
+ *      v = battery.batteryVoltage();
+ *   }
+ */
+class SNMEA2000RxCache : public SNMEA2000Listener {
+    public:
+        SNMEA2000RxCache(SNMEA2000CacheSlot * slots, uint8_t nSlots, byte * arena, uint16_t arenaSize) :
+            slots{slots},
+            arena{arena},
+            arenaSize{arenaSize},
+            nSlots{nSlots} {
+        };
+        /**
+         * @brief lay out the arena, false if it is too small for all the slots, in which case the
+         * slots that dont fit are disabled.
+         */
+        bool begin();
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override;
+        /**
+         * @brief view of the latest payload in a slot, empty if nothing has been recieved.
+         */
+        SNMEA2000FieldView get(uint8_t slot);
+        /**
+         * @brief ms since the latest payload in slot was recieved, SNMEA2000RxCache::never if never.
+         */
+        unsigned long age(uint8_t slot);
+        /**
+         * @brief micros() when the last frame of the latest payload in slot was captured by the transport.
+         */
+        unsigned long capturedAt(uint8_t slot) { return slots[slot].capturedAt; };
+        /**
+         * @brief arena bytes required by slots.
+         */
+        static uint16_t requiredArenaSize(const SNMEA2000CacheSlot * slots, uint8_t nSlots);
+
+        static const uint8_t noInstance = 0xff;
+        static const unsigned long never = 0xffffffff;
+    private:
+        void updateSingleFrame(SNMEA2000CacheSlot *slot, byte * buffer, int len);
+        void updateFastPacket(SNMEA2000CacheSlot *slot, MessageHeader *messageHeader, byte * buffer, int len);
+        byte * currentPayload(SNMEA2000CacheSlot *slot) {
+            return &arena[slot->offset + ((slot->current != 0)?slot->size:0)];
+        };
+        byte * assemblyPayload(SNMEA2000CacheSlot *slot) {
+            return &arena[slot->offset + ((slot->current == 0)?slot->size:0)];
+        };
+        SNMEA2000CacheSlot * slots;
+        byte * arena;
+        uint16_t arenaSize;
+        uint8_t nSlots;
+};
+
+
+#endif
@@ -32,7 +32,8 @@ const SNMEA2000ConfigInfo configInfo PROGMEM={
 };
 
 
-const unsigned long txPGN[] PROGMEM = { 
+// rx and tx lists are checked on every frame so are kept in RAM.
+const unsigned long txPGN[] = { 
     127488L, // Rapid engine ideally 0.1s
     127489L, // Dynamic engine 0.5s
     127505L, // Tank Level 2.5s
@@ -40,7 +41,7 @@ const unsigned long txPGN[] PROGMEM = {
     127508L,
   SNMEA200_DEFAULT_TX_PGN
 };
-const unsigned long rxPGN[] PROGMEM = { 
+const unsigned long rxPGN[] = { 
   SNMEA200_DEFAULT_RX_PGN
 };
 
@@ -54,13 +55,30 @@ SNMEA2000DeviceInfo devInfo = SNMEA2000DeviceInfo(
 #define DEVICE_ADDRESS 24
 #define SNMEA_SPI_CS_PIN 10
 
+SNMEA2000MCP2515 canTransport = SNMEA2000MCP2515(SNMEA_SPI_CS_PIN);
+
 EngineMonitor engineMonitor = EngineMonitor(DEVICE_ADDRESS,
   &devInfo,
   &productInfomation, 
   &configInfo, 
   &txPGN[0], 
+  sizeof(txPGN)/sizeof(unsigned long),
   &rxPGN[0],
-  SNMEA_SPI_CS_PIN);
+  sizeof(rxPGN)/sizeof(unsigned long),
+  &canTransport);
+
+// fuel and temperatures are low priority and back off when the bus is busy.
+const SNMEA2000ThrottleCurve lowPriorityThrottle = {
+  {50, 70, 85}, // % bus load
+  {2, 4, 10}    // period multiplier
+};
+
+#define FUEL_SCHEDULE 0
+#define TEMPERATURE_SCHEDULE 1
+SNMEA2000TxSchedule txSchedule[] = {
+  { 127505L, FUEL_UPDATE_PERIOD, &lowPriorityThrottle, 0, 0, 0 },
+  { 130312L, TEMPERATURE_UPDATE_PERIOD, &lowPriorityThrottle, 0, 0, 0 }
+};
 
 
 void sendRapidEngineData() {
@@ -87,38 +105,31 @@ void sendEngineData() {
 
 void sendVoltages() {
   static unsigned long lastVoltageUpdate=0;
-  static byte sid = 0;
   unsigned long now = millis();
   if ( now-lastVoltageUpdate > VOLTAGE_UPDATE_PERIOD ) {
     lastVoltageUpdate = now;
+    // both batteries are read in one pass and share a sid.
+    byte sid = engineMonitor.nextSid();
     // because the engine monitor is not on all the time, the sid and instance ids of these messages has been shifted
     // to make space for sensors that are on all the time, and would be used by default
     engineMonitor.sendDCBatterStatusMessage(SERVICE_BATTERY_INSTANCE, sid, 14.3);
     engineMonitor.sendDCBatterStatusMessage(ENGINE_BATTERY_INSTANCE, sid, 14.1);
-    sid++;
   }
 }
 
 void sendFuel() {
-  static unsigned long lastFuelUpdate=0;
-  unsigned long now = millis();
-  if ( now-lastFuelUpdate > FUEL_UPDATE_PERIOD ) {
-    lastFuelUpdate = now;
+  if ( engineMonitor.isTxDue(FUEL_SCHEDULE) ) {
     engineMonitor.sendFluidLevelMessage(FUEL_TYPE, FUEL_LEVEL_INSTANCE, 80, 60);
 
   }
 }
 
 void sendTemperatures() {
-  static unsigned long lastTempUpdate=0;
-  static byte sid = 0;
-  unsigned long now = millis();
-  if ( now-lastTempUpdate > TEMPERATURE_UPDATE_PERIOD ) {
-    lastTempUpdate = now;
+  if ( engineMonitor.isSampleDue(TEMPERATURE_SCHEDULE) ) {
+    byte sid = engineMonitor.getSampleSid(TEMPERATURE_SCHEDULE);
     engineMonitor.sendTemperatureMessage(sid, 0, 14,440);
     engineMonitor.sendTemperatureMessage(sid, 1, 3, 350);
     engineMonitor.sendTemperatureMessage(sid, 2, 15, 350);
-    sid++;
   }
 }
 
@@ -126,6 +137,7 @@ void setup() {
   Serial.begin(115200);
   Serial.println(F("Example engine monitor start"));
   Serial.println(F("Opening CAN"));
+  engineMonitor.setTxSchedule(&txSchedule[0], sizeof(txSchedule)/sizeof(SNMEA2000TxSchedule));
   while (!engineMonitor.open() ) {
      Serial.println(F("Failed to start NMEA2000, retry in 5s"));
     delay(5000);
@@ -0,0 +1,294 @@
+#!/usr/bin/env python3
+"""
+Generate PGN encoders, decoders and PROGMEM field tables from the canboat PGN database.
+
+    generator/n2kgen.py -i canboat.json -o SmallNMEA2000PGNs.h 130311 127489 engineParametersRapidUpdate
+
+canboat.json is docs/canboat.json from https://github.com/canboat/canboat. PGNs are selected by
+number, which selects every definition of that PGN, or by canboat Id. For each PGN the header has
+
+    N2k<Id>Fields[]     PROGMEM field table for SNMEA2000Fields::encode/decode
+    N2k<Id>PGN          SNMEA2000PGNDef for the table
+    sendN2k<Id>()       inline encoder, builds the payload and sends it as a frame or fast packet
+    N2k<Id>View         SNMEA2000FieldView with a typed getter per field
+
+Everything is inline or const so only what a build uses is linked. Numbers with a resolution or
+offset or a unit are doubles in the units of canboat (SI), rounded to the resolution and encoded
+as not available when SNMEA2000::n2kDoubleNA. Lookups and unitless numbers are integers. PGNs
+with variable length or repeating fields, or fields over 32 bits, are skipped with a warning.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+SUPPORTED = {
+    "NUMBER", "LOOKUP", "BITLOOKUP", "INDIRECT_LOOKUP", "FIELDTYPE_LOOKUP", "TIME", "DATE",
+    "DURATION", "MMSI", "PGN", "BINARY", "RESERVED", "SPARE", "STRING_FIX", "DECIMAL"
+}
+INTEGER_TYPES = {"LOOKUP", "BITLOOKUP", "INDIRECT_LOOKUP", "FIELDTYPE_LOOKUP", "MMSI", "PGN", "BINARY"}
+
+
+class Skip(Exception):
+    pass
+
+
+def identifier(s):
+    s = re.sub(r"[^0-9A-Za-z]+", " ", s).strip()
+    words = s.split(" ")
+    name = words[0] + "".join(w[:1].upper() + w[1:] for w in words[1:])
+    if not name or name[0].isdigit():
+        name = "f" + name
+    return name
+
+
+def typeName(name):
+    return name[:1].upper() + name[1:]
+
+
+def number(v):
+    r = repr(float(v))
+    return r if ("e" in r or "." in r) else r + ".0"
+
+
+def intType(bits, signed):
+    for size in (8, 16, 32):
+        if bits <= size:
+            return ("int%d_t" if signed else "uint%d_t") % size
+    raise Skip("field over 32 bits")
+
+
+class Field:
+    def __init__(self, f):
+        self.id = identifier(f.get("Id") or f.get("Name"))
+        self.name = f.get("Name", self.id)
+        self.kind = f.get("FieldType", "NUMBER")
+        self.bitOffset = int(f["BitOffset"])
+        self.bitLength = int(f["BitLength"])
+        self.signed = bool(f.get("Signed", False))
+        self.resolution = float(f.get("Resolution", 1) or 1)
+        self.offset = float(f.get("Offset", 0) or 0)
+        self.unit = f.get("Unit", "")
+        if self.kind not in SUPPORTED:
+            raise Skip("%s field %s" % (self.kind, self.id))
+        if self.kind != "STRING_FIX" and self.bitLength > 32:
+            raise Skip("field %s over 32 bits" % self.id)
+        if self.kind == "STRING_FIX" and (self.bitOffset % 8 != 0 or self.bitLength % 8 != 0):
+            raise Skip("unaligned string %s" % self.id)
+
+    def isFiller(self):
+        return self.kind in ("RESERVED", "SPARE")
+
+    def isDouble(self):
+        return (self.kind not in INTEGER_TYPES and self.kind != "STRING_FIX" and not self.isFiller()
+                and (self.resolution != 1 or self.offset != 0 or self.unit != ""))
+
+    def cType(self):
+        if self.kind == "STRING_FIX":
+            return "const char *"
+        if self.isDouble():
+            return "double "
+        return intType(self.bitLength, self.signed) + " "
+
+    def aligned(self):
+        return self.bitOffset % 8 == 0 and self.bitLength in (8, 16, 24, 32)
+
+    def comment(self):
+        c = self.name
+        if self.unit:
+            c += ", " + self.unit
+        return c
+
+
+class PGN:
+    def __init__(self, p):
+        self.pgn = int(p["PGN"])
+        self.id = identifier(p["Id"])
+        self.description = p.get("Description", self.id)
+        self.fast = p.get("Type", "Single") == "Fast"
+        self.priority = int(p.get("Priority", 6) or 6)
+        if p.get("RepeatingFieldSet1Size") or p.get("RepeatingFields"):
+            raise Skip("repeating fields")
+        if p.get("Type") not in (None, "Single", "Fast"):
+            raise Skip("%s PGN" % p.get("Type"))
+        self.fields = [Field(f) for f in p.get("Fields", [])]
+        self.fields.sort(key=lambda f: f.bitOffset)
+        bits = max([f.bitOffset + f.bitLength for f in self.fields] or [0])
+        self.length = int(p.get("Length") or (bits + 7)//8)
+        if self.length > 223 or (not self.fast and self.length > 8):
+            raise Skip("length %d" % self.length)
+        seen = set()
+        for f in self.fields:
+            base = f.id
+            n = 2
+            while f.id in seen:
+                f.id = "%s%d" % (base, n)
+                n += 1
+            seen.add(f.id)
+
+
+def fieldTable(out, p):
+    name = "N2k" + typeName(p.id)
+    out.append("const SNMEA2000FieldDef %sFields[] PROGMEM = {" % name)
+    for f in p.fields:
+        if f.isFiller() or f.kind == "STRING_FIX":
+            continue
+        out.append("    { %d, %d, %s, %sf, %sf }, // %s" % (f.bitOffset, f.bitLength,
+            "SNMEA2000_FIELD_SIGNED" if f.signed else "0", number(f.resolution), number(f.offset), f.id))
+    out.append("};")
+    out.append("const SNMEA2000PGNDef %sPGN PROGMEM = {" % name)
+    out.append("    %dL, %d, %d, sizeof(%sFields)/sizeof(SNMEA2000FieldDef), %sFields" % (
+        p.pgn, p.length, 1 if p.fast else 0, name, name))
+    out.append("};")
+
+
+def rawExpression(f):
+    if f.isDouble():
+        fn = "encodeSigned" if f.signed else "encodeUnsigned"
+        return "SNMEA2000Fields::%s(%s, %s, %s, %d)" % (fn, f.id, number(1.0/f.resolution), number(f.offset), f.bitLength)
+    return "(uint32_t)%s" % f.id
+
+
+def encoder(out, p):
+    name = typeName(p.id)
+    params = ["SNMEA2000 *device"]
+    for f in p.fields:
+        if not f.isFiller():
+            params.append("%s%s" % (f.cType(), f.id))
+    params.append("byte destination = SNMEA2000::broadcastAddress")
+    params.append("byte priority = %d" % p.priority)
+    out.append("/**")
+    out.append(" * @brief send PGN %d %s%s." % (p.pgn, p.description, ", fast packet" if p.fast else ""))
+    for f in p.fields:
+        if not f.isFiller():
+            out.append(" * @param %s %s" % (f.id, f.comment()))
+    out.append(" */")
+    out.append("inline void sendN2k%s(%s) {" % (name, ",\n        ".join(params)))
+    out.append("    byte payload[%d];" % p.length)
+    # fields that share bytes are masked in, so start from all bits 1 as undefined bits are reserved.
+    packed = any(not f.aligned() and f.kind != "STRING_FIX" for f in p.fields)
+    if packed:
+        out.append("    memset(payload, 0xff, %d);" % p.length)
+    covered = 0
+    for f in p.fields:
+        o = f.bitOffset // 8
+        if f.kind == "STRING_FIX":
+            out.append("    SNMEA2000Fields::putString(&payload[%d], %s, %d);" % (o, f.id, f.bitLength//8))
+        elif f.isFiller():
+            value = ("0x%X" % ((1 << f.bitLength) - 1)) if f.kind == "RESERVED" else "0"
+            if f.aligned():
+                out.append("    SNMEA2000Fields::put%d(&payload[%d], %s); // %s" % (f.bitLength//8, o, value, f.id))
+            else:
+                out.append("    SNMEA2000Fields::setBits(payload, %d, %d, %s); // %s" % (f.bitOffset, f.bitLength, value, f.id))
+        elif f.aligned():
+            out.append("    SNMEA2000Fields::put%d(&payload[%d], %s);" % (f.bitLength//8, o, rawExpression(f)))
+        else:
+            out.append("    SNMEA2000Fields::setBits(payload, %d, %d, %s);" % (f.bitOffset, f.bitLength, rawExpression(f)))
+        covered = max(covered, f.bitOffset + f.bitLength)
+    if not packed and covered < p.length*8:
+        # undefined trailing bytes are reserved.
+        out.append("    for (uint8_t i = %d; i < %d; i++) {" % (covered//8, p.length))
+        out.append("        payload[i] = 0xff;")
+        out.append("    }")
+    out.append("    MessageHeader messageHeader(%dL, priority, device->getAddress(), destination);" % p.pgn)
+    if p.fast:
+        out.append("    device->sendFastPacket(&messageHeader, payload, %d);" % p.length)
+    else:
+        out.append("    device->sendMessage(&messageHeader, payload, %d);" % p.length)
+    out.append("}")
+
+
+def getter(f):
+    if f.isDouble():
+        if f.aligned() and f.offset == 0 and not (f.signed and f.bitLength == 8):
+            fn = "get%dByte%sDouble" % (f.bitLength//8, "" if f.signed else "U")
+            return "double %s() { return %s(%d, %s); };" % (f.id, fn, f.bitOffset//8, number(f.resolution))
+        fn = "getBitsDouble" if f.signed else "getBitsUDouble"
+        return "double %s() { return %s(%d, %d, %s, %s); };" % (f.id, fn, f.bitOffset, f.bitLength,
+            number(f.resolution), number(f.offset))
+    t = intType(f.bitLength, f.signed)
+    if f.aligned() and not f.signed:
+        return "%s %s() { return get%dByteUInt(%d); };" % (t, f.id, f.bitLength//8, f.bitOffset//8)
+    if f.signed:
+        return "%s %s() { return getSignedBits(%d, %d); };" % (t, f.id, f.bitOffset, f.bitLength)
+    return "%s %s() { return getBits(%d, %d); };" % (t, f.id, f.bitOffset, f.bitLength)
+
+
+def view(out, p):
+    name = "N2k" + typeName(p.id) + "View"
+    out.append("// PGN %d %s" % (p.pgn, p.description))
+    out.append("class %s : public SNMEA2000FieldView {" % name)
+    out.append("    public:")
+    out.append("        %s(SNMEA2000FieldView view) : SNMEA2000FieldView{view} {};" % name)
+    out.append("        %s(const byte * data, uint8_t length) : SNMEA2000FieldView{data, length} {};" % name)
+    for f in p.fields:
+        if f.isFiller():
+            continue
+        if f.kind == "STRING_FIX":
+            out.append("        const byte * %s() { return has(%d, %d)?&data[%d]:NULL; }; // %d chars, 0xff padded" % (
+                f.id, f.bitOffset//8, f.bitLength//8, f.bitOffset//8, f.bitLength//8))
+            continue
+        out.append("        %s // %s" % (getter(f), f.comment()))
+    out.append("};")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-i", "--input", required=True, help="canboat.json")
+    parser.add_argument("-o", "--output", help="header to write, default stdout")
+    parser.add_argument("pgns", nargs="+", help="PGN numbers or canboat Ids")
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        db = json.load(f)
+    definitions = db["PGNs"] if isinstance(db, dict) else db
+    selected = []
+    for want in args.pgns:
+        matches = [d for d in definitions if str(d.get("PGN")) == want or d.get("Id") == want]
+        if not matches:
+            sys.exit("%s not found in %s" % (want, args.input))
+        for d in matches:
+            if d not in selected:
+                selected.append(d)
+
+    guard = re.sub(r"[^0-9A-Za-z]", "_", (args.output or "SmallNMEA2000PGNs.h").split("/")[-1].replace(".h", ".H"))
+    out = [
+        "// Generated by generator/n2kgen.py from %s, do not edit." % args.input.split("/")[-1],
+        "// %s" % " ".join(args.pgns),
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        "#include \"SmallNMEA2000.h\"",
+        "#include \"SmallNMEA2000Fields.h\"",
+        "#include \"SmallNMEA2000RxCache.h\"",
+        "",
+    ]
+    names = set()
+    for d in selected:
+        try:
+            p = PGN(d)
+        except (Skip, KeyError, ValueError) as e:
+            sys.stderr.write("Skipping %s %s: %s\n" % (d.get("PGN"), d.get("Id"), e))
+            continue
+        if p.id in names:
+            p.id = "%s%d" % (p.id, p.pgn)
+        names.add(p.id)
+        out.append("// PGN %d %s, %s, %d bytes" % (p.pgn, p.description, "fast packet" if p.fast else "single frame", p.length))
+        fieldTable(out, p)
+        out.append("")
+        encoder(out, p)
+        out.append("")
+        view(out, p)
+        out.append("")
+    out.append("#endif")
+    text = "\n".join(out) + "\n"
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == "__main__":
+    main()
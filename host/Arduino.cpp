@@ -0,0 +1,109 @@
+#include "Arduino.h"
+#include <time.h>
+#include <unistd.h>
+
+HostSerial Serial(stdout);
+
+static struct timespec start = {0, 0};
+static HostClock *hostClock = NULL;
+
+void setHostClock(HostClock *clock) {
+    hostClock = clock;
+}
+
+static uint64_t elapsedMicros() {
+    if ( hostClock != NULL ) {
+        return hostClock->now();
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ( start.tv_sec == 0 && start.tv_nsec == 0 ) {
+        start = now;
+    }
+    return (uint64_t)(now.tv_sec - start.tv_sec)*1000000ULL + (now.tv_nsec - start.tv_nsec)/1000;
+}
+
+unsigned long millis() {
+    return (unsigned long)(elapsedMicros()/1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)elapsedMicros();
+}
+
+void delay(unsigned long ms) {
+    if ( hostClock != NULL ) {
+        hostClock->sleep((uint64_t)ms*1000);
+    } else {
+        usleep(ms*1000);
+    }
+}
+
+void delayMicroseconds(unsigned int us) {
+    if ( hostClock != NULL ) {
+        hostClock->sleep(us);
+    } else {
+        usleep(us);
+    }
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(const char *s) {
+    return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned long long n, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), (base == HEX)?"%llX":"%llu", n);
+    return print(buf);
+}
+
+size_t Print::print(long n, int base) {
+    if ( base == HEX ) {
+        return print((unsigned long long)(unsigned long)n, base);
+    }
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", n);
+    return print(buf);
+}
+
+size_t Print::print(unsigned char n, int base) { return print((unsigned long long)n, base); }
+size_t Print::print(int n, int base) { return print((long)n, base); }
+size_t Print::print(unsigned int n, int base) { return print((unsigned long long)n, base); }
+size_t Print::print(unsigned long n, int base) { return print((unsigned long long)n, base); }
+
+size_t Print::print(double n, int digits) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return print(buf);
+}
+
+size_t Print::println() { return print('\n'); }
+size_t Print::println(const char *s) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char n, int base) { return print(n, base) + println(); }
+size_t Print::println(int n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t Print::println(long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long long n, int base) { return print(n, base) + println(); }
+size_t Print::println(double n, int digits) { return print(n, digits) + println(); }
+
+size_t HostSerial::write(uint8_t c) {
+    return fputc(c, out) == EOF?0:1;
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size) {
+    return fwrite(buffer, 1, size, out);
+}
@@ -0,0 +1,101 @@
+#ifndef SNMEA2000_HOST_ARDUINO_H
+#define SNMEA2000_HOST_ARDUINO_H
+
+/**
+ * Minimal Arduino API for building the library on Linux, see host/Makefile.
+ * Only what the library and host tools use is provided. PROGMEM is ordinary memory.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define F(x) (x)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+// reads the low 32 bits, as AVR does, of a uint32_t or a little endian unsigned long.
+static inline uint32_t pgm_read_dword(const void *addr) {
+    uint32_t v;
+    memcpy(&v, addr, sizeof(v));
+    return v;
+}
+// AVR code assigns the result to char * relying on -fpermissive.
+#define pgm_read_ptr(addr) ((char *)*(void * const *)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#define DEC 10
+#define HEX 16
+
+#define noInterrupts()
+#define interrupts()
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/**
+ * Source of time for millis(), micros() and delay(), by default CLOCK_MONOTONIC
+ * from the first call. Simulations replace it with setHostClock(), NULL restores the default.
+ */
+class HostClock {
+    public:
+        virtual ~HostClock() {};
+        virtual uint64_t now() = 0;
+        virtual void sleep(uint64_t us) = 0;
+};
+
+void setHostClock(HostClock *clock);
+
+class Print {
+    public:
+        virtual ~Print() {};
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size);
+        virtual int availableForWrite() { return 0; };
+        size_t print(const char *s);
+        size_t print(char c);
+        size_t print(unsigned char n, int base = DEC);
+        size_t print(int n, int base = DEC);
+        size_t print(unsigned int n, int base = DEC);
+        size_t print(long n, int base = DEC);
+        size_t print(unsigned long n, int base = DEC);
+        size_t print(unsigned long long n, int base = DEC);
+        size_t print(double n, int digits = 2);
+        size_t println();
+        size_t println(const char *s);
+        size_t println(char c);
+        size_t println(unsigned char n, int base = DEC);
+        size_t println(int n, int base = DEC);
+        size_t println(unsigned int n, int base = DEC);
+        size_t println(long n, int base = DEC);
+        size_t println(unsigned long n, int base = DEC);
+        size_t println(unsigned long long n, int base = DEC);
+        size_t println(double n, int digits = 2);
+};
+
+/**
+ * Print to a stdio stream, Serial prints to stdout.
+ */
+class HostSerial : public Print {
+    public:
+        HostSerial(FILE *out) : out{out} {};
+        void begin(unsigned long) {};
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        int availableForWrite() override { return 4096; };
+        void flush() { fflush(out); };
+    private:
+        FILE *out;
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,241 @@
+#include "CandumpLog.h"
+#include <ctype.h>
+#include <time.h>
+
+static uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+static const char * skipSpace(const char *p, const char *end) {
+    while ( p < end && (*p == ' ' || *p == '\t') ) {
+        p++;
+    }
+    return p;
+}
+
+static int hexValue(char c) {
+    if ( c >= '0' && c <= '9' ) return c - '0';
+    if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+static bool parseHexByte(const char *p, const char *end, byte *b) {
+    if ( end - p < 2 ) {
+        return false;
+    }
+    int h = hexValue(p[0]);
+    int l = hexValue(p[1]);
+    if ( h < 0 || l < 0 ) {
+        return false;
+    }
+    *b = (h<<4)|l;
+    return true;
+}
+
+// seconds.fraction without strtod, which dominates the parse time of large logs.
+static const char * parseTime(const char *p, const char *end, double *time) {
+    uint64_t seconds = 0;
+    while ( p < end && *p >= '0' && *p <= '9' ) {
+        seconds = seconds*10 + (*p++ - '0');
+    }
+    uint64_t fraction = 0;
+    uint64_t scale = 1;
+    if ( p < end && *p == '.' ) {
+        p++;
+        while ( p < end && *p >= '0' && *p <= '9' ) {
+            if ( scale < 1000000000ULL ) {
+                fraction = fraction*10 + (*p - '0');
+                scale *= 10;
+            }
+            p++;
+        }
+    }
+    *time = seconds + (double)fraction/scale;
+    return p;
+}
+
+bool parseCandumpLine(const char *line, size_t length, CandumpFrame *frame) {
+    const char *end = line + length;
+    const char *p = skipSpace(line, end);
+    frame->time = 0;
+    if ( p < end && *p == '(' ) {
+        p = parseTime(p+1, end, &frame->time);
+        if ( p >= end || *p != ')' ) {
+            return false;
+        }
+        p = skipSpace(p+1, end);
+    }
+    // interface name
+    while ( p < end && *p != ' ' && *p != '\t' ) {
+        p++;
+    }
+    p = skipSpace(p, end);
+    // only 29 bit ids, 8 hex digits.
+    unsigned long id = 0;
+    for (int i = 0; i < 8; i++, p++) {
+        int v = (p < end)?hexValue(*p):-1;
+        if ( v < 0 ) {
+            return false;
+        }
+        id = (id<<4)|v;
+    }
+    frame->id = id & 0x1fffffff;
+    frame->len = 0;
+    if ( p < end && *p == '#' ) {
+        p++;
+        while ( frame->len < 8 && parseHexByte(p, end, &frame->buf[frame->len]) ) {
+            frame->len++;
+            p += 2;
+        }
+        return true;
+    }
+    p = skipSpace(p, end);
+    if ( p >= end || *p != '[' || p+2 >= end || p[1] < '0' || p[1] > '8' || p[2] != ']' ) {
+        return false;
+    }
+    int dlc = p[1] - '0';
+    p += 3;
+    for (int i = 0; i < dlc; i++) {
+        p = skipSpace(p, end);
+        if ( !parseHexByte(p, end, &frame->buf[frame->len]) ) {
+            return false;
+        }
+        frame->len++;
+        p += 2;
+    }
+    return true;
+}
+
+void writeCandumpLine(FILE *out, double time, const char *interfaceName, unsigned long id, uint8_t len, const byte *buf) {
+    fprintf(out, "(%.6f) %s %08lX#", time, interfaceName, id & 0x1fffffff);
+    for (uint8_t i = 0; i < len && i < 8; i++) {
+        fprintf(out, "%02X", buf[i]);
+    }
+    fputc('\n', out);
+}
+
+bool loadCandumpLog(const char *fileName, std::vector<CandumpFrame> *frames) {
+    FILE *in = (strcmp(fileName, "-") == 0)?stdin:fopen(fileName, "r");
+    if ( in == NULL ) {
+        perror(fileName);
+        return false;
+    }
+    char line[256];
+    CandumpFrame frame;
+    while ( fgets(line, sizeof(line), in) != NULL ) {
+        if ( parseCandumpLine(line, strlen(line), &frame) ) {
+            frames->push_back(frame);
+        }
+    }
+    if ( in != stdin ) {
+        fclose(in);
+    }
+    return true;
+}
+
+bool CandumpReplay::open() {
+    next = 0;
+    logClock = 0;
+    rxQueue.clear();
+    startTime = micros();
+    return true;
+}
+
+CandumpPGNStats * CandumpReplay::statsFor(unsigned long pgn) {
+    CandumpPGNStats *s = &stats[pgn];
+    s->pgn = pgn;
+    return s;
+}
+
+uint64_t CandumpReplay::logOffset(size_t frame) {
+    double offset = (*frames)[frame].time - (*frames)[0].time;
+    return (offset > 0)?(uint64_t)(offset*1000000.0):0;
+}
+
+uint64_t CandumpReplay::waitTime() {
+    if ( !realTime ) {
+        return 0;
+    }
+    uint64_t due;
+    if ( pollInterval > 0 ) {
+        due = startTime + logClock;
+    } else if ( rxQueue.size() == 0 && next < frames->size() ) {
+        due = startTime + logOffset(next);
+    } else {
+        return 0;
+    }
+    uint64_t now = micros();
+    return (due > now)?(due - now):0;
+}
+
+void CandumpReplay::fillRxQueue() {
+    if ( pollInterval == 0 ) {
+        logClock = micros() - startTime;
+    }
+    while ( next < frames->size() && logOffset(next) <= logClock ) {
+        if ( rxBuffers == 0 || rxQueue.size() < rxBuffers ) {
+            rxQueue.push_back(next);
+        } else {
+            overflows++;
+            statsFor(getPgnId((*frames)[next].id))->overflows++;
+        }
+        next++;
+    }
+}
+
+void CandumpReplay::endFrame() {
+    if ( current != NULL ) {
+        current->handlerNs += nowNs() - currentStart;
+        current = NULL;
+    }
+}
+
+void CandumpReplay::endCall() {
+    endFrame();
+    logClock += pollInterval;
+}
+
+void CandumpReplay::frameHandled(bool accepted) {
+    if ( current != NULL ) {
+        if ( accepted ) {
+            current->accepted++;
+        } else {
+            current->rejected++;
+        }
+    }
+}
+
+bool CandumpReplay::receiveFrame(unsigned long *id, uint8_t *len, byte *buf) {
+    endFrame();
+    const CandumpFrame *frame;
+    if ( realTime || pollInterval > 0 ) {
+        fillRxQueue();
+        if ( rxQueue.size() == 0 ) {
+            return false;
+        }
+        frame = &(*frames)[rxQueue[0]];
+        rxQueue.erase(rxQueue.begin());
+    } else {
+        if ( next >= frames->size() ) {
+            return false;
+        }
+        frame = &(*frames)[next++];
+    }
+    *id = frame->id;
+    *len = frame->len;
+    memcpy(buf, frame->buf, frame->len);
+    framesRead++;
+    lastFrame = frame;
+    current = statsFor(getPgnId(frame->id));
+    current->frames++;
+    currentStart = nowNs();
+    return true;
+}
+
+bool CandumpReplay::sendFrame(unsigned long id, uint8_t len, const byte *buf) {
+    framesSent++;
+    return true;
+}
@@ -0,0 +1,108 @@
+#ifndef CandumpLog_H
+#define CandumpLog_H
+
+#include "SmallNMEA2000.h"
+#include <map>
+#include <vector>
+
+typedef struct CandumpFrame {
+    double time; // seconds, 0 if the line had no timestamp
+    unsigned long id;
+    uint8_t len;
+    byte buf[8];
+} CandumpFrame;
+
+/**
+ * @brief parse a candump line of length chars, which need not be null terminated, either the -l log format
+ *   (1436509053.650713) can0 09F80105#0102030405060708
+ * or the default format, optionally with -t a timestamp
+ *   (1436509053.650713)  can0  09F80105   [8]  01 02 03 04 05 06 07 08
+ * false for anything else, eg standard 11 bit frames.
+ */
+bool parseCandumpLine(const char *line, size_t length, CandumpFrame *frame);
+
+/**
+ * @brief write a frame in candump -l format, which canboat analyzer and canplayer read.
+ */
+void writeCandumpLine(FILE *out, double time, const char *interfaceName, unsigned long id, uint8_t len, const byte *buf);
+
+/**
+ * @brief load every frame in a candump log, false if the file cant be read.
+ */
+bool loadCandumpLog(const char *fileName, std::vector<CandumpFrame> *frames);
+
+typedef struct CandumpPGNStats {
+    unsigned long pgn;
+    unsigned long frames;
+    unsigned long accepted;
+    unsigned long rejected;
+    unsigned long overflows;
+    uint64_t handlerNs;
+} CandumpPGNStats;
+
+/**
+ * Transport that replays a loaded candump log into processMessages, as fast as
+ * processMessages reads, or with the original timing.
+ * With a poll interval, processMessages is taken to be called every pollInterval us of log
+ * time, call endCall() after each call, and frames that arrive when the emulated controller rx
+ * buffers are full are lost, as on a device whose loop is too slow. Losses are then repeatable
+ * and independent of the speed of the host.
+ * The time between a frame being returned and the next read, or endCall(), is counted as
+ * handler time for the frames PGN. Frames sent by devices are counted and discarded.
+ */
+class CandumpReplay : public SNMEA2000Transport {
+    public:
+        CandumpReplay(std::vector<CandumpFrame> *frames, bool realTime, uint8_t rxBuffers = 2, unsigned long pollInterval = 0) :
+            frames{frames},
+            realTime{realTime},
+            rxBuffers{rxBuffers},
+            pollInterval{pollInterval} {
+        };
+        bool open() override;
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override;
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override;
+        /**
+         * @brief call after each processMessages.
+         */
+        void endCall();
+        /**
+         * @brief record the fate of the frame last read, from a frame monitor.
+         */
+        void frameHandled(bool accepted);
+        /**
+         * @brief the frame last returned by receiveFrame.
+         */
+        const CandumpFrame * getLastFrame() { return lastFrame; };
+        bool isFinished() { return next >= frames->size() && rxQueue.size() == 0; };
+        /**
+         * @brief us to wait before the next processMessages call with the original timing.
+         */
+        uint64_t waitTime();
+        /**
+         * @brief us of log time replayed, with a poll interval or the original timing.
+         */
+        uint64_t getLogTime() { return logClock; };
+        std::map<unsigned long, CandumpPGNStats> * getStats() { return &stats; };
+        unsigned long framesRead = 0;
+        unsigned long framesSent = 0;
+        unsigned long overflows = 0;
+    private:
+        CandumpPGNStats * statsFor(unsigned long pgn);
+        uint64_t logOffset(size_t frame);
+        void fillRxQueue();
+        void endFrame();
+        std::vector<CandumpFrame> * frames;
+        bool realTime;
+        uint8_t rxBuffers;
+        unsigned long pollInterval;
+        size_t next = 0;
+        std::vector<size_t> rxQueue;
+        std::map<unsigned long, CandumpPGNStats> stats;
+        const CandumpFrame * lastFrame = NULL;
+        CandumpPGNStats * current = NULL;
+        uint64_t currentStart = 0;
+        uint64_t startTime = 0;
+        uint64_t logClock = 0; // us since the first frame
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "RxEngine.h"
+#include <sched.h>
+#include <unistd.h>
+
+static const unsigned long defaultDevicePGNs[] = { SNMEA2000_RX_DEVICE_PGNS };
+
+SNMEA2000RxRing::SNMEA2000RxRing(uint32_t size) {
+    uint32_t n = 2;
+    while ( n < size ) {
+        n <<= 1;
+    }
+    mask = n - 1;
+    frames = new SNMEA2000RxFrame[n];
+}
+
+SNMEA2000RxRing::~SNMEA2000RxRing() {
+    delete[] frames;
+}
+
+bool SNMEA2000RxRing::push(const SNMEA2000RxFrame *frame) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if ( h - cachedTail > mask ) {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if ( h - cachedTail > mask ) {
+            return false;
+        }
+    }
+    frames[h & mask] = *frame;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+bool SNMEA2000RxRing::pop(SNMEA2000RxFrame *frame) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if ( t == cachedHead ) {
+        cachedHead = head.load(std::memory_order_acquire);
+        if ( t == cachedHead ) {
+            return false;
+        }
+    }
+    *frame = frames[t & mask];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+SNMEA2000RxEngine::SNMEA2000RxEngine(SNMEA2000Transport *transport, uint8_t workers, uint32_t ringSize) :
+        transport{transport},
+        devicePGNs{defaultDevicePGNs},
+        devicePGNsLen{sizeof(defaultDevicePGNs)/sizeof(unsigned long)},
+        nWorkers{(workers < 1)?(uint8_t)1:(workers > SNMEA2000_RX_MAX_WORKERS)?(uint8_t)SNMEA2000_RX_MAX_WORKERS:workers},
+        deviceRing{ringSize} {
+    for (uint8_t i = 0; i < nWorkers; i++) {
+        Worker *w = &this->workers[i];
+        w->ring = new SNMEA2000RxRing(ringSize);
+        w->listeners = NULL;
+        w->queued = 0;
+        w->frames = 0;
+        w->messages = 0;
+        w->dropped = 0;
+    }
+}
+
+SNMEA2000RxEngine::~SNMEA2000RxEngine() {
+    close();
+    for (uint8_t i = 0; i < nWorkers; i++) {
+        delete workers[i].ring;
+    }
+}
+
+void SNMEA2000RxEngine::addListener(uint8_t worker, SNMEA2000Listener *listener) {
+    Worker *w = &workers[worker % nWorkers];
+    listener->nextListener = w->listeners;
+    listener->device = device;
+    w->listeners = listener;
+}
+
+bool SNMEA2000RxEngine::open() {
+    if ( reading ) {
+        return true;
+    }
+    if ( device == NULL || !transport->open() ) {
+        return false;
+    }
+    address = device->getAddress();
+    working = true;
+    for (uint8_t i = 0; i < nWorkers; i++) {
+        workers[i].thread = std::thread(&SNMEA2000RxEngine::worker, this, &workers[i]);
+    }
+    reading = true;
+    readerThread = std::thread(&SNMEA2000RxEngine::reader, this);
+    return true;
+}
+
+void SNMEA2000RxEngine::close() {
+    if ( reading.exchange(false) ) {
+        readerThread.join();
+    }
+    if ( working.exchange(false) ) {
+        for (uint8_t i = 0; i < nWorkers; i++) {
+            workers[i].thread.join();
+        }
+    }
+}
+
+bool SNMEA2000RxEngine::flush(unsigned long timeout) {
+    unsigned long start = millis();
+    for (uint8_t i = 0; i < nWorkers; i++) {
+        while ( workers[i].frames.load() != workers[i].queued.load() ) {
+            if ( millis() - start > timeout ) {
+                return false;
+            }
+            usleep(100);
+        }
+    }
+    return true;
+}
+
+bool SNMEA2000RxEngine::isDevicePGN(unsigned long pgn) {
+    for (uint8_t i = 0; i < devicePGNsLen; i++) {
+        if ( devicePGNs[i] == pgn ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SNMEA2000RxEngine::push(SNMEA2000RxRing *ring, const SNMEA2000RxFrame *frame) {
+    while ( !ring->push(frame) ) {
+        if ( !blocking || !reading ) {
+            return false;
+        }
+        sched_yield();
+    }
+    return true;
+}
+
+void SNMEA2000RxEngine::reader() {
+    SNMEA2000RxFrame frame;
+    unsigned int idle = 0;
+    while ( reading ) {
+        if ( !transport->receiveFrame(&frame.id, &frame.len, frame.buf) ) {
+            if ( ++idle < 100 ) {
+                sched_yield();
+            } else {
+                usleep(50);
+            }
+            continue;
+        }
+        idle = 0;
+        frame.timestamp = transport->getRxTimestamp();
+        framesRead++;
+        if ( isDevicePGN(getPgnId(frame.id)) ) {
+            if ( !push(&deviceRing, &frame) ) {
+                deviceDropped++;
+            }
+            continue;
+        }
+        Worker *w = &workers[(frame.id & 0xff) % nWorkers];
+        if ( push(w->ring, &frame) ) {
+            w->queued++;
+        } else {
+            w->dropped++;
+        }
+    }
+}
+
+void SNMEA2000RxEngine::worker(Worker *w) {
+    SNMEA2000RxFrame frame;
+    unsigned int idle = 0;
+    unsigned int sinceProcess = 0;
+    // listeners calling device->getRxTimestamp() get the capture time of the frame being handled.
+    SNMEA2000::setThreadRxTimestamp(&frame.timestamp);
+    for (;;) {
+        if ( w->ring->pop(&frame) ) {
+            handle(w, &frame);
+            w->frames++;
+            idle = 0;
+            if ( ++sinceProcess < SNMEA2000_RX_PROCESS_FRAMES ) {
+                continue;
+            }
+        } else if ( !working && !reading ) {
+            break;
+        } else if ( ++idle < 100 ) {
+            sched_yield();
+        } else {
+            usleep(50);
+        }
+        sinceProcess = 0;
+        for (SNMEA2000Listener *l = w->listeners; l != NULL; l = l->nextListener) {
+            l->process();
+        }
+    }
+}
+
+void SNMEA2000RxEngine::handle(Worker *w, const SNMEA2000RxFrame *frame) {
+    if ( frame->len < 1 || frame->len > 8 ) {
+        return;
+    }
+    unsigned long pgn = getPgnId(frame->id);
+    MessageHeader messageHeader(frame->id, pgn);
+    if ( messageHeader.destination != SNMEA2000::broadcastAddress && messageHeader.destination != address.load(std::memory_order_relaxed) ) {
+        return;
+    }
+    // the rx list is not changed once open.
+    if ( !device->isRxPGN(pgn) ) {
+        return;
+    }
+    w->messages++;
+    // listeners may modify the buffer, as they can in processMessages.
+    byte buf[8];
+    memcpy(buf, frame->buf, frame->len);
+    for (SNMEA2000Listener *l = w->listeners; l != NULL; l = l->nextListener) {
+        l->onMessage(&messageHeader, buf, frame->len);
+    }
+}
+
+bool SNMEA2000RxEngine::receiveFrame(unsigned long *id, uint8_t *len, byte *buf) {
+    // called by processMessages, so on the thread that claims addresses.
+    address.store(device->getAddress(), std::memory_order_relaxed);
+    SNMEA2000RxFrame frame;
+    if ( !deviceRing.pop(&frame) ) {
+        return false;
+    }
+    *id = frame.id;
+    *len = frame.len;
+    memcpy(buf, frame.buf, (frame.len > 8)?8:frame.len);
+    rxTimestamp = frame.timestamp;
+    return true;
+}
+
+void SNMEA2000RxEngine::dumpStatus(Print * console) {
+    console->print(F("Rx engine frames read="));
+    console->print(getFramesRead());
+    console->print(F(" device dropped="));
+    console->println(getDeviceDropped());
+    for (uint8_t i = 0; i < nWorkers; i++) {
+        console->print(F("  worker "));
+        console->print(i);
+        console->print(F(" frames="));
+        console->print(getFrames(i));
+        console->print(F(" messages="));
+        console->print(getMessages(i));
+        console->print(F(" dropped="));
+        console->println(getDropped(i));
+    }
+}
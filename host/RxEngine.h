@@ -0,0 +1,147 @@
+#ifndef RxEngine_H
+#define RxEngine_H
+
+#include "SmallNMEA2000.h"
+#include <atomic>
+#include <thread>
+
+// most worker threads
+#define SNMEA2000_RX_MAX_WORKERS 16
+// frames each ring holds by default, a power of 2
+#define SNMEA2000_RX_RING_SIZE 4096
+// frames handled by a worker between calls to its listeners process()
+#define SNMEA2000_RX_PROCESS_FRAMES 64
+// PGNs handled by the device on the thread calling processMessages, ISO acknowledgement, request,
+// transport protocol, address claim, commanded address and group function.
+#define SNMEA2000_RX_DEVICE_PGNS 59392L,59904L,60160L,60416L,60928L,65240L,126208L
+
+typedef struct SNMEA2000RxFrame {
+    unsigned long id;
+    unsigned long timestamp;
+    uint8_t len;
+    byte buf[8];
+} SNMEA2000RxFrame;
+
+/**
+ * Bounded single producer, single consumer ring of frames. push() must only be called from one
+ * thread and pop() from one other thread. Each side keeps a copy of the other sides index so
+ * the shared indexes are only read when the ring looks full or empty.
+ */
+class SNMEA2000RxRing {
+    public:
+        SNMEA2000RxRing(uint32_t size = SNMEA2000_RX_RING_SIZE);
+        ~SNMEA2000RxRing();
+        bool push(const SNMEA2000RxFrame *frame);
+        bool pop(SNMEA2000RxFrame *frame);
+    private:
+        SNMEA2000RxFrame *frames;
+        uint32_t mask;
+        // producer and consumer indexes on separate cache lines.
+        char pad0[64];
+        std::atomic<uint32_t> head{0};
+        uint32_t cachedTail = 0;
+        char pad1[64];
+        std::atomic<uint32_t> tail{0};
+        uint32_t cachedHead = 0;
+        char pad2[64];
+};
+
+/**
+ * Recieves on Linux with several threads, eg a gateway bridging buses or replaying logs faster
+ * than one processMessages loop can handle. A reader thread started by open() reads the wrapped
+ * transport and passes each frame through a SNMEA2000RxRing to the worker for its source address,
+ * source % workers, so the frames from one source, and so its fast packets, are handled in order
+ * by one thread without locks. Each worker applies the device rx filter, the destination and
+ * isRxPGN, and passes messages to its own listeners, added with addListener(worker, listener),
+ * eg a SNMEA2000RxCache or an assembler per worker, calling their process() every
+ * SNMEA2000_RX_PROCESS_FRAMES frames and when idle. In worker listeners device->getRxTimestamp()
+ * is the capture time of the frame the worker is handling. Workers see a new device address from
+ * the next processMessages call, and the rx list must not change once open.
+ *
+ * Frames with SNMEA2000_RX_DEVICE_PGNS, or the list given to setDevicePGNs, go to the device
+ * instead: the engine is the device transport and they are returned by receiveFrame() to
+ * processMessages, which must still be called to claim the address and answer requests. Sending
+ * goes to the wrapped transport; if worker listeners send, wrap the transport in a
+ * SNMEA2000ThreadedTransport and build with SNMEA2000_THREADS.
+ *
+ * A full ring drops the frame and counts it, as a controller overflow would, unless
+ * setBlocking(true), where the reader waits, for replays that can be paused.
+ */
+class SNMEA2000RxEngine : public SNMEA2000Transport {
+    public:
+        SNMEA2000RxEngine(SNMEA2000Transport *transport, uint8_t workers, uint32_t ringSize = SNMEA2000_RX_RING_SIZE);
+        virtual ~SNMEA2000RxEngine();
+        /**
+         * @brief the device whose rx filter the workers apply, and which worker listeners send with.
+         */
+        void setDevice(SNMEA2000 *device) { this->device = device; };
+        /**
+         * @brief add a listener run on worker, before open().
+         */
+        void addListener(uint8_t worker, SNMEA2000Listener *listener);
+        void setDevicePGNs(const unsigned long *pgns, uint8_t len) {
+            devicePGNs = pgns;
+            devicePGNsLen = len;
+        };
+        void setBlocking(bool blocking) { this->blocking = blocking; };
+        /**
+         * @brief open the wrapped transport and start the reader and worker threads.
+         */
+        bool open() override;
+        /**
+         * @brief stop reading, let the workers empty their rings and stop the threads.
+         */
+        void close();
+        /**
+         * @brief wait up to timeout ms for the workers to handle every frame read so far.
+         */
+        bool flush(unsigned long timeout);
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override;
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override {
+            return transport->sendFrame(id, len, buf);
+        };
+        unsigned long getRxTimestamp() override { return rxTimestamp; };
+        uint8_t getControllerState() override { return transport->getControllerState(); };
+        bool checkErrors() override { return transport->checkErrors(); };
+        uint8_t getWorkers() { return nWorkers; };
+        unsigned long getFramesRead() { return framesRead; };
+        unsigned long getFrames(uint8_t worker) { return workers[worker].frames; };
+        unsigned long getMessages(uint8_t worker) { return workers[worker].messages; };
+        unsigned long getDropped(uint8_t worker) { return workers[worker].dropped; };
+        unsigned long getDeviceDropped() { return deviceDropped; };
+        void dumpStatus(Print * console);
+    private:
+        typedef struct Worker {
+            SNMEA2000RxRing *ring;
+            SNMEA2000Listener *listeners;
+            std::thread thread;
+            std::atomic<unsigned long> queued; // by the reader
+            std::atomic<unsigned long> frames; // by the worker
+            std::atomic<unsigned long> messages;
+            std::atomic<unsigned long> dropped;
+            char pad[64];
+        } Worker;
+        bool isDevicePGN(unsigned long pgn);
+        bool push(SNMEA2000RxRing *ring, const SNMEA2000RxFrame *frame);
+        void reader();
+        void worker(Worker *w);
+        void handle(Worker *w, const SNMEA2000RxFrame *frame);
+        SNMEA2000Transport *transport;
+        SNMEA2000 *device = NULL;
+        const unsigned long *devicePGNs;
+        uint8_t devicePGNsLen;
+        uint8_t nWorkers;
+        bool blocking = false;
+        Worker workers[SNMEA2000_RX_MAX_WORKERS];
+        SNMEA2000RxRing deviceRing;
+        std::thread readerThread;
+        std::atomic<bool> reading{false};
+        std::atomic<bool> working{false};
+        std::atomic<unsigned long> framesRead{0};
+        std::atomic<unsigned long> deviceDropped{0};
+        // the device address, copied on each receiveFrame() as the device may re-claim.
+        std::atomic<uint8_t> address{SNMEA2000::broadcastAddress};
+        unsigned long rxTimestamp = 0;
+};
+
+#endif
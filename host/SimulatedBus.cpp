@@ -0,0 +1,165 @@
+#include "SimulatedBus.h"
+
+// bits before the data field of an extended frame, SOF to DLC.
+#define HEADER_BITS 39
+// error flag, echo flags and delimiter, and the interframe space.
+#define ERROR_FRAME_BITS 23
+
+bool SimulatedFrameQueue::push(unsigned long id, uint8_t len, const byte *buf) {
+    if ( count >= size ) {
+        return false;
+    }
+    SimulatedFrame *frame = &frames[(first+count)%size];
+    frame->id = id;
+    frame->len = (len > 8)?8:len;
+    memcpy(frame->buf, buf, frame->len);
+    count++;
+    return true;
+}
+
+void SimulatedFrameQueue::pop() {
+    if ( count > 0 ) {
+        first = (first+1)%size;
+        count--;
+    }
+}
+
+bool SimulatedBusTransport::receiveFrame(unsigned long *id, uint8_t *len, byte *buf) {
+    SimulatedFrame *frame = rxQueue.head();
+    if ( frame == NULL ) {
+        return false;
+    }
+    *id = frame->id;
+    *len = frame->len;
+    memcpy(buf, frame->buf, frame->len);
+    rxQueue.pop();
+    return true;
+}
+
+bool SimulatedBusTransport::sendFrame(unsigned long id, uint8_t len, const byte *buf) {
+    if ( !txQueue.push(id, len, buf) ) {
+        txOverflows++;
+        return false;
+    }
+    return true;
+}
+
+SimulatedBus::~SimulatedBus() {
+    while ( transports != NULL ) {
+        SimulatedBusTransport *t = transports;
+        transports = t->next;
+        delete t;
+    }
+}
+
+SimulatedBusTransport * SimulatedBus::connect(uint8_t txBuffers, uint8_t rxBuffers) {
+    SimulatedBusTransport *t = new SimulatedBusTransport(this, txBuffers, rxBuffers);
+    t->next = transports;
+    transports = t;
+    return t;
+}
+
+uint64_t SimulatedBus::frameTime(uint8_t len) {
+    // 67 bits including the interframe space with no stuffing, 1 stuff bit per 4 worst case.
+    unsigned long bits = 67 + 8*len + (53 + 8*len)/4;
+    return (uint64_t)(bits*bitTime + 0.5);
+}
+
+static int compareFrames(const SimulatedFrame *a, const SimulatedFrame *b) {
+    if ( a->id != b->id ) {
+        return (a->id < b->id)?-1:1;
+    }
+    if ( a->len != b->len ) {
+        return (a->len < b->len)?-1:1;
+    }
+    return memcmp(a->buf, b->buf, a->len);
+}
+
+void SimulatedBus::arbitrate() {
+    if ( busy ) {
+        return;
+    }
+    SimulatedFrame *winner = NULL;
+    for (SimulatedBusTransport *t = transports; t != NULL; t = t->next) {
+        SimulatedFrame *frame = t->txQueue.head();
+        if ( frame != NULL && (winner == NULL || compareFrames(frame, winner) < 0) ) {
+            winner = frame;
+        }
+    }
+    if ( winner == NULL ) {
+        return;
+    }
+    current = *winner;
+    bool collision = false;
+    uint8_t firstDifference = 8;
+    for (SimulatedBusTransport *t = transports; t != NULL; t = t->next) {
+        SimulatedFrame *frame = t->txQueue.head();
+        t->sending = false;
+        if ( frame == NULL || frame->id != current.id ) {
+            continue;
+        }
+        if ( compareFrames(frame, &current) == 0 ) {
+            t->sending = true;
+        } else if ( !resolveCollision ) {
+            collision = true;
+            t->errors++;
+            for (uint8_t i = 0; i < firstDifference && i < frame->len && i < current.len; i++) {
+                if ( frame->buf[i] != current.buf[i] ) {
+                    firstDifference = i;
+                }
+            }
+        }
+    }
+    busy = true;
+    uint64_t duration;
+    if ( collision ) {
+        // the frame is destroyed at the first bit that differs, everyone retries.
+        currentValid = false;
+        resolveCollision = true;
+        errorFrames++;
+        for (SimulatedBusTransport *t = transports; t != NULL; t = t->next) {
+            if ( t->sending ) {
+                t->errors++;
+                t->sending = false;
+            }
+        }
+        duration = (uint64_t)((HEADER_BITS + 8*(firstDifference+1) + ERROR_FRAME_BITS)*bitTime + 0.5);
+    } else {
+        currentValid = true;
+        resolveCollision = false;
+        duration = frameTime(current.len);
+    }
+    frameEnd = time + duration;
+    busyTime += duration;
+}
+
+void SimulatedBus::completeFrame() {
+    busy = false;
+    if ( !currentValid ) {
+        return;
+    }
+    frames++;
+    if ( monitor != NULL ) {
+        monitor(monitorContext, time, current.id, current.len, current.buf);
+    }
+    for (SimulatedBusTransport *t = transports; t != NULL; t = t->next) {
+        if ( t->sending ) {
+            t->txQueue.pop();
+            t->framesSent++;
+            t->sending = false;
+        } else if ( !t->rxQueue.push(current.id, current.len, current.buf) ) {
+            t->rxOverflows++;
+        }
+    }
+}
+
+void SimulatedBus::advanceTo(uint64_t t) {
+    while ( busy && frameEnd <= t ) {
+        time = frameEnd;
+        completeFrame();
+        arbitrate();
+    }
+    if ( t > time ) {
+        time = t;
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef SimulatedBus_H
+#define SimulatedBus_H
+
+#include "SmallNMEA2000.h"
+
+class SimulatedBus;
+
+typedef void (*SimulatedBusMonitor)(void *context, uint64_t time, unsigned long id, uint8_t len, const byte *buf);
+
+typedef struct SimulatedFrame {
+    unsigned long id;
+    uint8_t len;
+    byte buf[8];
+} SimulatedFrame;
+
+/**
+ * Fixed size frame FIFO.
+ */
+class SimulatedFrameQueue {
+    public:
+        SimulatedFrameQueue(uint8_t size) : size{size} {
+            frames = new SimulatedFrame[size];
+        };
+        ~SimulatedFrameQueue() { delete[] frames; };
+        bool push(unsigned long id, uint8_t len, const byte *buf);
+        SimulatedFrame * head() { return (count > 0)?&frames[first]:NULL; };
+        void pop();
+        uint8_t length() { return count; };
+    private:
+        SimulatedFrame * frames;
+        uint8_t size;
+        uint8_t first = 0;
+        uint8_t count = 0;
+};
+
+/**
+ * One controller on a SimulatedBus. Like the MCP2515 it has a small number of tx and
+ * rx buffers, sendFrame fails when the tx buffers are full and frames arriving when the
+ * rx buffers are full are lost. Frames are sent in the order they were queued.
+ */
+class SimulatedBusTransport final : public SNMEA2000Transport {
+    public:
+        SimulatedBusTransport(SimulatedBus *bus, uint8_t txBuffers, uint8_t rxBuffers) :
+            bus{bus},
+            txQueue{txBuffers},
+            rxQueue{rxBuffers} {
+        };
+        bool open() override { return true; };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override;
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override;
+
+        unsigned long framesSent = 0;
+        unsigned long txOverflows = 0;
+        unsigned long rxOverflows = 0;
+        unsigned long errors = 0;
+    private:
+        friend class SimulatedBus;
+        SimulatedBus * bus;
+        SimulatedFrameQueue txQueue;
+        SimulatedFrameQueue rxQueue;
+        SimulatedBusTransport * next = NULL;
+        bool sending = false;
+};
+
+/**
+ * Discrete event CAN bus with a simulated clock, for testing many devices in one process.
+ * Install the bus as the host clock with setHostClock(&bus), then alternate between
+ * running devices at bus.now() and advancing time with advanceTo().
+ *
+ * When the bus is idle the lowest id at the head of the controller tx queues wins
+ * arbitration. Controllers sending an identical frame at the same time all succeed,
+ * as on a real bus. Controllers sending the same id with different data collide, this costs
+ * the bus an error frame and the lowest data wins the retry, an approximation of
+ * the error counters eventually letting one through. Senders do not recieve their own frames.
+ * Frame times include worst case bit stuffing and the interframe space. delay() does not
+ * advance simulated time.
+ */
+class SimulatedBus : public HostClock {
+    public:
+        SimulatedBus(unsigned long bitrate = 250000) :
+            bitTime{1000000.0/bitrate} {
+        };
+        ~SimulatedBus();
+        uint64_t now() override { return time; };
+        void sleep(uint64_t us) override {};
+        SimulatedBusTransport * connect(uint8_t txBuffers = 3, uint8_t rxBuffers = 2);
+        /**
+         * @brief start a frame if the bus is idle, call after running devices.
+         */
+        void arbitrate();
+        /**
+         * @brief time the current frame ends, or UINT64_MAX when idle.
+         */
+        uint64_t nextEvent() { return busy?frameEnd:UINT64_MAX; };
+        /**
+         * @brief complete frames ending at or before t and set the time to t.
+         */
+        void advanceTo(uint64_t t);
+        void setMonitor(SimulatedBusMonitor monitor, void *context) {
+            this->monitor = monitor;
+            monitorContext = context;
+        };
+
+        unsigned long frames = 0;
+        unsigned long errorFrames = 0;
+        uint64_t busyTime = 0;
+    private:
+        uint64_t frameTime(uint8_t len);
+        void completeFrame();
+        double bitTime;
+        uint64_t time = 0;
+        uint64_t frameEnd = 0;
+        bool busy = false;
+        bool currentValid = false;
+        bool resolveCollision = false;
+        SimulatedFrame current;
+        SimulatedBusTransport * transports = NULL;
+        SimulatedBusMonitor monitor = NULL;
+        void * monitorContext = NULL;
+};
+
+#endif
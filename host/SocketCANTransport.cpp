@@ -0,0 +1,95 @@
+#include "SocketCANTransport.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/sockios.h>
+
+SNMEA2000SocketCAN::~SNMEA2000SocketCAN() {
+    if ( fd >= 0 ) {
+        close(fd);
+    }
+}
+
+bool SNMEA2000SocketCAN::open() {
+    if ( fd >= 0 ) {
+        return true;
+    }
+    int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if ( s < 0 ) {
+        perror("socket");
+        return false;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interfaceName, IFNAMSIZ-1);
+    if ( ioctl(s, SIOCGIFINDEX, &ifr) < 0 ) {
+        perror(interfaceName);
+        close(s);
+        return false;
+    }
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if ( bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 ) {
+        perror("bind");
+        close(s);
+        return false;
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    fd = s;
+    return true;
+}
+
+bool SNMEA2000SocketCAN::receiveFrame(unsigned long *id, uint8_t *len, byte *buf) {
+    struct can_frame frame;
+    while ( fd >= 0 && read(fd, &frame, sizeof(frame)) == sizeof(frame) ) {
+        if ( (frame.can_id & CAN_EFF_FLAG) == 0 || (frame.can_id & (CAN_RTR_FLAG|CAN_ERR_FLAG)) != 0 ) {
+            continue;
+        }
+        *id = frame.can_id & CAN_EFF_MASK;
+        *len = (frame.can_dlc > 8)?8:frame.can_dlc;
+        memcpy(buf, frame.data, *len);
+        // the kernel rx timestamp is wall clock time, convert to micros().
+        rxTimestamp = micros();
+        struct timeval received;
+        struct timeval now;
+        if ( ioctl(fd, SIOCGSTAMP, &received) == 0 && gettimeofday(&now, NULL) == 0 ) {
+            int64_t age = (int64_t)(now.tv_sec - received.tv_sec)*1000000LL + (now.tv_usec - received.tv_usec);
+            if ( age > 0 && age < 10000000LL ) {
+                rxTimestamp -= age;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool SNMEA2000SocketCAN::sendFrame(unsigned long id, uint8_t len, const byte *buf) {
+    if ( fd < 0 || len > 8 ) {
+        return false;
+    }
+    struct can_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    frame.can_dlc = len;
+    memcpy(frame.data, buf, len);
+    for (int retry = 0; retry < 10; retry++) {
+        if ( write(fd, &frame, sizeof(frame)) == sizeof(frame) ) {
+            return true;
+        }
+        if ( errno != EAGAIN && errno != ENOBUFS ) {
+            return false;
+        }
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        poll(&pfd, 1, 10);
+    }
+    return false;
+}
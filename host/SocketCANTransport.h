@@ -0,0 +1,34 @@
+#ifndef SocketCANTransport_H
+#define SocketCANTransport_H
+
+#include "SmallNMEA2000.h"
+
+/**
+ * SocketCAN transport for Linux, eg can0 or vcan0. Reads are non blocking, 
+ * use getFd() with poll() to wait for frames. Only 29 bit data frames are recieved.
+ */
+class SNMEA2000SocketCAN : public SNMEA2000Transport {
+    public:
+        SNMEA2000SocketCAN(const char *interfaceName) :
+            interfaceName{interfaceName} {
+        };
+        virtual ~SNMEA2000SocketCAN();
+        bool open() override;
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override;
+        /**
+         * @brief send a frame, waiting up to 100ms for space in the interface tx queue.
+         */
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override;
+        /**
+         * @brief the kernel rx timestamp of the frame.
+         */
+        unsigned long getRxTimestamp() override { return rxTimestamp; };
+        int getFd() { return fd; };
+        const char * getInterfaceName() { return interfaceName; };
+    private:
+        const char * interfaceName;
+        int fd = -1;
+        unsigned long rxTimestamp = 0;
+};
+
+#endif
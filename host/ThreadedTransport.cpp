@@ -0,0 +1,189 @@
+#include "ThreadedTransport.h"
+#include <sched.h>
+#include <unistd.h>
+
+thread_local SNMEA2000TxBatch *SNMEA2000TxBatch::current = NULL;
+
+SNMEA2000ThreadedTransport::SNMEA2000ThreadedTransport(SNMEA2000Transport *transport, uint32_t queueSize) :
+        transport{transport} {
+    uint32_t size = 2;
+    while ( size < queueSize ) {
+        size <<= 1;
+    }
+    mask = size - 1;
+    cells = new Cell[size];
+    for (uint32_t i = 0; i < size; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+SNMEA2000ThreadedTransport::~SNMEA2000ThreadedTransport() {
+    close();
+    delete[] cells;
+}
+
+bool SNMEA2000ThreadedTransport::open() {
+    if ( running ) {
+        return true;
+    }
+    if ( !transport->open() ) {
+        return false;
+    }
+    running = true;
+    writerThread = std::thread(&SNMEA2000ThreadedTransport::writer, this);
+    return true;
+}
+
+void SNMEA2000ThreadedTransport::close() {
+    if ( running.exchange(false) ) {
+        writerThread.join();
+    }
+}
+
+bool SNMEA2000ThreadedTransport::sendFrame(unsigned long id, uint8_t len, const byte *buf) {
+    if ( len > 8 ) {
+        return false;
+    }
+    SNMEA2000TxBatch *batch = SNMEA2000TxBatch::getCurrent(this);
+    if ( batch != NULL ) {
+        return batch->add(id, len, buf);
+    }
+    SNMEA2000TxMessage message;
+    message.frames = 1;
+    message.id[0] = id;
+    message.len[0] = len;
+    memcpy(message.data[0], buf, len);
+    return enqueue(&message);
+}
+
+/**
+ * Bounded MPMC queue after D. Vyukov, used with a single consumer. Each cell sequence is its
+ * position when free and position+1 once written, so producers claim positions with one CAS
+ * and the writer sees a message only when it is complete.
+ */
+bool SNMEA2000ThreadedTransport::enqueue(const SNMEA2000TxMessage *message) {
+    bool waiting = false;
+    unsigned long waitStart = 0;
+    uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &cells[position & mask];
+        uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - position);
+        if ( diff == 0 ) {
+            if ( enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed) ) {
+                break;
+            }
+        } else if ( diff < 0 ) {
+            // full, wait for the writer.
+            if ( !waiting ) {
+                waiting = true;
+                waitStart = millis();
+            } else if ( millis() - waitStart > SNMEA2000_TX_QUEUE_WAIT ) {
+                queueFull++;
+                return false;
+            } else {
+                // sleep rather than spin so the writer gets the cpu when producers outnumber cores.
+                usleep(20);
+            }
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+    SNMEA2000TxMessage *m = &cell->message;
+    m->frames = message->frames;
+    for (uint8_t i = 0; i < message->frames; i++) {
+        m->id[i] = message->id[i];
+        m->len[i] = message->len[i];
+        memcpy(m->data[i], message->data[i], message->len[i]);
+    }
+    cell->sequence.store(position + 1, std::memory_order_release);
+    messagesQueued++;
+    return true;
+}
+
+bool SNMEA2000ThreadedTransport::writeNext() {
+    uint64_t position = dequeuePosition.load(std::memory_order_relaxed);
+    Cell *cell = &cells[position & mask];
+    if ( cell->sequence.load(std::memory_order_acquire) != position + 1 ) {
+        return false;
+    }
+    SNMEA2000TxMessage *m = &cell->message;
+    for (uint8_t i = 0; i < m->frames; i++) {
+        if ( transport->sendFrame(m->id[i], m->len[i], m->data[i]) ) {
+            framesWritten++;
+        } else {
+            writeErrors++;
+        }
+    }
+    cell->sequence.store(position + mask + 1, std::memory_order_release);
+    dequeuePosition.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+void SNMEA2000ThreadedTransport::writer() {
+    unsigned int idle = 0;
+    while ( running ) {
+        if ( writeNext() ) {
+            idle = 0;
+        } else if ( ++idle < 100 ) {
+            sched_yield();
+        } else {
+            // nothing queued for a while, poll less often.
+            usleep(50);
+        }
+    }
+    while ( writeNext() ) {
+    }
+}
+
+bool SNMEA2000ThreadedTransport::flush(unsigned long timeout) {
+    unsigned long start = millis();
+    while ( enqueuePosition.load() != dequeuePosition.load() ) {
+        if ( millis() - start > timeout ) {
+            return false;
+        }
+        usleep(100);
+    }
+    return true;
+}
+
+void SNMEA2000ThreadedTransport::dumpStatus(Print * console) {
+    console->print(F("Tx queue messages="));
+    console->print(getMessagesQueued());
+    console->print(F(" frames written="));
+    console->print(getFramesWritten());
+    console->print(F(" full="));
+    console->print(getQueueFull());
+    console->print(F(" write errors="));
+    console->println(getWriteErrors());
+}
+
+SNMEA2000TxBatch::SNMEA2000TxBatch(SNMEA2000ThreadedTransport *transport) :
+        transport{transport},
+        previous{current} {
+    message.frames = 0;
+    current = this;
+}
+
+bool SNMEA2000TxBatch::add(unsigned long id, uint8_t len, const byte *buf) {
+    bool ok = true;
+    if ( message.frames == SNMEA2000_TX_MESSAGE_FRAMES ) {
+        ok = commit();
+    }
+    uint8_t i = message.frames++;
+    message.id[i] = id;
+    message.len[i] = len;
+    memcpy(message.data[i], buf, len);
+    return ok;
+}
+
+bool SNMEA2000TxBatch::commit() {
+    if ( message.frames == 0 ) {
+        return true;
+    }
+    bool ok = transport->enqueue(&message);
+    message.frames = 0;
+    return ok;
+}
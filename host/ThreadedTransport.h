@@ -0,0 +1,118 @@
+#ifndef ThreadedTransport_H
+#define ThreadedTransport_H
+
+#include "SmallNMEA2000.h"
+#include <atomic>
+#include <thread>
+
+#ifndef SNMEA2000_THREADS
+#error "Build with -DSNMEA2000_THREADS so that the SNMEA2000 send path counters are atomic."
+#endif
+
+// frames in one queued message, a 223 byte fast packet is 32 frames.
+#define SNMEA2000_TX_MESSAGE_FRAMES 32
+// messages the queue holds by default, a power of 2
+#define SNMEA2000_TX_QUEUE_SIZE 1024
+// ms a sender waits for space in a full queue
+#define SNMEA2000_TX_QUEUE_WAIT 100
+
+typedef struct SNMEA2000TxMessage {
+    uint8_t frames;
+    uint8_t len[SNMEA2000_TX_MESSAGE_FRAMES];
+    unsigned long id[SNMEA2000_TX_MESSAGE_FRAMES];
+    byte data[SNMEA2000_TX_MESSAGE_FRAMES][8];
+} SNMEA2000TxMessage;
+
+/**
+ * Lets several threads send through one SNMEA2000 on Linux. Frames sent by any thread go into a
+ * bounded lock free multi producer, single consumer queue and one writer thread started by open()
+ * passes them to the wrapped transport, eg a SNMEA2000SocketCAN, in queue order.
+ *
+ * Frames sent inside a SNMEA2000TxBatch on the sending thread are queued as one message, so the
+ * frames of a fast packet are never interleaved with frames from other threads, eg
+ *
+ *  {
+ *      SNMEA2000TxBatch batch(&transport);
+ *      device.sendFastPacket(&messageHeader, payload, 26);
+ *  }
+ *
+ * Other frames are queued one at a time. A sender waits up to SNMEA2000_TX_QUEUE_WAIT ms for
+ * space in a full queue. sendFastPacket, sendFrame, sendMessage and SNMEA2000PacketWriters on the
+ * stack are safe from any thread with SNMEA2000_THREADS defined, which makes the send counters and
+ * fast packet sequences atomic; startPacket/outputByte on the device are not, and processMessages
+ * must only be called from one thread. Recieving is passed straight to the wrapped transport.
+ */
+class SNMEA2000ThreadedTransport : public SNMEA2000Transport {
+    friend class SNMEA2000TxBatch;
+    public:
+        SNMEA2000ThreadedTransport(SNMEA2000Transport *transport, uint32_t queueSize = SNMEA2000_TX_QUEUE_SIZE);
+        virtual ~SNMEA2000ThreadedTransport();
+        /**
+         * @brief open the wrapped transport and start the writer thread.
+         */
+        bool open() override;
+        /**
+         * @brief write the queued messages and stop the writer thread.
+         */
+        void close();
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override {
+            return transport->receiveFrame(id, len, buf);
+        };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override;
+        unsigned long getRxTimestamp() override { return transport->getRxTimestamp(); };
+        uint8_t getControllerState() override { return transport->getControllerState(); };
+        bool checkErrors() override { return transport->checkErrors(); };
+        /**
+         * @brief wait up to timeout ms for the writer to empty the queue, false if it did not.
+         */
+        bool flush(unsigned long timeout);
+        unsigned long getMessagesQueued() { return messagesQueued; };
+        unsigned long getFramesWritten() { return framesWritten; };
+        unsigned long getQueueFull() { return queueFull; };
+        unsigned long getWriteErrors() { return writeErrors; };
+        void dumpStatus(Print * console);
+    private:
+        typedef struct Cell {
+            std::atomic<uint64_t> sequence;
+            SNMEA2000TxMessage message;
+        } Cell;
+        bool enqueue(const SNMEA2000TxMessage *message);
+        bool writeNext();
+        void writer();
+        SNMEA2000Transport *transport;
+        Cell *cells;
+        uint64_t mask;
+        std::atomic<uint64_t> enqueuePosition{0};
+        std::atomic<uint64_t> dequeuePosition{0};
+        std::thread writerThread;
+        std::atomic<bool> running{false};
+        std::atomic<unsigned long> messagesQueued{0};
+        std::atomic<unsigned long> framesWritten{0};
+        std::atomic<unsigned long> queueFull{0};
+        std::atomic<unsigned long> writeErrors{0};
+};
+
+/**
+ * Queues the frames sent to transport by this thread while it is in scope as one message.
+ * More than SNMEA2000_TX_MESSAGE_FRAMES frames are queued as several messages.
+ */
+class SNMEA2000TxBatch {
+    public:
+        SNMEA2000TxBatch(SNMEA2000ThreadedTransport *transport);
+        ~SNMEA2000TxBatch() { commit(); current = previous; };
+        /**
+         * @brief queue the frames added so far, false if the queue stayed full.
+         */
+        bool commit();
+        bool add(unsigned long id, uint8_t len, const byte *buf);
+        static SNMEA2000TxBatch * getCurrent(SNMEA2000ThreadedTransport *transport) {
+            return (current != NULL && current->transport == transport)?current:NULL;
+        };
+    private:
+        static thread_local SNMEA2000TxBatch *current;
+        SNMEA2000ThreadedTransport *transport;
+        SNMEA2000TxBatch *previous;
+        SNMEA2000TxMessage message;
+};
+
+#endif
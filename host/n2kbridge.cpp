@@ -0,0 +1,113 @@
+/**
+ * Two port NMEA2000 bridge on SocketCAN.
+ *
+ * n2kbridge [-s seconds] [-a rule]... [-b rule]... ifaceA ifaceB
+ *
+ *   -a rule   forward from ifaceA to ifaceB
+ *   -b rule   forward from ifaceB to ifaceA
+ *   -s n      print counters every n seconds, default 10
+ *
+ * rule is pgn[:minIntervalms[:f[:source]]], f marks a fast packet PGN, eg
+ *
+ * n2kbridge -a 127488 -a 129025:1000 -a 129029:5000:f -b 59904 vcan0 vcan1
+ *
+ * PGNs without a rule are not forwarded. Counters are printed on exit (SIGINT).
+ */
+#include <Arduino.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include "SmallNMEA2000Bridge.h"
+#include "SocketCANTransport.h"
+
+#define MAX_RULES 64
+
+static SNMEA2000BridgeRule aToB[MAX_RULES];
+static SNMEA2000BridgeRule bToA[MAX_RULES];
+static uint8_t aToBLen = 0;
+static uint8_t bToALen = 0;
+static volatile bool running = true;
+
+static void stop(int) {
+    running = false;
+}
+
+static bool parseRule(const char *arg, SNMEA2000BridgeRule *rules, uint8_t *len) {
+    if ( *len >= MAX_RULES ) {
+        fprintf(stderr, "Too many rules\n");
+        return false;
+    }
+    SNMEA2000BridgeRule *rule = &rules[*len];
+    memset(rule, 0, sizeof(SNMEA2000BridgeRule));
+    rule->source = SNMEA2000::anySource;
+    char *end;
+    rule->pgn = strtoul(arg, &end, 10);
+    if ( end == arg ) {
+        fprintf(stderr, "Invalid rule %s\n", arg);
+        return false;
+    }
+    if ( *end == ':' ) {
+        rule->minInterval = strtoul(end+1, &end, 10);
+    }
+    if ( *end == ':' ) {
+        end++;
+        rule->fastPacket = (*end == 'f');
+        while ( *end != '\0' && *end != ':') end++;
+    }
+    if ( *end == ':' ) {
+        rule->source = strtoul(end+1, &end, 10);
+    }
+    (*len)++;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int statusPeriod = 10;
+    int opt;
+    while ( (opt = getopt(argc, argv, "a:b:s:")) != -1 ) {
+        switch (opt) {
+        case 'a':
+            if ( !parseRule(optarg, aToB, &aToBLen) ) return 1;
+            break;
+        case 'b':
+            if ( !parseRule(optarg, bToA, &bToALen) ) return 1;
+            break;
+        case 's':
+            statusPeriod = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s seconds] [-a rule]... [-b rule]... ifaceA ifaceB\n", argv[0]);
+            return 1;
+        }
+    }
+    if ( argc - optind != 2 ) {
+        fprintf(stderr, "Usage: %s [-s seconds] [-a rule]... [-b rule]... ifaceA ifaceB\n", argv[0]);
+        return 1;
+    }
+    SNMEA2000SocketCAN portA(argv[optind]);
+    SNMEA2000SocketCAN portB(argv[optind+1]);
+    SNMEA2000Bridge bridge(&portA, &portB, aToB, aToBLen, bToA, bToALen);
+    if ( !bridge.open() ) {
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    printf("Bridging %s and %s, %d rules A>B, %d rules B>A\n", argv[optind], argv[optind+1], aToBLen, bToALen);
+    unsigned long lastStatus = millis();
+    struct pollfd fds[2] = {
+        { portA.getFd(), POLLIN, 0 },
+        { portB.getFd(), POLLIN, 0 }
+    };
+    while ( running ) {
+        poll(fds, 2, 100);
+        bridge.process();
+        if ( statusPeriod > 0 && millis() - lastStatus > (unsigned long)statusPeriod*1000 ) {
+            lastStatus = millis();
+            bridge.dumpStatus();
+            Serial.flush();
+        }
+    }
+    bridge.dumpStatus();
+    Serial.flush();
+    return 0;
+}
@@ -0,0 +1,271 @@
+/**
+ * Compares the integer sensor conditioning in SmallNMEA2000Filters.h and the fixed point
+ * encoders with the same chain in floating point.
+ *
+ * n2kdspbench [-n samples] [-m samples per message] [-r seed]
+ *
+ *   -n   samples to time, default 1000000
+ *   -m   samples filtered per 127508 sent, default 10
+ *   -r   random seed for the samples, default 1
+ *
+ * Voltage, current and temperature ADC samples with noise and occasional spikes are despiked
+ * with a median of 3, then voltage and current are averaged over 8 samples and temperature low
+ * pass filtered, calibrated to N2K units and sent as 127508. The fixed point chain keeps the
+ * fractional bits of the average and low pass through calibration. Every field sent by both
+ * chains is compared and the largest difference reported in N2K units, then both chains are
+ * timed with frames going to a transport that only checksums them. Host CPUs have floating
+ * point hardware, where the chains take about the same time, on AVR it is emulated in software
+ * and each double operation costs 10 to 50 times its integer equivalent. Exits 1 if a field
+ * differs by more than half an ADC count, or 1 if that is less than 1 in N2K units.
+ */
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include "SmallNMEA2000Filters.h"
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2kdspbench", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Filter benchmark", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN, 127508L };
+const unsigned long rxPGN[] = { SNMEA200_DEFAULT_RX_PGN };
+
+// 14.7mV per count from a 1:3 divider, 0.1A per count about 512, TMP36 on a 5V 10 bit ADC.
+#define VOLTS_PER_COUNT 0.0147
+#define AMPS_PER_COUNT 0.1
+#define CURRENT_ZERO 512
+#define C_PER_COUNT 0.488
+#define C_AT_ZERO -50.0
+
+#define AVERAGE_SAMPLES 8
+#define LOW_PASS_SHIFT 4
+
+// the fixed point chain calibrates the sum of AVERAGE_SAMPLES and the low pass state directly.
+const SNMEA2000Calibration voltageCalibration(VOLTS_PER_COUNT*100/AVERAGE_SAMPLES, 0.0);
+const SNMEA2000Calibration currentCalibration(AMPS_PER_COUNT*10/AVERAGE_SAMPLES, -CURRENT_ZERO*AMPS_PER_COUNT*10);
+const SNMEA2000Calibration temperatureCalibration(C_PER_COUNT*100/(1 << SNMEA2000_LOWPASS_FRACTION_BITS),
+    CToKelvin(C_AT_ZERO)*100);
+
+class ChecksumTransport : public SNMEA2000Transport {
+    public:
+        bool open() override { return true; };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override { return false; };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override {
+            memcpy(last, buf, len);
+            checksum = checksum*31 + id + len;
+            for (uint8_t i = 0; i < len; i++) {
+                checksum = checksum*31 + buf[i];
+            }
+            return true;
+        };
+        uint32_t checksum = 0;
+        byte last[8];
+};
+
+typedef struct Samples {
+    int16_t voltage;
+    int16_t current;
+    int16_t temperature;
+} Samples;
+
+class FixedChain {
+    public:
+        FixedChain() :
+            voltageMedian{voltageMedianWindow, 3},
+            currentMedian{currentMedianWindow, 3},
+            temperatureMedian{temperatureMedianWindow, 3},
+            voltageAverage{voltageWindow, AVERAGE_SAMPLES},
+            currentAverage{currentWindow, AVERAGE_SAMPLES},
+            temperatureLowPass{LOW_PASS_SHIFT} {
+        };
+        void add(Samples *s) {
+            voltageAverage.add(voltageMedian.add(s->voltage));
+            currentAverage.add(currentMedian.add(s->current));
+            temperatureLowPass.add(temperatureMedian.add(s->temperature));
+        };
+        void send(EngineMonitor *engine, uint8_t sid) {
+            engine->sendDCBatterStatusMessageFixed(0, sid,
+                voltageCalibration.apply(voltageAverage.getSum()),
+                temperatureCalibration.apply(temperatureLowPass.getState()),
+                currentCalibration.apply(currentAverage.getSum()));
+        };
+    private:
+        int16_t voltageMedianWindow[3];
+        int16_t currentMedianWindow[3];
+        int16_t temperatureMedianWindow[3];
+        int16_t voltageWindow[AVERAGE_SAMPLES];
+        int16_t currentWindow[AVERAGE_SAMPLES];
+        SNMEA2000MedianFilter voltageMedian;
+        SNMEA2000MedianFilter currentMedian;
+        SNMEA2000MedianFilter temperatureMedian;
+        SNMEA2000MovingAverage voltageAverage;
+        SNMEA2000MovingAverage currentAverage;
+        SNMEA2000LowPass temperatureLowPass;
+};
+
+/**
+ * The chain as sketches write it, converting each sample to double first.
+ */
+class FloatChain {
+    public:
+        void add(Samples *s) {
+            double v = median(voltageMedian, s->voltage*VOLTS_PER_COUNT);
+            double c = median(currentMedian, (s->current-CURRENT_ZERO)*AMPS_PER_COUNT);
+            double t = median(temperatureMedian, CToKelvin(s->temperature*C_PER_COUNT + C_AT_ZERO));
+            voltageSum += v - voltageWindow[next];
+            voltageWindow[next] = v;
+            currentSum += c - currentWindow[next];
+            currentWindow[next] = c;
+            next = (next + 1) % AVERAGE_SAMPLES;
+            if ( samples++ == 0 ) {
+                temperature = t;
+            } else {
+                temperature += (t - temperature)/(1 << LOW_PASS_SHIFT);
+            }
+            n++;
+        };
+        void send(EngineMonitor *engine, uint8_t sid) {
+            engine->sendDCBatterStatusMessage(0, sid, voltageSum/AVERAGE_SAMPLES, temperature, currentSum/AVERAGE_SAMPLES);
+        };
+    private:
+        double median(double *window, double v) {
+            window[0] = window[1];
+            window[1] = window[2];
+            window[2] = v;
+            if ( n < 2 ) {
+                // same as the fixed chain while the window fills
+                return (n == 0)?v:((window[1] < v)?v:window[1]);
+            }
+            double a = window[0], b = window[1], c = window[2];
+            if ( a > b ) { double x = a; a = b; b = x; }
+            if ( b > c ) { b = c; }
+            return (a > b)?a:b;
+        };
+        double voltageMedian[3] = {};
+        double currentMedian[3] = {};
+        double temperatureMedian[3] = {};
+        double voltageWindow[AVERAGE_SAMPLES] = {};
+        double currentWindow[AVERAGE_SAMPLES] = {};
+        double voltageSum = 0;
+        double currentSum = 0;
+        double temperature = 0;
+        unsigned long samples = 0;
+        unsigned long n = 0;
+        uint8_t next = 0;
+};
+
+// repeatable on every platform, unlike rand().
+static uint32_t randomState = 1;
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+// slowly moving values with +-2 counts of noise and a spike 1 in 64.
+static void nextSamples(Samples *s, unsigned long i) {
+    int16_t spike = ((nextRandom() & 0x3f) == 0)?300:0;
+    s->voltage = 870 + (int16_t)((i/1000) % 60) + (int16_t)(nextRandom() % 5) - 2 + spike;
+    s->current = 300 + (int16_t)((i/500) % 400) + (int16_t)(nextRandom() % 5) - 2;
+    s->temperature = 150 + (int16_t)((i/2000) % 100) + (int16_t)(nextRandom() % 5) - 2;
+}
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static int field(byte *buf, uint8_t offset, bool isSigned) {
+    uint16_t v = buf[offset] | (buf[offset+1] << 8);
+    return isSigned?(int16_t)v:v;
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = 1000000;
+    unsigned long perMessage = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:r:")) != -1) {
+        switch(opt) {
+            case 'n': iterations = strtoul(optarg, NULL, 10); break;
+            case 'm': perMessage = strtoul(optarg, NULL, 10); if ( perMessage == 0 ) perMessage = 1; break;
+            case 'r': randomState = strtoul(optarg, NULL, 10); if ( randomState == 0 ) randomState = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n samples] [-m samples per message] [-r seed]\n", argv[0]);
+                return 2;
+        }
+    }
+    uint32_t seed = randomState;
+    ChecksumTransport fixedTransport;
+    ChecksumTransport floatTransport;
+    EngineMonitor fixedEngine(23, new SNMEA2000DeviceInfo(1, 140, 50), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long), &fixedTransport);
+    EngineMonitor floatEngine(23, new SNMEA2000DeviceInfo(1, 140, 50), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long), &floatTransport);
+    fixedEngine.open();
+    floatEngine.open();
+
+    // compare, skipping messages while the average and low pass settle.
+    FixedChain fixedCompare;
+    FloatChain floatCompare;
+    int maxDiff[3] = {0, 0, 0};
+    unsigned long compared = 0;
+    for (unsigned long i = 0; i < 200000; i++) {
+        Samples s;
+        nextSamples(&s, i);
+        fixedCompare.add(&s);
+        floatCompare.add(&s);
+        if ( i % perMessage == 0 && i > 100 ) {
+            fixedCompare.send(&fixedEngine, i);
+            floatCompare.send(&floatEngine, i);
+            compared++;
+            // voltage at 1, current at 3, temperature at 5
+            const uint8_t offsets[3] = {1, 3, 5};
+            for (uint8_t f = 0; f < 3; f++) {
+                int d = abs(field(fixedTransport.last, offsets[f], f < 2) - field(floatTransport.last, offsets[f], f < 2));
+                if ( d > maxDiff[f] ) {
+                    maxDiff[f] = d;
+                }
+            }
+        }
+    }
+    printf("%lu messages compared, largest difference voltage %d x 0.01V, current %d x 0.1A, temperature %d x 0.01K\n",
+        compared, maxDiff[0], maxDiff[1], maxDiff[2]);
+
+    randomState = seed;
+    Samples *samples = new Samples[4096];
+    for (int i = 0; i < 4096; i++) {
+        nextSamples(&samples[i], i);
+    }
+    FixedChain fixedChain;
+    FloatChain floatChain;
+    uint64_t start = nowNs();
+    for (unsigned long i = 0; i < iterations; i++) {
+        fixedChain.add(&samples[i & 4095]);
+        if ( i % perMessage == 0 ) {
+            fixedChain.send(&fixedEngine, i);
+        }
+    }
+    uint64_t fixedNs = nowNs() - start;
+    start = nowNs();
+    for (unsigned long i = 0; i < iterations; i++) {
+        floatChain.add(&samples[i & 4095]);
+        if ( i % perMessage == 0 ) {
+            floatChain.send(&floatEngine, i);
+        }
+    }
+    uint64_t floatNs = nowNs() - start;
+    printf("%-8s %12s %12s\n", "", "fixed ns", "float ns");
+    printf("%-8s %12.1f %12.1f\n", "sample", fixedNs/(double)iterations, floatNs/(double)iterations);
+    printf("checksums %08X %08X\n", fixedTransport.checksum, floatTransport.checksum);
+    // half an ADC count in N2K units
+    const double tolerance[3] = { VOLTS_PER_COUNT*100/2, AMPS_PER_COUNT*10/2, C_PER_COUNT*100/2 };
+    bool ok = true;
+    for (uint8_t f = 0; f < 3; f++) {
+        ok = ok && (maxDiff[f] <= 1 || maxDiff[f] <= tolerance[f]);
+    }
+    return ok?0:1;
+}
@@ -0,0 +1,337 @@
+/**
+ * Fuzz harness for the recieve path, drives processMessages() with frames decoded from the
+ * fuzz input through a transport that reads them from memory.
+ *
+ * n2kfuzz [-n inputs] [-r seed] [input ...]
+ *
+ *   -n   random inputs to run when no input files are given, default 100000
+ *   -r   random seed, default 1
+ *
+ * Each input is a sequence of records, one frame each:
+ *
+ *   ms  selector  source  destination  length  [id]  data
+ *
+ * ms is the time since the previous frame, the selector picks one of the PGNs handled by the
+ * library, or a raw 29 bit id from the selector, source, destination and an extra id byte when
+ * it is beyond the table. The low 4 bits of length are the length the transport reports, up to
+ * 15 so that frames longer than 8 bytes are seen, at most 8 data bytes follow. A device
+ * with every recieving service, SNMEA2000GroupFunction, SNMEA2000IsoTP, SNMEA2000RxCache,
+ * SNMEA2000Clock, SNMEA2000LatencyHistogram and SNMEA2000Gateway, and a BatteryMonitor sharing
+ * the transport are created for each input, on a simulated clock so runs are repeatable. Messages
+ * the SNMEA2000IsoTP reassembles reach the other services whole, up to 1785 bytes, which random
+ * frames rarely complete, so each input is also dispatched as one such message, with a PGN picked
+ * by its first byte, in a buffer of exactly its length.
+ *
+ * Built by make with -fsanitize=address,undefined, input files are run once each, for
+ * reproducing crashes or with afl-fuzz, eg
+ *
+ *   make CXX=afl-g++ build/n2kfuzz && afl-fuzz -i seeds -o findings build/n2kfuzz @@
+ *
+ * Without files, random inputs biased towards valid headers are run. make fuzz builds
+ * build/n2kfuzz-libfuzzer with clang and -fsanitize=fuzzer. Reports execs/s and frames/s,
+ * a proxy for recieve throughput with sanitizers, and the frames dropped by length validation.
+ */
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include "SmallNMEA2000Battery.h"
+#include "SmallNMEA2000Clock.h"
+#include "SmallNMEA2000Gateway.h"
+#include "SmallNMEA2000GroupFunction.h"
+#include "SmallNMEA2000IsoTP.h"
+#include "SmallNMEA2000RxCache.h"
+
+#define DEVICE_ADDRESS 20
+#define BATTERY_ADDRESS 21
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2kfuzz", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Fuzz harness", "https://github.com/ieb/SmallNMEA2000"
+};
+const SNMEA2000BatteryConfig batteryConfig PROGMEM = {
+    1, 2, 0, 1, 0, 100, 5, 125, 95
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN, 126208L, 60416L, 60160L };
+const unsigned long rxPGN[] = { SNMEA200_DEFAULT_RX_PGN, 126208L, 60416L, 60160L,
+    126992L, 127508L, 127489L, 130312L };
+const unsigned long batteryTxPGN[] = { SNMEA200_DEFAULT_TX_PGN, 127506L, 127508L, 127513L };
+const unsigned long batteryRxPGN[] = { SNMEA200_DEFAULT_RX_PGN };
+const unsigned long gatewayFastPackets[] = { 127489L, 126208L };
+
+// PGNs handled by the library, selected by the first byte of a record.
+const unsigned long fuzzPGNs[] = {
+    59392L, 59904L, 60928L, 126208L, 60416L, 60160L,
+    126992L, 127508L, 127489L, 130312L, 126993L, 126464L
+};
+#define FUZZ_PGNS (sizeof(fuzzPGNs)/sizeof(unsigned long))
+#define RECORD_HEADER 5
+
+class FuzzClock : public HostClock {
+    public:
+        uint64_t now() override { return t; };
+        void sleep(uint64_t us) override { t += us; };
+        uint64_t t = 0;
+};
+
+class NullPrint : public Print {
+    public:
+        size_t write(uint8_t c) override { return 1; };
+        int availableForWrite() override { return 4096; };
+};
+
+/**
+ * Frames from the fuzz input, sent frames are checked and discarded.
+ */
+class FuzzTransport : public SNMEA2000Transport {
+    public:
+        FuzzTransport(FuzzClock *clock, const uint8_t *data, size_t size) :
+            clock{clock}, data{data}, size{size} {};
+        bool open() override { return true; };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override {
+            if ( pos + RECORD_HEADER > size ) {
+                pos = size;
+                return false;
+            }
+            const uint8_t *r = &data[pos];
+            pos += RECORD_HEADER;
+            clock->t += (uint64_t)r[0]*1000;
+            uint8_t selector = r[1];
+            if ( selector < FUZZ_PGNS ) {
+                unsigned long pgn = fuzzPGNs[selector];
+                *id = (6UL << 26) | (pgn << 8) | r[2];
+                if ( ((pgn >> 8) & 0xff) < 240 ) {
+                    *id |= ((unsigned long)r[3]) << 8;
+                }
+            } else {
+                uint8_t extra = (pos < size)?data[pos++]:0;
+                *id = ((((unsigned long)selector) << 24) | (((unsigned long)r[3]) << 16) |
+                    (((unsigned long)extra) << 8) | r[2]) & 0x1fffffff;
+            }
+            *len = r[4] & 0x0f;
+            uint8_t n = (*len > 8)?8:*len;
+            for (uint8_t i = 0; i < n; i++) {
+                buf[i] = (pos < size)?data[pos++]:0xff;
+            }
+            frames++;
+            return true;
+        };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override {
+            if ( len > 8 || id > 0x1fffffff ) {
+                fprintf(stderr, "invalid frame sent id=%08lX len=%d\n", id, len);
+                abort();
+            }
+            for (uint8_t i = 0; i < len; i++) {
+                checksum = checksum*31 + buf[i];
+            }
+            sent++;
+            return true;
+        };
+        bool done() { return pos >= size; };
+        FuzzClock *clock;
+        const uint8_t *data;
+        size_t size;
+        size_t pos = 0;
+        unsigned long frames = 0;
+        unsigned long sent = 0;
+        unsigned long checksum = 0;
+};
+
+static unsigned long totalFrames = 0;
+static unsigned long totalSent = 0;
+static unsigned long totalLengthErrors = 0;
+static volatile unsigned long handled = 0;
+
+static void messageHandler(MessageHeader *messageHeader, byte * buffer, int len) {
+    // read every byte so that the sanitizers see any read beyond len.
+    for (int i = 0; i < len; i++) {
+        handled += buffer[i];
+    }
+}
+
+static bool isoRequestHandler(unsigned long requestedPGN, MessageHeader *messageHeader, byte * buffer, int len) {
+    messageHandler(messageHeader, buffer, len);
+    return false;
+}
+
+static void cacheSlot(SNMEA2000CacheSlot *slot, unsigned long pgn, uint8_t instanceOffset, uint8_t instance, uint8_t size) {
+    memset(slot, 0, sizeof(SNMEA2000CacheSlot));
+    slot->pgn = pgn;
+    slot->source = SNMEA2000::anySource;
+    slot->instanceOffset = instanceOffset;
+    slot->instance = instance;
+    slot->size = size;
+}
+
+static void runInput(const uint8_t *data, size_t size) {
+    static FuzzClock clock;
+    static NullPrint console;
+    static byte tpBuffer[SNMEA2000IsoTP::maxLength];
+    static byte gatewayRing[1024];
+    clock.t = 0;
+    setHostClock(&clock);
+
+    FuzzTransport transport(&clock, data, size);
+    SNMEA2000DeviceInfo devInfo(1, 140, 50);
+    SNMEA2000 device(DEVICE_ADDRESS, &devInfo, &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long),
+        rxPGN, sizeof(rxPGN)/sizeof(unsigned long),
+        &transport, &console);
+    SNMEA2000DeviceInfo batteryInfo(2, 170, 35);
+    BatteryMonitor battery(BATTERY_ADDRESS, &batteryInfo, &productInfo, &configInfo,
+        batteryTxPGN, sizeof(batteryTxPGN)/sizeof(unsigned long),
+        batteryRxPGN, sizeof(batteryRxPGN)/sizeof(unsigned long),
+        &transport, &batteryConfig, 1000, 1000);
+    device.addDevice(&battery);
+    device.setMessageHandler(messageHandler);
+    device.setIsoRequestHandler(isoRequestHandler);
+
+    SNMEA2000GroupFunction groupFunction;
+    device.addListener(&groupFunction);
+    SNMEA2000IsoTP isoTP(&device, tpBuffer, sizeof(tpBuffer));
+    device.addListener(&isoTP);
+    device.setIsoTP(&isoTP);
+    SNMEA2000CacheSlot cacheSlots[3];
+    cacheSlot(&cacheSlots[0], 127508L, 0, 1, 8);
+    cacheSlot(&cacheSlots[1], 127489L, 0, 0, 26);
+    cacheSlot(&cacheSlots[2], 130312L, SNMEA2000RxCache::noInstance, 0, 8);
+    static byte arena[128];
+    SNMEA2000RxCache cache(cacheSlots, 3, arena, sizeof(arena));
+    cache.begin();
+    device.addListener(&cache);
+    SNMEA2000Clock busClock;
+    device.addListener(&busClock);
+    SNMEA2000LatencyHistogram latency;
+    device.addListener(&latency);
+    SNMEA2000Gateway gateway(&console, SNMEA2000_GATEWAY_ACTISENSE, gatewayRing, sizeof(gatewayRing),
+        gatewayFastPackets, sizeof(gatewayFastPackets)/sizeof(unsigned long));
+    gateway.begin();
+    device.addListener(&gateway);
+
+    device.open();
+    battery.open();
+    while ( !transport.done() ) {
+        device.processMessages();
+    }
+    // let address claims, transport sessions and fast packets time out.
+    for (int i = 0; i < 4; i++) {
+        clock.t += 1000000;
+        device.processMessages();
+    }
+    if ( size > 8 ) {
+        // as a transport protocol message, in its own allocation so that reads beyond len are seen.
+        size_t len = (size > SNMEA2000IsoTP::maxLength)?SNMEA2000IsoTP::maxLength:size;
+        byte *message = new byte[len];
+        memcpy(message, data, len);
+        MessageHeader messageHeader(fuzzPGNs[data[0] % FUZZ_PGNS], 6, data[2], DEVICE_ADDRESS);
+        device.dispatchMessage(&messageHeader, message, len);
+        delete[] message;
+    }
+    totalFrames += transport.frames;
+    totalSent += transport.sent;
+    totalLengthErrors += device.getRxLengthErrors() + battery.getRxLengthErrors();
+    setHostClock(NULL);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    runInput(data, size);
+    return 0;
+}
+
+#ifndef SNMEA2000_LIBFUZZER
+
+static uint32_t rngState = 1;
+
+static uint32_t rng() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+/**
+ * Random records with mostly valid headers and lengths, and first bytes that are likely
+ * fast packet, transport protocol and group function headers.
+ */
+static size_t randomInput(uint8_t *input, size_t max) {
+    static const uint8_t firstBytes[] = { 0x00, 0x01, 0x02, 0x20, 0x21, 0x10, 0x11, 0x13, 0x20, 0xff };
+    size_t records = 1 + rng()%64;
+    size_t n = 0;
+    for (size_t i = 0; i < records && n + RECORD_HEADER + 9 <= max; i++) {
+        input[n++] = rng()%20;
+        input[n++] = (rng()%8 == 0)?rng():rng()%FUZZ_PGNS;
+        input[n++] = rng();
+        uint8_t destinations[] = { DEVICE_ADDRESS, BATTERY_ADDRESS, 0xff, (uint8_t)rng() };
+        input[n++] = destinations[rng()%4];
+        uint8_t len = (rng()%4 == 0)?rng()%16:8;
+        input[n++] = len;
+        if ( input[n-4] >= FUZZ_PGNS ) {
+            input[n++] = rng();
+        }
+        for (uint8_t b = 0; b < len && b < 8; b++) {
+            input[n++] = (b == 0 && rng()%2 == 0)?firstBytes[rng()%sizeof(firstBytes)]:rng();
+        }
+    }
+    return n;
+}
+
+static bool runFile(const char *name) {
+    FILE *f = fopen(name, "rb");
+    if ( f == NULL ) {
+        perror(name);
+        return false;
+    }
+    static uint8_t input[65536];
+    size_t size = fread(input, 1, sizeof(input), f);
+    fclose(f);
+    runInput(input, size);
+    return true;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n inputs] [-r seed] [input ...]\n", name);
+}
+
+int main(int argc, char **argv) {
+    unsigned long inputs = 100000;
+    int opt;
+    while ( (opt = getopt(argc, argv, "n:r:")) != -1 ) {
+        switch(opt) {
+        case 'n': inputs = strtoul(optarg, NULL, 10); break;
+        case 'r': rngState = strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( rngState == 0 ) {
+        rngState = 1;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long execs = 0;
+    if ( optind < argc ) {
+        for (int i = optind; i < argc; i++) {
+            if ( !runFile(argv[i]) ) {
+                return 1;
+            }
+            execs++;
+        }
+    } else {
+        static uint8_t input[64*(RECORD_HEADER+9)];
+        for (; execs < inputs; execs++) {
+            runInput(input, randomInput(input, sizeof(input)));
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    if ( seconds <= 0 ) {
+        seconds = 1e-9;
+    }
+    printf("execs=%lu frames=%lu sent=%lu length errors=%lu\n", execs, totalFrames, totalSent, totalLengthErrors);
+    printf("%.0f execs/s %.0f frames/s\n", execs/seconds, totalFrames/seconds);
+    return 0;
+}
+
+#endif
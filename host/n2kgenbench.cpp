@@ -0,0 +1,260 @@
+/**
+ * Compares the encoders generated by generator/n2kgen.py with the hand written encoders in
+ * EngineMonitor and PressureMonitor.
+ *
+ * n2kgenbench [-n iterations] [-r seed]
+ *
+ *   -n   iterations of each encoder to time, default 1000000
+ *   -r   random seed for the values, default 1
+ *
+ * Every PGN is first encoded with the same values, including not available and negative
+ * values for unsigned fields, by both encoders on devices in the same state and the frames
+ * compared byte for byte. Each encoder is then timed over the same values, with frames going
+ * to a transport that only checksums them. Exits 1 if any frames differ.
+ */
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "SmallNMEA2000PGNs.h"
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2kgenbench", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Encoder benchmark", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN };
+const unsigned long rxPGN[] = { SNMEA200_DEFAULT_RX_PGN };
+
+typedef struct CapturedFrame {
+    unsigned long id;
+    uint8_t len;
+    byte buf[8];
+} CapturedFrame;
+
+class CaptureTransport : public SNMEA2000Transport {
+    public:
+        bool open() override { return true; };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override { return false; };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override {
+            if ( capture ) {
+                CapturedFrame f;
+                f.id = id;
+                f.len = len;
+                memcpy(f.buf, buf, len);
+                frames.push_back(f);
+            }
+            checksum = checksum*31 + id + len;
+            for (uint8_t i = 0; i < len; i++) {
+                checksum = checksum*31 + buf[i];
+            }
+            return true;
+        };
+        bool capture = true;
+        uint32_t checksum = 0;
+        std::vector<CapturedFrame> frames;
+};
+
+typedef struct TestValues {
+    uint8_t instance;
+    uint8_t sid;
+    uint8_t source;
+    int8_t percent;
+    uint16_t status;
+    double speed;
+    double pressure;
+    double temperature;
+    double voltage;
+    double current;
+    double rate;
+    double hours;
+    double humidity;
+    double level;
+    double capacity;
+} TestValues;
+
+typedef struct Encoders {
+    EngineMonitor *engine;
+    PressureMonitor *pressure;
+} Encoders;
+
+// repeatable on every platform, unlike rand().
+static uint32_t randomState = 1;
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+// NA 1 in 16, otherwise uniform over min..max.
+static double randomValue(double min, double max) {
+    uint32_t r = nextRandom();
+    if ( (r & 0x0f) == 0 ) {
+        return SNMEA2000::n2kDoubleNA;
+    }
+    return min + (max - min)*((r >> 4)/(double)0x0fffffff);
+}
+
+static void randomValues(TestValues *v) {
+    v->instance = nextRandom() & 0x0f;
+    v->sid = nextRandom();
+    v->source = nextRandom() & 0x3f;
+    v->percent = (int8_t)(nextRandom()%201 - 100);
+    v->status = nextRandom();
+    v->speed = randomValue(-10, 16000);
+    v->pressure = randomValue(-1000, 6000000);
+    v->temperature = randomValue(-5, 600);
+    v->voltage = randomValue(-300, 300);
+    v->current = randomValue(-3000, 3000);
+    v->rate = randomValue(-3000, 3000);
+    v->hours = randomValue(-10, 4000000000.0);
+    v->humidity = randomValue(-100, 100);
+    v->level = randomValue(-100, 100);
+    v->capacity = randomValue(-10, 400000000.0);
+}
+
+// the hand written encoders, pressure fits 16 bits at 100Pa for 130310 and 130311.
+#define PGN_COUNT 10
+static void sendHandWritten(Encoders *e, uint8_t pgn, TestValues *v) {
+    double pressure16 = (v->pressure == SNMEA2000::n2kDoubleNA)?v->pressure:v->pressure/1000.0;
+    switch(pgn) {
+        case 0: e->engine->sendRapidEngineDataMessage(v->instance, v->speed, pressure16, v->percent); break;
+        case 1: e->engine->sendEngineDynamicParamMessage(v->instance, v->hours, v->temperature, v->voltage,
+            v->status, v->status ^ 0x5555, pressure16, v->temperature, v->rate, pressure16, v->pressure/100.0,
+            v->percent, -v->percent); break;
+        case 2: e->engine->sendFluidLevelMessage(v->instance, v->instance ^ 0x0f, v->level, v->capacity); break;
+        case 3: e->engine->sendDCBatterStatusMessage(v->instance, v->sid, v->voltage, v->temperature, v->current); break;
+        case 4: e->engine->sendTemperatureMessage(v->sid, v->instance, v->source, v->temperature, v->temperature); break;
+        case 5: e->pressure->sendOutsideEnvironmentParameters(v->sid, v->temperature, v->temperature, pressure16); break;
+        case 6: e->pressure->sendEnvironmentParameters(v->sid, pressure16, v->source, v->temperature, v->source & 0x03, v->humidity); break;
+        case 7: e->pressure->sendHumidity(v->sid, v->source, v->instance, v->humidity); break;
+        case 8: e->pressure->sendPressure(v->sid, v->source, v->instance, v->pressure); break;
+        case 9: e->pressure->sendTemperature(v->sid, v->source, v->instance, v->temperature); break;
+    }
+}
+
+static void sendGenerated(Encoders *e, uint8_t pgn, TestValues *v) {
+    double pressure16 = (v->pressure == SNMEA2000::n2kDoubleNA)?v->pressure:v->pressure/1000.0;
+    switch(pgn) {
+        case 0: sendN2kEngineParametersRapidUpdate(e->engine, v->instance, v->speed, pressure16, v->percent); break;
+        case 1: sendN2kEngineParametersDynamic(e->engine, v->instance, pressure16, v->temperature, v->temperature,
+            v->voltage, v->rate, v->hours, pressure16, v->pressure/100.0, v->status, v->status ^ 0x5555,
+            v->percent, -v->percent); break;
+        case 2: sendN2kFluidLevel(e->engine, v->instance ^ 0x0f, v->instance, v->level, v->capacity); break;
+        case 3: sendN2kBatteryStatus(e->engine, v->instance, v->voltage, v->current, v->temperature, v->sid); break;
+        case 4: sendN2kTemperature(e->engine, v->sid, v->instance, v->source, v->temperature, v->temperature); break;
+        case 5: sendN2kEnvironmentalParametersObsolete(e->pressure, v->sid, v->temperature, v->temperature, pressure16); break;
+        case 6: sendN2kEnvironmentalParameters(e->pressure, v->sid, v->source, v->source & 0x03, v->temperature, v->humidity, pressure16); break;
+        case 7: sendN2kHumidity(e->pressure, v->sid, v->instance, v->source, v->humidity, SNMEA2000::n2kDoubleNA); break;
+        case 8: sendN2kActualPressure(e->pressure, v->sid, v->instance, v->source, v->pressure); break;
+        case 9: sendN2kTemperatureExtendedRange(e->pressure, v->sid, v->instance, v->source, v->temperature, SNMEA2000::n2kDoubleNA); break;
+    }
+}
+
+static const char * pgnNames[PGN_COUNT] = {
+    "127488", "127489", "127505", "127508", "130312", "130310", "130311", "130313", "130314", "130316"
+};
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static Encoders createEncoders(CaptureTransport *transport) {
+    Encoders e;
+    e.engine = new EngineMonitor(23, new SNMEA2000DeviceInfo(1, 140, 50), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long), transport);
+    e.pressure = new PressureMonitor(24, new SNMEA2000DeviceInfo(2, 130, 75), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long), transport);
+    e.engine->open();
+    e.pressure->open();
+    transport->frames.clear();
+    return e;
+}
+
+static void printFrames(const char *label, std::vector<CapturedFrame> *frames) {
+    printf("  %s", label);
+    for (CapturedFrame &f : *frames) {
+        printf(" %08lX#", f.id);
+        for (uint8_t i = 0; i < f.len; i++) {
+            printf("%02X", f.buf[i]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    unsigned long iterations = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch(opt) {
+            case 'n': iterations = strtoul(optarg, NULL, 10); break;
+            case 'r': randomState = strtoul(optarg, NULL, 10); if ( randomState == 0 ) randomState = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-r seed]\n", argv[0]);
+                return 2;
+        }
+    }
+    uint32_t seed = randomState;
+    CaptureTransport handTransport;
+    CaptureTransport generatedTransport;
+    Encoders hand = createEncoders(&handTransport);
+    Encoders generated = createEncoders(&generatedTransport);
+
+    unsigned long compared = 0;
+    unsigned long differences = 0;
+    for (int n = 0; n < 10000; n++) {
+        TestValues v;
+        randomValues(&v);
+        for (uint8_t pgn = 0; pgn < PGN_COUNT; pgn++) {
+            handTransport.frames.clear();
+            generatedTransport.frames.clear();
+            sendHandWritten(&hand, pgn, &v);
+            sendGenerated(&generated, pgn, &v);
+            compared++;
+            bool same = handTransport.frames.size() == generatedTransport.frames.size();
+            for (size_t i = 0; same && i < handTransport.frames.size(); i++) {
+                CapturedFrame *a = &handTransport.frames[i];
+                CapturedFrame *b = &generatedTransport.frames[i];
+                same = a->id == b->id && a->len == b->len && memcmp(a->buf, b->buf, a->len) == 0;
+            }
+            if ( !same ) {
+                if ( differences++ < 10 ) {
+                    printf("PGN %s differs\n", pgnNames[pgn]);
+                    printFrames("hand     ", &handTransport.frames);
+                    printFrames("generated", &generatedTransport.frames);
+                }
+            }
+        }
+    }
+    printf("%lu messages compared, %lu differ\n", compared, differences);
+
+    handTransport.capture = false;
+    generatedTransport.capture = false;
+    TestValues values[64];
+    randomState = seed;
+    for (int i = 0; i < 64; i++) {
+        randomValues(&values[i]);
+    }
+    printf("%-8s %12s %12s\n", "PGN", "hand ns", "generated ns");
+    for (uint8_t pgn = 0; pgn < PGN_COUNT; pgn++) {
+        uint64_t start = nowNs();
+        for (unsigned long i = 0; i < iterations; i++) {
+            sendHandWritten(&hand, pgn, &values[i & 63]);
+        }
+        uint64_t handNs = nowNs() - start;
+        start = nowNs();
+        for (unsigned long i = 0; i < iterations; i++) {
+            sendGenerated(&generated, pgn, &values[i & 63]);
+        }
+        uint64_t generatedNs = nowNs() - start;
+        printf("%-8s %12.1f %12.1f\n", pgnNames[pgn], handNs/(double)iterations, generatedNs/(double)iterations);
+    }
+    if ( handTransport.checksum != generatedTransport.checksum ) {
+        printf("checksums differ %08X %08X\n", handTransport.checksum, generatedTransport.checksum);
+    }
+    return (differences == 0)?0:1;
+}
@@ -0,0 +1,393 @@
+/**
+ * Multi threaded decoder for large candump logs.
+ *
+ * n2klog [-j threads] [-f pgn]... [-e pgn:offset:type:resolution]... [-o series.csv] log
+ *
+ *   -j   threads, default the number of cores
+ *   -f   treat pgn as a fast packet, in addition to the built in list
+ *   -e   extract a field into a time series, type is u1 u2 i2 u3 i3 u4 i4, eg 127488:1:u2:0.25
+ *        for engine speed in RPM. Fields not available are omitted.
+ *   -o   write the time series as time,pgn,source,field,value csv, default stdout
+ *
+ * The log is memory mapped and split into one chunk per thread at line boundaries. Each thread
+ * parses its chunk, reassembles fast packets with the library assembleFastPacket and decodes
+ * fields with SNMEA2000FieldView. Fast packets spanning chunk boundaries are completed when the
+ * chunks are joined. Prints frames and messages per PGN and source, and the parse rate.
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "CandumpLog.h"
+#include "SmallNMEA2000RxCache.h"
+
+#define MAX_EXTRACTS 32
+
+// fast packet PGNs from the canboat database, proprietary ranges are checked separately.
+static const unsigned long fastPacketPGNs[] = {
+    126208L, 126464L, 126720L, 126983L, 126984L, 126985L, 126986L, 126987L, 126988L, 126996L, 126998L,
+    127233L, 127237L, 127489L, 127496L, 127497L, 127498L, 127503L, 127504L, 127506L, 127507L,
+    127509L, 127510L, 127511L, 127512L, 127513L, 127514L, 128275L, 128520L, 128538L,
+    129029L, 129038L, 129039L, 129040L, 129041L, 129044L, 129045L, 129284L, 129285L, 129301L,
+    129302L, 129538L, 129540L, 129541L, 129542L, 129545L, 129547L, 129549L, 129551L, 129556L,
+    129792L, 129793L, 129794L, 129795L, 129796L, 129797L, 129798L, 129799L, 129800L, 129801L,
+    129802L, 129803L, 129804L, 129805L, 129806L, 129807L, 129808L, 129809L, 129810L,
+    130052L, 130053L, 130054L, 130060L, 130061L, 130064L, 130065L, 130066L, 130067L, 130068L,
+    130069L, 130070L, 130071L, 130072L, 130073L, 130074L, 130320L, 130321L, 130322L, 130323L,
+    130324L, 130330L, 130560L, 130561L, 130562L, 130563L, 130564L, 130565L, 130566L, 130567L,
+    130569L, 130570L, 130571L, 130572L, 130573L, 130574L, 130577L, 130578L, 130580L, 130581L,
+    130583L, 130584L, 130586L
+};
+
+typedef struct Extract {
+    unsigned long pgn;
+    uint8_t offset;
+    char type;
+    uint8_t bytes;
+    double resolution;
+} Extract;
+
+typedef struct KeyStats {
+    unsigned long frames;
+    unsigned long messages;
+    unsigned long errors;
+    double first;
+    double last;
+} KeyStats;
+
+typedef struct Sample {
+    double time;
+    unsigned long pgn;
+    uint8_t source;
+    uint8_t field;
+    double value;
+} Sample;
+
+typedef struct Assembly {
+    SNMEA2000FastPacketState state;
+    byte payload[223];
+} Assembly;
+
+// a frame continuing a fast packet started in an earlier chunk.
+typedef struct Orphan {
+    uint32_t key;
+    double time;
+    uint8_t len;
+    byte buf[8];
+} Orphan;
+
+typedef struct Chunk {
+    const char *start;
+    const char *end;
+    std::unordered_map<uint32_t, KeyStats> stats;
+    // fast packets seen starting in this chunk, incomplete ones are carried into the next.
+    std::unordered_map<uint32_t, Assembly> assemblies;
+    std::vector<Orphan> orphans;
+    std::vector<Sample> samples;
+    unsigned long lines;
+    unsigned long frames;
+} Chunk;
+
+static std::vector<bool> fastPacket(1 << 18, false);
+static Extract extracts[MAX_EXTRACTS];
+static uint8_t nExtracts = 0;
+
+static inline uint32_t makeKey(unsigned long pgn, uint8_t source) {
+    return (uint32_t)((pgn << 8) | source);
+}
+
+static void addStats(std::unordered_map<uint32_t, KeyStats> *stats, uint32_t key, double time,
+        unsigned long frames, unsigned long messages, unsigned long errors) {
+    KeyStats *s = &(*stats)[key];
+    if ( s->frames + s->messages + s->errors == 0 || time < s->first ) {
+        s->first = time;
+    }
+    if ( time > s->last ) {
+        s->last = time;
+    }
+    s->frames += frames;
+    s->messages += messages;
+    s->errors += errors;
+}
+
+static void extractFields(std::vector<Sample> *samples, double time, unsigned long pgn, uint8_t source,
+        const byte *payload, uint8_t len) {
+    for (uint8_t i = 0; i < nExtracts; i++) {
+        Extract *e = &extracts[i];
+        if ( e->pgn != pgn ) {
+            continue;
+        }
+        SNMEA2000FieldView view(payload, len);
+        double value = SNMEA2000::n2kDoubleNA;
+        switch ((e->type == 'i'?-1:1)*e->bytes) {
+        case 1: value = view.get1ByteUDouble(e->offset, e->resolution); break;
+        case 2: value = view.get2ByteUDouble(e->offset, e->resolution); break;
+        case -2: value = view.get2ByteDouble(e->offset, e->resolution); break;
+        case 3: value = view.get3ByteUDouble(e->offset, e->resolution); break;
+        case -3: value = view.get3ByteDouble(e->offset, e->resolution); break;
+        case 4: value = view.get4ByteUDouble(e->offset, e->resolution); break;
+        case -4: value = view.get4ByteDouble(e->offset, e->resolution); break;
+        }
+        if ( value != SNMEA2000::n2kDoubleNA ) {
+            Sample sample = { time, pgn, source, i, value };
+            samples->push_back(sample);
+        }
+    }
+}
+
+static void decodeChunk(Chunk *chunk) {
+    CandumpFrame frame;
+    const char *p = chunk->start;
+    while ( p < chunk->end ) {
+        const char *eol = (const char *)memchr(p, '\n', chunk->end - p);
+        if ( eol == NULL ) {
+            eol = chunk->end;
+        }
+        chunk->lines++;
+        if ( parseCandumpLine(p, eol - p, &frame) ) {
+            chunk->frames++;
+            unsigned long pgn = getPgnId(frame.id);
+            uint8_t source = frame.id & 0xff;
+            uint32_t key = makeKey(pgn, source);
+            if ( !fastPacket[pgn] ) {
+                addStats(&chunk->stats, key, frame.time, 1, 1, 0);
+                extractFields(&chunk->samples, frame.time, pgn, source, frame.buf, frame.len);
+            } else {
+                std::unordered_map<uint32_t, Assembly>::iterator a = chunk->assemblies.find(key);
+                if ( a == chunk->assemblies.end() && frame.len > 0 && (frame.buf[0] & 0x1f) != 0 ) {
+                    // may complete a packet from the previous chunk.
+                    Orphan orphan;
+                    orphan.key = key;
+                    orphan.time = frame.time;
+                    orphan.len = frame.len;
+                    memcpy(orphan.buf, frame.buf, frame.len);
+                    chunk->orphans.push_back(orphan);
+                } else {
+                    Assembly *assembly = &chunk->assemblies[key];
+                    bool wasAssembling = assembly->state.nextFrame != 0;
+                    uint8_t length = assembleFastPacket(&assembly->state, assembly->payload, 223, frame.buf, frame.len);
+                    bool abandoned = wasAssembling && (frame.buf[0] & 0x1f) == 0;
+                    bool error = abandoned || (length == 0 && assembly->state.nextFrame == 0 && (frame.buf[0] & 0x1f) != 0);
+                    addStats(&chunk->stats, key, frame.time, 1, (length > 0)?1:0, error?1:0);
+                    if ( length > 0 ) {
+                        extractFields(&chunk->samples, frame.time, pgn, source, assembly->payload, (length > 223)?223:length);
+                    }
+                }
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+static bool parseExtract(const char *arg) {
+    if ( nExtracts >= MAX_EXTRACTS ) {
+        fprintf(stderr, "Too many fields\n");
+        return false;
+    }
+    Extract *e = &extracts[nExtracts];
+    char type[3];
+    int offset;
+    if ( sscanf(arg, "%lu:%d:%2[a-z0-9]:%lf", &e->pgn, &offset, type, &e->resolution) != 4 ||
+        offset < 0 || offset > 222 || e->pgn >= (1UL << 18) ) {
+        return false;
+    }
+    e->offset = offset;
+    e->type = type[0];
+    e->bytes = type[1] - '0';
+    if ( !((e->type == 'u' && e->bytes >= 1 && e->bytes <= 4) || (e->type == 'i' && e->bytes >= 2 && e->bytes <= 4)) ) {
+        return false;
+    }
+    nExtracts++;
+    return true;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-j threads] [-f pgn]... [-e pgn:offset:type:resolution]... [-o series.csv] log\n", name);
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)/1000000000.0;
+}
+
+static bool bySampleTime(const Sample &a, const Sample &b) {
+    return a.time < b.time;
+}
+
+int main(int argc, char **argv) {
+    int threads = std::thread::hardware_concurrency();
+    const char *seriesFile = NULL;
+    for (unsigned int i = 0; i < sizeof(fastPacketPGNs)/sizeof(unsigned long); i++) {
+        fastPacket[fastPacketPGNs[i]] = true;
+    }
+    // proprietary fast packet ranges.
+    for (unsigned long pgn = 126720L; pgn < 126976L; pgn++) {
+        fastPacket[pgn] = true;
+    }
+    for (unsigned long pgn = 130816L; pgn < 131072L; pgn++) {
+        fastPacket[pgn] = true;
+    }
+    int opt;
+    while ( (opt = getopt(argc, argv, "j:f:e:o:")) != -1 ) {
+        switch (opt) {
+        case 'j': threads = atoi(optarg); break;
+        case 'f': {
+            unsigned long pgn = strtoul(optarg, NULL, 10);
+            if ( pgn >= (1UL << 18) ) {
+                usage(argv[0]);
+                return 1;
+            }
+            fastPacket[pgn] = true;
+            break;
+        }
+        case 'e':
+            if ( !parseExtract(optarg) ) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o': seriesFile = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( optind >= argc || threads < 1 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    if ( fd < 0 ) {
+        perror(argv[optind]);
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    if ( size == 0 ) {
+        fprintf(stderr, "%s is empty\n", argv[optind]);
+        return 1;
+    }
+    const char *log = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ( log == MAP_FAILED ) {
+        perror("mmap");
+        return 1;
+    }
+    madvise((void *)log, size, MADV_SEQUENTIAL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // split at line boundaries.
+    std::vector<Chunk> chunks(threads);
+    const char *end = log + size;
+    const char *p = log;
+    for (int i = 0; i < threads; i++) {
+        chunks[i].start = p;
+        const char *split = (i == threads-1)?end:log + (size/threads)*(i+1);
+        if ( split < p ) {
+            split = p;
+        }
+        const char *eol = (split < end)?(const char *)memchr(split, '\n', end - split):NULL;
+        p = (eol == NULL)?end:eol+1;
+        chunks[i].end = p;
+        chunks[i].lines = 0;
+        chunks[i].frames = 0;
+    }
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread(decodeChunk, &chunks[i]));
+    }
+    for (int i = 0; i < threads; i++) {
+        workers[i].join();
+    }
+
+    // join the chunks in order, completing fast packets that span a boundary.
+    std::unordered_map<uint32_t, KeyStats> stats;
+    std::unordered_map<uint32_t, Assembly> carry;
+    std::vector<Sample> samples;
+    unsigned long lines = 0;
+    unsigned long frames = 0;
+    for (int i = 0; i < threads; i++) {
+        Chunk *chunk = &chunks[i];
+        std::vector<Sample> boundarySamples;
+        for (size_t o = 0; o < chunk->orphans.size(); o++) {
+            Orphan *orphan = &chunk->orphans[o];
+            std::unordered_map<uint32_t, Assembly>::iterator a = carry.find(orphan->key);
+            unsigned long pgn = orphan->key >> 8;
+            uint8_t source = orphan->key & 0xff;
+            if ( a == carry.end() ) {
+                addStats(&stats, orphan->key, orphan->time, 1, 0, 1);
+                continue;
+            }
+            uint8_t length = assembleFastPacket(&a->second.state, a->second.payload, 223, orphan->buf, orphan->len);
+            addStats(&stats, orphan->key, orphan->time, 1, (length > 0)?1:0, (a->second.state.nextFrame == 0 && length == 0)?1:0);
+            if ( length > 0 ) {
+                extractFields(&boundarySamples, orphan->time, pgn, source, a->second.payload, (length > 223)?223:length);
+            }
+            if ( a->second.state.nextFrame == 0 ) {
+                carry.erase(a);
+            }
+        }
+        for (std::unordered_map<uint32_t, Assembly>::iterator a = chunk->assemblies.begin(); a != chunk->assemblies.end(); a++) {
+            if ( a->second.state.nextFrame != 0 ) {
+                carry[a->first] = a->second;
+            } else {
+                carry.erase(a->first);
+            }
+        }
+        for (std::unordered_map<uint32_t, KeyStats>::iterator s = chunk->stats.begin(); s != chunk->stats.end(); s++) {
+            addStats(&stats, s->first, s->second.first, s->second.frames, s->second.messages, s->second.errors);
+            addStats(&stats, s->first, s->second.last, 0, 0, 0);
+        }
+        size_t merged = samples.size();
+        samples.insert(samples.end(), chunk->samples.begin(), chunk->samples.end());
+        if ( boundarySamples.size() > 0 ) {
+            size_t middle = samples.size();
+            samples.insert(samples.end(), boundarySamples.begin(), boundarySamples.end());
+            std::inplace_merge(samples.begin()+merged, samples.begin()+middle, samples.end(), bySampleTime);
+        }
+        lines += chunk->lines;
+        frames += chunk->frames;
+    }
+    double seconds = elapsed(&start);
+
+    std::map<uint32_t, KeyStats> sorted(stats.begin(), stats.end());
+    printf("%8s %6s %10s %10s %8s %18s %18s %8s\n", "pgn", "source", "frames", "messages", "errors", "first", "last", "Hz");
+    for (std::map<uint32_t, KeyStats>::iterator s = sorted.begin(); s != sorted.end(); s++) {
+        KeyStats *k = &s->second;
+        double span = k->last - k->first;
+        printf("%8u %6u %10lu %10lu %8lu %18.6f %18.6f %8.2f\n", s->first >> 8, s->first & 0xff,
+            k->frames, k->messages, k->errors, k->first, k->last, (span > 0 && k->messages > 1)?(k->messages-1)/span:0.0);
+    }
+    printf("%lu lines, %lu frames, %.1f MB in %.3fs with %d threads, %.0f MB/s, %.0f frames/s\n",
+        lines, frames, size/1000000.0, seconds, threads, size/1000000.0/seconds, frames/seconds);
+
+    if ( nExtracts > 0 ) {
+        FILE *out = (seriesFile == NULL)?stdout:fopen(seriesFile, "w");
+        if ( out == NULL ) {
+            perror(seriesFile);
+            return 1;
+        }
+        fprintf(out, "time,pgn,source,field,value\n");
+        for (size_t i = 0; i < samples.size(); i++) {
+            Sample *s = &samples[i];
+            fprintf(out, "%.6f,%lu,%u,%u,%g\n", s->time, s->pgn, s->source, s->field, s->value);
+        }
+        if ( out != stdout ) {
+            fclose(out);
+        }
+    }
+    munmap((void *)log, size);
+    close(fd);
+    return 0;
+}
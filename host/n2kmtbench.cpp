@@ -0,0 +1,201 @@
+/**
+ * Throughput of several threads sending through one SNMEA2000 with a SNMEA2000ThreadedTransport.
+ *
+ * n2kmtbench [-i interface] [-t threads] [-n messages]
+ *
+ *   -i   SocketCAN interface to write to, eg vcan0, default frames are only checked
+ *   -t   most producer threads, runs 1, 2, 4 ... up to this, default the number of cores
+ *   -n   messages sent by each producer, default 100000
+ *
+ * Each producer alternates a 26 byte 127489 fast packet, 4 frames sent in a SNMEA2000TxBatch,
+ * with a single frame 127488 sent with sendFrame(). The writer thread checks every frame before
+ * passing it to the interface: the frames of each fast packet must be consecutive and in order.
+ * Reports messages/s and frames/s for each number of producers and the speed up over 1 producer.
+ * On vcan the writer is limited by one write() per frame, without an interface by the queue.
+ * Messages the queue rejected after waiting SNMEA2000_TX_QUEUE_WAIT ms are counted, not retried.
+ * Exits 1 if any fast packet was interleaved or an accepted message was not written.
+ */
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "SocketCANTransport.h"
+#include "ThreadedTransport.h"
+
+#define FAST_PACKET_PGN 127489L
+#define FAST_PACKET_LENGTH 26
+#define FAST_PACKET_FRAMES 4
+#define SINGLE_FRAME_PGN 127488L
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2kmtbench", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Threaded send benchmark", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN, SINGLE_FRAME_PGN, FAST_PACKET_PGN };
+const unsigned long rxPGN[] = { SNMEA200_DEFAULT_RX_PGN };
+
+class NullPrint : public Print {
+    public:
+        size_t write(uint8_t c) override { return 1; };
+};
+
+/**
+ * Checks the order of frames written by the writer thread, then passes them on.
+ */
+class CheckingTransport : public SNMEA2000Transport {
+    public:
+        CheckingTransport(SNMEA2000Transport *transport) : transport{transport} {};
+        bool open() override { return transport == NULL || transport->open(); };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override { return false; };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override {
+            unsigned long pgn = (id >> 8) & 0x1ffff;
+            if ( nextFrame != 0 ) {
+                if ( pgn != FAST_PACKET_PGN || (buf[0] & 0x1f) != nextFrame || (buf[0] >> 5) != sequence ) {
+                    interleaved++;
+                    nextFrame = 0;
+                } else if ( ++nextFrame == FAST_PACKET_FRAMES ) {
+                    nextFrame = 0;
+                    fastPackets++;
+                }
+            } else if ( pgn == FAST_PACKET_PGN ) {
+                if ( (buf[0] & 0x1f) != 0 ) {
+                    interleaved++;
+                } else {
+                    sequence = buf[0] >> 5;
+                    nextFrame = 1;
+                }
+            } else if ( pgn == SINGLE_FRAME_PGN ) {
+                singleFrames++;
+            }
+            return transport == NULL || transport->sendFrame(id, len, buf);
+        };
+        void reset() {
+            nextFrame = 0;
+            fastPackets = 0;
+            singleFrames = 0;
+        };
+        SNMEA2000Transport *transport;
+        uint8_t nextFrame = 0;
+        uint8_t sequence = 0;
+        unsigned long fastPackets = 0;
+        unsigned long singleFrames = 0;
+        unsigned long interleaved = 0;
+};
+
+static std::atomic<unsigned long> rejected{0};
+
+static void producer(SNMEA2000 *device, SNMEA2000ThreadedTransport *transport, unsigned long messages) {
+    MessageHeader messageHeader(FAST_PACKET_PGN, 2, device->getAddress(), SNMEA2000::broadcastAddress);
+    byte payload[FAST_PACKET_LENGTH];
+    byte frame[8] = { 0, 0x40, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xff };
+    for (uint8_t i = 0; i < FAST_PACKET_LENGTH; i++) {
+        payload[i] = i;
+    }
+    unsigned long singleFrameId = SNMEA2000::canIdBase(SINGLE_FRAME_PGN, 2) | device->getAddress();
+    for (unsigned long i = 0; i < messages; i += 2) {
+        {
+            SNMEA2000TxBatch batch(transport);
+            device->sendFastPacket(&messageHeader, payload, FAST_PACKET_LENGTH);
+            if ( !batch.commit() ) {
+                rejected++;
+            }
+        }
+        frame[0] = i & 0xff;
+        {
+            // a batch of one, only to see if the queue took the frame.
+            SNMEA2000TxBatch batch(transport);
+            device->sendFrame(singleFrameId, frame, 8);
+            if ( !batch.commit() ) {
+                rejected++;
+            }
+        }
+    }
+}
+
+static double elapsedSeconds(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec)/1e9;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-i interface] [-t threads] [-n messages]\n", name);
+}
+
+int main(int argc, char **argv) {
+    const char *interfaceName = NULL;
+    int maxThreads = std::thread::hardware_concurrency();
+    unsigned long messages = 100000;
+    int opt;
+    while ( (opt = getopt(argc, argv, "i:t:n:")) != -1 ) {
+        switch(opt) {
+        case 'i': interfaceName = optarg; break;
+        case 't': maxThreads = atoi(optarg); break;
+        case 'n': messages = strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( maxThreads < 1 || messages < 2 ) {
+        usage(argv[0]);
+        return 1;
+    }
+    messages &= ~1UL;
+
+    SNMEA2000SocketCAN *socketCAN = (interfaceName != NULL)?new SNMEA2000SocketCAN(interfaceName):NULL;
+    CheckingTransport checking(socketCAN);
+    SNMEA2000ThreadedTransport transport(&checking, 4096);
+    NullPrint console;
+    SNMEA2000DeviceInfo devInfo(1, 140, 50);
+    SNMEA2000 device(22, &devInfo, &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long),
+        rxPGN, sizeof(rxPGN)/sizeof(unsigned long),
+        &transport, &console);
+    if ( !device.open() ) {
+        fprintf(stderr, "Unable to open %s\n", interfaceName);
+        return 1;
+    }
+    transport.flush(1000);
+
+    printf("%-8s %14s %14s %8s %8s\n", "threads", "messages/s", "frames/s", "speedup", "rejected");
+    double baseline = 0;
+    bool failed = false;
+    for (int threads = 1; threads <= maxThreads; threads = (threads*2 > maxThreads && threads < maxThreads)?maxThreads:threads*2) {
+        checking.reset();
+        unsigned long writtenBefore = transport.getFramesWritten();
+        rejected = 0;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        std::vector<std::thread> producers;
+        for (int i = 0; i < threads; i++) {
+            producers.push_back(std::thread(producer, &device, &transport, messages));
+        }
+        for (int i = 0; i < threads; i++) {
+            producers[i].join();
+        }
+        transport.flush(10000);
+        double seconds = elapsedSeconds(&start);
+        unsigned long frames = transport.getFramesWritten() - writtenBefore;
+        double rate = (messages*threads)/seconds;
+        if ( baseline == 0 ) {
+            baseline = rate;
+        }
+        printf("%-8d %14.0f %14.0f %7.2fx %8lu\n", threads, rate, frames/seconds, rate/baseline, rejected.load());
+        unsigned long expected = messages*threads - rejected;
+        if ( checking.fastPackets + checking.singleFrames != expected ) {
+            printf("  lost messages, written %lu accepted %lu\n",
+                checking.fastPackets + checking.singleFrames, expected);
+            failed = true;
+        }
+    }
+    transport.close();
+    printf("interleaved fast packets=%lu\n", checking.interleaved);
+    transport.dumpStatus(&Serial);
+    delete socketCAN;
+    return (failed || checking.interleaved > 0)?1:0;
+}
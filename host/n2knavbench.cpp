@@ -0,0 +1,322 @@
+/**
+ * Sustained rate of a NavigationSensor sending 127250, 127251, 127257, 129025 and 129026 while
+ * recieving background traffic, on a simulated bus.
+ *
+ * n2knavbench [-f Hz] [-b frames/s] [-p us] [-t ms] [-n iterations]
+ *
+ *   -f   rate each PGN is sent, default 20
+ *   -b   background frames/s from another node, all accepted by the sensor, default 800
+ *   -p   interval processMessages is called, default 1000us
+ *   -t   simulated run time, default 10000ms
+ *   -n   iterations of each encoder to time, default 1000000
+ *
+ * The encoders are first compared with the same frames built with startPacket and outputByte,
+ * and both timed. The sensor then runs on a 250kbit/s SimulatedBus with MCP2515 sized buffers,
+ * 3 tx and 2 rx, alongside a node sending background frames the sensor handles. The PGNs are
+ * staggered over the period, sending all 5 in one call overflows the 3 tx buffers. Reports the
+ * frames sent and recieved, tx and rx buffer overflows and the host time spent in
+ * processMessages and the encoders per simulated second. Exits 1 if any frame differs, any
+ * navigation frame was not sent or any background frame was lost.
+ */
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include "SimulatedBus.h"
+#include "SmallNMEA2000Navigation.h"
+
+#define BACKGROUND_PGN 130306L // wind data
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2knavbench", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Navigation benchmark", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN, 127250L, 127251L, 127257L, 129025L, 129026L };
+const unsigned long rxPGN[] = { SNMEA200_DEFAULT_RX_PGN, BACKGROUND_PGN };
+
+typedef struct CapturedFrame {
+    unsigned long id;
+    uint8_t len;
+    byte buf[8];
+} CapturedFrame;
+
+class CaptureTransport : public SNMEA2000Transport {
+    public:
+        bool open() override { return true; };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override { return false; };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override {
+            last.id = id;
+            last.len = len;
+            memcpy(last.buf, buf, len);
+            checksum = checksum*31 + id + buf[0];
+            return true;
+        };
+        CapturedFrame last;
+        uint32_t checksum = 0;
+};
+
+class NullPrint : public Print {
+    public:
+        size_t write(uint8_t c) override { return 1; };
+};
+static NullPrint quiet;
+
+typedef struct NavValues {
+    uint8_t sid;
+    uint16_t heading;
+    int16_t pitch;
+    int16_t roll;
+    int32_t rate;
+    int32_t latitude;
+    int32_t longitude;
+    uint16_t sog;
+} NavValues;
+
+#define PGN_COUNT 5
+static const char * pgnNames[PGN_COUNT] = { "127250", "127251", "127257", "129025", "129026" };
+
+static void sendDirect(NavigationSensor *sensor, uint8_t pgn, NavValues *v) {
+    switch(pgn) {
+        case 0: sensor->sendHeading(v->sid, v->heading, SNMEA2000::n2kInt16NA, -v->roll, N2K_HEADING_MAGNETIC); break;
+        case 1: sensor->sendRateOfTurn(v->sid, v->rate); break;
+        case 2: sensor->sendAttitude(v->sid, v->heading, v->pitch, v->roll); break;
+        case 3: sensor->sendPosition(v->latitude, v->longitude); break;
+        case 4: sensor->sendCOGSOG(v->sid, N2K_HEADING_TRUE, v->heading, v->sog); break;
+    }
+}
+
+// the same frames through the MessageHeader and outputByte path the other device classes use.
+static void sendPacket(NavigationSensor *sensor, uint8_t pgn, NavValues *v) {
+    static const unsigned long pgns[PGN_COUNT] = { 127250L, 127251L, 127257L, 129025L, 129026L };
+    MessageHeader messageHeader(pgns[pgn], (pgn == 2)?3:2, sensor->getAddress(), SNMEA2000::broadcastAddress);
+    sensor->startPacket(&messageHeader);
+    switch(pgn) {
+        case 0:
+            sensor->outputByte(v->sid);
+            sensor->output2ByteUInt(v->heading);
+            sensor->output2ByteInt(SNMEA2000::n2kInt16NA);
+            sensor->output2ByteInt(-v->roll);
+            sensor->outputByte(0xfd);
+            break;
+        case 1:
+            sensor->outputByte(v->sid);
+            sensor->output2ByteUInt((v->rate*3200) & 0xffff);
+            sensor->output2ByteUInt(((v->rate*3200) >> 16) & 0xffff);
+            sensor->output3ByteUInt(0xffffff);
+            break;
+        case 2:
+            sensor->outputByte(v->sid);
+            sensor->output2ByteInt(v->heading);
+            sensor->output2ByteInt(v->pitch);
+            sensor->output2ByteInt(v->roll);
+            sensor->outputByte(0xff);
+            break;
+        case 3:
+            sensor->output2ByteUInt(v->latitude & 0xffff);
+            sensor->output2ByteUInt((v->latitude >> 16) & 0xffff);
+            sensor->output2ByteUInt(v->longitude & 0xffff);
+            sensor->output2ByteUInt((v->longitude >> 16) & 0xffff);
+            break;
+        case 4:
+            sensor->outputByte(v->sid);
+            sensor->outputByte(0xfc);
+            sensor->output2ByteUInt(v->heading);
+            sensor->output2ByteUInt(v->sog);
+            sensor->output2ByteUInt(0xffff);
+            break;
+    }
+    sensor->finishPacket();
+}
+
+// repeatable on every platform, unlike rand().
+static uint32_t randomState = 1;
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static void randomValues(NavValues *v) {
+    v->sid = nextRandom();
+    v->heading = nextRandom() % 62832;
+    v->pitch = (int16_t)(nextRandom() % 3000) - 1500;
+    v->roll = (int16_t)(nextRandom() % 6000) - 3000;
+    v->rate = (int32_t)(nextRandom() % 20000) - 10000;
+    v->latitude = (int32_t)(nextRandom() % 1800000000) - 900000000;
+    v->longitude = (int32_t)(nextRandom() % 3600000000UL - 1800000000L);
+    v->sog = nextRandom() % 5000;
+}
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long backgroundHandled = 0;
+static void countBackground(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( messageHeader->pgn == BACKGROUND_PGN ) {
+        backgroundHandled++;
+    }
+}
+
+static unsigned long navDelivered = 0;
+static void countNavigation(void *context, uint64_t time, unsigned long id, uint8_t len, const byte *buf) {
+    unsigned long pgn = getPgnId(id);
+    if ( pgn == 127250L || pgn == 127251L || pgn == 127257L || pgn == 129025L || pgn == 129026L ) {
+        navDelivered++;
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-f Hz] [-b frames/s] [-p us] [-t ms] [-n iterations]\n", name);
+}
+
+int main(int argc, char **argv) {
+    unsigned long rate = 20;
+    unsigned long background = 800;
+    unsigned long pollInterval = 1000;
+    unsigned long runTime = 10000;
+    unsigned long iterations = 1000000;
+    int opt;
+    while ( (opt = getopt(argc, argv, "f:b:p:t:n:")) != -1 ) {
+        switch (opt) {
+        case 'f': rate = strtoul(optarg, NULL, 10); break;
+        case 'b': background = strtoul(optarg, NULL, 10); break;
+        case 'p': pollInterval = strtoul(optarg, NULL, 10); break;
+        case 't': runTime = strtoul(optarg, NULL, 10); break;
+        case 'n': iterations = strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( rate == 0 || rate > 1000 || pollInterval == 0 || background > 2000 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // encoders
+    CaptureTransport directTransport;
+    CaptureTransport packetTransport;
+    NavigationSensor direct(30, new SNMEA2000DeviceInfo(1, 140, 60), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long), &directTransport);
+    NavigationSensor packet(30, new SNMEA2000DeviceInfo(1, 140, 60), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long), &packetTransport);
+    direct.open();
+    packet.open();
+    unsigned long differences = 0;
+    for (int n = 0; n < 10000; n++) {
+        NavValues v;
+        randomValues(&v);
+        for (uint8_t pgn = 0; pgn < PGN_COUNT; pgn++) {
+            sendDirect(&direct, pgn, &v);
+            sendPacket(&packet, pgn, &v);
+            CapturedFrame *a = &directTransport.last;
+            CapturedFrame *b = &packetTransport.last;
+            if ( a->id != b->id || a->len != b->len || memcmp(a->buf, b->buf, a->len) != 0 ) {
+                if ( differences++ < 10 ) {
+                    printf("PGN %s differs %08lX %08lX\n", pgnNames[pgn], a->id, b->id);
+                }
+            }
+        }
+    }
+    printf("%d messages compared, %lu differ\n", 10000*PGN_COUNT, differences);
+    NavValues values[64];
+    for (int i = 0; i < 64; i++) {
+        randomValues(&values[i]);
+    }
+    printf("%-8s %12s %12s\n", "PGN", "direct ns", "packet ns");
+    for (uint8_t pgn = 0; pgn < PGN_COUNT; pgn++) {
+        uint64_t start = nowNs();
+        for (unsigned long i = 0; i < iterations; i++) {
+            sendDirect(&direct, pgn, &values[i & 63]);
+        }
+        uint64_t directNs = nowNs() - start;
+        start = nowNs();
+        for (unsigned long i = 0; i < iterations; i++) {
+            sendPacket(&packet, pgn, &values[i & 63]);
+        }
+        uint64_t packetNs = nowNs() - start;
+        printf("%-8s %12.1f %12.1f\n", pgnNames[pgn], directNs/(double)iterations, packetNs/(double)iterations);
+    }
+
+    // sustained rate on a simulated bus
+    SimulatedBus bus;
+    setHostClock(&bus);
+    bus.setMonitor(countNavigation, NULL);
+    SimulatedBusTransport *sensorTransport = bus.connect(3, 2);
+    SimulatedBusTransport *backgroundTransport = bus.connect(32, 2);
+    NavigationSensor sensor(30, new SNMEA2000DeviceInfo(2, 140, 60), &productInfo, &configInfo,
+        txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long),
+        sensorTransport, &quiet);
+    sensor.setMessageHandler(countBackground);
+    sensor.open();
+    uint64_t end = (uint64_t)runTime*1000;
+    uint64_t sendPeriod = 1000000/rate;
+    uint64_t nextPoll = 0;
+    // after the address claim, PGNs staggered over the period as the MCP2515 has 3 tx buffers.
+    uint64_t nextSend[PGN_COUNT];
+    for (uint8_t pgn = 0; pgn < PGN_COUNT; pgn++) {
+        nextSend[pgn] = 300000 + pgn*sendPeriod/PGN_COUNT;
+    }
+    uint64_t backgroundPeriod = (background > 0)?1000000/background:UINT64_MAX;
+    uint64_t nextBackground = backgroundPeriod/2;
+    unsigned long backgroundSent = 0;
+    unsigned long navAttempted = 0;
+    uint64_t cpuNs = 0;
+    NavValues v;
+    randomValues(&v);
+    byte backgroundFrame[8] = { 0, 0x10, 0x27, 0x00, 0x40, 0xfa, 0xff, 0xff };
+    unsigned long backgroundId = SNMEA2000::canIdBase(BACKGROUND_PGN, 2) | 40;
+    while ( bus.now() < end ) {
+        uint64_t now = bus.now();
+        if ( nextPoll <= now ) {
+            uint64_t start = nowNs();
+            sensor.processMessages();
+            for (uint8_t pgn = 0; pgn < PGN_COUNT; pgn++) {
+                if ( nextSend[pgn] <= now ) {
+                    if ( pgn == 0 ) {
+                        v.sid++;
+                    }
+                    sendDirect(&sensor, pgn, &v);
+                    navAttempted++;
+                    nextSend[pgn] += sendPeriod;
+                }
+            }
+            cpuNs += nowNs() - start;
+            nextPoll += pollInterval;
+        }
+        if ( nextBackground <= now ) {
+            backgroundFrame[0]++;
+            if ( backgroundTransport->sendFrame(backgroundId, 8, backgroundFrame) ) {
+                backgroundSent++;
+            }
+            nextBackground += backgroundPeriod;
+        }
+        bus.arbitrate();
+        uint64_t next = end;
+        if ( nextPoll < next ) next = nextPoll;
+        if ( nextBackground < next ) next = nextBackground;
+        if ( bus.nextEvent() < next ) next = bus.nextEvent();
+        bus.advanceTo(next);
+    }
+    // let the last frames drain before counting.
+    for (int i = 0; i < 10; i++) {
+        bus.arbitrate();
+        if ( bus.nextEvent() != UINT64_MAX ) {
+            bus.advanceTo(bus.nextEvent());
+        }
+        sensor.processMessages();
+    }
+    printf("rate=%luHz background=%lu frames/s poll=%luus busload=%.1f%%\n",
+        rate, background, pollInterval, 100.0*bus.busyTime/end);
+    printf("navigation frames sent=%lu/%lu tx overflows=%lu\n", navDelivered, navAttempted, sensorTransport->txOverflows);
+    printf("background frames handled=%lu/%lu rx overflows=%lu\n", backgroundHandled, backgroundSent, sensorTransport->rxOverflows);
+    printf("host cpu %.1f us per simulated second\n", cpuNs/1000.0/(runTime/1000.0));
+    bool ok = differences == 0 && navDelivered == navAttempted && sensorTransport->txOverflows == 0 && sensorTransport->rxOverflows == 0
+        && backgroundHandled == backgroundSent;
+    return ok?0:1;
+}
@@ -0,0 +1,139 @@
+/**
+ * Record SocketCAN traffic as seen by a device, in candump -l format.
+ *
+ * n2krecord [-x pgn]... [-o accepted.log] [-j rejected.log] [-t] iface
+ *
+ *   -x   add pgn to the rx list, without -x only the default rx PGNs are accepted
+ *   -o   accepted frames, default stdout
+ *   -j   frames rejected by the rx filters, default not written
+ *   -t   claim an address and respond to requests, default listen only
+ *
+ * Logs can be replayed with host/build/n2kreplay, canplayer or canboat analyzer.
+ * Stops on SIGINT.
+ */
+#include <Arduino.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "CandumpLog.h"
+#include "SocketCANTransport.h"
+
+#define MAX_PGNS 64
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2krecord", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Log recorder", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN };
+static unsigned long rxPGN[MAX_PGNS] = { SNMEA200_DEFAULT_RX_PGN };
+static uint8_t rxPGNLen = 0;
+
+static const char *interfaceName = NULL;
+static FILE *acceptedLog = stdout;
+static FILE *rejectedLog = NULL;
+static unsigned long recorded = 0;
+static unsigned long rejected = 0;
+static volatile bool running = true;
+
+/**
+ * Drops frames sent by the device so recording does not disturb the bus.
+ */
+class ListenOnlySocketCAN : public SNMEA2000SocketCAN {
+    public:
+        ListenOnlySocketCAN(const char *interfaceName) : SNMEA2000SocketCAN(interfaceName) {};
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override { return true; };
+};
+
+static void stop(int) {
+    running = false;
+}
+
+static void frameMonitor(unsigned long canId, byte *buffer, uint8_t len, bool accepted) {
+    if ( !accepted ) {
+        rejected++;
+    }
+    FILE *out = accepted?acceptedLog:rejectedLog;
+    if ( out != NULL ) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        writeCandumpLine(out, now.tv_sec + now.tv_usec/1000000.0, interfaceName, canId, len, buffer);
+        recorded++;
+    }
+}
+
+static FILE * openLog(const char *fileName) {
+    FILE *f = fopen(fileName, "w");
+    if ( f == NULL ) {
+        perror(fileName);
+        exit(1);
+    }
+    return f;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-x pgn]... [-o accepted.log] [-j rejected.log] [-t] iface\n", name);
+}
+
+int main(int argc, char **argv) {
+    bool transmit = false;
+    int opt;
+    while ( (opt = getopt(argc, argv, "x:o:j:t")) != -1 ) {
+        switch (opt) {
+        case 'x':
+            if ( rxPGNLen >= MAX_PGNS ) {
+                fprintf(stderr, "Too many PGNs\n");
+                return 1;
+            }
+            rxPGN[rxPGNLen++] = strtoul(optarg, NULL, 10);
+            break;
+        case 'o': acceptedLog = openLog(optarg); break;
+        case 'j': rejectedLog = openLog(optarg); break;
+        case 't': transmit = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( optind >= argc ) {
+        usage(argv[0]);
+        return 1;
+    }
+    if ( rxPGNLen == 0 ) {
+        while ( rxPGNLen < MAX_PGNS && rxPGN[rxPGNLen] != 0 ) {
+            rxPGNLen++;
+        }
+    } else {
+        const unsigned long defaults[] = { SNMEA200_DEFAULT_RX_PGN };
+        for (unsigned int i = 0; i < sizeof(defaults)/sizeof(unsigned long) && rxPGNLen < MAX_PGNS; i++) {
+            rxPGN[rxPGNLen++] = defaults[i];
+        }
+    }
+    interfaceName = argv[optind];
+    SNMEA2000SocketCAN *transport = transmit?new SNMEA2000SocketCAN(interfaceName):new ListenOnlySocketCAN(interfaceName);
+    SNMEA2000DeviceInfo deviceInfo(1, 130, 25);
+    SNMEA2000 device(100, &deviceInfo, &productInfo, &configInfo, txPGN, sizeof(txPGN)/sizeof(unsigned long),
+        rxPGN, rxPGNLen, transport);
+    device.setFrameMonitor(frameMonitor);
+    if ( !device.open() ) {
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    struct pollfd pfd = { transport->getFd(), POLLIN, 0 };
+    while ( running ) {
+        poll(&pfd, 1, 100);
+        device.processMessages();
+    }
+    fprintf(stderr, "Recorded %lu frames, %lu rejected by the rx filters\n", recorded, rejected);
+    if ( acceptedLog != stdout ) {
+        fclose(acceptedLog);
+    }
+    if ( rejectedLog != NULL ) {
+        fclose(rejectedLog);
+    }
+    delete transport;
+    return 0;
+}
@@ -0,0 +1,306 @@
+/**
+ * Replay a candump log through processMessages.
+ *
+ * n2kreplay [-r] [-p us] [-b buffers] [-u us] [-x pgn[:size]]... [-o accepted.log] [-j rejected.log]
+ *           [-g actisense|ydraw[:baud]] [-w gateway.out] log
+ *
+ *   -r   replay with the original timing, default as fast as possible
+ *   -p   emulate a device calling processMessages every us of log time, default 0, no emulation
+ *   -b   controller rx buffers emulated with -p, default 2, 0 for unlimited
+ *   -u   call processMessages(budget) with a budget of us, default processMessages()
+ *   -x   add pgn to the rx list and cache it in a SNMEA2000RxCache slot of size bytes,
+ *        default 8, > 8 for fast packets. Without -x only the default rx PGNs are accepted.
+ *   -o   write accepted frames to a candump log
+ *   -j   write rejected frames to a candump log
+ *   -g   stream accepted messages through a SNMEA2000Gateway to a serial port emulated at baud,
+ *        draining in log time with -p, default unlimited. -x PGNs > 8 bytes are fast packets.
+ *   -w   write the gateway output to a file, default discarded
+ *
+ * log is a candump log, either the -l format or the default format with -t timestamps,
+ * - reads stdin. Prints the frame rate, accepted, rejected and lost frames, and the
+ * time spent handling each PGN.
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include "CandumpLog.h"
+#include "SmallNMEA2000RxCache.h"
+#include "SmallNMEA2000Gateway.h"
+
+#define MAX_PGNS 64
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2kreplay", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Log replay", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN };
+static unsigned long rxPGN[MAX_PGNS] = { SNMEA200_DEFAULT_RX_PGN };
+static uint8_t rxPGNLen = 0;
+static SNMEA2000CacheSlot cacheSlots[MAX_PGNS];
+static uint8_t nCacheSlots = 0;
+
+static CandumpReplay *replay = NULL;
+static FILE *acceptedLog = NULL;
+static FILE *rejectedLog = NULL;
+
+/**
+ * Serial port with a 64 byte transmit buffer, as an AVR HardwareSerial, draining at baud/10
+ * bytes/s of log time. Unlimited with baud 0.
+ */
+class EmulatedSerial : public Print {
+    public:
+        EmulatedSerial(FILE *out, unsigned long baud) : out{out}, baud{baud} {};
+        size_t write(uint8_t c) override { return write(&c, 1); };
+        size_t write(const uint8_t *buffer, size_t size) override {
+            if ( out != NULL ) {
+                fwrite(buffer, 1, size, out);
+            }
+            queued += size;
+            return size;
+        };
+        int availableForWrite() override {
+            if ( baud == 0 ) {
+                return 4096;
+            }
+            uint64_t now = replay->getLogTime();
+            queued -= (now - lastTime)*baud/10000000.0;
+            if ( queued < 0 ) {
+                queued = 0;
+            }
+            lastTime = now;
+            return 64 - (int)ceil(queued);
+        };
+    private:
+        FILE *out;
+        unsigned long baud;
+        double queued = 0;
+        uint64_t lastTime = 0;
+};
+
+static void frameMonitor(unsigned long canId, byte *buffer, uint8_t len, bool accepted) {
+    replay->frameHandled(accepted);
+    FILE *out = accepted?acceptedLog:rejectedLog;
+    if ( out != NULL ) {
+        writeCandumpLine(out, replay->getLastFrame()->time, "can0", canId, len, buffer);
+    }
+}
+
+static bool parsePGN(const char *arg) {
+    if ( rxPGNLen >= MAX_PGNS ) {
+        fprintf(stderr, "Too many PGNs\n");
+        return false;
+    }
+    char *end;
+    unsigned long pgn = strtoul(arg, &end, 10);
+    int size = 8;
+    if ( *end == ':' ) {
+        size = atoi(end+1);
+    } else if ( *end != '\0' ) {
+        return false;
+    }
+    if ( size < 1 || size > 223 ) {
+        return false;
+    }
+    rxPGN[rxPGNLen++] = pgn;
+    SNMEA2000CacheSlot *slot = &cacheSlots[nCacheSlots++];
+    memset(slot, 0, sizeof(SNMEA2000CacheSlot));
+    slot->pgn = pgn;
+    slot->source = SNMEA2000::anySource;
+    slot->instanceOffset = SNMEA2000RxCache::noInstance;
+    slot->size = size;
+    return true;
+}
+
+static FILE * openLog(const char *fileName) {
+    FILE *f = fopen(fileName, "w");
+    if ( f == NULL ) {
+        perror(fileName);
+        exit(1);
+    }
+    return f;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-r] [-p us] [-b buffers] [-u us] [-x pgn[:size]]... [-o accepted.log] [-j rejected.log] "
+        "[-g actisense|ydraw[:baud]] [-w gateway.out] log\n", name);
+}
+
+int main(int argc, char **argv) {
+    bool realTime = false;
+    int rxBuffers = 2;
+    unsigned long pollInterval = 0;
+    uint16_t budget = 0;
+    int gatewayFormat = -1;
+    unsigned long gatewayBaud = 0;
+    FILE *gatewayOut = NULL;
+    int opt;
+    while ( (opt = getopt(argc, argv, "rp:b:u:x:o:j:g:w:")) != -1 ) {
+        switch (opt) {
+        case 'r': realTime = true; break;
+        case 'p': pollInterval = atol(optarg); break;
+        case 'b': rxBuffers = atoi(optarg); break;
+        case 'u': budget = atoi(optarg); break;
+        case 'x':
+            if ( !parsePGN(optarg) ) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o': acceptedLog = openLog(optarg); break;
+        case 'j': rejectedLog = openLog(optarg); break;
+        case 'g':
+            if ( strncmp(optarg, "actisense", 9) == 0 ) {
+                gatewayFormat = SNMEA2000_GATEWAY_ACTISENSE;
+            } else if ( strncmp(optarg, "ydraw", 5) == 0 ) {
+                gatewayFormat = SNMEA2000_GATEWAY_YDRAW;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            if ( strchr(optarg, ':') != NULL ) {
+                gatewayBaud = strtoul(strchr(optarg, ':')+1, NULL, 10);
+            }
+            break;
+        case 'w': gatewayOut = openLog(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( optind >= argc || rxBuffers < 0 || rxBuffers > 255 ) {
+        usage(argv[0]);
+        return 1;
+    }
+    if ( rxPGNLen == 0 ) {
+        while ( rxPGNLen < MAX_PGNS && rxPGN[rxPGNLen] != 0 ) {
+            rxPGNLen++;
+        }
+    } else {
+        // the devices own protocol PGNs are always accepted.
+        const unsigned long defaults[] = { SNMEA200_DEFAULT_RX_PGN };
+        for (unsigned int i = 0; i < sizeof(defaults)/sizeof(unsigned long) && rxPGNLen < MAX_PGNS; i++) {
+            rxPGN[rxPGNLen++] = defaults[i];
+        }
+    }
+
+    if ( pollInterval == 0 ) {
+        rxBuffers = 0;
+    }
+
+    std::vector<CandumpFrame> frames;
+    if ( !loadCandumpLog(argv[optind], &frames) ) {
+        return 1;
+    }
+    if ( frames.size() == 0 ) {
+        fprintf(stderr, "No frames in %s\n", argv[optind]);
+        return 1;
+    }
+
+    CandumpReplay transport(&frames, realTime, rxBuffers, pollInterval);
+    replay = &transport;
+    SNMEA2000DeviceInfo deviceInfo(1, 130, 25);
+    SNMEA2000 device(100, &deviceInfo, &productInfo, &configInfo, txPGN, sizeof(txPGN)/sizeof(unsigned long),
+        rxPGN, rxPGNLen, &transport);
+    uint16_t arenaSize = SNMEA2000RxCache::requiredArenaSize(cacheSlots, nCacheSlots);
+    byte *arena = new byte[arenaSize+1];
+    SNMEA2000RxCache cache(cacheSlots, nCacheSlots, arena, arenaSize);
+    cache.begin();
+    device.addListener(&cache);
+    device.setFrameMonitor(frameMonitor);
+    unsigned long fastPacketPGNs[MAX_PGNS];
+    uint8_t nFastPacketPGNs = 0;
+    for (uint8_t i = 0; i < nCacheSlots; i++) {
+        if ( cacheSlots[i].size > 8 ) {
+            fastPacketPGNs[nFastPacketPGNs++] = cacheSlots[i].pgn;
+        }
+    }
+    EmulatedSerial serial(gatewayOut, (pollInterval > 0)?gatewayBaud:0);
+    byte gatewayRing[1024];
+    SNMEA2000Gateway gateway(&serial, gatewayFormat, gatewayRing, sizeof(gatewayRing), fastPacketPGNs, nFastPacketPGNs);
+    if ( gatewayFormat >= 0 ) {
+        gateway.begin();
+        device.addListener(&gateway);
+    }
+    if ( !device.open() ) {
+        return 1;
+    }
+
+    unsigned long calls = 0;
+    uint64_t start = micros();
+    while ( !transport.isFinished() ) {
+        if ( realTime ) {
+            uint64_t wait = transport.waitTime();
+            if ( wait > 0 ) {
+                delayMicroseconds(wait);
+            }
+        }
+        if ( budget > 0 ) {
+            device.processMessages(budget);
+        } else {
+            device.processMessages();
+        }
+        transport.endCall();
+        calls++;
+    }
+    if ( gatewayFormat >= 0 ) {
+        // drain the ring, as if the loop kept running after the log ended.
+        while ( gateway.getRingUsed() > 0 ) {
+            transport.endCall();
+            gateway.process();
+            if ( pollInterval == 0 ) {
+                break;
+            }
+        }
+    }
+    double seconds = (micros() - start)/1000000.0;
+
+    unsigned long accepted = 0;
+    unsigned long rejected = 0;
+    uint64_t handlerNs = 0;
+    std::map<unsigned long, CandumpPGNStats> *stats = transport.getStats();
+    for (std::map<unsigned long, CandumpPGNStats>::iterator i = stats->begin(); i != stats->end(); i++) {
+        accepted += i->second.accepted;
+        rejected += i->second.rejected;
+        handlerNs += i->second.handlerNs;
+    }
+    printf("%lu frames in %.3fs, %.0f frames/s, %lu processMessages calls, %s\n",
+        transport.framesRead, seconds, transport.framesRead/seconds, calls, realTime?"original timing":"as fast as possible");
+    if ( pollInterval > 0 ) {
+        printf("processMessages every %luus of log time with %d rx buffers\n", pollInterval, rxBuffers);
+    }
+    if ( budget > 0 ) {
+        printf("budget=%uus overruns=%u backlogs=%u longest call=%uus\n",
+            budget, device.getBudgetOverruns(), device.getBudgetBacklogs(), device.getMaxProcessMicros());
+    }
+    printf("accepted=%lu rejected=%lu lost=%lu sent=%lu handler time=%.3fms\n",
+        accepted, rejected, transport.overflows, transport.framesSent, handlerNs/1000000.0);
+    printf("%8s %10s %10s %10s %8s %12s %8s\n", "pgn", "frames", "accepted", "rejected", "lost", "handler ms", "ns/frame");
+    for (std::map<unsigned long, CandumpPGNStats>::iterator i = stats->begin(); i != stats->end(); i++) {
+        CandumpPGNStats *s = &i->second;
+        unsigned long handled = s->accepted + s->rejected;
+        printf("%8lu %10lu %10lu %10lu %8lu %12.3f %8.0f\n", s->pgn, s->frames, s->accepted, s->rejected,
+            s->overflows, s->handlerNs/1000000.0, (handled > 0)?(double)s->handlerNs/handled:0.0);
+    }
+    if ( gatewayFormat >= 0 ) {
+        SNMEA2000GatewayCounters *c = gateway.getCounters();
+        printf("gateway messages=%lu bytes=%lu overflows=%lu fastPacketErrors=%lu peak ring=%u/%u",
+            c->messages, c->bytes, c->overflows, c->fastPacketErrors, c->peakUsed, (unsigned int)sizeof(gatewayRing));
+        if ( gatewayBaud > 0 && pollInterval > 0 ) {
+            printf(" at %lu baud, %.0f%% of the port", gatewayBaud,
+                100.0*c->bytes*10.0/(gatewayBaud*(transport.getLogTime()/1000000.0)));
+        }
+        printf("\n");
+    }
+    if ( gatewayOut != NULL ) {
+        fclose(gatewayOut);
+    }
+    if ( acceptedLog != NULL ) {
+        fclose(acceptedLog);
+    }
+    if ( rejectedLog != NULL ) {
+        fclose(rejectedLog);
+    }
+    delete[] arena;
+    return 0;
+}
@@ -0,0 +1,293 @@
+/**
+ * Frames/s recieved through a SNMEA2000RxEngine against the number of worker threads.
+ *
+ * n2krxbench [-w workers] [-n frames] [-s sources] [-c ns] [-l log]
+ *
+ *   -w   most worker threads, runs 1, 2, 4 ... up to this, default the number of cores
+ *   -n   synthetic frames, default 2000000
+ *   -s   synthetic sources, default 32
+ *   -c   extra ns of decoding per message in the worker listeners, default 0
+ *   -l   replay the frames of a candump log instead of synthetic frames
+ *
+ * Synthetic traffic interleaves the sources, each sending 129029 GNSS Position Data, a 43 byte
+ * fast packet of 7 frames with a payload derived from the source and sequence, and 127488,
+ * 127250 and 130306 single frames. Each worker has a listener reassembling fast packets per
+ * source with assembleFastPacket and decoding single frames with SNMEA2000FieldView, so frames
+ * from one source handled out of order show as corrupt or missing fast packets. The reader
+ * waits for space in a full ring, so no frames are dropped. Exits 1 if a synthetic fast packet
+ * was lost or corrupt.
+ */
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "CandumpLog.h"
+#include "RxEngine.h"
+#include "SmallNMEA2000RxCache.h"
+
+#define FAST_PACKET_PGN 129029L
+#define FAST_PACKET_LENGTH 43
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2krxbench", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Sharded recieve benchmark", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN };
+static unsigned long rxPGN[255] = { SNMEA200_DEFAULT_RX_PGN, FAST_PACKET_PGN, 127488L, 127250L, 130306L };
+static uint8_t rxPGNLen = SNMEA200_DEFAULT_RX_PGN_LEN + 4;
+
+class NullPrint : public Print {
+    public:
+        size_t write(uint8_t c) override { return 1; };
+};
+
+/**
+ * Returns frames from memory once started, discards frames sent.
+ */
+class MemoryTransport : public SNMEA2000Transport {
+    public:
+        MemoryTransport(std::vector<CandumpFrame> *frames) : frames{frames} {};
+        bool open() override { return true; };
+        bool receiveFrame(unsigned long *id, uint8_t *len, byte *buf) override {
+            if ( !started || next >= frames->size() ) {
+                return false;
+            }
+            CandumpFrame *frame = &(*frames)[next++];
+            *id = frame->id;
+            *len = frame->len;
+            memcpy(buf, frame->buf, (frame->len > 8)?8:frame->len);
+            if ( next == frames->size() ) {
+                finished = true;
+            }
+            return true;
+        };
+        bool sendFrame(unsigned long id, uint8_t len, const byte *buf) override { return true; };
+        void start() { started = true; };
+        bool isFinished() { return finished; };
+    private:
+        std::vector<CandumpFrame> *frames;
+        size_t next = 0;
+        std::atomic<bool> started{false};
+        std::atomic<bool> finished{false};
+};
+
+static byte payloadByte(uint8_t source, uint8_t sequence, uint8_t i) {
+    return (byte)(source * 31 + sequence * 7 + i);
+}
+
+/**
+ * Reassembles fast packets per source and decodes single frames, one per worker.
+ */
+class BenchListener final : public SNMEA2000Listener {
+    public:
+        BenchListener(unsigned long cost) : cost{cost} {
+            memset(assemblies, 0, sizeof(assemblies));
+        };
+        void onMessage(MessageHeader *messageHeader, byte * buffer, int len) override {
+            if ( messageHeader->pgn == FAST_PACKET_PGN ) {
+                Assembly *a = &assemblies[messageHeader->source];
+                uint8_t length = assembleFastPacket(&a->state, a->payload, sizeof(a->payload), buffer, len);
+                if ( length == 0 ) {
+                    return;
+                }
+                fastPackets++;
+                // the first byte carries the sequence of the synthetic message.
+                for (uint8_t i = 1; i < FAST_PACKET_LENGTH && length == FAST_PACKET_LENGTH; i++) {
+                    if ( a->payload[i] != payloadByte(messageHeader->source, a->payload[0], i) ) {
+                        corrupt++;
+                        break;
+                    }
+                }
+            } else {
+                SNMEA2000FieldView view(buffer, len);
+                checksum += view.get2ByteUInt(1) + view.get2ByteInt(3);
+            }
+            if ( cost > 0 ) {
+                spin();
+            }
+        };
+        unsigned long fastPackets = 0;
+        unsigned long corrupt = 0;
+        unsigned long checksum = 0;
+    private:
+        typedef struct Assembly {
+            SNMEA2000FastPacketState state;
+            byte payload[223];
+        } Assembly;
+        void spin() {
+            struct timespec start, now;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            do {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+            } while ( (unsigned long)((now.tv_sec - start.tv_sec)*1000000000L + now.tv_nsec - start.tv_nsec) < cost );
+        };
+        Assembly assemblies[256];
+        unsigned long cost;
+};
+
+static void addFrame(std::vector<CandumpFrame> *frames, unsigned long pgn, uint8_t source, const byte *buf, uint8_t len) {
+    CandumpFrame frame;
+    frame.time = 0;
+    frame.id = SNMEA2000::canIdBase(pgn, (pgn == FAST_PACKET_PGN)?3:2) | source;
+    frame.len = len;
+    memcpy(frame.buf, buf, len);
+    frames->push_back(frame);
+}
+
+/**
+ * @brief synthetic traffic of about n frames, returns the number of fast packets.
+ */
+static unsigned long generateFrames(std::vector<CandumpFrame> *frames, unsigned long n, uint8_t sources) {
+    unsigned long fastPackets = 0;
+    uint8_t sequence = 0;
+    byte payload[FAST_PACKET_LENGTH];
+    byte buf[8];
+    while ( frames->size() < n ) {
+        // 7 frames of a fast packet from each source, interleaved, then 3 single frames from each.
+        for (uint8_t f = 0; f < 7; f++) {
+            for (uint8_t s = 0; s < sources; s++) {
+                uint8_t source = s + 1;
+                payload[0] = sequence;
+                for (uint8_t i = 1; i < FAST_PACKET_LENGTH; i++) {
+                    payload[i] = payloadByte(source, sequence, i);
+                }
+                buf[0] = ((sequence & 0x07) << 5) | f;
+                if ( f == 0 ) {
+                    buf[1] = FAST_PACKET_LENGTH;
+                    memcpy(&buf[2], payload, 6);
+                } else {
+                    uint8_t offset = 6 + (f - 1) * 7;
+                    memset(&buf[1], 0xff, 7);
+                    memcpy(&buf[1], &payload[offset], (FAST_PACKET_LENGTH - offset < 7)?FAST_PACKET_LENGTH - offset:7);
+                }
+                addFrame(frames, FAST_PACKET_PGN, source, buf, 8);
+            }
+        }
+        fastPackets += sources;
+        for (uint8_t s = 0; s < sources; s++) {
+            for (uint8_t i = 0; i < 8; i++) {
+                buf[i] = sequence + i;
+            }
+            addFrame(frames, 127488L, s + 1, buf, 8);
+            addFrame(frames, 127250L, s + 1, buf, 8);
+            addFrame(frames, 130306L, s + 1, buf, 8);
+        }
+        sequence++;
+    }
+    return fastPackets;
+}
+
+static void addLogPGNs(std::vector<CandumpFrame> *frames) {
+    for (size_t i = 0; i < frames->size() && rxPGNLen < 255; i++) {
+        unsigned long pgn = getPgnId((*frames)[i].id);
+        bool found = false;
+        for (uint8_t j = 0; j < rxPGNLen && !found; j++) {
+            found = rxPGN[j] == pgn;
+        }
+        if ( !found ) {
+            rxPGN[rxPGNLen++] = pgn;
+        }
+    }
+}
+
+static double elapsedSeconds(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec)/1e9;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-w workers] [-n frames] [-s sources] [-c ns] [-l log]\n", name);
+}
+
+int main(int argc, char **argv) {
+    int maxWorkers = std::thread::hardware_concurrency();
+    unsigned long nFrames = 2000000;
+    int sources = 32;
+    unsigned long cost = 0;
+    const char *logName = NULL;
+    int opt;
+    while ( (opt = getopt(argc, argv, "w:n:s:c:l:")) != -1 ) {
+        switch(opt) {
+        case 'w': maxWorkers = atoi(optarg); break;
+        case 'n': nFrames = strtoul(optarg, NULL, 10); break;
+        case 's': sources = atoi(optarg); break;
+        case 'c': cost = strtoul(optarg, NULL, 10); break;
+        case 'l': logName = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( maxWorkers < 1 || maxWorkers > SNMEA2000_RX_MAX_WORKERS || sources < 1 || sources > 250 ) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<CandumpFrame> frames;
+    unsigned long expectedFastPackets = 0;
+    if ( logName != NULL ) {
+        if ( !loadCandumpLog(logName, &frames) ) {
+            fprintf(stderr, "Unable to read %s\n", logName);
+            return 1;
+        }
+        addLogPGNs(&frames);
+    } else {
+        expectedFastPackets = generateFrames(&frames, nFrames, sources);
+    }
+    printf("%lu frames\n", (unsigned long)frames.size());
+    printf("%-8s %14s %14s %8s %10s %8s\n", "workers", "frames/s", "messages/s", "speedup", "fast pkts", "corrupt");
+
+    NullPrint console;
+    double baseline = 0;
+    bool failed = false;
+    for (int workers = 1; workers <= maxWorkers; workers = (workers*2 > maxWorkers && workers < maxWorkers)?maxWorkers:workers*2) {
+        MemoryTransport transport(&frames);
+        SNMEA2000RxEngine engine(&transport, workers);
+        engine.setBlocking(true);
+        SNMEA2000DeviceInfo devInfo(1, 130, 25);
+        SNMEA2000 device(22, &devInfo, &productInfo, &configInfo,
+            txPGN, sizeof(txPGN)/sizeof(unsigned long),
+            rxPGN, rxPGNLen,
+            &engine, &console);
+        engine.setDevice(&device);
+        std::vector<BenchListener *> listeners;
+        for (int i = 0; i < workers; i++) {
+            listeners.push_back(new BenchListener(cost));
+            engine.addListener(i, listeners[i]);
+        }
+        device.open();
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        transport.start();
+        while ( !transport.isFinished() ) {
+            device.processMessages();
+            usleep(100);
+        }
+        engine.flush(60000);
+        double seconds = elapsedSeconds(&start);
+        engine.close();
+        device.processMessages();
+
+        unsigned long messages = 0, fastPackets = 0, corrupt = 0;
+        for (int i = 0; i < workers; i++) {
+            messages += engine.getMessages(i);
+            fastPackets += listeners[i]->fastPackets;
+            corrupt += listeners[i]->corrupt;
+            delete listeners[i];
+        }
+        double rate = frames.size()/seconds;
+        if ( baseline == 0 ) {
+            baseline = rate;
+        }
+        printf("%-8d %14.0f %14.0f %7.2fx %10lu %8lu\n", workers, rate, messages/seconds, rate/baseline, fastPackets, corrupt);
+        if ( corrupt > 0 || (logName == NULL && fastPackets != expectedFastPackets) ) {
+            failed = true;
+        }
+    }
+    return failed?1:0;
+}
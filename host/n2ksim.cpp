@@ -0,0 +1,231 @@
+/**
+ * Address claim convergence on a simulated bus.
+ *
+ * n2ksim [-n nodes] [-a address] [-s spread] [-d duplicates] [-w ms] [-p us] [-t ms] [-q ms] [-r seed] [-v]
+ *
+ *   -n   number of devices, default 100
+ *   -a   first preferred address, default 22
+ *   -s   number of distinct preferred addresses, default 1, all devices start on the same address
+ *   -d   number of devices given the same NAME as another device, default 0
+ *   -w   devices power up at random times over this window, default 0, all at once
+ *   -p   interval processMessages is called, default 1000us, each device has a random phase
+ *   -t   simulated run time, default 5000ms
+ *   -q   broadcast a request for address claim at this time, default none
+ *   -r   random seed, default 1
+ *   -v   print every address claim
+ *
+ * Each device is a SNMEA2000 with its own controller on a 250kbit/s SimulatedBus, running
+ * the library address claim code against a simulated clock, so runs are repeatable for a seed.
+ * Prints the time the last address claim was sent, the number of claim frames, and whether the
+ * final addresses are unique. Exits 1 if they are not.
+ */
+#include <Arduino.h>
+#include <unistd.h>
+#include "SimulatedBus.h"
+
+#define ADDRESS_CLAIM_PGN 60928L
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2ksim", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "Simulated device", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { SNMEA200_DEFAULT_TX_PGN };
+const unsigned long rxPGN[] = { SNMEA200_DEFAULT_RX_PGN };
+
+typedef struct SimulatedNode {
+    SNMEA2000DeviceInfo * devInfo;
+    SNMEA2000 * device;
+    SimulatedBusTransport * transport;
+    uint64_t nextPoll;
+    uint8_t preferredAddress;
+    uint8_t address;
+    bool started;
+    unsigned long addressChanges;
+} SimulatedNode;
+
+typedef struct ClaimStats {
+    unsigned long claims;
+    uint64_t lastClaim;
+    bool verbose;
+} ClaimStats;
+
+// device console output, eg can: err on a full tx queue, is counted rather than printed.
+class NullPrint : public Print {
+    public:
+        size_t write(uint8_t c) override { return 1; };
+};
+static NullPrint quiet;
+
+// repeatable on every platform, unlike rand().
+static uint32_t randomState = 1;
+static uint32_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static void monitorClaims(void *context, uint64_t time, unsigned long id, uint8_t len, const byte *buf) {
+    ClaimStats *stats = (ClaimStats *)context;
+    if ( getPgnId(id) != ADDRESS_CLAIM_PGN ) {
+        return;
+    }
+    stats->claims++;
+    stats->lastClaim = time;
+    if ( stats->verbose ) {
+        uint64_t name = 0;
+        for (int i = len-1; i >= 0; i--) {
+            name = (name<<8)|buf[i];
+        }
+        printf("%10.3f ms claim address=%lu name=%016llx\n", time/1000.0, id&0xff, (unsigned long long)name);
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n nodes] [-a address] [-s spread] [-d duplicates] [-w ms] [-p us] [-t ms] [-q ms] [-r seed] [-v]\n", name);
+}
+
+int main(int argc, char **argv) {
+    int nodes = 100;
+    int firstAddress = 22;
+    int spread = 1;
+    int duplicates = 0;
+    unsigned long window = 0;
+    unsigned long pollInterval = 1000;
+    unsigned long runTime = 5000;
+    long requestAt = -1;
+    ClaimStats stats = { 0, 0, false };
+    int opt;
+    while ( (opt = getopt(argc, argv, "n:a:s:d:w:p:t:q:r:v")) != -1 ) {
+        switch (opt) {
+        case 'n': nodes = atoi(optarg); break;
+        case 'a': firstAddress = atoi(optarg); break;
+        case 's': spread = atoi(optarg); break;
+        case 'd': duplicates = atoi(optarg); break;
+        case 'w': window = atol(optarg); break;
+        case 'p': pollInterval = atol(optarg); break;
+        case 't': runTime = atol(optarg); break;
+        case 'q': requestAt = atol(optarg); break;
+        case 'r': randomState = strtoul(optarg, NULL, 10); break;
+        case 'v': stats.verbose = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ( nodes < 1 || nodes > 252 || spread < 1 || firstAddress < 0 || firstAddress > 251 ||
+        duplicates < 0 || duplicates >= nodes || pollInterval == 0 || randomState == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+    unsigned long seed = randomState;
+
+    SimulatedBus bus;
+    setHostClock(&bus);
+    bus.setMonitor(monitorClaims, &stats);
+    SimulatedBusTransport *requester = bus.connect();
+
+    SimulatedNode *node = new SimulatedNode[nodes];
+    for (int i = 0; i < nodes; i++) {
+        // the last duplicates devices copy the NAME of a device from the start of the list.
+        int unique = (i >= nodes-duplicates)?(i-(nodes-duplicates)):i;
+        node[i].preferredAddress = (firstAddress + (i%spread))%252;
+        node[i].address = node[i].preferredAddress;
+        node[i].devInfo = new SNMEA2000DeviceInfo(1000+unique, 130, 25);
+        node[i].transport = bus.connect();
+        node[i].device = new SNMEA2000(node[i].preferredAddress, node[i].devInfo, &productInfo, &configInfo,
+            txPGN, sizeof(txPGN)/sizeof(unsigned long), rxPGN, sizeof(rxPGN)/sizeof(unsigned long),
+            node[i].transport, &quiet);
+        node[i].nextPoll = (window > 0)?(nextRandom()%(window*1000)):(nextRandom()%pollInterval);
+        node[i].started = false;
+        node[i].addressChanges = 0;
+    }
+
+    uint64_t end = (uint64_t)runTime*1000;
+    bool requestSent = (requestAt < 0);
+    while ( bus.now() < end ) {
+        uint64_t now = bus.now();
+        uint64_t next = end;
+        for (int i = 0; i < nodes; i++) {
+            SimulatedNode *n = &node[i];
+            if ( n->nextPoll <= now ) {
+                if ( !n->started ) {
+                    n->device->open();
+                    n->started = true;
+                }
+                n->device->processMessages();
+                if ( n->device->getAddress() != n->address ) {
+                    n->address = n->device->getAddress();
+                    n->addressChanges++;
+                }
+                n->nextPoll += pollInterval;
+            }
+            if ( n->nextPoll < next ) {
+                next = n->nextPoll;
+            }
+        }
+        if ( !requestSent ) {
+            if ( now >= (uint64_t)requestAt*1000 ) {
+                // request from the null address, as a device that has not claimed would.
+                MessageHeader messageHeader(59904L, 6, 254, 0xff);
+                byte request[3] = { ADDRESS_CLAIM_PGN&0xff, (ADDRESS_CLAIM_PGN>>8)&0xff, (ADDRESS_CLAIM_PGN>>16)&0xff };
+                requester->sendFrame(messageHeader.id, 3, request);
+                requestSent = true;
+            } else if ( (uint64_t)requestAt*1000 < next ) {
+                next = (uint64_t)requestAt*1000;
+            }
+        }
+        bus.arbitrate();
+        if ( bus.nextEvent() < next ) {
+            next = bus.nextEvent();
+        }
+        bus.advanceTo(next);
+    }
+
+    int unique = 0;
+    int moved = 0;
+    int claimed = 0;
+    unsigned long maxChanges = 0;
+    unsigned long txOverflows = 0;
+    unsigned long rxOverflows = 0;
+    for (int i = 0; i < nodes; i++) {
+        bool shared = false;
+        for (int j = 0; j < nodes; j++) {
+            if ( i != j && node[i].address == node[j].address ) {
+                shared = true;
+            }
+        }
+        if ( !shared ) {
+            unique++;
+        }
+        if ( node[i].address != node[i].preferredAddress ) {
+            moved++;
+        }
+        if ( node[i].device->hasClaimedAddress() ) {
+            claimed++;
+        }
+        if ( node[i].addressChanges > maxChanges ) {
+            maxChanges = node[i].addressChanges;
+        }
+        txOverflows += node[i].transport->txOverflows;
+        rxOverflows += node[i].transport->rxOverflows;
+    }
+    printf("nodes=%d seed=%lu preferred=%d-%d duplicates=%d window=%lums poll=%luus\n",
+        nodes, seed, firstAddress, firstAddress+spread-1, duplicates, window, pollInterval);
+    printf("claims=%lu last claim=%.3fms frames=%lu error frames=%lu busload=%.1f%%\n",
+        stats.claims, stats.lastClaim/1000.0, bus.frames, bus.errorFrames, 100.0*bus.busyTime/end);
+    printf("unique addresses=%d/%d claimed=%d moved=%d max address changes=%lu tx overflows=%lu rx overflows=%lu\n",
+        unique, nodes, claimed, moved, maxChanges, txOverflows, rxOverflows);
+    bool converged = (unique == nodes && claimed == nodes);
+    printf("%s\n", converged?"converged":"not converged");
+
+    setHostClock(NULL);
+    for (int i = 0; i < nodes; i++) {
+        delete node[i].device;
+        delete node[i].devInfo;
+    }
+    delete[] node;
+    return converged?0:1;
+}
@@ -0,0 +1,130 @@
+/**
+ * ISO transport protocol throughput between 2 devices on one SocketCAN interface.
+ *
+ * n2ktp [-b] [-n bytes] [-c count] iface
+ *
+ *   -b   use BAM broadcasts, default is RTS/CTS connection mode
+ *   -n   payload length, default 1785
+ *   -c   messages to send, default 10
+ *
+ * Device 20 sends to device 21 using separate sockets on iface, eg vcan0,
+ * and prints the payload throughput and frame rate on completion.
+ */
+#include <Arduino.h>
+#include <poll.h>
+#include <unistd.h>
+#include "SmallNMEA2000IsoTP.h"
+#include "SocketCANTransport.h"
+
+#define TEST_PGN 130816L
+
+const SNMEA2000ProductInfo productInfo PROGMEM = {
+    2100, 1, "n2ktp", "1.0.0", "1.0.0", "00000001", 0, 1
+};
+const SNMEA2000ConfigInfo configInfo PROGMEM = {
+    "SmallNMEA2000", "ISO TP throughput", "https://github.com/ieb/SmallNMEA2000"
+};
+const unsigned long txPGN[] = { TEST_PGN, 60416L, 60160L, SNMEA200_DEFAULT_TX_PGN };
+const unsigned long rxPGN[] = { TEST_PGN, 60416L, 60160L, SNMEA200_DEFAULT_RX_PGN };
+
+static unsigned long recieved = 0;
+static unsigned long corrupt = 0;
+static uint16_t payloadLength = 1785;
+
+static byte readPattern(const void * context, uint16_t offset) {
+    return (offset*7+3)&0xff;
+}
+
+static void messageHandler(MessageHeader *messageHeader, byte * buffer, int len) {
+    if ( messageHeader->pgn != TEST_PGN ) {
+        return;
+    }
+    recieved++;
+    if ( len != payloadLength ) {
+        corrupt++;
+        return;
+    }
+    for (int i = 0; i < len; i++) {
+        if ( buffer[i] != readPattern(NULL, i) ) {
+            corrupt++;
+            return;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    bool broadcast = false;
+    unsigned long count = 10;
+    int opt;
+    while ( (opt = getopt(argc, argv, "bn:c:")) != -1 ) {
+        switch (opt) {
+        case 'b': broadcast = true; break;
+        case 'n': payloadLength = atoi(optarg); break;
+        case 'c': count = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-b] [-n bytes] [-c count] iface\n", argv[0]);
+            return 1;
+        }
+    }
+    if ( optind >= argc || payloadLength < 9 || payloadLength > SNMEA2000IsoTP::maxLength ) {
+        fprintf(stderr, "Usage: %s [-b] [-n 9-1785] [-c count] iface\n", argv[0]);
+        return 1;
+    }
+    SNMEA2000SocketCAN senderTransport(argv[optind]);
+    SNMEA2000SocketCAN recieverTransport(argv[optind]);
+    SNMEA2000DeviceInfo senderInfo(1, 130, 25);
+    SNMEA2000DeviceInfo recieverInfo(2, 130, 25);
+    SNMEA2000 sender(20, &senderInfo, &productInfo, &configInfo, txPGN, sizeof(txPGN)/sizeof(unsigned long),
+        rxPGN, sizeof(rxPGN)/sizeof(unsigned long), &senderTransport);
+    SNMEA2000 reciever(21, &recieverInfo, &productInfo, &configInfo, txPGN, sizeof(txPGN)/sizeof(unsigned long),
+        rxPGN, sizeof(rxPGN)/sizeof(unsigned long), &recieverTransport);
+    static byte rxBuffer[SNMEA2000IsoTP::maxLength];
+    SNMEA2000IsoTP senderTP(&sender);
+    SNMEA2000IsoTP recieverTP(&reciever, rxBuffer, sizeof(rxBuffer));
+    sender.addListener(&senderTP);
+    reciever.addListener(&recieverTP);
+    reciever.setMessageHandler(messageHandler);
+    if ( !sender.open() || !reciever.open() ) {
+        return 1;
+    }
+    // let the address claims settle.
+    unsigned long start = millis();
+    while ( millis() - start < 300 ) {
+        sender.processMessages();
+        reciever.processMessages();
+    }
+    struct pollfd fds[2] = {
+        { senderTransport.getFd(), POLLIN, 0 },
+        { recieverTransport.getFd(), POLLIN, 0 }
+    };
+    unsigned long sent = 0;
+    unsigned long lastProgress = millis();
+    start = micros();
+    while ( recieved < count ) {
+        if ( sent < count && !senderTP.isBusy() ) {
+            if ( senderTP.send(TEST_PGN, 7, broadcast?SNMEA2000::broadcastAddress:21, 
+                    payloadLength, readPattern, NULL) ) {
+                sent++;
+                lastProgress = millis();
+            }
+        }
+        poll(fds, 2, 1);
+        sender.processMessages();
+        reciever.processMessages();
+        if ( millis() - lastProgress > 5000 ) {
+            fprintf(stderr, "Stalled after %lu messages\n", recieved);
+            break;
+        }
+        if ( recieverTP.getCounters()->messagesRecieved != recieved ) {
+            lastProgress = millis();
+        }
+    }
+    double seconds = (micros() - start)/1000000.0;
+    unsigned long frames = (payloadLength+6)/7*recieved;
+    printf("%s %u bytes x %lu in %.3fs, %.0f bytes/s, %.0f TP.DT frames/s, %lu corrupt\n",
+        broadcast?"BAM":"CMDT", payloadLength, recieved, seconds,
+        payloadLength*recieved/seconds, frames/seconds, corrupt);
+    senderTP.dumpStatus(&Serial);
+    recieverTP.dumpStatus(&Serial);
+    return (recieved == count && corrupt == 0)?0:1;
+}
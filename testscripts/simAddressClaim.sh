@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# Address claim convergence at 50-250 devices on the simulated bus, no hardware needed.
+# $ (cd host; make)
+# Extra arguments are passed to n2ksim, eg -w 500 to power up over 500ms, -s 4 for 4 preferred addresses.
+
+for nodes in 50 100 150 200 250; do
+    for seed in 1 2 3; do
+        echo "## nodes=${nodes} seed=${seed} $*"
+        host/build/n2ksim -n ${nodes} -r ${seed} -t 10000 "$@" | tail -n +2
+    done
+done
@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# Tests host/build/n2kbridge between 2 virtual can interfaces, requires can-utils.
+# $ sudo modprobe vcan
+# $ sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+# $ sudo ip link add dev vcan1 type vcan && sudo ip link set up vcan1
+# $ (cd host; make)
+
+portA="${1:-vcan0}"
+portB="${2:-vcan1}"
+
+# 129025 decimated to 1Hz, 129029 fast packets forwarded whole, everything else dropped.
+host/build/n2kbridge -s 5 -a 129025:1000 -a 129029:0:f ${portA} ${portB} &
+sleep 1
+candump -t d ${portB} &
+sleep 1
+
+echo "## Sending 129025 at 10Hz for 3s on ${portA}, expect 3 on ${portB}"
+for i in $(seq 1 30); do
+    cansend ${portA} 09F80105#0102030405060708
+    sleep 0.1
+done
+echo "## Sending a 129029 fast packet on ${portA}, expect 7 frames on ${portB}"
+for f in 00 01 02 03 04 05 06; do
+    if [ $f == "00" ]; then
+        cansend ${portA} 0DF80507#${f}2B010203040506
+    else
+        cansend ${portA} 0DF80507#${f}01020304050607
+    fi
+done
+echo "## Sending 130306 on ${portA}, expect it to be dropped"
+cansend ${portA} 09FD0205#0102030405060708
+sleep 6
+kill %2
+kill -INT %1
+wait